@@ -0,0 +1,294 @@
+/*
+ * bandconv.cpp -- parallel row band conversion
+ */
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "bandconv.h"
+
+/* Polls of the barrier before the caller goes to sleep. */
+#define BANDCONV_SPIN		4000
+
+static uint64_t bandconv_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bandconv_futex_wake(volatile uint32_t *addr)
+{
+	syscall(__NR_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static void bandconv_futex_wait(volatile uint32_t *addr, uint32_t val)
+{
+	syscall(__NR_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+/* Convert bands until there are none left for this frame. */
+static void bandconv_work(struct bandconv *bc, struct bandconv_worker *worker)
+{
+	unsigned int band;
+
+	while ((band = __sync_fetch_and_add(&bc->next, 1)) < bc->nbands) {
+		unsigned int first = band * bc->lines;
+		unsigned int last = first + bc->lines;
+		uint64_t start, time;
+
+		if (last > bc->src->height)
+			last = bc->src->height;
+
+		start = bandconv_now();
+		if (bc->hook)
+			bc->hook(bc->hook_priv, worker->index, bc->src, first, last);
+		if (bc->orient_fn)
+			bc->orient_fn(bc->src, bc->dst, bc->map, first, last);
+		else
+			bc->fn(bc->src, bc->dst, first, last);
+		time = bandconv_now() - start;
+
+		bc->band_ns[band] += time;
+		worker->bands++;
+		worker->busy += time;
+	}
+}
+
+static void *bandconv_thread(void *arg)
+{
+	struct bandconv_worker *worker = (struct bandconv_worker *)arg;
+	struct bandconv *bc = worker->bc;
+	uint32_t seen = 0;
+
+	while (1) {
+		while (bc->generation == seen && !bc->stop)
+			bandconv_futex_wait(&bc->generation, seen);
+		if (bc->stop)
+			break;
+
+		seen = bc->generation;
+		bandconv_work(bc, worker);
+
+		if (__sync_sub_and_fetch(&bc->active, 1) == 0)
+			bandconv_futex_wake(&bc->active);
+	}
+
+	return NULL;
+}
+
+/*
+ * Start nthreads - 1 threads, 0 for one thread per CPU. With a CPU list
+ * the threads are pinned to its CPUs in turn; the calling thread is left
+ * where it is.
+ */
+int bandconv_init(struct bandconv *bc, unsigned int nthreads, const char *cpus)
+{
+	cpu_set_t set;
+	unsigned int cpu = 0;
+	unsigned int i;
+	int ret;
+
+	memset(bc, 0, sizeof *bc);
+
+	if (cpus && cpulist_parse(cpus, &set) < 0) {
+		printf("Invalid CPU list '%s'.\n", cpus);
+		return -EINVAL;
+	}
+
+	if (nthreads == 0)
+		nthreads = cpus ? CPU_COUNT(&set) + 1 : sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads > BANDCONV_MAX_THREADS)
+		nthreads = BANDCONV_MAX_THREADS;
+
+	bc->workers[0].bc = bc;
+	bc->workers[0].cpu = -1;
+	bc->nthreads = 1;
+
+	for (i = 1; i < nthreads; ++i) {
+		struct bandconv_worker *worker = &bc->workers[i];
+
+		worker->bc = bc;
+		worker->index = i;
+		worker->cpu = -1;
+
+		ret = pthread_create(&worker->thread, NULL, bandconv_thread, worker);
+		if (ret) {
+			printf("Unable to start conversion thread: %s (%d).\n",
+				strerror(ret), ret);
+			bandconv_cleanup(bc);
+			return -ret;
+		}
+
+		bc->nthreads++;
+
+		if (cpus) {
+			cpu_set_t one;
+
+			while (!CPU_ISSET(cpu % CPU_SETSIZE, &set))
+				cpu++;
+			worker->cpu = cpu % CPU_SETSIZE;
+			cpu++;
+
+			CPU_ZERO(&one);
+			CPU_SET(worker->cpu, &one);
+			ret = pthread_setaffinity_np(worker->thread, sizeof one, &one);
+			if (ret)
+				printf("Unable to pin thread %u to CPU %d: %s (%d).\n",
+					i, worker->cpu, strerror(ret), ret);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Apply the scheduling policy of an rtsched setting to the threads. The
+ * CPUs are given to bandconv_init() instead, one per thread.
+ */
+int bandconv_set_sched(struct bandconv *bc, const char *spec)
+{
+	struct rt_config config;
+	unsigned int i;
+	int ret;
+
+	ret = rt_parse(spec, &config);
+	if (ret < 0)
+		return ret;
+
+	config.set_cpus = false;
+
+	for (i = 1; i < bc->nthreads; ++i) {
+		ret = rt_apply(bc->workers[i].thread, &config);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+static void bandconv_start(struct bandconv *bc, const struct image *src,
+	struct image *dst, unsigned int align)
+{
+	unsigned int lines;
+	unsigned int spin;
+	uint32_t active;
+	uint64_t start;
+
+	lines = BANDCONV_BAND_BYTES / (src->stride + dst->stride);
+	if (lines * BANDCONV_MAX_BANDS < src->height)
+		lines = (src->height + BANDCONV_MAX_BANDS - 1) / BANDCONV_MAX_BANDS;
+	lines = (lines + align - 1) / align * align;
+
+	start = bandconv_now();
+
+	bc->src = src;
+	bc->dst = dst;
+	bc->lines = lines;
+	bc->nbands = (src->height + lines - 1) / lines;
+	bc->next = 0;
+	bc->active = bc->nthreads - 1;
+
+	if (bc->nthreads > 1) {
+		__sync_fetch_and_add(&bc->generation, 1);
+		bandconv_futex_wake(&bc->generation);
+	}
+
+	bandconv_work(bc, &bc->workers[0]);
+
+	/* Every thread checks in, so none is still reading this frame. */
+	for (spin = 0; (active = bc->active) != 0; ++spin) {
+		if (spin >= BANDCONV_SPIN)
+			bandconv_futex_wait(&bc->active, active);
+	}
+
+	bc->wall += bandconv_now() - start;
+	bc->frames++;
+}
+
+/* Convert all lines of src into dst and wait for the last band. */
+void bandconv_run(struct bandconv *bc, convert_fn fn, const struct image *src,
+	struct image *dst)
+{
+	bc->fn = fn;
+	bc->orient_fn = NULL;
+
+	/* Keep bands on an even line for vertically subsampled formats. */
+	bandconv_start(bc, src, dst, 2);
+}
+
+/*
+ * Convert all lines of src into their rotated/flipped location in dst.
+ * Bands are whole rows of conversion tiles.
+ */
+void bandconv_run_oriented(struct bandconv *bc, convert_orient_fn fn,
+	const struct orient_map *map, const struct image *src, struct image *dst)
+{
+	bc->orient_fn = fn;
+	bc->map = map;
+
+	bandconv_start(bc, src, dst, CONVERT_TILE_SIZE);
+}
+
+/* Run hook on the source of every band of the following frames, NULL stops. */
+void bandconv_set_hook(struct bandconv *bc, bandconv_hook_fn hook, void *priv)
+{
+	bc->hook = hook;
+	bc->hook_priv = priv;
+}
+
+void bandconv_print_stats(struct bandconv *bc)
+{
+	unsigned int groups;
+	unsigned int i, j;
+	uint64_t busy = 0;
+
+	if (bc->frames == 0)
+		return;
+
+	printf("%u threads, %u bands of %u lines, %.3f ms/frame\n", bc->nthreads,
+		bc->nbands, bc->lines, bc->wall / 1e6 / bc->frames);
+
+	for (i = 0; i < bc->nthreads; ++i) {
+		struct bandconv_worker *worker = &bc->workers[i];
+
+		busy += worker->busy;
+		printf("thread %2u cpu %3d: %6.1f bands/frame %8.3f ms/frame %5.1f%%\n",
+			i, worker->cpu, (double)worker->bands / bc->frames,
+			worker->busy / 1e6 / bc->frames,
+			bc->wall ? worker->busy * 100.0 / bc->wall : 0.0);
+	}
+
+	printf("parallel efficiency %.1f%%\n",
+		bc->wall ? busy * 100.0 / bc->wall / bc->nthreads : 0.0);
+
+	/* Average band time in eight groups from the top to the bottom. */
+	groups = bc->nbands < 8 ? bc->nbands : 8;
+	printf("band us, top to bottom:");
+	for (i = 0; i < groups; ++i) {
+		unsigned int first = i * bc->nbands / groups;
+		unsigned int last = (i + 1) * bc->nbands / groups;
+		uint64_t sum = 0;
+
+		for (j = first; j < last; ++j)
+			sum += bc->band_ns[j];
+		printf(" %.1f", sum / 1e3 / bc->frames / (last - first));
+	}
+	printf("\n");
+}
+
+void bandconv_cleanup(struct bandconv *bc)
+{
+	unsigned int i;
+
+	bc->stop = true;
+	__sync_fetch_and_add(&bc->generation, 1);
+	bandconv_futex_wake(&bc->generation);
+
+	for (i = 1; i < bc->nthreads; ++i)
+		pthread_join(bc->workers[i].thread, NULL);
+
+	bc->nthreads = 0;
+}
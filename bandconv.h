@@ -0,0 +1,90 @@
+/*
+ * bandconv.h -- parallel row band conversion
+ *
+ * Splits a conversion into bands of lines sized so that the source and
+ * destination lines of one band stay in the L2 cache, and hands the bands
+ * to a set of threads started once and optionally pinned to CPUs. The
+ * calling thread converts bands too and returns when every thread has
+ * checked in at the end of the frame; threads sleep on a futex between
+ * frames. Images are read and written in place, a capture buffer can be
+ * converted straight from its mmap. Rotated conversions are split in
+ * bands of source lines too, whole rows of conversion tiles each.
+ *
+ * A hook can be set to run on the source lines of every band right before
+ * they are converted, on the thread converting them, to compute something
+ * from the source while it is in the cache.
+ *
+ * Band timings are accumulated per band position and per thread, to see
+ * whether the frame is evenly split and how well the threads scale.
+ */
+
+#ifndef __BANDCONV_H__
+#define __BANDCONV_H__
+
+#include <pthread.h>
+
+#include "convert.h"
+#include "rtsched.h"
+
+#define BANDCONV_MAX_THREADS	32
+#define BANDCONV_MAX_BANDS	512
+#define BANDCONV_BAND_BYTES	(128 * 1024)
+
+struct bandconv;
+
+/* Called with the index of the calling worker, 0 to nthreads - 1. */
+typedef void (*bandconv_hook_fn)(void *priv, unsigned int worker,
+	const struct image *src, unsigned int first, unsigned int last);
+
+struct bandconv_worker
+{
+	struct bandconv *bc;
+	unsigned int index;
+	pthread_t thread;
+	int cpu;
+
+	/* Statistics. */
+	unsigned int bands;
+	uint64_t busy;
+};
+
+struct bandconv
+{
+	/* Worker 0 is the calling thread. */
+	struct bandconv_worker workers[BANDCONV_MAX_THREADS];
+	unsigned int nthreads;
+
+	/* Current frame, converted by orient_fn if set. */
+	convert_fn fn;
+	convert_orient_fn orient_fn;
+	const struct orient_map *map;
+	const struct image *src;
+	struct image *dst;
+	unsigned int lines;
+	unsigned int nbands;
+	volatile unsigned int next;
+
+	bandconv_hook_fn hook;
+	void *hook_priv;
+
+	volatile uint32_t generation;
+	volatile uint32_t active;
+	volatile bool stop;
+
+	/* Statistics. */
+	unsigned int frames;
+	uint64_t wall;
+	uint64_t band_ns[BANDCONV_MAX_BANDS];
+};
+
+int bandconv_init(struct bandconv *bc, unsigned int nthreads, const char *cpus);
+void bandconv_run(struct bandconv *bc, convert_fn fn, const struct image *src,
+	struct image *dst);
+void bandconv_run_oriented(struct bandconv *bc, convert_orient_fn fn,
+	const struct orient_map *map, const struct image *src, struct image *dst);
+void bandconv_set_hook(struct bandconv *bc, bandconv_hook_fn hook, void *priv);
+int bandconv_set_sched(struct bandconv *bc, const char *spec);
+void bandconv_print_stats(struct bandconv *bc);
+void bandconv_cleanup(struct bandconv *bc);
+
+#endif /* __BANDCONV_H__ */
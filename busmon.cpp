@@ -0,0 +1,155 @@
+/*
+ * busmon.cpp -- frame bus subscriber
+ *
+ * Subscribes to a frame bus and reports, once per second, the frame rate,
+ * the frames dropped and the latency from capture to delivery. Frames can
+ * be saved, and a slow consumer can be simulated to exercise drops.
+ */
+
+#include <signal.h>
+
+#include "yavtalib.h"
+#include "framebus.h"
+
+static volatile sig_atomic_t busmon_stop;
+
+static void busmon_signal(int)
+{
+	busmon_stop = 1;
+}
+
+static uint64_t busmon_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void busmon_save(const struct framebus_frame *frame, const char *pattern)
+{
+	char filename[256];
+	const char *p;
+	FILE *file;
+
+	p = strchr(pattern, '#');
+	if (p != NULL)
+		snprintf(filename, sizeof filename, "%.*s%06u%s", (int)(p - pattern),
+			 pattern, frame->sequence, p + 1);
+	else
+		snprintf(filename, sizeof filename, "%s", pattern);
+
+	file = fopen(filename, p != NULL ? "wb" : "ab");
+	if (file == NULL)
+		return;
+
+	fwrite(frame->image.data, 1, frame->bytesused, file);
+	fclose(file);
+}
+
+static void usage(const char *argv0)
+{
+	printf("Usage: %s [options] name\n", argv0);
+	printf("Subscribe to the frame bus called name.\n\n");
+	printf("Supported options:\n");
+	printf("-d, --delay ms			Spend ms per frame, to simulate a slow consumer\n");
+	printf("-F, --file[=pattern]		Save frames to file (# is replaced by the sequence)\n");
+	printf("-h, --help			Show this help screen\n");
+	printf("-n, --nframes n			Stop after n frames\n");
+}
+
+static struct option opts[] = {
+	{"delay", 1, 0, 'd'},
+	{"file", 2, 0, 'F'},
+	{"help", 0, 0, 'h'},
+	{"nframes", 1, 0, 'n'},
+	{0, 0, 0, 0}
+};
+
+int main(int argc, char *argv[])
+{
+	struct framebus bus;
+	const char *pattern = NULL;
+	unsigned int nframes = (unsigned int)-1;
+	unsigned int delay = 0;
+	unsigned int frames = 0, count = 0, stale = 0;
+	unsigned int dropped = 0;
+	uint64_t latency = 0;
+	uint64_t last;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "d:F::hn:", opts, NULL)) != -1) {
+		switch (c) {
+		case 'd':
+			delay = atoi(optarg);
+			break;
+		case 'F':
+			pattern = optarg ? optarg : "frame-#.bin";
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		case 'n':
+			nframes = atoi(optarg);
+			break;
+		default:
+			printf("Invalid option -%c\n", c);
+			printf("Run %s -h for help.\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	signal(SIGINT, busmon_signal);
+	signal(SIGTERM, busmon_signal);
+
+	if (framebus_open(&bus, argv[optind]) < 0)
+		return 1;
+
+	last = busmon_now();
+
+	while (frames < nframes && !busmon_stop) {
+		struct framebus_frame frame;
+		uint64_t now;
+
+		if (framebus_wait(&bus, &frame, 1000) < 0) {
+			printf("No frame for a second.\n");
+			continue;
+		}
+
+		now = busmon_now();
+		latency += now - frame.timestamp;
+
+		if (pattern)
+			busmon_save(&frame, pattern);
+		if (delay)
+			usleep(delay * 1000);
+
+		if (!framebus_done(&bus, &frame))
+			stale++;
+
+		frames++;
+		count++;
+
+		if (now - last >= 1000000000ULL) {
+			printf("%ux%u %s: %.2f fps, %u dropped (%u overwritten while read), "
+			       "latency %.3f ms\n", frame.image.width, frame.image.height,
+			       v4l2_format_name(frame.image.fourcc),
+			       count * 1e9 / (now - last), bus.dropped - dropped, stale,
+			       latency / 1e6 / count);
+			dropped = bus.dropped;
+			count = 0;
+			stale = 0;
+			latency = 0;
+			last = now;
+		}
+	}
+
+	printf("%u frames received, %u dropped.\n", frames, bus.dropped);
+	framebus_close(&bus);
+	return 0;
+}
@@ -0,0 +1,210 @@
+/*
+ * capctl.cpp -- adaptive capture buffer count and frame interval
+ */
+
+#include "yavtalib.h"
+#include "capctl.h"
+
+/* Frames in a window, about two seconds at the interval in use. */
+#define CAPCTL_WINDOW_NS	2000000000ULL
+#define CAPCTL_WINDOW_MIN	15
+#define CAPCTL_WINDOW_MAX	600
+#define CAPCTL_WINDOW_DEFAULT	60
+
+static uint64_t capctl_ns(const struct v4l2_fract *interval)
+{
+	return (uint64_t)interval->numerator * 1000000000ULL / interval->denominator;
+}
+
+/* a < b, a == b or a > b as -1, 0 or 1. */
+static int capctl_compare(const struct v4l2_fract *a, const struct v4l2_fract *b)
+{
+	uint64_t x = (uint64_t)a->numerator * b->denominator;
+	uint64_t y = (uint64_t)b->numerator * a->denominator;
+
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static void capctl_set_window(struct capctl *cc)
+{
+	uint64_t window;
+
+	if (cc->nintervals == 0) {
+		cc->window = CAPCTL_WINDOW_DEFAULT;
+		return;
+	}
+
+	window = CAPCTL_WINDOW_NS / capctl_ns(&cc->intervals[cc->interval]);
+	cc->window = window < CAPCTL_WINDOW_MIN ? CAPCTL_WINDOW_MIN
+		   : window > CAPCTL_WINDOW_MAX ? CAPCTL_WINDOW_MAX : window;
+}
+
+/*
+ * Control a stream of nbufs buffers between min_bufs and max_bufs, at the
+ * frame interval current, choosing from the intervals the driver lists
+ * those no shorter than current. Without current, when the driver cannot
+ * tell its frame interval, only the buffer count is controlled.
+ */
+void capctl_init(struct capctl *cc, const struct v4l2_fract *intervals,
+	unsigned int nintervals, const struct v4l2_fract *current,
+	unsigned int nbufs, unsigned int min_bufs, unsigned int max_bufs)
+{
+	unsigned int i, j;
+
+	memset(cc, 0, sizeof *cc);
+	cc->min_bufs = min_bufs < 2 ? 2 : min_bufs;
+	cc->max_bufs = max_bufs < cc->min_bufs ? cc->min_bufs : max_bufs;
+	cc->nbufs = nbufs < cc->min_bufs ? cc->min_bufs
+		  : nbufs > cc->max_bufs ? cc->max_bufs : nbufs;
+
+	if (current == NULL || current->numerator == 0 || current->denominator == 0)
+		goto done;
+
+	/* The stream starts at the fastest rate it is allowed. */
+	cc->intervals[cc->nintervals++] = *current;
+
+	for (i = 0; i < nintervals && cc->nintervals < CAPCTL_MAX_INTERVALS; ++i) {
+		const struct v4l2_fract *interval = &intervals[i];
+
+		if (interval->numerator == 0 || interval->denominator == 0 ||
+		    capctl_compare(interval, current) <= 0)
+			continue;
+
+		/* Sorted insertion, without duplicates. */
+		for (j = cc->nintervals; j > 0; --j) {
+			int order = capctl_compare(interval, &cc->intervals[j - 1]);
+
+			if (order == 0)
+				break;
+			if (order > 0) {
+				memmove(&cc->intervals[j + 1], &cc->intervals[j],
+					(cc->nintervals - j) * sizeof *cc->intervals);
+				cc->intervals[j] = *interval;
+				cc->nintervals++;
+				break;
+			}
+		}
+	}
+
+done:
+	capctl_set_window(cc);
+}
+
+/* Start the window over, for instance after the stream restarted. */
+void capctl_restart_window(struct capctl *cc)
+{
+	cc->frames = 0;
+	cc->lost = 0;
+	cc->held_max = 0;
+}
+
+/*
+ * Account one dequeued frame, with lost frames the driver skipped before
+ * it and held buffers downstream, this one included. Returns true when
+ * the window is complete and capctl_decide() is due.
+ */
+bool capctl_record(struct capctl *cc, unsigned int lost, unsigned int held)
+{
+	cc->frames++;
+	cc->lost += lost;
+	if (held > cc->held_max)
+		cc->held_max = held;
+
+	return cc->frames >= cc->window;
+}
+
+/*
+ * Close the window, given the processing time per frame of the slowest
+ * consumer and the frames the queues dropped over it. Returns the
+ * capctl_action flags of what to change, capctl_interval() and nbufs
+ * hold the new values.
+ */
+unsigned int capctl_decide(struct capctl *cc, uint64_t busy_ns,
+	unsigned int dropped)
+{
+	unsigned int lost = cc->lost + dropped;
+	unsigned int action = CAPCTL_NONE;
+	uint64_t interval_ns = 0;
+	bool slow;
+
+	if (cc->nintervals)
+		interval_ns = capctl_ns(&cc->intervals[cc->interval]);
+
+	slow = interval_ns && busy_ns * 100 > interval_ns * CAPCTL_SLOW_PCT;
+
+	cc->windows++;
+	if (busy_ns > cc->busy_max)
+		cc->busy_max = busy_ns;
+
+	if (slow) {
+		cc->fast_windows = 0;
+		if (cc->interval + 1 < cc->nintervals) {
+			cc->interval++;
+			cc->slower++;
+			action |= CAPCTL_INTERVAL;
+		}
+	} else if (cc->interval > 0 && lost == 0 &&
+		   busy_ns * 100 < capctl_ns(&cc->intervals[cc->interval - 1]) * CAPCTL_FAST_PCT) {
+		if (++cc->fast_windows >= CAPCTL_SETTLE) {
+			cc->interval--;
+			cc->faster++;
+			cc->fast_windows = 0;
+			action |= CAPCTL_INTERVAL;
+		}
+	} else {
+		cc->fast_windows = 0;
+	}
+
+	/*
+	 * Losses while the consumers keep up on average come from bursts a
+	 * deeper ring absorbs; under sustained load only a longer interval
+	 * helps.
+	 */
+	if (lost && !slow) {
+		cc->idle_windows = 0;
+		if (cc->nbufs < cc->max_bufs) {
+			cc->nbufs += CAPCTL_GROW;
+			if (cc->nbufs > cc->max_bufs)
+				cc->nbufs = cc->max_bufs;
+			cc->grown++;
+			action |= CAPCTL_BUFFERS;
+		}
+	} else if (lost == 0 && cc->held_max + CAPCTL_SPARE < cc->nbufs &&
+		   cc->nbufs > cc->min_bufs) {
+		if (++cc->idle_windows >= CAPCTL_SETTLE) {
+			cc->nbufs--;
+			cc->shrunk++;
+			cc->idle_windows = 0;
+			action |= CAPCTL_BUFFERS;
+		}
+	} else {
+		cc->idle_windows = 0;
+	}
+
+	capctl_restart_window(cc);
+	if (action & CAPCTL_INTERVAL)
+		capctl_set_window(cc);
+
+	return action;
+}
+
+/* The frame interval in use, NULL when not controlled. */
+const struct v4l2_fract *capctl_interval(const struct capctl *cc)
+{
+	return cc->nintervals ? &cc->intervals[cc->interval] : NULL;
+}
+
+void capctl_print(const struct capctl *cc, const char *name)
+{
+	if (cc->windows == 0)
+		return;
+
+	printf("%s: %u windows, %u buffers (%u grown, %u shrunk)", name,
+		cc->windows, cc->nbufs, cc->grown, cc->shrunk);
+	if (cc->nintervals)
+		printf(", interval %u/%u (%u slower, %u faster)",
+			cc->intervals[cc->interval].numerator,
+			cc->intervals[cc->interval].denominator,
+			cc->slower, cc->faster);
+	printf(", slowest consumer %.2f ms/frame at worst\n", cc->busy_max / 1e6);
+}
@@ -0,0 +1,89 @@
+/*
+ * capctl.h -- adaptive capture buffer count and frame interval
+ *
+ * Trades memory and latency against dropped frames from measurements,
+ * instead of a buffer count and frame rate tuned by hand per board. Each
+ * window of frames, about two seconds' worth, the controller looks at
+ *
+ *  - the processing time per frame of the slowest consumer: above
+ *    CAPCTL_SLOW_PCT percent of the frame interval it cannot keep up, and
+ *    the interval steps to the next longer one the driver enumerates;
+ *    when it would fit in CAPCTL_FAST_PCT percent of the next shorter
+ *    one for CAPCTL_SETTLE windows in a row, the interval steps back, up
+ *    to the one the stream started with;
+ *  - frames lost by the driver (sequence gaps) or dropped by the queues
+ *    downstream: while the consumers keep up on average these come from
+ *    bursts, and the buffer ring grows by CAPCTL_GROW;
+ *  - the most buffers held downstream at once: a ring that kept more than
+ *    CAPCTL_SPARE buffers unused for CAPCTL_SETTLE windows in a row, and
+ *    lost nothing, shrinks by one.
+ *
+ * The controller only decides. Most drivers take a new frame interval
+ * only between streams, and a new buffer count only with the buffers
+ * freed, so the capture source applies the decisions by restarting the
+ * stream, see the capture node in nodes.cpp.
+ */
+
+#ifndef __CAPCTL_H__
+#define __CAPCTL_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/videodev2.h>
+
+#define CAPCTL_MAX_INTERVALS	16
+
+#define CAPCTL_SLOW_PCT		90
+#define CAPCTL_FAST_PCT		60
+#define CAPCTL_SETTLE		3
+#define CAPCTL_GROW		2
+#define CAPCTL_SPARE		2
+
+enum capctl_action
+{
+	CAPCTL_NONE = 0,
+	CAPCTL_INTERVAL = 1 << 0,
+	CAPCTL_BUFFERS = 1 << 1
+};
+
+struct capctl
+{
+	/* Frame intervals, shortest first, and the one in use. */
+	struct v4l2_fract intervals[CAPCTL_MAX_INTERVALS];
+	unsigned int nintervals;
+	unsigned int interval;
+
+	unsigned int nbufs;
+	unsigned int min_bufs;
+	unsigned int max_bufs;
+
+	/* The current window. */
+	unsigned int window;
+	unsigned int frames;
+	unsigned int lost;
+	unsigned int held_max;
+
+	/* Windows in a row with time or buffers to spare. */
+	unsigned int fast_windows;
+	unsigned int idle_windows;
+
+	/* Statistics. */
+	unsigned int windows;
+	unsigned int slower;
+	unsigned int faster;
+	unsigned int grown;
+	unsigned int shrunk;
+	uint64_t busy_max;
+};
+
+void capctl_init(struct capctl *cc, const struct v4l2_fract *intervals,
+	unsigned int nintervals, const struct v4l2_fract *current,
+	unsigned int nbufs, unsigned int min_bufs, unsigned int max_bufs);
+void capctl_restart_window(struct capctl *cc);
+bool capctl_record(struct capctl *cc, unsigned int lost, unsigned int held);
+unsigned int capctl_decide(struct capctl *cc, uint64_t busy_ns,
+	unsigned int dropped);
+const struct v4l2_fract *capctl_interval(const struct capctl *cc);
+void capctl_print(const struct capctl *cc, const char *name);
+
+#endif /* __CAPCTL_H__ */
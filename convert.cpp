@@ -0,0 +1,199 @@
+/*
+ * convert.cpp -- CPU colour space conversion
+ */
+
+#include "convert.h"
+
+struct converter_entry
+{
+	unsigned int src;
+	unsigned int dst;
+	convert_fn fn;
+	convert_fn simd_fn;
+	convert_fn stream_fn;
+	convert_orient_fn orient_fn;
+};
+
+#define CONVERTER(_src, _dst) \
+	{ _src, _dst, converter<_src, _dst>::convert, \
+	  simd_converter<_src, _dst>::convert, \
+	  stream_converter<_src, _dst>::convert, \
+	  oriented_converter<_src, _dst>::convert }
+
+static const struct converter_entry converters[] = {
+	CONVERTER(V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_RGB24),
+	CONVERTER(V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_BGR24),
+	CONVERTER(V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_BGR32),
+	CONVERTER(V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_RGB32),
+	CONVERTER(V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_RGB565),
+	CONVERTER(V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_RGB24),
+	CONVERTER(V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_BGR24),
+	CONVERTER(V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_BGR32),
+	CONVERTER(V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_RGB32),
+	CONVERTER(V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_RGB565),
+	CONVERTER(V4L2_PIX_FMT_GREY, V4L2_PIX_FMT_RGB24),
+	CONVERTER(V4L2_PIX_FMT_GREY, V4L2_PIX_FMT_BGR24),
+	CONVERTER(V4L2_PIX_FMT_GREY, V4L2_PIX_FMT_BGR32),
+	CONVERTER(V4L2_PIX_FMT_GREY, V4L2_PIX_FMT_RGB32),
+	CONVERTER(V4L2_PIX_FMT_GREY, V4L2_PIX_FMT_RGB565),
+};
+
+#undef CONVERTER
+
+static const struct converter_entry *converter_find(unsigned int src_fourcc,
+	unsigned int dst_fourcc)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(converters); ++i) {
+		if (converters[i].src == src_fourcc &&
+		    converters[i].dst == dst_fourcc)
+			return &converters[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Resolve a converter for a format pair. This is meant to be called once
+ * when a stream is set up, not per frame.
+ */
+convert_fn convert_lookup(unsigned int src_fourcc, unsigned int dst_fourcc)
+{
+	return convert_lookup_variant(src_fourcc, dst_fourcc, CONVERT_SIMD);
+}
+
+convert_fn convert_lookup_variant(unsigned int src_fourcc,
+	unsigned int dst_fourcc, enum convert_variant variant)
+{
+	const struct converter_entry *entry;
+
+	entry = converter_find(src_fourcc, dst_fourcc);
+	if (entry == NULL)
+		return NULL;
+
+	switch (variant) {
+	case CONVERT_SIMD:
+		return entry->simd_fn;
+	case CONVERT_STREAM:
+		return entry->stream_fn;
+	default:
+		return entry->fn;
+	}
+}
+
+convert_orient_fn convert_orient_lookup(unsigned int src_fourcc,
+	unsigned int dst_fourcc)
+{
+	const struct converter_entry *entry;
+
+	entry = converter_find(src_fourcc, dst_fourcc);
+	return entry ? entry->orient_fn : NULL;
+}
+
+void orient_map_init(struct orient_map *map, unsigned int orientation,
+	unsigned int width, unsigned int height)
+{
+	/* Flipped source coordinates, as (sx, sy, constant) coefficients. */
+	int x[3] = { 1, 0, 0 };
+	int y[3] = { 0, 1, 0 };
+	int w = width - 1;
+	int h = height - 1;
+
+	if (orientation & ORIENT_HFLIP) {
+		x[0] = -1;
+		x[2] = w;
+	}
+	if (orientation & ORIENT_VFLIP) {
+		y[1] = -1;
+		y[2] = h;
+	}
+
+	map->orientation = orientation;
+
+	switch (orientation & ORIENT_ROTATE_MASK) {
+	case ORIENT_ROTATE_0:
+	default:
+		map->xx = x[0]; map->xy = x[1]; map->x0 = x[2];
+		map->yx = y[0]; map->yy = y[1]; map->y0 = y[2];
+		break;
+
+	case ORIENT_ROTATE_90:
+		/* dx = h - y, dy = x */
+		map->xx = -y[0]; map->xy = -y[1]; map->x0 = h - y[2];
+		map->yx = x[0]; map->yy = x[1]; map->y0 = x[2];
+		break;
+
+	case ORIENT_ROTATE_180:
+		/* dx = w - x, dy = h - y */
+		map->xx = -x[0]; map->xy = -x[1]; map->x0 = w - x[2];
+		map->yx = -y[0]; map->yy = -y[1]; map->y0 = h - y[2];
+		break;
+
+	case ORIENT_ROTATE_270:
+		/* dx = y, dy = w - x */
+		map->xx = y[0]; map->xy = y[1]; map->x0 = y[2];
+		map->yx = -x[0]; map->yy = -x[1]; map->y0 = w - x[2];
+		break;
+	}
+
+	if (orientation & ORIENT_ROTATE_90) {
+		map->width = height;
+		map->height = width;
+	} else {
+		map->width = width;
+		map->height = height;
+	}
+}
+
+int orientation_parse(const char *rotate, bool hflip, bool vflip,
+	unsigned int *orientation)
+{
+	unsigned int value = ORIENT_ROTATE_0;
+
+	if (rotate != NULL) {
+		switch (atoi(rotate)) {
+		case 0:
+			value = ORIENT_ROTATE_0;
+			break;
+		case 90:
+			value = ORIENT_ROTATE_90;
+			break;
+		case 180:
+			value = ORIENT_ROTATE_180;
+			break;
+		case 270:
+			value = ORIENT_ROTATE_270;
+			break;
+		default:
+			printf("Invalid rotation %s, must be 0, 90, 180 or 270.\n",
+				rotate);
+			return -EINVAL;
+		}
+	}
+
+	if (hflip)
+		value |= ORIENT_HFLIP;
+	if (vflip)
+		value |= ORIENT_VFLIP;
+
+	*orientation = value;
+	return 0;
+}
+
+int image_init(struct image *img, unsigned int fourcc, unsigned int width,
+	unsigned int height, unsigned int stride, void *data)
+{
+	const struct pixfmt_info *info;
+
+	info = pixfmt_lookup(fourcc);
+	if (info == NULL || info->bpp == 0)
+		return -EINVAL;
+
+	img->data = (uint8_t *)data;
+	img->fourcc = fourcc;
+	img->width = width;
+	img->height = height;
+	img->stride = stride ? stride : pixfmt_bytesperline(info, width);
+	return 0;
+}
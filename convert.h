@@ -0,0 +1,500 @@
+/*
+ * convert.h -- CPU colour space conversion
+ *
+ * Converters are generated from pixfmt_traits<>: the source format class
+ * and layout pick the kernel, the destination order picks the pixel
+ * writer. convert_lookup() resolves a (source, destination) pair to a
+ * function pointer once per stream so the per-frame path carries no
+ * format dispatch at all.
+ */
+
+#ifndef __CONVERT_H__
+#define __CONVERT_H__
+
+#include "pixfmt.h"
+#include "simd.h"
+
+struct image
+{
+	uint8_t *data;
+	unsigned int fourcc;
+	unsigned int width;
+	unsigned int height;
+	unsigned int stride;
+};
+
+/*
+ * Output orientation: optional flips applied to the source first, then a
+ * clockwise rotation.
+ */
+enum orientation
+{
+	ORIENT_ROTATE_0 = 0,
+	ORIENT_ROTATE_90 = 1,
+	ORIENT_ROTATE_180 = 2,
+	ORIENT_ROTATE_270 = 3,
+	ORIENT_ROTATE_MASK = 3,
+	ORIENT_HFLIP = 1 << 2,
+	ORIENT_VFLIP = 1 << 3
+};
+
+/*
+ * Integer mapping from source to destination coordinates,
+ * dx = xx * sx + xy * sy + x0 and dy = yx * sx + yy * sy + y0.
+ */
+struct orient_map
+{
+	unsigned int orientation;
+	unsigned int width;
+	unsigned int height;
+	int xx, xy, x0;
+	int yx, yy, y0;
+};
+
+/* Convert source lines [first, last) into the same lines of dst. */
+typedef void (*convert_fn)(const struct image *src, struct image *dst,
+	unsigned int first, unsigned int last);
+
+/*
+ * Convert source lines [first, last) into their rotated/flipped location
+ * in dst. Bands starting on a multiple of CONVERT_TILE_SIZE give the best
+ * cache behaviour.
+ */
+typedef void (*convert_orient_fn)(const struct image *src, struct image *dst,
+	const struct orient_map *map, unsigned int first, unsigned int last);
+
+enum convert_variant
+{
+	CONVERT_SCALAR,
+	CONVERT_SIMD,
+	CONVERT_STREAM		/* SIMD, for write-combined destinations */
+};
+
+convert_fn convert_lookup(unsigned int src_fourcc, unsigned int dst_fourcc);
+convert_fn convert_lookup_variant(unsigned int src_fourcc,
+	unsigned int dst_fourcc, enum convert_variant variant);
+convert_orient_fn convert_orient_lookup(unsigned int src_fourcc,
+	unsigned int dst_fourcc);
+void orient_map_init(struct orient_map *map, unsigned int orientation,
+	unsigned int width, unsigned int height);
+int orientation_parse(const char *rotate, bool hflip, bool vflip,
+	unsigned int *orientation);
+int image_init(struct image *img, unsigned int fourcc, unsigned int width,
+	unsigned int height, unsigned int stride, void *data);
+
+/*
+ * BT.601 limited range to full range RGB, 16.16 fixed point. The
+ * coefficients match the ones used by yuv2rgb.frag so the CPU and GPU
+ * paths render the same picture.
+ */
+#define YUV_FIX_Y	76304	/* 1.1643 */
+#define YUV_FIX_RV	104582	/* 1.5958 */
+#define YUV_FIX_GU	25672	/* 0.39173 */
+#define YUV_FIX_GV	53274	/* 0.81290 */
+#define YUV_FIX_BU	132186	/* 2.017 */
+#define YUV_FIX_ROUND	(1 << 15)
+
+static inline uint8_t clamp_u8(int v)
+{
+	return (unsigned int)v > 255 ? (uint8_t)(~v >> 31) : (uint8_t)v;
+}
+
+struct yuv_chroma
+{
+	int r;
+	int g;
+	int b;
+};
+
+static inline void yuv_chroma_terms(int u, int v, struct yuv_chroma *c)
+{
+	u -= 128;
+	v -= 128;
+	c->r = YUV_FIX_RV * v + YUV_FIX_ROUND;
+	c->g = -YUV_FIX_GU * u - YUV_FIX_GV * v + YUV_FIX_ROUND;
+	c->b = YUV_FIX_BU * u + YUV_FIX_ROUND;
+}
+
+/*
+ * Pixel writers, one per destination component order. Byte-addressable
+ * orders also expose the offsets of their components.
+ */
+template<int Order> struct rgb_writer;
+
+template<> struct rgb_writer<ORDER_RGB>
+{
+	enum { bytes = 3, r = 0, g = 1, b = 2 };
+	static inline void store(uint8_t *p, uint8_t r, uint8_t g, uint8_t b)
+	{
+		p[0] = r;
+		p[1] = g;
+		p[2] = b;
+	}
+};
+
+template<> struct rgb_writer<ORDER_BGR>
+{
+	enum { bytes = 3, r = 2, g = 1, b = 0 };
+	static inline void store(uint8_t *p, uint8_t r, uint8_t g, uint8_t b)
+	{
+		p[0] = b;
+		p[1] = g;
+		p[2] = r;
+	}
+};
+
+template<> struct rgb_writer<ORDER_BGRX>
+{
+	enum { bytes = 4, r = 2, g = 1, b = 0 };
+	static inline void store(uint8_t *p, uint8_t r, uint8_t g, uint8_t b)
+	{
+		p[0] = b;
+		p[1] = g;
+		p[2] = r;
+		p[3] = 0xff;
+	}
+};
+
+template<> struct rgb_writer<ORDER_XRGB>
+{
+	enum { bytes = 4, r = 1, g = 2, b = 3 };
+	static inline void store(uint8_t *p, uint8_t r, uint8_t g, uint8_t b)
+	{
+		p[0] = 0xff;
+		p[1] = r;
+		p[2] = g;
+		p[3] = b;
+	}
+};
+
+template<> struct rgb_writer<ORDER_RGB565>
+{
+	enum { bytes = 2 };
+	static inline void store(uint8_t *p, uint8_t r, uint8_t g, uint8_t b)
+	{
+		uint16_t v = ((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3);
+
+		p[0] = v & 0xff;
+		p[1] = v >> 8;
+	}
+};
+
+template<class Writer>
+static inline void yuv_store(uint8_t *p, int y, const struct yuv_chroma *c)
+{
+	int cy = YUV_FIX_Y * (y - 16);
+
+	Writer::store(p, clamp_u8((cy + c->r) >> 16), clamp_u8((cy + c->g) >> 16),
+	      clamp_u8((cy + c->b) >> 16));
+}
+
+/*
+ * Converter kernels, specialized on the source format class and bits per
+ * pixel. Instantiating an unsupported combination fails to compile.
+ */
+template<unsigned int Src, unsigned int Dst,
+	 int Class = pixfmt_traits<Src>::cls,
+	 int Bpp = pixfmt_traits<Src>::bpp>
+struct converter;
+
+/* Packed 4:2:2 YUV (YUYV, UYVY). */
+template<unsigned int Src, unsigned int Dst>
+struct converter<Src, Dst, PIXFMT_CLASS_YUV, 16>
+{
+	typedef yuv422_layout<pixfmt_traits<Src>::order> layout;
+	typedef rgb_writer<pixfmt_traits<Dst>::order> writer;
+
+	/* Convert pixels [x0, x1) of a line, x0 and x1 must be even. */
+	static inline void convert_line(const uint8_t *s, uint8_t *d, long step,
+		unsigned int x0, unsigned int x1)
+	{
+		unsigned int x;
+
+		s += x0 * 2;
+
+		for (x = x0; x < x1; x += 2) {
+			struct yuv_chroma c;
+
+			yuv_chroma_terms(s[layout::u], s[layout::v], &c);
+			yuv_store<writer>(d, s[layout::y0], &c);
+			yuv_store<writer>(d + step, s[layout::y1], &c);
+			s += 4;
+			d += 2 * step;
+		}
+	}
+
+	static void convert(const struct image *src, struct image *dst,
+		unsigned int first, unsigned int last)
+	{
+		unsigned int y;
+
+		for (y = first; y < last; ++y)
+			convert_line(src->data + y * src->stride,
+				     dst->data + y * dst->stride, writer::bytes,
+				     0, src->width);
+	}
+};
+
+/* 8-bit greyscale. */
+template<unsigned int Src, unsigned int Dst>
+struct converter<Src, Dst, PIXFMT_CLASS_LUMA, 8>
+{
+	typedef rgb_writer<pixfmt_traits<Dst>::order> writer;
+
+	static inline void convert_line(const uint8_t *s, uint8_t *d, long step,
+		unsigned int x0, unsigned int x1)
+	{
+		struct yuv_chroma c;
+		unsigned int x;
+
+		yuv_chroma_terms(128, 128, &c);
+
+		for (x = x0; x < x1; ++x) {
+			yuv_store<writer>(d, s[x], &c);
+			d += step;
+		}
+	}
+
+	static void convert(const struct image *src, struct image *dst,
+		unsigned int first, unsigned int last)
+	{
+		unsigned int y;
+
+		for (y = first; y < last; ++y)
+			convert_line(src->data + y * src->stride,
+				     dst->data + y * dst->stride, writer::bytes,
+				     0, src->width);
+	}
+};
+
+/*
+ * Vectorized converters, giving the same output as the scalar ones. Only
+ * packed 4:2:2 sources have a SIMD kernel, every other combination
+ * resolves to the scalar converter.
+ */
+#ifdef HAVE_SIMD
+template<int Order> struct simd_rgb_writer
+{
+	/* Spill the vectors and use the scalar writer. */
+	static inline void store(uint8_t *d, const struct simd_rgb *rgb)
+	{
+		uint8_t r[16] SIMD_ALIGN, g[16] SIMD_ALIGN, b[16] SIMD_ALIGN;
+		unsigned int i;
+
+		simd_store(r, rgb->r);
+		simd_store(g, rgb->g);
+		simd_store(b, rgb->b);
+
+		for (i = 0; i < 16; ++i)
+			rgb_writer<Order>::store(d + i * rgb_writer<Order>::bytes,
+						 r[i], g[i], b[i]);
+	}
+};
+
+template<> struct simd_rgb_writer<ORDER_RGB>
+{
+	static inline void store(uint8_t *d, const struct simd_rgb *rgb)
+	{
+		simd_store3(d, rgb->r, rgb->g, rgb->b);
+	}
+};
+
+template<> struct simd_rgb_writer<ORDER_BGR>
+{
+	static inline void store(uint8_t *d, const struct simd_rgb *rgb)
+	{
+		simd_store3(d, rgb->b, rgb->g, rgb->r);
+	}
+};
+
+template<> struct simd_rgb_writer<ORDER_BGRX>
+{
+	static inline void store(uint8_t *d, const struct simd_rgb *rgb)
+	{
+		simd_store4(d, rgb->b, rgb->g, rgb->r, simd_splat(0xff));
+	}
+};
+
+template<> struct simd_rgb_writer<ORDER_XRGB>
+{
+	static inline void store(uint8_t *d, const struct simd_rgb *rgb)
+	{
+		simd_store4(d, simd_splat(0xff), rgb->r, rgb->g, rgb->b);
+	}
+};
+
+template<> struct simd_rgb_writer<ORDER_RGB565>
+{
+	static inline void store(uint8_t *d, const struct simd_rgb *rgb)
+	{
+		simd_store565(d, rgb->r, rgb->g, rgb->b);
+	}
+};
+
+template<unsigned int Src, unsigned int Dst,
+	 int Class = pixfmt_traits<Src>::cls,
+	 int Bpp = pixfmt_traits<Src>::bpp>
+struct simd_converter : converter<Src, Dst>
+{
+};
+
+template<unsigned int Src, unsigned int Dst>
+struct simd_converter<Src, Dst, PIXFMT_CLASS_YUV, 16>
+{
+	typedef converter<Src, Dst> scalar;
+	typedef yuv422_layout<pixfmt_traits<Src>::order> layout;
+	typedef rgb_writer<pixfmt_traits<Dst>::order> writer;
+	typedef simd_rgb_writer<pixfmt_traits<Dst>::order> simd_writer;
+
+	/* Convert pixels [x0, x1) of a line into contiguous output. */
+	static inline void convert_line(const uint8_t *s, uint8_t *d,
+		unsigned int x0, unsigned int x1)
+	{
+		unsigned int x;
+
+		for (x = x0; x + 16 <= x1; x += 16) {
+			struct simd_rgb rgb;
+
+			simd_yuv422_to_rgb<layout>(s + x * 2, &rgb);
+			simd_writer::store(d, &rgb);
+			d += 16 * writer::bytes;
+		}
+
+		scalar::convert_line(s, d, writer::bytes, x, x1);
+	}
+
+	static void convert(const struct image *src, struct image *dst,
+		unsigned int first, unsigned int last)
+	{
+		unsigned int y;
+
+		for (y = first; y < last; ++y)
+			convert_line(src->data + y * src->stride,
+				     dst->data + y * dst->stride, 0, src->width);
+	}
+};
+#else
+template<unsigned int Src, unsigned int Dst>
+struct simd_converter : converter<Src, Dst>
+{
+};
+#endif
+
+/*
+ * Conversion into write-combined memory such as a framebuffer. Each line
+ * is converted in chunks into a buffer that stays in L1 and streamed out
+ * with simd_stream_copy(), so the destination only sees full sequential
+ * stores and is never read back.
+ */
+#define CONVERT_STREAM_CHUNK	256
+
+template<unsigned int Src, unsigned int Dst>
+struct stream_converter
+{
+	typedef simd_converter<Src, Dst> kernel;
+	typedef rgb_writer<pixfmt_traits<Dst>::order> writer;
+
+	static void convert(const struct image *src, struct image *dst,
+		unsigned int first, unsigned int last)
+	{
+		uint8_t chunk[CONVERT_STREAM_CHUNK * writer::bytes] SIMD_ALIGN;
+		struct image s = *src;
+		struct image d = *dst;
+		unsigned int x, y;
+
+		d.data = chunk;
+		s.height = d.height = 1;
+
+		for (y = first; y < last; ++y) {
+			for (x = 0; x < src->width; x += CONVERT_STREAM_CHUNK) {
+				unsigned int n = src->width - x < CONVERT_STREAM_CHUNK
+					       ? src->width - x : CONVERT_STREAM_CHUNK;
+
+				s.data = src->data + y * src->stride +
+					 x * pixfmt_traits<Src>::bpp / 8;
+				s.width = d.width = n;
+				kernel::convert(&s, &d, 0, 1);
+
+				simd_stream_copy(dst->data + y * dst->stride + x * writer::bytes,
+						 chunk, n * writer::bytes);
+			}
+		}
+
+		simd_stream_fence();
+	}
+};
+
+/*
+ * Rotation and flips fused with conversion. The source is walked in
+ * CONVERT_TILE_SIZE square tiles; each tile is converted with the SIMD
+ * line kernel into a small buffer that stays in L1, and the buffer is then
+ * read back transposed/mirrored into contiguous destination line segments.
+ * Destination memory is thus streamed line by line whatever the
+ * orientation, instead of being written one pixel per cache line as a
+ * naive 90 degree rotation would.
+ */
+#define CONVERT_TILE_SIZE	32
+
+template<unsigned int Src, unsigned int Dst>
+struct oriented_converter
+{
+	typedef simd_converter<Src, Dst> kernel;
+	typedef rgb_writer<pixfmt_traits<Dst>::order> writer;
+
+	static void convert(const struct image *src, struct image *dst,
+		const struct orient_map *map, unsigned int first, unsigned int last)
+	{
+		uint8_t tile[CONVERT_TILE_SIZE * CONVERT_TILE_SIZE * writer::bytes] SIMD_ALIGN;
+		struct image s = *src;
+		struct image t = *dst;
+		unsigned int tx, ty, x, y;
+
+		t.data = tile;
+
+		for (ty = first; ty < last; ty += CONVERT_TILE_SIZE) {
+			int th = last - ty < CONVERT_TILE_SIZE ? last - ty : CONVERT_TILE_SIZE;
+
+			for (tx = 0; tx < src->width; tx += CONVERT_TILE_SIZE) {
+				int tw = src->width - tx < CONVERT_TILE_SIZE
+				       ? src->width - tx : CONVERT_TILE_SIZE;
+				/* Destination rectangle covered by this tile. */
+				int ax = map->xx * (int)tx + map->xy * (int)ty + map->x0;
+				int ay = map->yx * (int)tx + map->yy * (int)ty + map->y0;
+				int bx = map->xx * (int)(tx + tw - 1) + map->xy * (int)(ty + th - 1) + map->x0;
+				int by = map->yx * (int)(tx + tw - 1) + map->yy * (int)(ty + th - 1) + map->y0;
+				int dx = ax < bx ? ax : bx;
+				int dy = ay < by ? ay : by;
+				unsigned int dw = (ax < bx ? bx - ax : ax - bx) + 1;
+				unsigned int dh = (ay < by ? by - ay : ay - by) + 1;
+				/*
+				 * The source pixel of the top left destination pixel,
+				 * and the tile offsets to the next one on the same
+				 * line and on the next line.
+				 */
+				int sx = -(map->xx * (ax - dx) + map->yx * (ay - dy));
+				int sy = -(map->xy * (ax - dx) + map->yy * (ay - dy));
+				long step = (map->xx + map->xy * tw) * writer::bytes;
+				long line = (map->yx + map->yy * tw) * writer::bytes;
+				const uint8_t *p = tile + (sx + sy * tw) * writer::bytes;
+
+				s.data = src->data + ty * src->stride +
+					 tx * pixfmt_traits<Src>::bpp / 8;
+				s.width = t.width = tw;
+				s.height = t.height = th;
+				t.stride = tw * writer::bytes;
+				kernel::convert(&s, &t, 0, th);
+
+				for (y = 0; y < dh; ++y, p += line) {
+					uint8_t *d = dst->data + (dy + y) * dst->stride +
+						     dx * writer::bytes;
+					const uint8_t *q = p;
+
+					for (x = 0; x < dw; ++x, q += step, d += writer::bytes)
+						memcpy(d, q, writer::bytes);
+				}
+			}
+		}
+	}
+};
+
+#endif /* __CONVERT_H__ */
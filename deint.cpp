@@ -0,0 +1,373 @@
+/*
+ * deint.cpp -- deinterlacing of V4L2 field modes
+ */
+
+#include "deint.h"
+
+static uint64_t deint_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* -----------------------------------------------------------------------------
+ * Kernels
+ */
+
+/*
+ * A missing line, between lines a and b of the current field. w is the
+ * same line in the previous field, wp in the one before it of the same
+ * parity, and a2 and b2 are a and b one frame earlier. The interpolation
+ * rounds up like the SIMD averages do.
+ */
+static void deint_bob(uint8_t *d, const uint8_t *a, const uint8_t *b,
+	unsigned int n)
+{
+	unsigned int i = 0;
+
+#if defined(SIMD_SSE2)
+	for (; i + 16 <= n; i += 16)
+		_mm_storeu_si128((__m128i *)(d + i),
+			_mm_avg_epu8(_mm_loadu_si128((const __m128i *)(a + i)),
+				     _mm_loadu_si128((const __m128i *)(b + i))));
+#elif defined(SIMD_NEON)
+	for (; i + 16 <= n; i += 16)
+		vst1q_u8(d + i, vrhaddq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+#endif
+
+	for (; i < n; ++i)
+		d[i] = (a[i] + b[i] + 1) >> 1;
+}
+
+#if defined(SIMD_SSE2)
+static inline __m128i deint_absdiff(__m128i x, __m128i y)
+{
+	return _mm_or_si128(_mm_subs_epu8(x, y), _mm_subs_epu8(y, x));
+}
+#endif
+
+static void deint_adaptive(uint8_t *d, const uint8_t *a, const uint8_t *b,
+	const uint8_t *w, const uint8_t *wp, const uint8_t *a2, const uint8_t *b2,
+	unsigned int n, unsigned int threshold)
+{
+	unsigned int i = 0;
+
+#if defined(SIMD_SSE2)
+	const __m128i thr = _mm_set1_epi8(threshold);
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+		__m128i vw = _mm_loadu_si128((const __m128i *)(w + i));
+		__m128i m = deint_absdiff(vw, _mm_loadu_si128((const __m128i *)(wp + i)));
+
+		m = _mm_max_epu8(m, deint_absdiff(va, _mm_loadu_si128((const __m128i *)(a2 + i))));
+		m = _mm_max_epu8(m, deint_absdiff(vb, _mm_loadu_si128((const __m128i *)(b2 + i))));
+		/* All ones where the byte is static. */
+		m = _mm_cmpeq_epi8(_mm_subs_epu8(m, thr), zero);
+		_mm_storeu_si128((__m128i *)(d + i),
+			_mm_or_si128(_mm_and_si128(m, vw),
+				     _mm_andnot_si128(m, _mm_avg_epu8(va, vb))));
+	}
+#elif defined(SIMD_NEON)
+	const uint8x16_t thr = vdupq_n_u8(threshold);
+
+	for (; i + 16 <= n; i += 16) {
+		uint8x16_t va = vld1q_u8(a + i);
+		uint8x16_t vb = vld1q_u8(b + i);
+		uint8x16_t vw = vld1q_u8(w + i);
+		uint8x16_t m = vabdq_u8(vw, vld1q_u8(wp + i));
+
+		m = vmaxq_u8(m, vabdq_u8(va, vld1q_u8(a2 + i)));
+		m = vmaxq_u8(m, vabdq_u8(vb, vld1q_u8(b2 + i)));
+		vst1q_u8(d + i, vbslq_u8(vcgtq_u8(m, thr), vrhaddq_u8(va, vb), vw));
+	}
+#endif
+
+	for (; i < n; ++i) {
+		int ma = abs(a[i] - a2[i]);
+		int mb = abs(b[i] - b2[i]);
+		int m = abs(w[i] - wp[i]);
+
+		if (ma > m)
+			m = ma;
+		if (mb > m)
+			m = mb;
+		d[i] = m > (int)threshold ? (a[i] + b[i] + 1) >> 1 : w[i];
+	}
+}
+
+/* -----------------------------------------------------------------------------
+ * Fields
+ */
+
+int deint_parse_mode(const char *name, enum deint_mode *mode)
+{
+	if (strcmp(name, "weave") == 0)
+		*mode = DEINT_WEAVE;
+	else if (strcmp(name, "bob") == 0)
+		*mode = DEINT_BOB;
+	else if (strcmp(name, "adaptive") == 0)
+		*mode = DEINT_ADAPTIVE;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
+/*
+ * Deinterlace into one frame per frame, or per field with field_rate.
+ * order is V4L2_FIELD_INTERLACED_TB or _BT, for INTERLACED frames.
+ */
+void deint_init(struct deint *di, enum deint_mode mode, bool field_rate,
+	unsigned int order)
+{
+	memset(di, 0, sizeof *di);
+	di->mode = mode;
+	di->field_rate = field_rate;
+	di->order = order == V4L2_FIELD_INTERLACED_BT ?
+		    V4L2_FIELD_INTERLACED_BT : V4L2_FIELD_INTERLACED_TB;
+	di->threshold = 12;
+}
+
+bool deint_progressive(const struct frame *frame)
+{
+	return frame->field == V4L2_FIELD_NONE;
+}
+
+/* Drop the fields kept, the next frame starts over. */
+void deint_reset(struct deint *di)
+{
+	unsigned int i;
+
+	for (i = 0; i < di->count; ++i)
+		frame_put(di->fields[i].frame);
+
+	di->count = 0;
+	di->pending = 0;
+	di->fourcc = 0;
+	di->timestamp = 0;
+	di->frame_ns = 0;
+}
+
+static void deint_queue(struct deint *di, struct frame *frame,
+	unsigned int parity, unsigned int step, unsigned int offset,
+	unsigned int index, uint64_t timestamp)
+{
+	struct deint_field *field;
+
+	if (di->count == DEINT_HISTORY)
+		frame_put(di->fields[--di->count].frame);
+
+	memmove(&di->fields[1], &di->fields[0], di->count * sizeof di->fields[0]);
+	di->count++;
+
+	field = &di->fields[0];
+	field->frame = frame_get(frame);
+	field->parity = parity;
+	field->step = step;
+	field->offset = offset;
+	field->sequence = frame->sequence * 2 + index;
+	field->timestamp = timestamp;
+}
+
+/*
+ * Queue the fields of an interlaced frame, in temporal order. Returns the
+ * number of output frames they complete, to render with deint_render().
+ */
+int deint_push(struct deint *di, struct frame *frame)
+{
+	const struct image *img = &frame->image;
+	const struct pixfmt_info *info = pixfmt_lookup(img->fourcc);
+	unsigned int field = frame->field;
+	unsigned int lines = img->height;
+	unsigned int first = 0;
+	unsigned int fields = 2;
+	uint64_t half = 0;
+
+	if (info == NULL || info->planes != 1 || info->bpp % 8 ||
+	    info->cls == PIXFMT_CLASS_COMPRESSED)
+		return -EINVAL;
+
+	switch (field) {
+	case V4L2_FIELD_TOP:
+	case V4L2_FIELD_BOTTOM:
+		fields = 1;
+		break;
+	case V4L2_FIELD_INTERLACED_BT:
+	case V4L2_FIELD_SEQ_BT:
+		first = 1;
+		break;
+	case V4L2_FIELD_SEQ_TB:
+	case V4L2_FIELD_INTERLACED_TB:
+		break;
+	case V4L2_FIELD_ALTERNATE:
+		/* Buffers should say which field they hold, guess. */
+		fields = 1;
+		field = di->count && di->fields[0].parity == 0 ?
+			V4L2_FIELD_BOTTOM : V4L2_FIELD_TOP;
+		break;
+	default:
+		/* INTERLACED, or ANY from sources that do not know. */
+		field = V4L2_FIELD_INTERLACED;
+		first = di->order == V4L2_FIELD_INTERLACED_BT;
+		break;
+	}
+
+	if (fields == 2) {
+		if (lines % 2)
+			return -EINVAL;
+		lines /= 2;
+	}
+
+	/* Start over when the stream changes. */
+	if (img->fourcc != di->fourcc || img->width != di->width ||
+	    lines != di->lines) {
+		deint_reset(di);
+		di->fourcc = img->fourcc;
+		di->width = img->width;
+		di->lines = lines;
+		di->bytes = pixfmt_bytesperline(info, img->width);
+	}
+
+	di->frames++;
+
+	if (fields == 1) {
+		unsigned int parity = field == V4L2_FIELD_BOTTOM;
+
+		deint_queue(di, frame, parity, 1, 0,
+			    parity != (di->order == V4L2_FIELD_INTERLACED_BT),
+			    frame->timestamp);
+		if (!di->field_rate && ++di->pending < 2)
+			return 0;
+		di->pending = 0;
+		di->pushed = 1;
+		return 1;
+	}
+
+	/* The second field was captured half a frame time later. */
+	if (frame->timestamp && di->timestamp && frame->timestamp > di->timestamp)
+		di->frame_ns = frame->timestamp - di->timestamp;
+	di->timestamp = frame->timestamp;
+	if (frame->timestamp)
+		half = di->frame_ns / 2;
+
+	if (field == V4L2_FIELD_SEQ_TB || field == V4L2_FIELD_SEQ_BT) {
+		unsigned int bottom = field == V4L2_FIELD_SEQ_TB ? lines : 0;
+
+		deint_queue(di, frame, first, 1, first ? bottom : lines - bottom,
+			    0, frame->timestamp);
+		deint_queue(di, frame, !first, 1, first ? lines - bottom : bottom,
+			    1, frame->timestamp + half);
+	} else {
+		deint_queue(di, frame, first, 2, first, 0, frame->timestamp);
+		deint_queue(di, frame, !first, 2, !first, 1, frame->timestamp + half);
+	}
+
+	di->pushed = di->field_rate ? 2 : 1;
+	return di->pushed;
+}
+
+void deint_output_size(const struct deint *di, unsigned int *width,
+	unsigned int *height)
+{
+	*width = di->width;
+	*height = di->lines * 2;
+}
+
+static inline const uint8_t *deint_line(const struct deint_field *field,
+	int line, unsigned int lines)
+{
+	const struct image *img = &field->frame->image;
+
+	if (line < 0)
+		line = 0;
+	else if (line >= (int)lines)
+		line = lines - 1;
+
+	return img->data + (line * field->step + field->offset) * img->stride;
+}
+
+/*
+ * Render output n of those the last deint_push() completed, oldest first,
+ * into out, a frame of the format and deint_output_size().
+ */
+void deint_render(struct deint *di, unsigned int n, struct frame *out)
+{
+	unsigned int index = di->field_rate ? di->pushed - 1 - n : 0;
+	const struct deint_field *cur = &di->fields[index];
+	const struct deint_field *prev = NULL;
+	const struct deint_field *prev2 = NULL;
+	const struct deint_field *prev3 = NULL;
+	uint64_t start = deint_now();
+	uint64_t elapsed;
+	unsigned int lines = di->lines;
+	unsigned int y;
+
+	/* The neighbours in time, when they are there and of the right parity. */
+	if (index + 1 < di->count && di->fields[index + 1].parity != cur->parity)
+		prev = &di->fields[index + 1];
+	if (index + 2 < di->count && di->fields[index + 2].parity == cur->parity)
+		prev2 = &di->fields[index + 2];
+	if (index + 3 < di->count && prev && di->fields[index + 3].parity == prev->parity)
+		prev3 = &di->fields[index + 3];
+
+	for (y = 0; y < lines * 2; ++y) {
+		uint8_t *d = out->image.data + y * out->image.stride;
+		int line = y >> 1;
+		const uint8_t *a, *b;
+
+		if ((y & 1) == cur->parity) {
+			memcpy(d, deint_line(cur, line, lines), di->bytes);
+			continue;
+		}
+
+		if (di->mode == DEINT_WEAVE && prev) {
+			memcpy(d, deint_line(prev, line, lines), di->bytes);
+			continue;
+		}
+
+		/* The lines of the current field above and below. */
+		a = deint_line(cur, ((int)y - 1) >> 1, lines);
+		b = deint_line(cur, (y + 1) >> 1, lines);
+
+		if (di->mode == DEINT_ADAPTIVE && prev && prev2 && prev3)
+			deint_adaptive(d, a, b, deint_line(prev, line, lines),
+				       deint_line(prev3, line, lines),
+				       deint_line(prev2, ((int)y - 1) >> 1, lines),
+				       deint_line(prev2, (y + 1) >> 1, lines),
+				       di->bytes, di->threshold);
+		else
+			deint_bob(d, a, b, di->bytes);
+	}
+
+	out->sequence = di->field_rate ? cur->sequence : cur->sequence / 2;
+	out->flags = cur->frame->flags;
+	out->field = V4L2_FIELD_NONE;
+	out->timestamp = cur->timestamp;
+	out->dequeued = cur->frame->dequeued;
+
+	elapsed = deint_now() - start;
+	di->outputs++;
+	di->deint_ns += elapsed;
+	if (elapsed > di->max_ns)
+		di->max_ns = elapsed;
+}
+
+void deint_print(const struct deint *di, const char *name)
+{
+	static const char * const modes[] = { "weave", "bob", "adaptive" };
+
+	if (di->outputs == 0)
+		return;
+
+	printf("%s: %u frames in, %u out, %s at %s rate, threshold %u\n", name,
+		di->frames, di->outputs, modes[di->mode],
+		di->field_rate ? "field" : "frame", di->threshold);
+	printf("%s: %.1f us/frame (max %.1f), %.2f ns/pixel\n", name,
+		di->deint_ns / 1e3 / di->outputs, di->max_ns / 1e3,
+		(double)di->deint_ns / di->outputs / (di->width * di->lines * 2));
+}
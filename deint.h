@@ -0,0 +1,95 @@
+/*
+ * deint.h -- deinterlacing of V4L2 field modes
+ *
+ *	weave     the lines of the field are completed with the ones of the
+ *	          previous field, perfect on static content, combs on motion
+ *	bob       the missing lines are interpolated from the field alone
+ *	adaptive  weave where the picture is static and bob where it moves,
+ *	          per byte, motion being the largest change over one frame
+ *	          time of the missing byte and of the two around it
+ *
+ * Frames carry the field layout V4L2 reported for their buffer:
+ * INTERLACED, INTERLACED_TB and _BT frames interleave their fields line by
+ * line, SEQ_TB and SEQ_BT store them one after the other, and TOP, BOTTOM
+ * (and ALTERNATE streams of them) carry a single field each. The temporal
+ * order of INTERLACED frames depends on the standard and is configured.
+ * NONE frames are progressive and are left alone.
+ *
+ * Output frames are progressive, twice the field height, one per frame or
+ * one per field (double rate). Fields are referenced, not copied: up to
+ * DEINT_HISTORY of them are kept, three frames at most, which the source
+ * needs to have buffers for.
+ *
+ * Any single plane packed format works; every byte is processed alike,
+ * 16 at a time with NEON or SSE2.
+ */
+
+#ifndef __DEINT_H__
+#define __DEINT_H__
+
+#include "frame.h"
+
+#define DEINT_HISTORY		5
+
+enum deint_mode
+{
+	DEINT_WEAVE,
+	DEINT_BOB,
+	DEINT_ADAPTIVE
+};
+
+struct deint_field
+{
+	struct frame *frame;
+	/* 0 for the top field, 1 for the bottom one. */
+	unsigned int parity;
+	/* Field line i is line i * step + offset of the frame. */
+	unsigned int step;
+	unsigned int offset;
+	unsigned int sequence;
+	uint64_t timestamp;
+};
+
+struct deint
+{
+	enum deint_mode mode;
+	bool field_rate;
+	/* Temporal order of V4L2_FIELD_INTERLACED frames, TB or BT. */
+	unsigned int order;
+	/* Change in levels that counts as motion, adaptive mode. */
+	volatile unsigned int threshold;
+
+	/* Newest first. */
+	struct deint_field fields[DEINT_HISTORY];
+	unsigned int count;
+	/* Outputs of the last deint_push(), fields waiting for a pair. */
+	unsigned int pushed;
+	unsigned int pending;
+
+	unsigned int fourcc;
+	unsigned int width;
+	unsigned int lines;
+	unsigned int bytes;
+	/* Capture time of the last frame and the frame period. */
+	uint64_t timestamp;
+	uint64_t frame_ns;
+
+	/* Statistics. */
+	unsigned int frames;
+	unsigned int outputs;
+	uint64_t deint_ns;
+	uint64_t max_ns;
+};
+
+int deint_parse_mode(const char *name, enum deint_mode *mode);
+void deint_init(struct deint *di, enum deint_mode mode, bool field_rate,
+	unsigned int order);
+bool deint_progressive(const struct frame *frame);
+int deint_push(struct deint *di, struct frame *frame);
+void deint_output_size(const struct deint *di, unsigned int *width,
+	unsigned int *height);
+void deint_render(struct deint *di, unsigned int n, struct frame *out);
+void deint_reset(struct deint *di);
+void deint_print(const struct deint *di, const char *name);
+
+#endif /* __DEINT_H__ */
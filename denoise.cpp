@@ -0,0 +1,265 @@
+/*
+ * denoise.cpp -- recursive temporal denoise fused with YUV to RGB conversion
+ */
+
+#include "denoise.h"
+
+/*
+ * Weights are in 1/128. A byte of the current frame c blends with the
+ * history h as
+ *
+ *	a = min(|c - h|, limit)
+ *	w = weight_min + (a * slope >> 8)
+ *	h' = h + ((c - h) * w + 64 >> 7)
+ *
+ * where weight_min = 128 - strength * 7 / 16 never drops below 17, so
+ * that slope = ((128 - weight_min) << 8) / limit and every product fits
+ * in 16 signed bits. All paths compute exactly the same values.
+ */
+#define DENOISE_WEIGHT_ONE	128
+
+static uint64_t denoise_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* -----------------------------------------------------------------------------
+ * Kernels
+ */
+
+static inline void denoise_blend(const uint8_t *s, uint8_t *h, unsigned int n,
+	const struct denoise *dn)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; ++i) {
+		int diff = s[i] - h[i];
+		int a = diff < 0 ? -diff : diff;
+		int w;
+
+		if (a > dn->limit)
+			a = dn->limit;
+		w = dn->weight_min + ((a * dn->slope) >> 8);
+		h[i] += (diff * w + 64) >> 7;
+	}
+}
+
+#ifdef HAVE_SIMD
+/* Blend 16 bytes of the current frame into the history. */
+static inline void denoise_blend16(const uint8_t *s, uint8_t *h,
+	const struct denoise *dn)
+{
+#if defined(SIMD_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i limit = _mm_set1_epi16(dn->limit);
+	const __m128i slope = _mm_set1_epi16(dn->slope);
+	const __m128i weight_min = _mm_set1_epi16(dn->weight_min);
+	const __m128i round = _mm_set1_epi16(64);
+	__m128i c = _mm_loadu_si128((const __m128i *)s);
+	__m128i p = _mm_loadu_si128((const __m128i *)h);
+	__m128i plo = _mm_unpacklo_epi8(p, zero);
+	__m128i phi = _mm_unpackhi_epi8(p, zero);
+	__m128i dlo = _mm_sub_epi16(_mm_unpacklo_epi8(c, zero), plo);
+	__m128i dhi = _mm_sub_epi16(_mm_unpackhi_epi8(c, zero), phi);
+	__m128i a = _mm_or_si128(_mm_subs_epu8(c, p), _mm_subs_epu8(p, c));
+	__m128i alo = _mm_min_epi16(_mm_unpacklo_epi8(a, zero), limit);
+	__m128i ahi = _mm_min_epi16(_mm_unpackhi_epi8(a, zero), limit);
+	__m128i wlo = _mm_add_epi16(weight_min, _mm_srli_epi16(_mm_mullo_epi16(alo, slope), 8));
+	__m128i whi = _mm_add_epi16(weight_min, _mm_srli_epi16(_mm_mullo_epi16(ahi, slope), 8));
+
+	dlo = _mm_srai_epi16(_mm_add_epi16(_mm_mullo_epi16(dlo, wlo), round), 7);
+	dhi = _mm_srai_epi16(_mm_add_epi16(_mm_mullo_epi16(dhi, whi), round), 7);
+	_mm_storeu_si128((__m128i *)h, _mm_packus_epi16(_mm_add_epi16(plo, dlo),
+							_mm_add_epi16(phi, dhi)));
+#elif defined(SIMD_NEON)
+	const uint8x16_t limit = vdupq_n_u8(dn->limit);
+	const uint16x8_t slope = vdupq_n_u16(dn->slope);
+	const int16x8_t weight_min = vdupq_n_s16(dn->weight_min);
+	uint8x16_t c = vld1q_u8(s);
+	uint8x16_t p = vld1q_u8(h);
+	uint8x16_t a = vminq_u8(vabdq_u8(c, p), limit);
+	int16x8_t dlo = vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(c), vget_low_u8(p)));
+	int16x8_t dhi = vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(c), vget_high_u8(p)));
+	int16x8_t wlo = vaddq_s16(weight_min, vreinterpretq_s16_u16(
+		vshrq_n_u16(vmulq_u16(vmovl_u8(vget_low_u8(a)), slope), 8)));
+	int16x8_t whi = vaddq_s16(weight_min, vreinterpretq_s16_u16(
+		vshrq_n_u16(vmulq_u16(vmovl_u8(vget_high_u8(a)), slope), 8)));
+
+	dlo = vrshrq_n_s16(vmulq_s16(dlo, wlo), 7);
+	dhi = vrshrq_n_s16(vmulq_s16(dhi, whi), 7);
+	dlo = vaddq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(p))), dlo);
+	dhi = vaddq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(p))), dhi);
+	vst1q_u8(h, vcombine_u8(vqmovun_s16(dlo), vqmovun_s16(dhi)));
+#endif
+}
+#endif
+
+/*
+ * Blend a line into the history and convert the result, 16 pixels at a
+ * time so that the blended bytes are converted straight from L1.
+ */
+template<unsigned int Src, unsigned int Dst>
+struct denoise_converter
+{
+	typedef converter<Src, Dst> scalar;
+	typedef rgb_writer<pixfmt_traits<Dst>::order> writer;
+#ifdef HAVE_SIMD
+	typedef yuv422_layout<pixfmt_traits<Src>::order> layout;
+	typedef simd_rgb_writer<pixfmt_traits<Dst>::order> simd_writer;
+#endif
+
+	static inline void convert_line(const struct denoise *dn, const uint8_t *s,
+		uint8_t *h, uint8_t *d, unsigned int width)
+	{
+		unsigned int x = 0;
+
+#ifdef HAVE_SIMD
+		for (; x + 16 <= width; x += 16) {
+			struct simd_rgb rgb;
+
+			denoise_blend16(s + x * 2, h + x * 2, dn);
+			denoise_blend16(s + x * 2 + 16, h + x * 2 + 16, dn);
+			simd_yuv422_to_rgb<layout>(h + x * 2, &rgb);
+			simd_writer::store(d, &rgb);
+			d += 16 * writer::bytes;
+		}
+#endif
+
+		denoise_blend(s + x * 2, h + x * 2, (width - x) * 2, dn);
+		scalar::convert_line(h, d, writer::bytes, x, width);
+	}
+
+	static void convert(struct denoise *dn, const struct image *src,
+		struct image *dst, unsigned int first, unsigned int last)
+	{
+		unsigned int y;
+
+		for (y = first; y < last; ++y)
+			convert_line(dn, src->data + y * src->stride,
+				     dn->history + y * dn->stride,
+				     dst->data + y * dst->stride, src->width);
+	}
+};
+
+struct denoise_entry
+{
+	unsigned int src;
+	unsigned int dst;
+	denoise_fn fn;
+};
+
+#define DENOISER(_src, _dst) \
+	{ _src, _dst, denoise_converter<_src, _dst>::convert }
+
+static const struct denoise_entry denoisers[] = {
+	DENOISER(V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_RGB24),
+	DENOISER(V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_BGR24),
+	DENOISER(V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_BGR32),
+	DENOISER(V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_RGB32),
+	DENOISER(V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_RGB565),
+	DENOISER(V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_RGB24),
+	DENOISER(V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_BGR24),
+	DENOISER(V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_BGR32),
+	DENOISER(V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_RGB32),
+	DENOISER(V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_RGB565),
+};
+
+#undef DENOISER
+
+/* -----------------------------------------------------------------------------
+ * Frames
+ */
+
+/* Denoise frames of a packed 4:2:2 format and size into dst_fourcc. */
+int denoise_init(struct denoise *dn, unsigned int src_fourcc,
+	unsigned int dst_fourcc, unsigned int width, unsigned int height)
+{
+	unsigned int i;
+
+	memset(dn, 0, sizeof *dn);
+
+	for (i = 0; i < ARRAY_SIZE(denoisers); ++i) {
+		if (denoisers[i].src == src_fourcc && denoisers[i].dst == dst_fourcc)
+			dn->fn = denoisers[i].fn;
+	}
+
+	if (dn->fn == NULL || width == 0 || height == 0 || width % 2)
+		return -EINVAL;
+
+	dn->src_fourcc = src_fourcc;
+	dn->dst_fourcc = dst_fourcc;
+	dn->width = width;
+	dn->height = height;
+	dn->stride = width * 2;
+
+	dn->history = (uint8_t *)malloc(dn->stride * height);
+	if (dn->history == NULL)
+		return -ENOMEM;
+
+	denoise_set_strength(dn, 128, 24);
+	return 0;
+}
+
+/* Takes effect from the next frame, may be called from any thread. */
+void denoise_set_strength(struct denoise *dn, unsigned int strength,
+	unsigned int threshold)
+{
+	dn->strength = strength > 255 ? 255 : strength;
+	dn->threshold = threshold < 1 ? 1 : threshold > 255 ? 255 : threshold;
+}
+
+/* Start over from the next frame, e.g. after a scene change. */
+void denoise_reset(struct denoise *dn)
+{
+	dn->started = false;
+}
+
+/* Denoise a frame into the history and convert it into dst. */
+void denoise_convert(struct denoise *dn, const struct image *src,
+	struct image *dst)
+{
+	uint64_t start = denoise_now();
+	uint64_t elapsed;
+	unsigned int y;
+
+	/* The first frame is the history as it is. */
+	if (!dn->started) {
+		for (y = 0; y < dn->height; ++y)
+			memcpy(dn->history + y * dn->stride,
+			       src->data + y * src->stride, dn->stride);
+		dn->started = true;
+	}
+
+	dn->limit = dn->threshold;
+	dn->weight_min = DENOISE_WEIGHT_ONE - dn->strength * 7 / 16;
+	dn->slope = ((DENOISE_WEIGHT_ONE - dn->weight_min) << 8) / dn->limit;
+
+	dn->fn(dn, src, dst, 0, dn->height);
+
+	elapsed = denoise_now() - start;
+	dn->frames++;
+	dn->denoise_ns += elapsed;
+	if (elapsed > dn->max_ns)
+		dn->max_ns = elapsed;
+}
+
+void denoise_print(const struct denoise *dn, const char *name)
+{
+	if (dn->frames == 0)
+		return;
+
+	printf("%s: %u frames denoised, strength %u threshold %u\n", name,
+		dn->frames, dn->strength, dn->threshold);
+	printf("%s: %.1f us/frame (max %.1f), %.2f ns/pixel\n", name,
+		dn->denoise_ns / 1e3 / dn->frames, dn->max_ns / 1e3,
+		(double)dn->denoise_ns / dn->frames / (dn->width * dn->height));
+}
+
+void denoise_cleanup(struct denoise *dn)
+{
+	free(dn->history);
+	dn->history = NULL;
+}
@@ -0,0 +1,64 @@
+/*
+ * denoise.h -- recursive temporal denoise fused with YUV to RGB conversion
+ *
+ * Every output pixel is a blend of the current frame and the previous
+ * denoised one, kept in packed 4:2:2 as the history. The weight of the
+ * current frame grows with the difference between the two, from the
+ * floor set by the strength where nothing changed to all of it at the
+ * threshold, so noise averages out over static areas while moving edges
+ * do not smear. Luma and chroma bytes are blended alike.
+ *
+ * One pass reads the current line and the history, writes the blend
+ * back to the history and converts it to RGB while it is still in L1,
+ * 16 pixels at a time with NEON or SSE2.
+ *
+ * The strength and threshold may be changed from any thread while frames
+ * are converted; they are read once per call and need no reallocation.
+ */
+
+#ifndef __DENOISE_H__
+#define __DENOISE_H__
+
+#include "convert.h"
+
+struct denoise;
+
+typedef void (*denoise_fn)(struct denoise *dn, const struct image *src,
+			   struct image *dst, unsigned int first, unsigned int last);
+
+struct denoise
+{
+	unsigned int src_fourcc;
+	unsigned int dst_fourcc;
+	unsigned int width;
+	unsigned int height;
+	denoise_fn fn;
+
+	/* 0 (off) to 255, and the difference in levels that counts as motion. */
+	volatile unsigned int strength;
+	volatile unsigned int threshold;
+	/* Blend parameters of the frame being converted, see denoise.cpp. */
+	int weight_min, slope, limit;
+
+	/* Denoised frame in the source format, valid once started. */
+	uint8_t *history;
+	unsigned int stride;
+	bool started;
+
+	/* Statistics. */
+	unsigned int frames;
+	uint64_t denoise_ns;
+	uint64_t max_ns;
+};
+
+int denoise_init(struct denoise *dn, unsigned int src_fourcc,
+	unsigned int dst_fourcc, unsigned int width, unsigned int height);
+void denoise_set_strength(struct denoise *dn, unsigned int strength,
+	unsigned int threshold);
+void denoise_convert(struct denoise *dn, const struct image *src,
+	struct image *dst);
+void denoise_reset(struct denoise *dn);
+void denoise_print(const struct denoise *dn, const char *name);
+void denoise_cleanup(struct denoise *dn);
+
+#endif /* __DENOISE_H__ */
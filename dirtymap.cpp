@@ -0,0 +1,222 @@
+/*
+ * dirtymap.cpp -- changed tiles between consecutive frames
+ */
+
+#include "dirtymap.h"
+
+/* Per line hash keys, so that swapped lines within a tile hash differently. */
+#define DIRTYMAP_KEY0		0x9e3779b97f4a7c15ULL
+#define DIRTYMAP_KEY1		0xc2b2ae3d27d4eb4fULL
+#define DIRTYMAP_LINE0		0x27d4eb2f165667c5ULL
+#define DIRTYMAP_LINE1		0x94d049bb133111ebULL
+
+static uint64_t dirtymap_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Maps frames of the given format and size, the first update marks all tiles. */
+int dirtymap_init(struct dirtymap *map, unsigned int fourcc, unsigned int width,
+	unsigned int height)
+{
+	const struct pixfmt_info *info = pixfmt_lookup(fourcc);
+	unsigned int tiles;
+
+	memset(map, 0, sizeof *map);
+
+	if (info == NULL || info->bpp == 0)
+		return -EINVAL;
+
+	map->fourcc = fourcc;
+	map->width = width;
+	map->height = height;
+	map->cols = (width + DIRTYMAP_TILE_WIDTH - 1) / DIRTYMAP_TILE_WIDTH;
+	map->rows = (height + DIRTYMAP_TILE_LINES - 1) / DIRTYMAP_TILE_LINES;
+
+	tiles = map->cols * map->rows;
+	map->hashes = (uint64_t *)calloc(tiles, sizeof *map->hashes);
+	map->changed_in = (unsigned int *)calloc(tiles, sizeof *map->changed_in);
+	map->acc = (uint64_t *)calloc(map->cols * 2, sizeof *map->acc);
+	if (map->hashes == NULL || map->changed_in == NULL || map->acc == NULL) {
+		dirtymap_cleanup(map);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/*
+ * Hash the tiles of a new frame, of the format and size given to
+ * dirtymap_init(), and return how many of them changed. Lines are read
+ * front to back, each tile row keeping one accumulator per column.
+ */
+unsigned int dirtymap_update(struct dirtymap *map, const struct image *img)
+{
+	const struct pixfmt_info *info = pixfmt_lookup(map->fourcc);
+	unsigned int tile_bytes = DIRTYMAP_TILE_WIDTH * info->bpp / 8;
+	unsigned int line_bytes = map->width * info->bpp / 8;
+	uint64_t start = dirtymap_now();
+	unsigned int changed = 0;
+	unsigned int row, col, y;
+
+	map->frame++;
+
+	for (row = 0; row < map->rows; ++row) {
+		unsigned int first = row * DIRTYMAP_TILE_LINES;
+		unsigned int last = first + DIRTYMAP_TILE_LINES;
+		uint64_t key[2] = { DIRTYMAP_KEY0, DIRTYMAP_KEY1 };
+
+		if (last > map->height)
+			last = map->height;
+
+		memset(map->acc, 0, map->cols * 2 * sizeof *map->acc);
+
+		for (y = first; y < last; ++y) {
+			const uint8_t *line = img->data + y * img->stride;
+
+			for (col = 0; col < map->cols; ++col) {
+				unsigned int offset = col * tile_bytes;
+				unsigned int n = line_bytes - offset;
+
+				if (n > tile_bytes)
+					n = tile_bytes;
+				simd_hash_mix(&map->acc[col * 2], line + offset, n, key);
+			}
+
+			key[0] += DIRTYMAP_LINE0;
+			key[1] += DIRTYMAP_LINE1;
+		}
+
+		for (col = 0; col < map->cols; ++col) {
+			unsigned int tile = row * map->cols + col;
+			uint64_t hash = simd_hash_final(&map->acc[col * 2]);
+
+			if (map->frame == 1 || hash != map->hashes[tile]) {
+				map->hashes[tile] = hash;
+				map->changed_in[tile] = map->frame;
+				changed++;
+			}
+		}
+	}
+
+	map->changed = changed;
+	if (changed == 0)
+		map->static_frames++;
+	map->tiles += map->cols * map->rows;
+	map->tiles_changed += changed;
+	map->bytes += (uint64_t)line_bytes * map->height;
+	map->hash_ns += dirtymap_now() - start;
+
+	return changed;
+}
+
+/* Number of tiles that changed after frame since. */
+unsigned int dirtymap_count_since(const struct dirtymap *map, unsigned int since)
+{
+	unsigned int tiles = map->cols * map->rows;
+	unsigned int count = 0;
+	unsigned int i;
+
+	if (since + 1 == map->frame)
+		return map->changed;
+
+	for (i = 0; i < tiles; ++i) {
+		if (map->changed_in[i] > since)
+			count++;
+	}
+
+	return count;
+}
+
+/* Whether any tile in columns [first_col, last_col) of a row changed after since. */
+bool dirtymap_row_changed(const struct dirtymap *map, unsigned int row,
+	unsigned int first_col, unsigned int last_col, unsigned int since)
+{
+	const unsigned int *changed_in = &map->changed_in[row * map->cols];
+	unsigned int col;
+
+	for (col = first_col; col < last_col; ++col) {
+		if (changed_in[col] > since)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Convert the tiles of src that changed after frame since into dst, which
+ * holds the conversion of frame since. Runs of changed tiles in a tile
+ * row are converted in one call, on images narrowed to the run. Returns
+ * the number of tiles converted.
+ */
+unsigned int dirtymap_convert(const struct dirtymap *map, unsigned int since,
+	convert_fn fn, const struct image *src, struct image *dst)
+{
+	const struct pixfmt_info *src_info = pixfmt_lookup(src->fourcc);
+	const struct pixfmt_info *dst_info = pixfmt_lookup(dst->fourcc);
+	unsigned int converted = 0;
+	unsigned int row, col;
+
+	for (row = 0; row < map->rows; ++row) {
+		unsigned int first = row * DIRTYMAP_TILE_LINES;
+		unsigned int last = first + DIRTYMAP_TILE_LINES;
+
+		if (last > map->height)
+			last = map->height;
+
+		for (col = 0; col < map->cols; ) {
+			struct image s = *src;
+			struct image d = *dst;
+			unsigned int run;
+			unsigned int x;
+
+			if (!dirtymap_tile_changed(map, col, row, since)) {
+				col++;
+				continue;
+			}
+
+			for (run = 1; col + run < map->cols; ++run) {
+				if (!dirtymap_tile_changed(map, col + run, row, since))
+					break;
+			}
+
+			x = col * DIRTYMAP_TILE_WIDTH;
+			s.data += x * src_info->bpp / 8;
+			d.data += x * dst_info->bpp / 8;
+			s.width = d.width = col + run == map->cols ? map->width - x
+				  : run * DIRTYMAP_TILE_WIDTH;
+			fn(&s, &d, first, last);
+
+			converted += run;
+			col += run;
+		}
+	}
+
+	return converted;
+}
+
+void dirtymap_print(const struct dirtymap *map, const char *name)
+{
+	if (map->frame == 0)
+		return;
+
+	printf("%s: %u frames, %u unchanged, %.1f%% of tiles changed\n", name,
+		map->frame, map->static_frames,
+		map->tiles ? map->tiles_changed * 100.0 / map->tiles : 0.0);
+	printf("%s: hashing %.1f us/frame, %.0f MB/s\n", name,
+		map->hash_ns / 1e3 / map->frame,
+		map->hash_ns ? map->bytes * 1e3 / map->hash_ns : 0.0);
+}
+
+void dirtymap_cleanup(struct dirtymap *map)
+{
+	free(map->hashes);
+	free(map->changed_in);
+	free(map->acc);
+	map->hashes = NULL;
+	map->changed_in = NULL;
+	map->acc = NULL;
+}
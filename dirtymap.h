@@ -0,0 +1,69 @@
+/*
+ * dirtymap.h -- changed tiles between consecutive frames
+ *
+ * Splits frames into tiles of DIRTYMAP_TILE_WIDTH pixels by
+ * DIRTYMAP_TILE_LINES lines and hashes every tile of every frame with
+ * NEON or SSE2, in one streaming pass over the buffer. A tile whose hash
+ * differs from the previous frame records the frame number it changed
+ * in, so every consumer of the map can catch up from whatever frame its
+ * own copy holds: a texture updated every frame asks for the tiles
+ * changed since the previous frame, a converter writing into one of
+ * several recycled output frames asks for those changed since that
+ * output was last written.
+ *
+ * The tile width keeps 4:2:2 pixel pairs whole, and every converter
+ * works on pixels independently, so a tile run can be converted as an
+ * image of its own with dirtymap_convert().
+ */
+
+#ifndef __DIRTYMAP_H__
+#define __DIRTYMAP_H__
+
+#include "convert.h"
+
+#define DIRTYMAP_TILE_WIDTH	64
+#define DIRTYMAP_TILE_LINES	16
+
+struct dirtymap
+{
+	unsigned int fourcc;
+	unsigned int width;
+	unsigned int height;
+	unsigned int cols;
+	unsigned int rows;
+
+	/* Frames hashed so far, tiles changed in the last one. */
+	unsigned int frame;
+	unsigned int changed;
+	uint64_t *hashes;
+	unsigned int *changed_in;
+	/* Two hash lanes per column of the tile row being hashed. */
+	uint64_t *acc;
+
+	/* Statistics. */
+	unsigned int static_frames;
+	uint64_t tiles;
+	uint64_t tiles_changed;
+	uint64_t bytes;
+	uint64_t hash_ns;
+};
+
+int dirtymap_init(struct dirtymap *map, unsigned int fourcc, unsigned int width,
+	unsigned int height);
+unsigned int dirtymap_update(struct dirtymap *map, const struct image *img);
+unsigned int dirtymap_count_since(const struct dirtymap *map, unsigned int since);
+bool dirtymap_row_changed(const struct dirtymap *map, unsigned int row,
+	unsigned int first_col, unsigned int last_col, unsigned int since);
+unsigned int dirtymap_convert(const struct dirtymap *map, unsigned int since,
+	convert_fn fn, const struct image *src, struct image *dst);
+void dirtymap_print(const struct dirtymap *map, const char *name);
+void dirtymap_cleanup(struct dirtymap *map);
+
+/* Whether tile (col, row) changed after frame since, 0 for never seen. */
+static inline bool dirtymap_tile_changed(const struct dirtymap *map,
+	unsigned int col, unsigned int row, unsigned int since)
+{
+	return map->changed_in[row * map->cols + col] > since;
+}
+
+#endif /* __DIRTYMAP_H__ */
@@ -0,0 +1,527 @@
+/*
+ * dmacheck.cpp -- check of the zero-copy capture to texture path
+ *
+ * Draws YUYV frames both ways the GPU converter can get them, imported
+ * in place from DMABUFs and uploaded, reads them back and compares both
+ * against the CPU converter. The frames come from a capture device, vivid
+ * for instance, whose buffers are exported with VIDIOC_EXPBUF, or without
+ * -d from memfd buffers made into DMABUFs by /dev/udmabuf and filled with
+ * the test pattern.
+ *
+ * When the driver cannot import the buffers (no EGL_EXT_image_dma_buf_import,
+ * no udmabuf, no exportable buffers), only the upload path is checked and
+ * the exit status is 77, the "skipped" of automake test harnesses, so a
+ * board without the zero-copy path does not pass for one with a working
+ * one.
+ */
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "yavtalib.h"
+#include "convert.h"
+#include "gpuconv.h"
+#include "pattern.h"
+
+#ifndef UDMABUF_CREATE		/* 4.20 */
+struct udmabuf_create {
+	__u32 memfd;
+	__u32 flags;
+	__u64 offset;
+	__u64 size;
+};
+
+#define UDMABUF_CREATE		_IOW('u', 0x42, struct udmabuf_create)
+#endif
+
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS		(1024 + 9)
+#define F_SEAL_SHRINK		0x0002
+#endif
+
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING	0x0002U
+#endif
+
+#define DMACHECK_SKIP		77
+
+/* Synthetic buffers without capture device, malloc()ed when memfd < 0. */
+struct dmacheck_buffer
+{
+	int memfd;
+	uint8_t *mem;
+	size_t size;
+};
+
+struct dmacheck
+{
+	struct device dev;
+	bool capture;
+
+	struct dmacheck_buffer *buffers;
+	unsigned int nbufs;
+
+	unsigned int width;
+	unsigned int height;
+	unsigned int stride;
+
+	struct gpuconv gc;
+	bool zero_copy;
+	convert_fn convert;
+	struct image reference;
+	struct frame out;
+
+	/* Largest difference to the CPU output and frames beyond tolerance. */
+	unsigned int max_diff[2];
+	unsigned int failed[2];
+	unsigned int frames;
+};
+
+/* Rounding in the shader and in the CPU converter. */
+#define DMACHECK_TOLERANCE	2
+
+/* -----------------------------------------------------------------------------
+ * Sources
+ */
+
+static int dmacheck_open_udmabuf(struct dmacheck *dc, unsigned int nbufs)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t size = (dc->stride * dc->height + page - 1) & ~(page - 1);
+	unsigned int i;
+	int devfd;
+	int ret;
+
+	devfd = open("/dev/udmabuf", O_RDWR);
+	if (devfd < 0) {
+		printf("Unable to open /dev/udmabuf: %s (%d).\n", strerror(errno), errno);
+		return -errno;
+	}
+
+	dc->buffers = (struct dmacheck_buffer *)calloc(nbufs, sizeof *dc->buffers);
+	if (dc->buffers == NULL) {
+		close(devfd);
+		return -ENOMEM;
+	}
+
+	dc->nbufs = nbufs;
+	for (i = 0; i < nbufs; ++i)
+		dc->buffers[i].memfd = -1;
+
+	for (i = 0; i < nbufs; ++i) {
+		struct dmacheck_buffer *buffer = &dc->buffers[i];
+
+		buffer->memfd = syscall(__NR_memfd_create, "dmacheck", MFD_ALLOW_SEALING);
+		if (buffer->memfd < 0) {
+			printf("Unable to create buffer %u: %s (%d).\n", i, strerror(errno), errno);
+			ret = -errno;
+			goto error;
+		}
+
+		/* udmabuf wants the memfd sealed against shrinking. */
+		if (ftruncate(buffer->memfd, size) < 0 ||
+		    fcntl(buffer->memfd, F_ADD_SEALS, F_SEAL_SHRINK) < 0) {
+			printf("Unable to size buffer %u: %s (%d).\n", i, strerror(errno), errno);
+			ret = -errno;
+			goto error;
+		}
+
+		buffer->mem = (uint8_t *)mmap(NULL, size, PROT_READ | PROT_WRITE,
+					      MAP_SHARED, buffer->memfd, 0);
+		if (buffer->mem == MAP_FAILED) {
+			printf("Unable to map buffer %u: %s (%d).\n", i, strerror(errno), errno);
+			buffer->mem = NULL;
+			ret = -errno;
+			goto error;
+		}
+
+		buffer->size = size;
+	}
+
+	close(devfd);
+	return 0;
+
+error:
+	close(devfd);
+	return ret;
+}
+
+static int dmacheck_export_udmabuf(struct dmacheck *dc, unsigned int index, int *fd)
+{
+	struct udmabuf_create create;
+	int devfd;
+
+	devfd = open("/dev/udmabuf", O_RDWR);
+	if (devfd < 0)
+		return -errno;
+
+	memset(&create, 0, sizeof create);
+	create.memfd = dc->buffers[index].memfd;
+	create.flags = O_CLOEXEC;
+	create.offset = 0;
+	create.size = dc->buffers[index].size;
+
+	*fd = ioctl(devfd, UDMABUF_CREATE, &create);
+	close(devfd);
+	if (*fd < 0) {
+		printf("Unable to export buffer %u: %s (%d).\n", index, strerror(errno), errno);
+		return -errno;
+	}
+
+	return 0;
+}
+
+static void dmacheck_close_udmabuf(struct dmacheck *dc)
+{
+	unsigned int i;
+
+	for (i = 0; i < dc->nbufs; ++i) {
+		struct dmacheck_buffer *buffer = &dc->buffers[i];
+
+		if (buffer->memfd < 0) {
+			free(buffer->mem);
+			continue;
+		}
+
+		if (buffer->mem)
+			munmap(buffer->mem, buffer->size);
+		close(buffer->memfd);
+	}
+
+	free(dc->buffers);
+	dc->buffers = NULL;
+	dc->nbufs = 0;
+}
+
+static int dmacheck_open_device(struct dmacheck *dc, const char *devname,
+	unsigned int nbufs)
+{
+	struct device *dev = &dc->dev;
+	int ret;
+
+	ret = video_open(dev, devname, 0);
+	if (ret < 0)
+		return ret;
+
+	if (dev->type != V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+		printf("%s is not a capture device.\n", devname);
+		return -EINVAL;
+	}
+
+	if (dc->width && dc->height)
+		ret = video_set_format(dev, dc->width, dc->height, V4L2_PIX_FMT_YUYV);
+	else
+		ret = video_get_format(dev);
+	if (ret < 0)
+		return ret;
+
+	if (dev->pixelformat != V4L2_PIX_FMT_YUYV) {
+		printf("%s captures %s, not YUYV.\n", devname,
+			v4l2_format_name(dev->pixelformat));
+		return -EINVAL;
+	}
+
+	dc->width = dev->width;
+	dc->height = dev->height;
+	dc->stride = dev->bytesperline ? dev->bytesperline : dev->width * 2;
+
+	ret = video_prepare_capture(dev, nbufs, 0, NULL, BUFFER_FILL_NONE);
+	if (ret < 0)
+		return ret;
+
+	dc->nbufs = dev->nbufs;
+	dc->capture = true;
+	return video_enable(dev, 1);
+}
+
+/* The next frame and the buffer holding it, -errno on capture errors. */
+static int dmacheck_next(struct dmacheck *dc, unsigned int frame, struct image *img)
+{
+	struct v4l2_buffer buf;
+	unsigned int index;
+	uint8_t *mem;
+
+	if (!dc->capture) {
+		index = frame % dc->nbufs;
+		mem = dc->buffers[index].mem;
+		image_init(img, V4L2_PIX_FMT_YUYV, dc->width, dc->height, dc->stride, mem);
+		pattern_fill(img, frame);
+		return index;
+	}
+
+	memset(&buf, 0, sizeof buf);
+	buf.type = dc->dev.type;
+	buf.memory = dc->dev.memtype;
+	if (ioctl(dc->dev.fd, VIDIOC_DQBUF, &buf) < 0) {
+		printf("Unable to dequeue buffer: %s (%d).\n", strerror(errno), errno);
+		return -errno;
+	}
+
+	mem = (uint8_t *)dc->dev.buffers[buf.index].mem;
+	image_init(img, V4L2_PIX_FMT_YUYV, dc->width, dc->height, dc->stride, mem);
+	return buf.index;
+}
+
+static void dmacheck_done(struct dmacheck *dc, unsigned int index)
+{
+	if (dc->capture)
+		video_queue_buffer(&dc->dev, index, BUFFER_FILL_NONE);
+}
+
+/* -----------------------------------------------------------------------------
+ * Checks
+ */
+
+static int dmacheck_import(struct dmacheck *dc)
+{
+	unsigned int i;
+	int ret;
+	int fd = -1;
+
+	ret = gpuconv_init_dmabuf(&dc->gc, dc->stride, dc->nbufs);
+	if (ret < 0)
+		return ret;
+
+	if (dc->capture)
+		return dmatex_import_device(&dc->gc.dmatex, &dc->dev);
+
+	for (i = 0; i < dc->nbufs; ++i) {
+		ret = dmacheck_export_udmabuf(dc, i, &fd);
+		if (ret < 0)
+			return ret;
+
+		ret = dmatex_import(&dc->gc.dmatex, i, fd, 0);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+static unsigned int dmacheck_compare(const struct dmacheck *dc)
+{
+	unsigned int max_diff = 0;
+	unsigned int x, y;
+
+	for (y = 0; y < dc->height; ++y) {
+		const uint8_t *ref = dc->reference.data + y * dc->reference.stride;
+		const uint8_t *out = dc->out.image.data + y * dc->out.image.stride;
+
+		/* The fourth byte is padding. */
+		for (x = 0; x < dc->width * 4; ++x) {
+			unsigned int diff = abs(ref[x] - out[x]);
+
+			if ((x & 3) != 3 && diff > max_diff)
+				max_diff = diff;
+		}
+	}
+
+	return max_diff;
+}
+
+/* Convert the frame in buffer index on the GPU, path 0 imported, 1 uploaded. */
+static int dmacheck_frame(struct dmacheck *dc, const struct image *img,
+	unsigned int index, unsigned int path)
+{
+	unsigned int diff;
+	struct frame src;
+	int ret;
+
+	memset(&src, 0, sizeof src);
+	src.image = *img;
+	src.sequence = dc->frames;
+
+	if (path == 0)
+		ret = gpuconv_submit_buffer(&dc->gc, &src, index);
+	else
+		ret = gpuconv_submit(&dc->gc, &src);
+	if (ret < 0)
+		return ret;
+
+	ret = gpuconv_readback(&dc->gc, &dc->out);
+	if (ret < 0)
+		return ret;
+
+	/* The GPU is done with the buffer once the readback returned. */
+	if (path == 0)
+		dmatex_wait(&dc->gc.dmatex, index);
+
+	diff = dmacheck_compare(dc);
+	if (diff > dc->max_diff[path])
+		dc->max_diff[path] = diff;
+	if (diff > DMACHECK_TOLERANCE)
+		dc->failed[path]++;
+
+	return 0;
+}
+
+static void usage(const char *argv0)
+{
+	printf("Usage: %s [options]\n", argv0);
+	printf("Check the zero-copy and upload paths of the GPU conversion.\n\n");
+	printf("Supported options:\n");
+	printf("-b, --buffers n			Number of buffers (default %u)\n", V4L_BUFFERS_DEFAULT);
+	printf("-d, --device dev		Capture device (default udmabuf test pattern)\n");
+	printf("-h, --help			Show this help screen\n");
+	printf("-n, --frames n			Number of frames (default 30)\n");
+	printf("-S, --shader file		Fragment shader (default yuv2rgb.frag)\n");
+	printf("-s, --size WxH			Frame size (default 640x480)\n");
+}
+
+static struct option opts[] = {
+	{"buffers", 1, 0, 'b'},
+	{"device", 1, 0, 'd'},
+	{"help", 0, 0, 'h'},
+	{"frames", 1, 0, 'n'},
+	{"shader", 1, 0, 'S'},
+	{"size", 1, 0, 's'},
+	{0, 0, 0, 0}
+};
+
+int main(int argc, char *argv[])
+{
+	struct dmacheck dc;
+	const char *devname = NULL;
+	const char *shader = "yuv2rgb.frag";
+	unsigned int nbufs = V4L_BUFFERS_DEFAULT;
+	unsigned int frames = 30;
+	unsigned int i, path;
+	uint8_t *out_mem = NULL;
+	int ret = 1;
+	int c;
+
+	memset(&dc, 0, sizeof dc);
+	dc.dev.fd = -1;
+
+	while ((c = getopt_long(argc, argv, "b:d:hn:S:s:", opts, NULL)) != -1) {
+		switch (c) {
+		case 'b':
+			nbufs = atoi(optarg);
+			break;
+		case 'd':
+			devname = optarg;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		case 'n':
+			frames = atoi(optarg);
+			break;
+		case 'S':
+			shader = optarg;
+			break;
+		case 's':
+			if (sscanf(optarg, "%ux%u", &dc.width, &dc.height) != 2) {
+				printf("Invalid size '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		default:
+			printf("Invalid option -%c\n", c);
+			printf("Run %s -h for help.\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (nbufs == 0 || frames == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (devname == NULL) {
+		if (dc.width == 0 || dc.height == 0) {
+			dc.width = 640;
+			dc.height = 480;
+		}
+		dc.stride = dc.width * 2;
+	}
+
+	/* Without udmabuf the pattern still goes through the upload path. */
+	if (devname) {
+		if (dmacheck_open_device(&dc, devname, nbufs) < 0)
+			goto done;
+	} else if (dmacheck_open_udmabuf(&dc, nbufs) < 0) {
+		uint8_t *mem;
+
+		dmacheck_close_udmabuf(&dc);
+		dc.buffers = (struct dmacheck_buffer *)calloc(1, sizeof *dc.buffers);
+		mem = (uint8_t *)malloc(dc.stride * dc.height);
+		if (dc.buffers == NULL || mem == NULL) {
+			free(mem);
+			goto done;
+		}
+		dc.buffers[0].memfd = -1;
+		dc.buffers[0].mem = mem;
+		dc.nbufs = 1;
+	}
+
+	dc.convert = convert_lookup(V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_BGR32);
+	out_mem = (uint8_t *)malloc(dc.width * 4 * dc.height * 2);
+	if (dc.convert == NULL || out_mem == NULL)
+		goto done;
+
+	image_init(&dc.reference, V4L2_PIX_FMT_BGR32, dc.width, dc.height, dc.width * 4, out_mem);
+	image_init(&dc.out.image, V4L2_PIX_FMT_BGR32, dc.width, dc.height, dc.width * 4,
+		   out_mem + dc.width * 4 * dc.height);
+
+	if (gpuconv_init(&dc.gc, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_BGR32, dc.width,
+			 dc.height, 1, shader) < 0)
+		goto done;
+
+	gpuconv_acquire(&dc.gc);
+
+	if (dc.buffers == NULL || dc.buffers[0].memfd >= 0) {
+		dc.zero_copy = dmacheck_import(&dc) == 0;
+		if (!dc.zero_copy)
+			printf("Zero-copy path unavailable, checking the upload path only.\n");
+	}
+
+	for (i = 0; i < frames; ++i) {
+		struct image img;
+		int index;
+
+		index = dmacheck_next(&dc, i, &img);
+		if (index < 0)
+			break;
+
+		dc.convert(&img, &dc.reference, 0, dc.height);
+
+		for (path = dc.zero_copy ? 0 : 1; path < 2; ++path) {
+			if (dmacheck_frame(&dc, &img, index, path) < 0) {
+				printf("Unable to convert frame %u.\n", i);
+				dmacheck_done(&dc, index);
+				goto release;
+			}
+		}
+
+		dmacheck_done(&dc, index);
+		dc.frames++;
+	}
+
+	printf("%u frames of %ux%u from %s\n", dc.frames, dc.width, dc.height,
+		devname ? devname : dc.buffers[0].memfd >= 0 ? "udmabuf" : "memory");
+	for (path = dc.zero_copy ? 0 : 1; path < 2; ++path)
+		printf("%s: max difference %u, %u frames beyond %u\n",
+			path == 0 ? "imported" : "uploaded", dc.max_diff[path],
+			dc.failed[path], DMACHECK_TOLERANCE);
+	gpuconv_print(&dc.gc, "gpu");
+
+	if (dc.frames != frames || dc.failed[0] || dc.failed[1])
+		ret = 1;
+	else
+		ret = dc.zero_copy ? 0 : DMACHECK_SKIP;
+
+release:
+	gpuconv_release(&dc.gc);
+done:
+	gpuconv_cleanup(&dc.gc);
+	if (dc.capture) {
+		video_enable(&dc.dev, 0);
+		video_free_buffers(&dc.dev);
+	}
+	if (dc.dev.fd >= 0)
+		video_close(&dc.dev);
+	dmacheck_close_udmabuf(&dc);
+	free(out_mem);
+	return ret;
+}
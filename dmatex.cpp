@@ -0,0 +1,229 @@
+/*
+ * dmatex.cpp -- capture buffers sampled in place by the GPU
+ */
+
+#include "dmatex.h"
+
+#ifndef EGL_LINUX_DMA_BUF_EXT
+#define EGL_LINUX_DMA_BUF_EXT		0x3270
+#define EGL_LINUX_DRM_FOURCC_EXT	0x3271
+#define EGL_DMA_BUF_PLANE0_FD_EXT	0x3272
+#define EGL_DMA_BUF_PLANE0_OFFSET_EXT	0x3273
+#define EGL_DMA_BUF_PLANE0_PITCH_EXT	0x3274
+#endif
+
+/* drm_fourcc.h, two 8 bit channels, red first in memory. */
+#define DMATEX_DRM_FORMAT_GR88		v4l2_fourcc('G', 'R', '8', '8')
+
+static bool dmatex_has_extension(const char *list, const char *name)
+{
+	size_t len = strlen(name);
+	const char *p = list;
+
+	while (p && (p = strstr(p, name)) != NULL) {
+		if ((p == list || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0'))
+			return true;
+		p += len;
+	}
+
+	return false;
+}
+
+/*
+ * Prepare the import of nbufs buffers of width x height fourcc frames,
+ * stride bytes apart, on display. Needs the GL context current. -ENOTSUP
+ * when the format or the driver cannot do it.
+ */
+int dmatex_init(struct dmatex *dt, EGLDisplay display, unsigned int fourcc,
+	unsigned int width, unsigned int height, unsigned int stride,
+	unsigned int nbufs)
+{
+	const char *egl = eglQueryString(display, EGL_EXTENSIONS);
+	const char *gl = (const char *)glGetString(GL_EXTENSIONS);
+	GLint max_size = 0;
+	unsigned int i;
+
+	memset(dt, 0, sizeof *dt);
+	dt->display = display;
+	dt->fourcc = fourcc;
+	dt->width = width;
+	dt->height = height;
+	dt->stride = stride;
+
+	if (fourcc != V4L2_PIX_FMT_YUYV) {
+		printf("No DMABUF import of %s frames.\n", v4l2_format_name(fourcc));
+		return -ENOTSUP;
+	}
+
+	if (!dmatex_has_extension(egl, "EGL_EXT_image_dma_buf_import") ||
+	    !dmatex_has_extension(gl, "GL_OES_EGL_image")) {
+		printf("No DMABUF import, the driver lacks %s.\n",
+			dmatex_has_extension(gl, "GL_OES_EGL_image")
+			? "EGL_EXT_image_dma_buf_import" : "GL_OES_EGL_image");
+		return -ENOTSUP;
+	}
+
+	/* One texture holds the frame, there are no tiles. */
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+	if (width > (unsigned int)max_size || height > (unsigned int)max_size) {
+		printf("No DMABUF import of %ux%u frames, textures are at most %d wide.\n",
+			width, height, max_size);
+		return -ENOTSUP;
+	}
+
+	dt->create_image = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+	dt->destroy_image = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+	dt->target_texture = (dmatex_target_texture_fn)eglGetProcAddress("glEGLImageTargetTexture2DOES");
+	if (!dt->create_image || !dt->destroy_image || !dt->target_texture)
+		return -ENOTSUP;
+
+	if (dmatex_has_extension(egl, "EGL_KHR_fence_sync")) {
+		dt->create_sync = (PFNEGLCREATESYNCKHRPROC)eglGetProcAddress("eglCreateSyncKHR");
+		dt->client_wait_sync = (PFNEGLCLIENTWAITSYNCKHRPROC)eglGetProcAddress("eglClientWaitSyncKHR");
+		dt->destroy_sync = (PFNEGLDESTROYSYNCKHRPROC)eglGetProcAddress("eglDestroySyncKHR");
+		if (!dt->create_sync || !dt->client_wait_sync || !dt->destroy_sync)
+			dt->create_sync = NULL;
+	}
+
+	dt->buffers = (struct dmatex_buffer *)calloc(nbufs, sizeof *dt->buffers);
+	if (dt->buffers == NULL)
+		return -ENOMEM;
+
+	dt->nbufs = nbufs;
+	for (i = 0; i < nbufs; ++i) {
+		dt->buffers[i].fd = -1;
+		dt->buffers[i].image = EGL_NO_IMAGE_KHR;
+		dt->buffers[i].sync = EGL_NO_SYNC_KHR;
+	}
+
+	return 0;
+}
+
+/*
+ * Bind the DMABUF fd, holding a frame at offset, to the texture of buffer
+ * index. The fd is owned by dt from then on, even on failure.
+ */
+int dmatex_import(struct dmatex *dt, unsigned int index, int fd,
+	unsigned int offset)
+{
+	struct dmatex_buffer *buffer = &dt->buffers[index];
+	const EGLint attribs[] = {
+		EGL_WIDTH, (EGLint)dt->width,
+		EGL_HEIGHT, (EGLint)dt->height,
+		EGL_LINUX_DRM_FOURCC_EXT, (EGLint)DMATEX_DRM_FORMAT_GR88,
+		EGL_DMA_BUF_PLANE0_FD_EXT, fd,
+		EGL_DMA_BUF_PLANE0_OFFSET_EXT, (EGLint)offset,
+		EGL_DMA_BUF_PLANE0_PITCH_EXT, (EGLint)dt->stride,
+		EGL_NONE
+	};
+	GLenum error;
+
+	buffer->fd = fd;
+
+	/* No context and no client buffer, the attributes say it all. */
+	buffer->image = dt->create_image(dt->display, EGL_NO_CONTEXT,
+					 EGL_LINUX_DMA_BUF_EXT, NULL, attribs);
+	if (buffer->image == EGL_NO_IMAGE_KHR) {
+		printf("Unable to import buffer %u (0x%04x).\n", index, eglGetError());
+		return -EINVAL;
+	}
+
+	glGenTextures(1, &buffer->texture);
+	glBindTexture(GL_TEXTURE_2D, buffer->texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	while (glGetError() != GL_NO_ERROR)
+		;
+	dt->target_texture(GL_TEXTURE_2D, buffer->image);
+	error = glGetError();
+	if (error != GL_NO_ERROR) {
+		printf("Unable to bind buffer %u to a texture (0x%04x).\n", index, error);
+		return -EINVAL;
+	}
+
+	dt->imported++;
+	return 0;
+}
+
+/* Export and import every buffer of a capture device. */
+int dmatex_import_device(struct dmatex *dt, struct device *dev)
+{
+	unsigned int i;
+	int ret;
+	int fd;
+
+	for (i = 0; i < dt->nbufs && i < dev->nbufs; ++i) {
+		ret = video_export_buffer(dev, i, &fd);
+		if (ret < 0)
+			return ret;
+
+		ret = dmatex_import(dt, i, fd, 0);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+GLuint dmatex_texture(const struct dmatex *dt, unsigned int index)
+{
+	return dt->buffers[index].texture;
+}
+
+/* After the last draw sampling buffer index. */
+void dmatex_fence(struct dmatex *dt, unsigned int index)
+{
+	struct dmatex_buffer *buffer = &dt->buffers[index];
+
+	if (dt->create_sync == NULL)
+		return;
+
+	if (buffer->sync != EGL_NO_SYNC_KHR)
+		dt->destroy_sync(dt->display, buffer->sync);
+	buffer->sync = dt->create_sync(dt->display, EGL_SYNC_FENCE_KHR, NULL);
+}
+
+/* Before buffer index goes back to the driver, to be written again. */
+void dmatex_wait(struct dmatex *dt, unsigned int index)
+{
+	struct dmatex_buffer *buffer = &dt->buffers[index];
+
+	if (dt->create_sync == NULL) {
+		glFinish();
+		return;
+	}
+
+	if (buffer->sync == EGL_NO_SYNC_KHR)
+		return;
+
+	dt->client_wait_sync(dt->display, buffer->sync,
+			     EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, EGL_FOREVER_KHR);
+	dt->destroy_sync(dt->display, buffer->sync);
+	buffer->sync = EGL_NO_SYNC_KHR;
+}
+
+void dmatex_cleanup(struct dmatex *dt)
+{
+	unsigned int i;
+
+	for (i = 0; i < dt->nbufs; ++i) {
+		struct dmatex_buffer *buffer = &dt->buffers[i];
+
+		if (buffer->sync != EGL_NO_SYNC_KHR)
+			dt->destroy_sync(dt->display, buffer->sync);
+		if (buffer->texture)
+			glDeleteTextures(1, &buffer->texture);
+		if (buffer->image != EGL_NO_IMAGE_KHR)
+			dt->destroy_image(dt->display, buffer->image);
+		if (buffer->fd >= 0)
+			close(buffer->fd);
+	}
+
+	free(dt->buffers);
+	dt->buffers = NULL;
+	dt->nbufs = 0;
+	dt->imported = 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * dmatex.h -- capture buffers sampled in place by the GPU
+ *
+ * Each V4L2 buffer is exported once as a DMABUF (VIDIOC_EXPBUF) and
+ * imported as an EGLImage (EGL_EXT_image_dma_buf_import) bound to a GL
+ * texture (GL_OES_EGL_image), so drawing a frame needs no copy at all:
+ * the texture of the buffer just dequeued is the frame. Packed YUYV is
+ * imported as a two channel GR88 image of one texel per pixel, luma in
+ * red and chroma in green, the layout of the luminance/alpha upload with
+ * the chroma moved, see TEXEL_RG in yuv2rgb.frag.
+ *
+ * The GPU reads the buffer after the draw call returns: a fence is set
+ * after the draws sampling a buffer, and waited for before the buffer is
+ * queued back to the driver (EGL_KHR_fence_sync, glFinish() without).
+ *
+ * Availability is found out at dmatex_init() time, with the context
+ * current, and any failure there or at import time returns an error for
+ * the caller to fall back to uploading the frames.
+ */
+
+#ifndef __DMATEX_H__
+#define __DMATEX_H__
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+
+#include "yavtalib.h"
+
+struct dmatex_buffer
+{
+	int fd;
+	EGLImageKHR image;
+	GLuint texture;
+	EGLSyncKHR sync;
+};
+
+typedef void (*dmatex_target_texture_fn)(GLenum target, void *image);
+
+struct dmatex
+{
+	EGLDisplay display;
+	PFNEGLCREATEIMAGEKHRPROC create_image;
+	PFNEGLDESTROYIMAGEKHRPROC destroy_image;
+	dmatex_target_texture_fn target_texture;
+	PFNEGLCREATESYNCKHRPROC create_sync;
+	PFNEGLCLIENTWAITSYNCKHRPROC client_wait_sync;
+	PFNEGLDESTROYSYNCKHRPROC destroy_sync;
+
+	unsigned int fourcc;
+	unsigned int width;
+	unsigned int height;
+	unsigned int stride;
+
+	struct dmatex_buffer *buffers;
+	unsigned int nbufs;
+	unsigned int imported;
+};
+
+int dmatex_init(struct dmatex *dt, EGLDisplay display, unsigned int fourcc,
+	unsigned int width, unsigned int height, unsigned int stride,
+	unsigned int nbufs);
+int dmatex_import(struct dmatex *dt, unsigned int index, int fd,
+	unsigned int offset);
+int dmatex_import_device(struct dmatex *dt, struct device *dev);
+GLuint dmatex_texture(const struct dmatex *dt, unsigned int index);
+void dmatex_fence(struct dmatex *dt, unsigned int index);
+void dmatex_wait(struct dmatex *dt, unsigned int index);
+void dmatex_cleanup(struct dmatex *dt);
+
+#endif /* __DMATEX_H__ */
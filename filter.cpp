@@ -0,0 +1,413 @@
+/*
+ * filter.cpp -- 3x3 and 5x5 luma filters on packed 4:2:2 frames
+ */
+
+#include "filter.h"
+
+/*
+ * Taps of the separable passes, 3x3 kernels are the 5 tap ones with the
+ * outer taps zero. Ranges, with 8-bit luma:
+ *
+ *	box      horizontal <= 1275, vertical <= 6375
+ *	binomial horizontal <= 4080 (shifted by 2 for unsharp 5x5),
+ *	         vertical <= 16320 before the shift to the blur
+ *	Sobel    smooth <= 4080, derivative within +-765, both gradients
+ *	         within +-12240
+ *
+ * so every sum fits in 16 signed bits and the SIMD and scalar paths give
+ * the same results.
+ */
+static const int16_t filter_box[2][FILTER_TAPS] = {
+	{ 0, 1, 1, 1, 0 }, { 1, 1, 1, 1, 1 },
+};
+static const int16_t filter_binomial[2][FILTER_TAPS] = {
+	{ 0, 1, 2, 1, 0 }, { 1, 4, 6, 4, 1 },
+};
+static const int16_t filter_derivative[2][FILTER_TAPS] = {
+	{ 0, -1, 0, 1, 0 }, { -1, -2, 0, 2, 1 },
+};
+
+#define FILTER_HALO		(FILTER_TAPS / 2)
+
+static uint64_t filter_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* -----------------------------------------------------------------------------
+ * Kernels
+ */
+
+/*
+ * Luma of pixels [x, x + n) of a packed 4:2:2 line, y at byte yoff of
+ * each pair, with the edge pixels repeated outside [0, width).
+ */
+static void filter_luma(const uint8_t *s, int16_t *l, int x, unsigned int n,
+	unsigned int width, unsigned int yoff)
+{
+	unsigned int i = 0;
+
+	for (; i < n && x + (int)i < 0; ++i)
+		l[i] = s[yoff];
+
+#if defined(SIMD_SSE2)
+	for (; i + 8 <= n && x + i + 8 <= width; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + (x + i) * 2));
+
+		v = yoff ? _mm_srli_epi16(v, 8) : _mm_and_si128(v, _mm_set1_epi16(0x00ff));
+		_mm_storeu_si128((__m128i *)(l + i), v);
+	}
+#elif defined(SIMD_NEON)
+	for (; i + 8 <= n && x + i + 8 <= width; i += 8) {
+		uint16x8_t v = vreinterpretq_u16_u8(vld1q_u8(s + (x + i) * 2));
+
+		v = yoff ? vshrq_n_u16(v, 8) : vandq_u16(v, vdupq_n_u16(0x00ff));
+		vst1q_s16(l + i, vreinterpretq_s16_u16(v));
+	}
+#endif
+
+	for (; i < n; ++i) {
+		unsigned int xc = x + i < width ? x + i : width - 1;
+
+		l[i] = s[xc * 2 + yoff];
+	}
+}
+
+/*
+ * out[i] = (sum of coef[k] * in[k][i] + rounding) >> shift, for n values.
+ * Zero taps are skipped.
+ */
+static void filter_taps(const int16_t *const *in, int16_t *out, unsigned int n,
+	const int16_t *coef, unsigned int shift)
+{
+	const int16_t *rows[FILTER_TAPS];
+	int16_t c[FILTER_TAPS];
+	int round = shift ? 1 << (shift - 1) : 0;
+	unsigned int taps = 0;
+	unsigned int i = 0, k;
+
+	for (k = 0; k < FILTER_TAPS; ++k) {
+		if (coef[k] == 0)
+			continue;
+		rows[taps] = in[k];
+		c[taps] = coef[k];
+		taps++;
+	}
+
+#ifdef HAVE_SIMD
+	simd_s16 vc[FILTER_TAPS];
+
+	for (k = 0; k < taps; ++k)
+		vc[k] = simd_s16_splat(c[k]);
+
+	/* Three taps (3x3 box and binomial) are the common case. */
+	if (taps == 3) {
+		for (; i + 8 <= n; i += 8) {
+			simd_s16 acc = simd_s16_splat(round);
+
+			acc = simd_s16_add(acc, simd_s16_mul(simd_s16_load(rows[0] + i), vc[0]));
+			acc = simd_s16_add(acc, simd_s16_mul(simd_s16_load(rows[1] + i), vc[1]));
+			acc = simd_s16_add(acc, simd_s16_mul(simd_s16_load(rows[2] + i), vc[2]));
+			simd_s16_store(out + i, simd_s16_sra(acc, shift));
+		}
+	}
+
+	for (; i + 8 <= n; i += 8) {
+		simd_s16 acc = simd_s16_splat(round);
+
+		for (k = 0; k < taps; ++k)
+			acc = simd_s16_add(acc, simd_s16_mul(simd_s16_load(rows[k] + i), vc[k]));
+		simd_s16_store(out + i, simd_s16_sra(acc, shift));
+	}
+#endif
+
+	for (; i < n; ++i) {
+		int acc = round;
+
+		for (k = 0; k < taps; ++k)
+			acc += rows[k][i] * c[k];
+		out[i] = acc >> shift;
+	}
+}
+
+/*
+ * Combine the centre luma c with the vertical pass results v0 and v1 and
+ * write n pixels of packed 4:2:2 to d, with the chroma of s.
+ */
+static void filter_combine(const struct filter *flt, unsigned int amount,
+	const int16_t *c, const int16_t *v0, const int16_t *v1,
+	const uint8_t *s, uint8_t *d, unsigned int n, unsigned int yoff)
+{
+	unsigned int big = flt->size == 5;
+	unsigned int i = 0;
+
+#ifdef HAVE_SIMD
+	const simd_s16 zero = simd_s16_splat(0);
+	const simd_s16 max = simd_s16_splat(255);
+	const simd_s16 gain = simd_s16_splat(amount);
+	const simd_s16 area = simd_s16_splat(big ? 25 : 9);
+	const simd_s16 chroma = simd_s16_splat(yoff ? 0x00ff : (int16_t)0xff00);
+	const simd_s16 grey = simd_s16_splat(yoff ? 0x0080 : (int16_t)0x8000);
+
+	for (; i + 8 <= n; i += 8) {
+		simd_s16 y = simd_s16_load(c + i);
+		simd_s16 r, pair;
+
+		switch (flt->mode) {
+		case FILTER_SHARPEN:
+			r = simd_s16_sub(simd_s16_mul(y, area), simd_s16_load(v0 + i));
+			r = simd_s16_sra(r, big ? 4 : 3);
+			r = simd_s16_add(y, simd_s16_sra(simd_s16_mul(r, gain), 4));
+			break;
+		case FILTER_UNSHARP:
+			r = simd_s16_sub(y, simd_s16_load(v0 + i));
+			r = simd_s16_add(y, simd_s16_sra(simd_s16_mul(r, gain), 4));
+			break;
+		case FILTER_SOBEL:
+		default:
+			r = simd_s16_add(simd_s16_abs(simd_s16_load(v0 + i)),
+					 simd_s16_abs(simd_s16_load(v1 + i)));
+			r = simd_s16_srl(simd_s16_mul(simd_s16_srl(r, big ? 5 : 2), gain), 4);
+			break;
+		}
+
+		r = simd_s16_min(simd_s16_max(r, zero), max);
+		pair = flt->mode == FILTER_SOBEL ? grey
+		     : simd_s16_and(simd_s16_load((const int16_t *)(s + i * 2)), chroma);
+		simd_s16_store((int16_t *)(d + i * 2),
+			       simd_s16_or(pair, simd_s16_sll(r, yoff * 8)));
+	}
+#endif
+
+	for (; i < n; ++i) {
+		int y = c[i];
+		int r;
+
+		switch (flt->mode) {
+		case FILTER_SHARPEN:
+			r = (y * (big ? 25 : 9) - v0[i]) >> (big ? 4 : 3);
+			r = y + ((r * (int)amount) >> 4);
+			break;
+		case FILTER_UNSHARP:
+			r = y + (((y - v0[i]) * (int)amount) >> 4);
+			break;
+		case FILTER_SOBEL:
+		default:
+			r = (abs(v0[i]) + abs(v1[i])) >> (big ? 5 : 2);
+			r = (r * amount) >> 4;
+			break;
+		}
+
+		d[i * 2 + yoff] = clamp_u8(r);
+		d[i * 2 + 1 - yoff] = flt->mode == FILTER_SOBEL ? 0x80 : s[i * 2 + 1 - yoff];
+	}
+}
+
+/* -----------------------------------------------------------------------------
+ * Frames
+ */
+
+int filter_parse_mode(const char *name, enum filter_mode *mode)
+{
+	if (strcmp(name, "sharpen") == 0)
+		*mode = FILTER_SHARPEN;
+	else if (strcmp(name, "unsharp") == 0)
+		*mode = FILTER_UNSHARP;
+	else if (strcmp(name, "sobel") == 0)
+		*mode = FILTER_SOBEL;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
+/*
+ * Filter frames of a packed 4:2:2 format and size with a size x size
+ * kernel, into the same format or converted to dst_fourcc.
+ */
+int filter_init(struct filter *flt, enum filter_mode mode, unsigned int size,
+	unsigned int fourcc, unsigned int dst_fourcc, unsigned int width,
+	unsigned int height)
+{
+	unsigned int luma_width = FILTER_BLOCK_WIDTH + 2 * FILTER_HALO;
+	int16_t *p;
+	unsigned int k;
+
+	memset(flt, 0, sizeof *flt);
+
+	if ((size != 3 && size != 5) || width == 0 || height == 0 || width % 2)
+		return -EINVAL;
+	if (fourcc != V4L2_PIX_FMT_YUYV && fourcc != V4L2_PIX_FMT_UYVY)
+		return -EINVAL;
+
+	if (dst_fourcc != fourcc) {
+		flt->convert = convert_lookup(fourcc, dst_fourcc);
+		if (flt->convert == NULL)
+			return -EINVAL;
+	}
+
+	flt->fourcc = fourcc;
+	flt->dst_fourcc = dst_fourcc;
+	flt->width = width;
+	flt->height = height;
+	flt->mode = mode;
+	flt->size = size;
+	flt->amount = FILTER_AMOUNT_ONE;
+
+	flt->buffer = (int16_t *)malloc((FILTER_TAPS * (luma_width + 2 * FILTER_BLOCK_WIDTH) +
+					 2 * FILTER_BLOCK_WIDTH) * sizeof *flt->buffer);
+	flt->line = (uint8_t *)malloc(FILTER_BLOCK_WIDTH * 2);
+	if (flt->buffer == NULL || flt->line == NULL) {
+		filter_cleanup(flt);
+		return -ENOMEM;
+	}
+
+	p = flt->buffer;
+	for (k = 0; k < FILTER_TAPS; ++k, p += luma_width)
+		flt->luma[k] = p;
+	for (k = 0; k < FILTER_TAPS; ++k, p += FILTER_BLOCK_WIDTH)
+		flt->horiz[0][k] = p;
+	for (k = 0; k < FILTER_TAPS; ++k, p += FILTER_BLOCK_WIDTH)
+		flt->horiz[1][k] = p;
+	flt->vert[0] = p;
+	flt->vert[1] = p + FILTER_BLOCK_WIDTH;
+
+	return 0;
+}
+
+/* Takes effect from the next frame, may be called from any thread. */
+void filter_set_amount(struct filter *flt, unsigned int amount)
+{
+	flt->amount = amount > FILTER_AMOUNT_MAX ? FILTER_AMOUNT_MAX : amount;
+}
+
+static inline unsigned int filter_slot(int line)
+{
+	return (line + FILTER_TAPS * FILTER_HALO) % FILTER_TAPS;
+}
+
+/* Luma and horizontal passes of a line, lines outside the frame repeat the edges. */
+static void filter_row(struct filter *flt, const struct image *src, int line,
+	unsigned int x0, unsigned int n, unsigned int yoff)
+{
+	unsigned int slot = filter_slot(line);
+	unsigned int big = flt->size == 5;
+	unsigned int y = line < 0 ? 0 : (unsigned int)line >= flt->height
+		       ? flt->height - 1 : line;
+	const int16_t *in[FILTER_TAPS];
+	unsigned int k;
+
+	filter_luma(src->data + y * src->stride, flt->luma[slot], (int)x0 - FILTER_HALO,
+		    n + 2 * FILTER_HALO, flt->width, yoff);
+
+	for (k = 0; k < FILTER_TAPS; ++k)
+		in[k] = flt->luma[slot] + k;
+
+	switch (flt->mode) {
+	case FILTER_SHARPEN:
+		filter_taps(in, flt->horiz[0][slot], n, filter_box[big], 0);
+		break;
+	case FILTER_UNSHARP:
+		filter_taps(in, flt->horiz[0][slot], n, filter_binomial[big], big ? 2 : 0);
+		break;
+	case FILTER_SOBEL:
+		filter_taps(in, flt->horiz[0][slot], n, filter_binomial[big], 0);
+		filter_taps(in, flt->horiz[1][slot], n, filter_derivative[big], 0);
+		break;
+	}
+}
+
+/*
+ * Filter a frame into dst. Each column block is run top to bottom, the
+ * horizontal pass staying FILTER_HALO lines ahead of the vertical one.
+ */
+void filter_run(struct filter *flt, const struct image *src, struct image *dst)
+{
+	const struct pixfmt_info *dst_info = pixfmt_lookup(flt->dst_fourcc);
+	unsigned int yoff = flt->fourcc == V4L2_PIX_FMT_UYVY;
+	unsigned int amount = flt->amount;
+	unsigned int big = flt->size == 5;
+	uint64_t start = filter_now();
+	uint64_t elapsed;
+	unsigned int x0;
+	int line;
+
+	for (x0 = 0; x0 < flt->width; x0 += FILTER_BLOCK_WIDTH) {
+		unsigned int n = flt->width - x0 < FILTER_BLOCK_WIDTH
+			       ? flt->width - x0 : FILTER_BLOCK_WIDTH;
+
+		for (line = -FILTER_HALO; line < FILTER_HALO; ++line)
+			filter_row(flt, src, line, x0, n, yoff);
+
+		for (line = 0; line < (int)flt->height; ++line) {
+			const int16_t *h0[FILTER_TAPS], *h1[FILTER_TAPS];
+			const uint8_t *s = src->data + line * src->stride + x0 * 2;
+			uint8_t *d = dst->data + line * dst->stride + x0 * dst_info->bpp / 8;
+			unsigned int k;
+
+			filter_row(flt, src, line + FILTER_HALO, x0, n, yoff);
+
+			for (k = 0; k < FILTER_TAPS; ++k) {
+				h0[k] = flt->horiz[0][filter_slot(line - FILTER_HALO + k)];
+				h1[k] = flt->horiz[1][filter_slot(line - FILTER_HALO + k)];
+			}
+
+			switch (flt->mode) {
+			case FILTER_SHARPEN:
+				filter_taps(h0, flt->vert[0], n, filter_box[big], 0);
+				break;
+			case FILTER_UNSHARP:
+				filter_taps(h0, flt->vert[0], n, filter_binomial[big], big ? 6 : 4);
+				break;
+			case FILTER_SOBEL:
+				filter_taps(h1, flt->vert[0], n, filter_binomial[big], 0);
+				filter_taps(h0, flt->vert[1], n, filter_derivative[big], 0);
+				break;
+			}
+
+			filter_combine(flt, amount, flt->luma[filter_slot(line)] + FILTER_HALO,
+				       flt->vert[0], flt->vert[1], s,
+				       flt->convert ? flt->line : d, n, yoff);
+
+			/* Converted while the block line is still in L1. */
+			if (flt->convert) {
+				struct image sline, dline;
+
+				image_init(&sline, flt->fourcc, n, 1, n * 2, flt->line);
+				image_init(&dline, flt->dst_fourcc, n, 1, dst->stride, d);
+				flt->convert(&sline, &dline, 0, 1);
+			}
+		}
+	}
+
+	elapsed = filter_now() - start;
+	flt->frames++;
+	flt->filter_ns += elapsed;
+	if (elapsed > flt->max_ns)
+		flt->max_ns = elapsed;
+}
+
+void filter_print(const struct filter *flt, const char *name)
+{
+	static const char * const modes[] = { "sharpen", "unsharp", "sobel" };
+
+	if (flt->frames == 0)
+		return;
+
+	printf("%s: %u frames, %s %ux%u amount %u/%u\n", name, flt->frames,
+		modes[flt->mode], flt->size, flt->size, flt->amount, FILTER_AMOUNT_ONE);
+	printf("%s: %.1f us/frame (max %.1f), %.2f ns/pixel\n", name,
+		flt->filter_ns / 1e3 / flt->frames, flt->max_ns / 1e3,
+		(double)flt->filter_ns / flt->frames / (flt->width * flt->height));
+}
+
+void filter_cleanup(struct filter *flt)
+{
+	free(flt->buffer);
+	free(flt->line);
+	flt->buffer = NULL;
+	flt->line = NULL;
+}
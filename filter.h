@@ -0,0 +1,74 @@
+/*
+ * filter.h -- 3x3 and 5x5 luma filters on packed 4:2:2 frames
+ *
+ *	sharpen   Laplacian sharpening, the frame plus amount times its
+ *	          difference to the box mean
+ *	unsharp   unsharp mask, the same with a binomial blur
+ *	sobel     Sobel gradient magnitude, as grey with neutral chroma
+ *
+ * Every kernel is separable: a horizontal pass over each luma line and a
+ * vertical pass over the last 5 of them, in 16-bit lanes with NEON or
+ * SSE2. The frame is processed in columns of FILTER_BLOCK_WIDTH pixels,
+ * top to bottom, so that the lines the vertical pass needs stay in L1.
+ *
+ * Chroma is passed through. The result is written as packed 4:2:2 in
+ * the source format, or converted to RGB a block line at a time while
+ * it is still in L1 when the filter is set up with an RGB format.
+ */
+
+#ifndef __FILTER_H__
+#define __FILTER_H__
+
+#include "convert.h"
+
+#define FILTER_BLOCK_WIDTH	512
+#define FILTER_TAPS		5
+
+/* Amounts are in 1/FILTER_AMOUNT_ONE, up to 4. */
+#define FILTER_AMOUNT_ONE	16
+#define FILTER_AMOUNT_MAX	64
+
+enum filter_mode
+{
+	FILTER_SHARPEN,
+	FILTER_UNSHARP,
+	FILTER_SOBEL
+};
+
+struct filter
+{
+	unsigned int fourcc;
+	unsigned int dst_fourcc;
+	unsigned int width;
+	unsigned int height;
+	enum filter_mode mode;
+	unsigned int size;
+	/* May be changed between frames from any thread. */
+	volatile unsigned int amount;
+
+	/* Conversion of the filtered lines, NULL to write packed 4:2:2. */
+	convert_fn convert;
+
+	/* Luma and horizontal pass rings, vertical pass results, one line. */
+	int16_t *luma[FILTER_TAPS];
+	int16_t *horiz[2][FILTER_TAPS];
+	int16_t *vert[2];
+	uint8_t *line;
+	int16_t *buffer;
+
+	/* Statistics. */
+	unsigned int frames;
+	uint64_t filter_ns;
+	uint64_t max_ns;
+};
+
+int filter_parse_mode(const char *name, enum filter_mode *mode);
+int filter_init(struct filter *flt, enum filter_mode mode, unsigned int size,
+	unsigned int fourcc, unsigned int dst_fourcc, unsigned int width,
+	unsigned int height);
+void filter_set_amount(struct filter *flt, unsigned int amount);
+void filter_run(struct filter *flt, const struct image *src, struct image *dst);
+void filter_print(const struct filter *flt, const char *name);
+void filter_cleanup(struct filter *flt);
+
+#endif /* __FILTER_H__ */
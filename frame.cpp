@@ -0,0 +1,61 @@
+/*
+ * frame.cpp -- reference counted frame handles
+ *
+ * Frames allocated here live in a slot of the frame pool, handle first
+ * and image data 64 bytes further, so a frame costs one slot and no heap
+ * allocation once the pool has warmed up.
+ */
+
+#include "frame.h"
+
+#define FRAME_HEADER_SIZE	((sizeof(struct frame) + 63) & ~63)
+
+static struct slotpool frame_slots;
+static unsigned int frame_pool_flags;
+static pthread_once_t frame_pool_once = PTHREAD_ONCE_INIT;
+
+static void frame_pool_init(void)
+{
+	slotpool_init(&frame_slots, frame_pool_flags);
+}
+
+/* Select SLOTPOOL_* flags, before the first frame_alloc(). */
+void frame_pool_setup(unsigned int flags)
+{
+	frame_pool_flags = flags;
+}
+
+struct slotpool *frame_pool(void)
+{
+	pthread_once(&frame_pool_once, frame_pool_init);
+	return &frame_slots;
+}
+
+static void frame_free(struct frame *frame)
+{
+	slotpool_release(&frame_slots, frame);
+}
+
+/* Allocate a frame with its own packed, 64 byte aligned memory. */
+struct frame *frame_alloc(unsigned int fourcc, unsigned int width,
+	unsigned int height)
+{
+	struct image image;
+	struct frame *frame;
+
+	if (image_init(&image, fourcc, width, height, 0, NULL) < 0)
+		return NULL;
+
+	frame = (struct frame *)slotpool_acquire(frame_pool(),
+		FRAME_HEADER_SIZE + image.stride * height);
+	if (frame == NULL)
+		return NULL;
+
+	memset(frame, 0, sizeof *frame);
+	frame->image = image;
+	frame->image.data = (uint8_t *)frame + FRAME_HEADER_SIZE;
+	frame->bytesused = image.stride * height;
+	frame->refcount = 1;
+	frame->release = frame_free;
+	return frame;
+}
@@ -0,0 +1,58 @@
+/*
+ * frame.h -- reference counted frame handles
+ *
+ * Frames move between pipeline stages as pointers to a struct frame and
+ * are never copied. Every holder owns a reference; the last frame_put()
+ * hands the frame back to whoever provided its memory, for instance to
+ * requeue a V4L2 capture buffer.
+ */
+
+#ifndef __FRAME_H__
+#define __FRAME_H__
+
+#include "convert.h"
+#include "slotpool.h"
+
+struct frame;
+
+typedef void (*frame_release_fn)(struct frame *frame);
+
+struct frame
+{
+	int refcount;
+	struct image image;
+	unsigned int bytesused;
+	/*
+	 * V4L2 sequence number, buffer flags and field layout, CLOCK_MONOTONIC
+	 * capture time in ns (0 when unknown) and time the frame entered the
+	 * pipeline.
+	 */
+	unsigned int sequence;
+	unsigned int flags;
+	unsigned int field;
+	uint64_t timestamp;
+	uint64_t dequeued;
+
+	frame_release_fn release;
+	void *priv;
+	unsigned int index;
+};
+
+static inline struct frame *frame_get(struct frame *frame)
+{
+	__sync_fetch_and_add(&frame->refcount, 1);
+	return frame;
+}
+
+static inline void frame_put(struct frame *frame)
+{
+	if (__sync_sub_and_fetch(&frame->refcount, 1) == 0)
+		frame->release(frame);
+}
+
+struct frame *frame_alloc(unsigned int fourcc, unsigned int width,
+	unsigned int height);
+void frame_pool_setup(unsigned int flags);
+struct slotpool *frame_pool(void);
+
+#endif /* __FRAME_H__ */
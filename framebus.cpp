@@ -0,0 +1,436 @@
+/*
+ * framebus.cpp -- shared memory frame bus
+ *
+ * Subscribers find a bus through an abstract UNIX socket named after it;
+ * the publisher polls the socket when it publishes and passes the memfd
+ * to new subscribers with SCM_RIGHTS. Abstract sockets vanish with the
+ * publisher, so a crashed publisher leaves nothing behind.
+ */
+
+#include <limits.h>
+#include <stddef.h>
+#include <linux/futex.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+#include "framebus.h"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC		0x0001U
+#define MFD_ALLOW_SEALING	0x0002U
+#endif
+
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS		(1024 + 9)
+#define F_SEAL_SEAL		0x0001
+#define F_SEAL_SHRINK		0x0002
+#define F_SEAL_GROW		0x0004
+#endif
+
+static int framebus_memfd(const char *name)
+{
+	return syscall(__NR_memfd_create, name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+}
+
+static void framebus_futex_wake(uint32_t *addr)
+{
+	syscall(__NR_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static int framebus_futex_wait(uint32_t *addr, uint32_t val,
+	const struct timespec *timeout)
+{
+	return syscall(__NR_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+static socklen_t framebus_address(struct sockaddr_un *addr, const char *name)
+{
+	int len;
+
+	memset(addr, 0, sizeof *addr);
+	addr->sun_family = AF_UNIX;
+	/* Abstract namespace, sun_path[0] stays 0. */
+	len = snprintf(addr->sun_path + 1, sizeof addr->sun_path - 1,
+		       "yuv2rgb-framebus-%s", name);
+	if (len > (int)sizeof addr->sun_path - 1)
+		len = sizeof addr->sun_path - 1;
+
+	return offsetof(struct sockaddr_un, sun_path) + 1 + len;
+}
+
+static volatile struct framebus_slot *framebus_slot(struct framebus *bus,
+	uint32_t frame)
+{
+	return &bus->header->slots[frame % bus->header->nslots];
+}
+
+static uint8_t *framebus_slot_data(struct framebus *bus, uint32_t frame)
+{
+	return bus->data + (frame % bus->header->nslots) * bus->header->slot_size;
+}
+
+/* -----------------------------------------------------------------------------
+ * Publisher
+ */
+
+int framebus_create(struct framebus *bus, const char *name, unsigned int nslots,
+	unsigned int slot_size)
+{
+	struct framebus_header *header;
+	struct sockaddr_un addr;
+	socklen_t addrlen;
+	unsigned int page = sysconf(_SC_PAGESIZE);
+	unsigned int data_offset;
+	int ret;
+
+	memset(bus, 0, sizeof *bus);
+	bus->fd = -1;
+	bus->sock = -1;
+	bus->publisher = true;
+
+	if (nslots < 2 || nslots > FRAMEBUS_MAX_SLOTS || slot_size == 0) {
+		printf("Invalid frame bus configuration.\n");
+		return -EINVAL;
+	}
+
+	/* Page aligned slots are also aligned for any SIMD consumer. */
+	slot_size = (slot_size + page - 1) / page * page;
+	data_offset = (sizeof *header + page - 1) / page * page;
+	bus->size = data_offset + (size_t)nslots * slot_size;
+
+	bus->fd = framebus_memfd(name);
+	if (bus->fd < 0) {
+		printf("Unable to create memfd: %s (%d).\n", strerror(errno), errno);
+		return -errno;
+	}
+
+	if (ftruncate(bus->fd, bus->size) < 0) {
+		ret = -errno;
+		printf("Unable to size frame bus: %s (%d).\n", strerror(errno), errno);
+		goto error;
+	}
+
+	/* Subscribers can rely on the size never changing under them. */
+	fcntl(bus->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+	header = (struct framebus_header *)mmap(NULL, bus->size, PROT_READ | PROT_WRITE,
+						MAP_SHARED, bus->fd, 0);
+	if (header == MAP_FAILED) {
+		ret = -errno;
+		printf("Unable to map frame bus: %s (%d).\n", strerror(errno), errno);
+		goto error;
+	}
+
+	bus->header = header;
+	bus->data = (uint8_t *)header + data_offset;
+	header->magic = FRAMEBUS_MAGIC;
+	header->version = FRAMEBUS_VERSION;
+	header->nslots = nslots;
+	header->slot_size = slot_size;
+	header->data_offset = data_offset;
+
+	bus->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (bus->sock < 0) {
+		ret = -errno;
+		goto error;
+	}
+
+	addrlen = framebus_address(&addr, name);
+	if (bind(bus->sock, (struct sockaddr *)&addr, addrlen) < 0 ||
+	    listen(bus->sock, 8) < 0) {
+		ret = -errno;
+		printf("Unable to register frame bus %s: %s (%d).\n", name,
+			strerror(errno), errno);
+		goto error;
+	}
+
+	return 0;
+
+error:
+	framebus_close(bus);
+	return ret;
+}
+
+/* Hand the memfd to subscribers that connected since the last frame. */
+static void framebus_accept(struct framebus *bus)
+{
+	int conn;
+
+	while ((conn = accept4(bus->sock, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+		char control[CMSG_SPACE(sizeof(int))];
+		uint32_t magic = FRAMEBUS_MAGIC;
+		struct iovec iov = { &magic, sizeof magic };
+		struct cmsghdr *cmsg;
+		struct msghdr msg;
+
+		memset(&msg, 0, sizeof msg);
+		memset(control, 0, sizeof control);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof control;
+
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &bus->fd, sizeof(int));
+
+		sendmsg(conn, &msg, MSG_NOSIGNAL);
+		close(conn);
+	}
+}
+
+/*
+ * Return the slot the next frame goes to. The caller writes the frame in
+ * place, for instance as the output of a converter, and then calls
+ * framebus_publish(). Subscribers reading the slot see it invalidated.
+ */
+uint8_t *framebus_begin(struct framebus *bus)
+{
+	uint32_t frame = bus->header->head;
+
+	framebus_slot(bus, frame)->seq = 2 * frame + 1;
+	__sync_synchronize();
+
+	return framebus_slot_data(bus, frame);
+}
+
+void framebus_publish(struct framebus *bus, const struct image *image,
+	unsigned int bytesused, unsigned int sequence, uint64_t timestamp)
+{
+	uint32_t frame = bus->header->head;
+	volatile struct framebus_slot *slot = framebus_slot(bus, frame);
+
+	slot->fourcc = image->fourcc;
+	slot->width = image->width;
+	slot->height = image->height;
+	slot->stride = image->stride;
+	slot->bytesused = bytesused;
+	slot->sequence = sequence;
+	slot->timestamp = timestamp;
+
+	__sync_synchronize();
+	slot->seq = 2 * frame + 2;
+	__sync_synchronize();
+	*(volatile uint32_t *)&bus->header->head = frame + 1;
+
+	framebus_futex_wake(&bus->header->head);
+	framebus_accept(bus);
+}
+
+/* Publish a copy of a frame, for sources that are not written in place. */
+int framebus_put(struct framebus *bus, const struct image *image,
+	unsigned int sequence, uint64_t timestamp)
+{
+	const struct pixfmt_info *info = pixfmt_lookup(image->fourcc);
+	struct image slot;
+	unsigned int bpl;
+	unsigned int y;
+
+	if (info == NULL || info->bpp == 0)
+		return -EINVAL;
+
+	bpl = pixfmt_bytesperline(info, image->width);
+	if (bpl * image->height > bus->header->slot_size)
+		return -ENOSPC;
+
+	slot = *image;
+	slot.stride = bpl;
+	slot.data = framebus_begin(bus);
+
+	if (image->stride == bpl) {
+		memcpy(slot.data, image->data, bpl * image->height);
+	} else {
+		for (y = 0; y < image->height; ++y)
+			memcpy(slot.data + y * bpl, image->data + y * image->stride, bpl);
+	}
+
+	framebus_publish(bus, &slot, bpl * image->height, sequence, timestamp);
+	return 0;
+}
+
+/* -----------------------------------------------------------------------------
+ * Subscriber
+ */
+
+int framebus_open(struct framebus *bus, const char *name)
+{
+	char control[CMSG_SPACE(sizeof(int))];
+	struct sockaddr_un addr;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	struct stat st;
+	uint32_t magic;
+	void *mem;
+	int ret;
+
+	memset(bus, 0, sizeof *bus);
+	bus->fd = -1;
+
+	bus->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (bus->sock < 0)
+		return -errno;
+
+	if (connect(bus->sock, (struct sockaddr *)&addr,
+		    framebus_address(&addr, name)) < 0) {
+		ret = -errno;
+		printf("No frame bus named %s: %s (%d).\n", name, strerror(errno), errno);
+		goto error;
+	}
+
+	/* The publisher answers when it publishes its next frame. */
+	memset(&msg, 0, sizeof msg);
+	iov.iov_base = &magic;
+	iov.iov_len = sizeof magic;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof control;
+
+	if (recvmsg(bus->sock, &msg, MSG_CMSG_CLOEXEC) < 0) {
+		ret = -errno;
+		goto error;
+	}
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (magic != FRAMEBUS_MAGIC || cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS) {
+		ret = -EPROTO;
+		goto error;
+	}
+	memcpy(&bus->fd, CMSG_DATA(cmsg), sizeof(int));
+
+	close(bus->sock);
+	bus->sock = -1;
+
+	if (fstat(bus->fd, &st) < 0) {
+		ret = -errno;
+		goto error;
+	}
+	bus->size = st.st_size;
+
+	/* Subscribers only ever read. */
+	mem = mmap(NULL, bus->size, PROT_READ, MAP_SHARED, bus->fd, 0);
+	if (mem == MAP_FAILED) {
+		ret = -errno;
+		printf("Unable to map frame bus: %s (%d).\n", strerror(errno), errno);
+		goto error;
+	}
+
+	bus->header = (struct framebus_header *)mem;
+	if (bus->size < sizeof *bus->header ||
+	    bus->header->magic != FRAMEBUS_MAGIC ||
+	    bus->header->version != FRAMEBUS_VERSION ||
+	    bus->header->data_offset + (size_t)bus->header->nslots *
+	    bus->header->slot_size > bus->size) {
+		printf("Frame bus %s is not compatible.\n", name);
+		ret = -EPROTO;
+		goto error;
+	}
+
+	bus->data = (uint8_t *)mem + bus->header->data_offset;
+	/* Start with the next frame published. */
+	bus->next = *(volatile uint32_t *)&bus->header->head;
+	return 0;
+
+error:
+	framebus_close(bus);
+	return ret;
+}
+
+/*
+ * Wait for the next frame, at most timeout_ms (forever if negative). The
+ * frame is read in place and must be checked with framebus_done() once
+ * the caller is finished with it. Frames overwritten before they could be
+ * read are skipped and added to bus->dropped.
+ */
+int framebus_wait(struct framebus *bus, struct framebus_frame *frame,
+	int timeout_ms)
+{
+	unsigned int nslots = bus->header->nslots;
+	struct timespec timeout;
+
+	timeout.tv_sec = timeout_ms / 1000;
+	timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+
+	while (1) {
+		uint32_t head = *(volatile uint32_t *)&bus->header->head;
+		volatile struct framebus_slot *slot;
+		uint32_t seq;
+
+		__sync_synchronize();
+
+		if (head == bus->next) {
+			if (framebus_futex_wait(&bus->header->head, head,
+						timeout_ms < 0 ? NULL : &timeout) < 0 &&
+			    errno == ETIMEDOUT)
+				return -ETIMEDOUT;
+			continue;
+		}
+
+		/* More than a ring behind, restart at the oldest frame kept. */
+		if (head - bus->next > nslots) {
+			bus->dropped += head - bus->next - nslots;
+			bus->next = head - nslots;
+		}
+
+		slot = framebus_slot(bus, bus->next);
+		seq = slot->seq;
+		__sync_synchronize();
+
+		frame->number = bus->next;
+		frame->image.fourcc = slot->fourcc;
+		frame->image.width = slot->width;
+		frame->image.height = slot->height;
+		frame->image.stride = slot->stride;
+		frame->image.data = framebus_slot_data(bus, bus->next);
+		frame->bytesused = slot->bytesused;
+		frame->sequence = slot->sequence;
+		frame->timestamp = slot->timestamp;
+
+		__sync_synchronize();
+		bus->next++;
+
+		/* Rewritten before or while the metadata was read. */
+		if (seq != 2 * frame->number + 2 || slot->seq != seq ||
+		    frame->bytesused > bus->header->slot_size) {
+			bus->dropped++;
+			continue;
+		}
+
+		return 0;
+	}
+}
+
+/*
+ * Return true if the frame stayed intact while it was used. A frame the
+ * publisher started to overwrite in the meantime is counted as dropped.
+ */
+bool framebus_done(struct framebus *bus, const struct framebus_frame *frame)
+{
+	__sync_synchronize();
+
+	if (framebus_slot(bus, frame->number)->seq == 2 * frame->number + 2)
+		return true;
+
+	bus->dropped++;
+	return false;
+}
+
+void framebus_close(struct framebus *bus)
+{
+	if (bus->header)
+		munmap(bus->header, bus->size);
+	if (bus->sock >= 0)
+		close(bus->sock);
+	if (bus->fd >= 0)
+		close(bus->fd);
+
+	bus->header = NULL;
+	bus->data = NULL;
+	bus->sock = -1;
+	bus->fd = -1;
+}
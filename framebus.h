@@ -0,0 +1,99 @@
+/*
+ * framebus.h -- shared memory frame bus
+ *
+ * A publisher exports frames into a ring of slots in a sealed memfd. Any
+ * number of processes on the same machine subscribe by name, receive the
+ * memfd over a UNIX socket and map it read-only, then read frames in place
+ * with no copy at all.
+ *
+ * The publisher never waits for subscribers. Every slot is guarded by a
+ * sequence counter (a seqlock): a subscriber that falls more than a ring
+ * behind, or whose slot is rewritten while it is still reading, sees the
+ * counter move and reports the frames as dropped. Subscribers sleep on a
+ * futex on the ring head.
+ *
+ * One bus carries one stream; raw YUYV and converted RGB go on two buses.
+ */
+
+#ifndef __FRAMEBUS_H__
+#define __FRAMEBUS_H__
+
+#include "convert.h"
+
+#define FRAMEBUS_MAGIC		0x53554246	/* "FBUS" */
+#define FRAMEBUS_VERSION	1
+#define FRAMEBUS_MAX_SLOTS	32
+
+/* Per-slot metadata, one cache line each. */
+struct framebus_slot
+{
+	/* 2 * frame + 1 while the frame is written, 2 * frame + 2 once done. */
+	uint32_t seq;
+	uint32_t fourcc;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+	uint32_t bytesused;
+	/* V4L2 buffer sequence number. */
+	uint32_t sequence;
+	uint32_t reserved;
+	/* Capture time, CLOCK_MONOTONIC nanoseconds. */
+	uint64_t timestamp;
+	uint32_t pad[6];
+};
+
+/* Start of the shared memory, followed by the slot table and the data. */
+struct framebus_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nslots;
+	uint32_t slot_size;
+	uint32_t data_offset;
+	/* Number of frames published, the futex subscribers sleep on. */
+	uint32_t head;
+	uint32_t pad[10];
+	struct framebus_slot slots[FRAMEBUS_MAX_SLOTS];
+};
+
+struct framebus_frame
+{
+	/* Frame data in the shared memory, valid until framebus_done(). */
+	struct image image;
+	unsigned int bytesused;
+	unsigned int sequence;
+	uint64_t timestamp;
+	/* Frame number on the bus. */
+	uint32_t number;
+};
+
+struct framebus
+{
+	int fd;
+	int sock;
+	bool publisher;
+	struct framebus_header *header;
+	uint8_t *data;
+	size_t size;
+
+	/* Subscriber: next frame number to read and frames missed so far. */
+	uint32_t next;
+	unsigned int dropped;
+};
+
+int framebus_create(struct framebus *bus, const char *name, unsigned int nslots,
+	unsigned int slot_size);
+uint8_t *framebus_begin(struct framebus *bus);
+void framebus_publish(struct framebus *bus, const struct image *image,
+	unsigned int bytesused, unsigned int sequence, uint64_t timestamp);
+int framebus_put(struct framebus *bus, const struct image *image,
+	unsigned int sequence, uint64_t timestamp);
+
+int framebus_open(struct framebus *bus, const char *name);
+int framebus_wait(struct framebus *bus, struct framebus_frame *frame,
+	int timeout_ms);
+bool framebus_done(struct framebus *bus, const struct framebus_frame *frame);
+
+void framebus_close(struct framebus *bus);
+
+#endif /* __FRAMEBUS_H__ */
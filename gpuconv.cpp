@@ -0,0 +1,617 @@
+/*
+ * gpuconv.cpp -- headless GPU conversion with asynchronous readback
+ */
+
+#include "gpuconv.h"
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA	0x31DD
+#endif
+
+typedef EGLDisplay (*gpuconv_platform_display_fn)(EGLenum platform,
+	void *native_display, const EGLint *attrib_list);
+
+static const char *gpuconv_vertex_shader =
+	"attribute vec4 a_position;\n"
+	"attribute vec2 a_texCoord;\n"
+	"varying vec2 v_texCoord;\n"
+	"void main()\n"
+	"{\n"
+	"	gl_Position = a_position;\n"
+	"	v_texCoord = a_texCoord;\n"
+	"}\n";
+
+static uint64_t gpuconv_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool gpuconv_has_extension(const char *list, const char *name)
+{
+	size_t len = strlen(name);
+	const char *p = list;
+
+	while (p && (p = strstr(p, name)) != NULL) {
+		if ((p == list || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0'))
+			return true;
+		p += len;
+	}
+
+	return false;
+}
+
+/* -----------------------------------------------------------------------------
+ * EGL
+ */
+
+static int gpuconv_init_egl(struct gpuconv *gc)
+{
+	static const EGLint context_attribs[] = {
+		EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE
+	};
+	static const EGLint pbuffer_attribs[] = {
+		EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE
+	};
+	EGLint config_attribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+		EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+		EGL_NONE
+	};
+	const char *extensions;
+	EGLint major, minor;
+	EGLint count;
+
+	/* Mesa runs without any window system on its surfaceless platform. */
+	extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	if (gpuconv_has_extension(extensions, "EGL_MESA_platform_surfaceless")) {
+		gpuconv_platform_display_fn get_display = (gpuconv_platform_display_fn)
+			eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+		if (get_display)
+			gc->display = get_display(EGL_PLATFORM_SURFACELESS_MESA,
+						  EGL_DEFAULT_DISPLAY, NULL);
+	}
+	if (gc->display == EGL_NO_DISPLAY)
+		gc->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	if (gc->display == EGL_NO_DISPLAY || !eglInitialize(gc->display, &major, &minor)) {
+		printf("Unable to initialize EGL (0x%04x).\n", eglGetError());
+		gc->display = EGL_NO_DISPLAY;
+		return -ENODEV;
+	}
+
+	extensions = eglQueryString(gc->display, EGL_EXTENSIONS);
+	gc->surfaceless = gpuconv_has_extension(extensions, "EGL_KHR_surfaceless_context");
+	if (gc->surfaceless)
+		config_attribs[1] = 0;
+
+	if (gpuconv_has_extension(extensions, "EGL_KHR_fence_sync")) {
+		gc->create_sync = (PFNEGLCREATESYNCKHRPROC)eglGetProcAddress("eglCreateSyncKHR");
+		gc->client_wait_sync = (PFNEGLCLIENTWAITSYNCKHRPROC)eglGetProcAddress("eglClientWaitSyncKHR");
+		gc->destroy_sync = (PFNEGLDESTROYSYNCKHRPROC)eglGetProcAddress("eglDestroySyncKHR");
+		if (!gc->create_sync || !gc->client_wait_sync || !gc->destroy_sync)
+			gc->create_sync = NULL;
+	}
+
+	eglBindAPI(EGL_OPENGL_ES_API);
+
+	if (!eglChooseConfig(gc->display, config_attribs, &gc->config, 1, &count) ||
+	    count == 0) {
+		printf("No EGL configuration for OpenGL ES 2.0 (0x%04x).\n", eglGetError());
+		return -ENODEV;
+	}
+
+	gc->context = eglCreateContext(gc->display, gc->config, EGL_NO_CONTEXT,
+				       context_attribs);
+	if (gc->context == EGL_NO_CONTEXT) {
+		printf("Unable to create an EGL context (0x%04x).\n", eglGetError());
+		return -ENODEV;
+	}
+
+	/* Everything is drawn into framebuffers, the surface is never used. */
+	if (!gc->surfaceless) {
+		gc->surface = eglCreatePbufferSurface(gc->display, gc->config,
+						      pbuffer_attribs);
+		if (gc->surface == EGL_NO_SURFACE) {
+			printf("Unable to create a pbuffer (0x%04x).\n", eglGetError());
+			return -ENODEV;
+		}
+	}
+
+	return 0;
+}
+
+void gpuconv_acquire(struct gpuconv *gc)
+{
+	eglMakeCurrent(gc->display, gc->surface, gc->surface, gc->context);
+}
+
+void gpuconv_release(struct gpuconv *gc)
+{
+	eglMakeCurrent(gc->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+/* -----------------------------------------------------------------------------
+ * GL
+ */
+
+static GLuint gpuconv_compile(GLenum type, const char *source)
+{
+	GLuint shader;
+	GLint compiled;
+
+	shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source, NULL);
+	glCompileShader(shader);
+
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+	if (!compiled) {
+		char log[1024];
+
+		glGetShaderInfoLog(shader, sizeof log, NULL, log);
+		printf("Failed to compile the %s shader: %s\n",
+			type == GL_VERTEX_SHADER ? "vertex" : "fragment", log);
+		glDeleteShader(shader);
+		return 0;
+	}
+
+	return shader;
+}
+
+/*
+ * The conversion of yuv2rgb.frag, writing the output byte order straight
+ * so that glReadPixels() in GL_RGBA gives the frame as is; texel_rg for
+ * DMABUF imports.
+ */
+static int gpuconv_init_program(struct gpuconv *gc, struct gpuconv_program *prog,
+	bool texel_rg)
+{
+	char define[80];
+	char *source;
+	FILE *file;
+	long size;
+	GLint linked;
+
+	/* Tiles are at most GL_MAX_TEXTURE_SIZE wide, any of them may be the frame. */
+	snprintf(define, sizeof define, "#define %s\n%s%s",
+		 gc->fourcc == V4L2_PIX_FMT_BGR32 ? "OUTPUT_BGRX" : "OUTPUT_XRGB",
+		 gc->width > 1024 ? "#define HIGHP\n" : "",
+		 texel_rg ? "#define TEXEL_RG\n" : "");
+
+	file = fopen(gc->shader, "rb");
+	if (file == NULL) {
+		printf("Unable to open %s: %s (%d).\n", gc->shader, strerror(errno), errno);
+		return -errno;
+	}
+
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	rewind(file);
+
+	source = (char *)malloc(strlen(define) + size + 1);
+	if (source == NULL) {
+		fclose(file);
+		return -ENOMEM;
+	}
+
+	strcpy(source, define);
+	if (fread(source + strlen(define), 1, size, file) != (size_t)size) {
+		printf("Unable to read %s.\n", gc->shader);
+		free(source);
+		fclose(file);
+		return -EIO;
+	}
+	source[strlen(define) + size] = '\0';
+	fclose(file);
+
+	prog->vert = gpuconv_compile(GL_VERTEX_SHADER, gpuconv_vertex_shader);
+	prog->frag = gpuconv_compile(GL_FRAGMENT_SHADER, source);
+	free(source);
+	if (prog->vert == 0 || prog->frag == 0)
+		return -EINVAL;
+
+	prog->program = glCreateProgram();
+	glAttachShader(prog->program, prog->vert);
+	glAttachShader(prog->program, prog->frag);
+	glBindAttribLocation(prog->program, 0, "a_position");
+	glBindAttribLocation(prog->program, 1, "a_texCoord");
+	glLinkProgram(prog->program);
+
+	glGetProgramiv(prog->program, GL_LINK_STATUS, &linked);
+	if (!linked) {
+		char log[1024];
+
+		glGetProgramInfoLog(prog->program, sizeof log, NULL, log);
+		printf("Failed to link the conversion program: %s\n", log);
+		return -EINVAL;
+	}
+
+	glUseProgram(prog->program);
+	glUniform1i(glGetUniformLocation(prog->program, "s_baseMap"), 0);
+	prog->texture_width_loc = glGetUniformLocation(prog->program, "texture_width");
+	prog->texel_width_loc = glGetUniformLocation(prog->program, "texel_width");
+	prog->texel_height_loc = glGetUniformLocation(prog->program, "texel_height");
+
+	return 0;
+}
+
+static void gpuconv_cleanup_program(struct gpuconv_program *prog)
+{
+	if (prog->program)
+		glDeleteProgram(prog->program);
+	if (prog->vert)
+		glDeleteShader(prog->vert);
+	if (prog->frag)
+		glDeleteShader(prog->frag);
+	memset(prog, 0, sizeof *prog);
+}
+
+static int gpuconv_init_slot(struct gpuconv *gc, struct gpuconv_slot *slot)
+{
+	glGenTextures(1, &slot->texture);
+	glBindTexture(GL_TEXTURE_2D, slot->texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, gc->width, gc->height, 0, GL_RGBA,
+		     GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	glGenFramebuffers(1, &slot->fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, slot->fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+			       slot->texture, 0);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		printf("Render target of %ux%u is incomplete.\n", gc->width, gc->height);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * Convert src_fourcc frames of width x height into fourcc, BGR32 or
+ * RGB32, through nslots render targets with the fragment shader in the
+ * file shader. The context is released on return.
+ */
+int gpuconv_init(struct gpuconv *gc, unsigned int src_fourcc,
+	unsigned int fourcc, unsigned int width, unsigned int height,
+	unsigned int nslots, const char *shader)
+{
+	unsigned int i;
+	int ret;
+
+	memset(gc, 0, sizeof *gc);
+	gc->display = EGL_NO_DISPLAY;
+	gc->context = EGL_NO_CONTEXT;
+	gc->surface = EGL_NO_SURFACE;
+	gc->src_fourcc = src_fourcc;
+	gc->fourcc = fourcc;
+	gc->width = width;
+	gc->height = height;
+	gc->nslots = nslots < 1 ? 1 : nslots > GPUCONV_MAX_SLOTS ? GPUCONV_MAX_SLOTS : nslots;
+
+	/* Only packed 4:2:2 YUYV goes up as a luminance/alpha texture. */
+	if (src_fourcc != V4L2_PIX_FMT_YUYV ||
+	    (fourcc != V4L2_PIX_FMT_BGR32 && fourcc != V4L2_PIX_FMT_RGB32)) {
+		printf("No GPU conversion from %s to %s.\n",
+			v4l2_format_name(src_fourcc), v4l2_format_name(fourcc));
+		return -EINVAL;
+	}
+
+	ret = gpuconv_init_egl(gc);
+	if (ret < 0)
+		goto error;
+
+	gc->shader = strdup(shader);
+	if (gc->shader == NULL) {
+		ret = -ENOMEM;
+		goto error;
+	}
+
+	gpuconv_acquire(gc);
+
+	ret = gpuconv_init_program(gc, &gc->upload, false);
+	if (ret < 0)
+		goto error;
+
+	gc->frame = new CTiledTexture();
+	if (!gc->frame->Init(width, height, GL_LUMINANCE_ALPHA, 2, 0)) {
+		printf("Unable to create the %ux%u frame textures.\n", width, height);
+		ret = -ENOMEM;
+		goto error;
+	}
+
+	for (i = 0; i < gc->nslots; ++i) {
+		ret = gpuconv_init_slot(gc, &gc->slots[i]);
+		if (ret < 0)
+			goto error;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+	printf("GPU conversion on %s, %s, %u render targets%s\n",
+		(const char *)glGetString(GL_RENDERER),
+		gc->surfaceless ? "surfaceless" : "pbuffer", gc->nslots,
+		gc->create_sync ? ", fenced" : "");
+
+	gpuconv_release(gc);
+	return 0;
+
+error:
+	gpuconv_cleanup(gc);
+	return ret;
+}
+
+/* -----------------------------------------------------------------------------
+ * Conversion
+ */
+
+/* A texture at its place in the frame, the top line at the bottom of the target. */
+static void gpuconv_draw_texture(struct gpuconv *gc, const struct gpuconv_program *prog,
+	unsigned int x, unsigned int y, unsigned int width, unsigned int height,
+	GLuint texture)
+{
+	float x0 = -1.0f + 2.0f * x / gc->width;
+	float x1 = -1.0f + 2.0f * (x + width) / gc->width;
+	float y0 = -1.0f + 2.0f * y / gc->height;
+	float y1 = -1.0f + 2.0f * (y + height) / gc->height;
+	const GLfloat positions[] = { x0, y0, x0, y1, x1, y0, x1, y1 };
+	static const GLfloat coords[] = { 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f, 1.0f };
+
+	glUniform1f(prog->texture_width_loc, (float)width);
+	glUniform1f(prog->texel_width_loc, 1.0f / width);
+	glUniform1f(prog->texel_height_loc, 1.0f / height);
+
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, positions);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, coords);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+static void gpuconv_begin_draw(struct gpuconv *gc, struct gpuconv_slot *slot,
+	const struct gpuconv_program *prog)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, slot->fbo);
+	glViewport(0, 0, gc->width, gc->height);
+	glUseProgram(prog->program);
+	glActiveTexture(GL_TEXTURE0);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+}
+
+static void gpuconv_end_draw(struct gpuconv *gc, struct gpuconv_slot *slot,
+	const struct frame *frame)
+{
+	if (gc->create_sync)
+		slot->sync = gc->create_sync(gc->display, EGL_SYNC_FENCE_KHR, NULL);
+	glFlush();
+
+	slot->sequence = frame->sequence;
+	slot->flags = frame->flags;
+	slot->field = frame->field;
+	slot->timestamp = frame->timestamp;
+	slot->dequeued = frame->dequeued;
+
+	gc->pending++;
+	gc->frames++;
+}
+
+/*
+ * Upload frame and draw it into the next render target. -EBUSY when all
+ * of them still wait for gpuconv_readback().
+ */
+int gpuconv_submit(struct gpuconv *gc, const struct frame *frame)
+{
+	const struct image *src = &frame->image;
+	struct gpuconv_slot *slot;
+	uint64_t start, uploaded;
+	unsigned int i;
+
+	if (gc->pending == gc->nslots)
+		return -EBUSY;
+
+	if (src->fourcc != gc->src_fourcc || src->width != gc->width ||
+	    src->height != gc->height)
+		return -EINVAL;
+
+	slot = &gc->slots[(gc->first + gc->pending) % gc->nslots];
+
+	start = gpuconv_now();
+	gc->frame->Upload(src->data, src->stride, 0, 0, src->width, src->height);
+	uploaded = gpuconv_now();
+
+	gpuconv_begin_draw(gc, slot, &gc->upload);
+	for (i = 0; i < gc->frame->GetTileCount(); ++i) {
+		const CTiledTexture::STile &tile = gc->frame->GetTile(i);
+
+		gpuconv_draw_texture(gc, &gc->upload, tile.uiX, tile.uiY,
+				     tile.uiWidth, tile.uiHeight, tile.uiTexture);
+	}
+	gpuconv_end_draw(gc, slot, frame);
+
+	gc->upload_ns += uploaded - start;
+	gc->render_ns += gpuconv_now() - uploaded;
+	return 0;
+}
+
+/*
+ * Prepare the import of nbufs capture buffers, stride bytes per line, to
+ * be drawn without upload by gpuconv_submit_buffer(). Needs the context
+ * acquired. -ENOTSUP when the driver cannot import them, frames are then
+ * to be given to gpuconv_submit().
+ */
+int gpuconv_init_dmabuf(struct gpuconv *gc, unsigned int stride,
+	unsigned int nbufs)
+{
+	int ret;
+
+	ret = dmatex_init(&gc->dmatex, gc->display, gc->src_fourcc, gc->width,
+			  gc->height, stride, nbufs);
+	if (ret < 0) {
+		dmatex_cleanup(&gc->dmatex);
+		return ret;
+	}
+
+	ret = gpuconv_init_program(gc, &gc->dmabuf, true);
+	if (ret < 0) {
+		gpuconv_cleanup_program(&gc->dmabuf);
+		dmatex_cleanup(&gc->dmatex);
+		return ret;
+	}
+
+	gc->zero_copy = true;
+	return 0;
+}
+
+/*
+ * Draw imported buffer index, holding frame, into the next render target.
+ * The buffer is read by the GPU until dmatex_wait() on it returns.
+ */
+int gpuconv_submit_buffer(struct gpuconv *gc, const struct frame *frame,
+	unsigned int index)
+{
+	struct gpuconv_slot *slot;
+	uint64_t start;
+
+	if (gc->pending == gc->nslots)
+		return -EBUSY;
+
+	if (!gc->zero_copy || index >= gc->dmatex.nbufs ||
+	    dmatex_texture(&gc->dmatex, index) == 0)
+		return -EINVAL;
+
+	slot = &gc->slots[(gc->first + gc->pending) % gc->nslots];
+
+	start = gpuconv_now();
+	gpuconv_begin_draw(gc, slot, &gc->dmabuf);
+	gpuconv_draw_texture(gc, &gc->dmabuf, 0, 0, gc->width, gc->height,
+			     dmatex_texture(&gc->dmatex, index));
+	dmatex_fence(&gc->dmatex, index);
+	gpuconv_end_draw(gc, slot, frame);
+
+	gc->render_ns += gpuconv_now() - start;
+	gc->zero_copy_frames++;
+	return 0;
+}
+
+/*
+ * Read the oldest frame drawn into out, a packed frame of the output
+ * format and size, along with its metadata. -EAGAIN when none is drawn.
+ */
+int gpuconv_readback(struct gpuconv *gc, struct frame *out)
+{
+	struct gpuconv_slot *slot;
+	uint64_t start, elapsed;
+
+	if (gc->pending == 0)
+		return -EAGAIN;
+
+	if (out->image.stride != gc->width * 4)
+		return -EINVAL;
+
+	slot = &gc->slots[gc->first];
+	gc->first = (gc->first + 1) % gc->nslots;
+	gc->pending--;
+
+	/* Time spent waiting for the GPU, not copying. */
+	if (slot->sync != EGL_NO_SYNC_KHR) {
+		start = gpuconv_now();
+		gc->client_wait_sync(gc->display, slot->sync,
+				     EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, EGL_FOREVER_KHR);
+		gc->wait_ns += gpuconv_now() - start;
+		gc->destroy_sync(gc->display, slot->sync);
+		slot->sync = EGL_NO_SYNC_KHR;
+	}
+
+	start = gpuconv_now();
+	glBindFramebuffer(GL_FRAMEBUFFER, slot->fbo);
+	glReadPixels(0, 0, gc->width, gc->height, GL_RGBA, GL_UNSIGNED_BYTE,
+		     out->image.data);
+	elapsed = gpuconv_now() - start;
+
+	gc->readback_ns += elapsed;
+	if (elapsed > gc->readback_max_ns)
+		gc->readback_max_ns = elapsed;
+	gc->readbacks++;
+
+	out->sequence = slot->sequence;
+	out->flags = slot->flags;
+	out->field = slot->field;
+	out->timestamp = slot->timestamp;
+	out->dequeued = slot->dequeued;
+	return 0;
+}
+
+void gpuconv_print(const struct gpuconv *gc, const char *name)
+{
+	double pixels = (double)gc->width * gc->height;
+
+	if (gc->frames == 0)
+		return;
+
+	printf("%s: %u frames drawn, %u read back %u frames later\n", name,
+		gc->frames, gc->readbacks, gc->nslots - 1);
+	if (gc->zero_copy_frames)
+		printf("%s: %u frames drawn from DMABUFs without upload\n", name,
+			gc->zero_copy_frames);
+	printf("%s: upload %.1f us/frame, draw %.1f us/frame\n", name,
+		gc->upload_ns / 1e3 / gc->frames, gc->render_ns / 1e3 / gc->frames);
+
+	if (gc->readbacks == 0)
+		return;
+
+	printf("%s: readback %.1f us/frame (max %.1f), %.2f ns/pixel", name,
+		gc->readback_ns / 1e3 / gc->readbacks, gc->readback_max_ns / 1e3,
+		gc->readback_ns / pixels / gc->readbacks);
+	if (gc->create_sync)
+		printf(", %.1f us/frame waiting for the GPU",
+			gc->wait_ns / 1e3 / gc->readbacks);
+	printf("\n");
+}
+
+void gpuconv_cleanup(struct gpuconv *gc)
+{
+	unsigned int i;
+
+	if (gc->display == EGL_NO_DISPLAY)
+		return;
+
+	if (gc->context != EGL_NO_CONTEXT) {
+		gpuconv_acquire(gc);
+
+		for (i = 0; i < gc->nslots; ++i) {
+			struct gpuconv_slot *slot = &gc->slots[i];
+
+			if (slot->sync != EGL_NO_SYNC_KHR)
+				gc->destroy_sync(gc->display, slot->sync);
+			if (slot->fbo)
+				glDeleteFramebuffers(1, &slot->fbo);
+			if (slot->texture)
+				glDeleteTextures(1, &slot->texture);
+		}
+
+		/* The textures go while the context is still current. */
+		delete gc->frame;
+		gc->frame = NULL;
+
+		if (gc->zero_copy)
+			dmatex_cleanup(&gc->dmatex);
+		gpuconv_cleanup_program(&gc->upload);
+		gpuconv_cleanup_program(&gc->dmabuf);
+
+		gpuconv_release(gc);
+		eglDestroyContext(gc->display, gc->context);
+	}
+
+	if (gc->surface != EGL_NO_SURFACE)
+		eglDestroySurface(gc->display, gc->surface);
+	eglTerminate(gc->display);
+	gc->display = EGL_NO_DISPLAY;
+	free(gc->shader);
+	gc->shader = NULL;
+}
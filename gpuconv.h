@@ -0,0 +1,119 @@
+/*
+ * gpuconv.h -- headless GPU conversion with asynchronous readback
+ *
+ * Runs the yuv2rgb.frag conversion without a display: the EGL context
+ * has no window, only a 1x1 pbuffer, or no surface at all where
+ * EGL_KHR_surfaceless_context is available, such as on Mesa's
+ * surfaceless platform, which also runs on the llvmpipe software
+ * rasterizer. Frames are uploaded to a tiled texture and drawn into one
+ * of a ring of framebuffers of the frame size.
+ *
+ * Readback lags the rendering by the depth of the ring less one frame:
+ * with two or three slots, frame N is read while N+1 (and N+2) render,
+ * so glReadPixels() does not stall the GPU on the frame just drawn. An
+ * EGL_KHR_fence_sync fence, where available, tells how long the CPU had
+ * to wait for the GPU apart from the copy itself.
+ *
+ * Capture buffers exported as DMABUFs can be drawn in place instead of
+ * uploaded, see dmatex.h: gpuconv_init_dmabuf() tells whether the driver
+ * can, the buffers are then imported into dmatex and drawn with
+ * gpuconv_submit_buffer().
+ *
+ * The EGL context belongs to whichever thread made it current last:
+ * gpuconv_acquire() and gpuconv_release() bracket the calls, so the
+ * converter can move between the threads of a pool.
+ */
+
+#ifndef __GPUCONV_H__
+#define __GPUCONV_H__
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+
+#include "dmatex.h"
+#include "frame.h"
+#include "tiledtex.h"
+
+#define GPUCONV_MAX_SLOTS	3
+
+struct gpuconv_slot
+{
+	GLuint fbo;
+	GLuint texture;
+	EGLSyncKHR sync;
+	/* Metadata of the frame drawn in the slot. */
+	unsigned int sequence;
+	unsigned int flags;
+	unsigned int field;
+	uint64_t timestamp;
+	uint64_t dequeued;
+};
+
+struct gpuconv_program
+{
+	GLuint vert;
+	GLuint frag;
+	GLuint program;
+	GLint texture_width_loc;
+	GLint texel_width_loc;
+	GLint texel_height_loc;
+};
+
+struct gpuconv
+{
+	EGLDisplay display;
+	EGLConfig config;
+	EGLContext context;
+	EGLSurface surface;
+	bool surfaceless;
+	PFNEGLCREATESYNCKHRPROC create_sync;
+	PFNEGLCLIENTWAITSYNCKHRPROC client_wait_sync;
+	PFNEGLDESTROYSYNCKHRPROC destroy_sync;
+
+	unsigned int src_fourcc;
+	unsigned int fourcc;
+	unsigned int width;
+	unsigned int height;
+
+	char *shader;
+	CTiledTexture *frame;
+	struct gpuconv_program upload;
+
+	/* Capture buffers sampled in place, see gpuconv_init_dmabuf(). */
+	bool zero_copy;
+	struct dmatex dmatex;
+	struct gpuconv_program dmabuf;
+
+	/* Slots first to last - 1 wait for readback, first is the oldest. */
+	struct gpuconv_slot slots[GPUCONV_MAX_SLOTS];
+	unsigned int nslots;
+	unsigned int first;
+	unsigned int pending;
+
+	/* Statistics. */
+	unsigned int frames;
+	unsigned int zero_copy_frames;
+	unsigned int readbacks;
+	uint64_t upload_ns;
+	uint64_t render_ns;
+	uint64_t wait_ns;
+	uint64_t readback_ns;
+	uint64_t readback_max_ns;
+};
+
+int gpuconv_init(struct gpuconv *gc, unsigned int src_fourcc,
+	unsigned int fourcc, unsigned int width, unsigned int height,
+	unsigned int nslots, const char *shader);
+void gpuconv_acquire(struct gpuconv *gc);
+void gpuconv_release(struct gpuconv *gc);
+int gpuconv_init_dmabuf(struct gpuconv *gc, unsigned int stride,
+	unsigned int nbufs);
+int gpuconv_submit(struct gpuconv *gc, const struct frame *frame);
+int gpuconv_submit_buffer(struct gpuconv *gc, const struct frame *frame,
+	unsigned int index);
+int gpuconv_readback(struct gpuconv *gc, struct frame *out);
+void gpuconv_print(const struct gpuconv *gc, const char *name);
+void gpuconv_cleanup(struct gpuconv *gc);
+
+#endif /* __GPUCONV_H__ */
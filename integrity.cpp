@@ -0,0 +1,332 @@
+/*
+ * integrity.cpp -- per frame capture integrity checks
+ */
+
+#include <pthread.h>
+
+#include "integrity.h"
+#include "pixfmt.h"
+#include "simd.h"
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_ARM		1
+#elif (defined(__x86_64__) || defined(__i386__)) && \
+      (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#include <nmmintrin.h>
+#define CRC32C_SSE42		1
+#endif
+
+/* -----------------------------------------------------------------------------
+ * CRC32C (Castagnoli), reflected, as computed by the instructions
+ */
+
+#if defined(__aarch64__) || defined(__x86_64__)
+typedef uint64_t crc32c_word;
+#else
+typedef uint32_t crc32c_word;
+#endif
+
+#if defined(CRC32C_ARM)
+#define crc32c_byte(crc, p)	__crc32cb(crc, *(p))
+#if defined(__aarch64__)
+#define crc32c_word(crc, p)	__crc32cd(crc, *(const crc32c_word *)(p))
+#else
+#define crc32c_word(crc, p)	__crc32cw(crc, *(const crc32c_word *)(p))
+#endif
+#elif defined(CRC32C_SSE42)
+#define crc32c_byte(crc, p)	_mm_crc32_u8(crc, *(p))
+#if defined(__x86_64__)
+#define crc32c_word(crc, p)	(uint32_t)_mm_crc32_u64(crc, *(const crc32c_word *)(p))
+#else
+#define crc32c_word(crc, p)	_mm_crc32_u32(crc, *(const crc32c_word *)(p))
+#endif
+#endif
+
+#define CRC32C_POLY		0x82f63b78
+/*
+ * The instruction has a latency of three cycles but a throughput of one,
+ * so three interleaved streams run three times as fast; their CRCs are
+ * combined by shifting them over the length of the following streams.
+ */
+#define CRC32C_LONG		8192
+#define CRC32C_SHORT		256
+
+static uint32_t crc32c_table[256];
+static uint32_t crc32c_long[4][256];
+static uint32_t crc32c_short[4][256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static uint32_t gf2_matrix_times(const uint32_t *mat, uint32_t vec)
+{
+	uint32_t sum = 0;
+
+	for (; vec; vec >>= 1, mat++) {
+		if (vec & 1)
+			sum ^= *mat;
+	}
+
+	return sum;
+}
+
+static void gf2_matrix_square(uint32_t *square, const uint32_t *mat)
+{
+	unsigned int n;
+
+	for (n = 0; n < 32; n++)
+		square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+/* Operator appending len zero bytes to a CRC, len a power of two. */
+static void crc32c_zeros_op(uint32_t *even, size_t len)
+{
+	uint32_t odd[32];
+	uint32_t row = 1;
+	unsigned int n;
+
+	odd[0] = CRC32C_POLY;
+	for (n = 1; n < 32; n++) {
+		odd[n] = row;
+		row <<= 1;
+	}
+
+	gf2_matrix_square(even, odd);
+	gf2_matrix_square(odd, even);
+
+	do {
+		gf2_matrix_square(even, odd);
+		len >>= 1;
+		if (len == 0)
+			return;
+		gf2_matrix_square(odd, even);
+		len >>= 1;
+	} while (len);
+
+	for (n = 0; n < 32; n++)
+		even[n] = odd[n];
+}
+
+static void crc32c_zeros(uint32_t zeros[][256], size_t len)
+{
+	uint32_t op[32];
+	unsigned int n;
+
+	crc32c_zeros_op(op, len);
+
+	for (n = 0; n < 256; n++) {
+		zeros[0][n] = gf2_matrix_times(op, n);
+		zeros[1][n] = gf2_matrix_times(op, n << 8);
+		zeros[2][n] = gf2_matrix_times(op, n << 16);
+		zeros[3][n] = gf2_matrix_times(op, n << 24);
+	}
+}
+
+static inline uint32_t crc32c_shift(uint32_t zeros[][256], uint32_t crc)
+{
+	return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^
+	       zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+
+static void crc32c_init_tables(void)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < 256; ++i) {
+		uint32_t crc = i;
+
+		for (j = 0; j < 8; ++j)
+			crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		crc32c_table[i] = crc;
+	}
+
+	crc32c_zeros(crc32c_long, CRC32C_LONG);
+	crc32c_zeros(crc32c_short, CRC32C_SHORT);
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, size_t size)
+{
+	while (size--)
+		crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+#if defined(CRC32C_ARM) || defined(CRC32C_SSE42)
+#if defined(CRC32C_SSE42)
+__attribute__((target("sse4.2")))
+#endif
+static uint32_t crc32c_hw(uint32_t crc0, const uint8_t *p, size_t size)
+{
+	const uint8_t *end;
+
+	for (; size && ((uintptr_t)p & (sizeof(crc32c_word) - 1)); --size, ++p)
+		crc0 = crc32c_byte(crc0, p);
+
+	for (; size >= CRC32C_LONG * 3; size -= CRC32C_LONG * 3) {
+		uint32_t crc1 = 0, crc2 = 0;
+
+		for (end = p + CRC32C_LONG; p < end; p += sizeof(crc32c_word)) {
+			crc0 = crc32c_word(crc0, p);
+			crc1 = crc32c_word(crc1, p + CRC32C_LONG);
+			crc2 = crc32c_word(crc2, p + CRC32C_LONG * 2);
+		}
+		crc0 = crc32c_shift(crc32c_long, crc0) ^ crc1;
+		crc0 = crc32c_shift(crc32c_long, crc0) ^ crc2;
+		p += CRC32C_LONG * 2;
+	}
+
+	for (; size >= CRC32C_SHORT * 3; size -= CRC32C_SHORT * 3) {
+		uint32_t crc1 = 0, crc2 = 0;
+
+		for (end = p + CRC32C_SHORT; p < end; p += sizeof(crc32c_word)) {
+			crc0 = crc32c_word(crc0, p);
+			crc1 = crc32c_word(crc1, p + CRC32C_SHORT);
+			crc2 = crc32c_word(crc2, p + CRC32C_SHORT * 2);
+		}
+		crc0 = crc32c_shift(crc32c_short, crc0) ^ crc1;
+		crc0 = crc32c_shift(crc32c_short, crc0) ^ crc2;
+		p += CRC32C_SHORT * 2;
+	}
+
+	for (; size >= sizeof(crc32c_word); size -= sizeof(crc32c_word), p += sizeof(crc32c_word))
+		crc0 = crc32c_word(crc0, p);
+
+	for (; size; --size, ++p)
+		crc0 = crc32c_byte(crc0, p);
+
+	return crc0;
+}
+#endif
+
+/* Continue a CRC32C, start with crc = 0. */
+uint32_t crc32c(uint32_t crc, const void *data, size_t size)
+{
+	const uint8_t *p = (const uint8_t *)data;
+
+	pthread_once(&crc32c_once, crc32c_init_tables);
+
+	crc = ~crc;
+#if defined(CRC32C_ARM)
+	crc = crc32c_hw(crc, p, size);
+#elif defined(CRC32C_SSE42)
+	if (__builtin_cpu_supports("sse4.2"))
+		crc = crc32c_hw(crc, p, size);
+	else
+		crc = crc32c_sw(crc, p, size);
+#else
+	crc = crc32c_sw(crc, p, size);
+#endif
+	return ~crc;
+}
+
+/* -----------------------------------------------------------------------------
+ * Checks
+ */
+
+static uint64_t integrity_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* crc_log names a file to log "sequence,bytesused,crc32c" lines to. */
+int integrity_init(struct integrity *ic, const struct device *dev,
+	const char *crc_log)
+{
+	const struct pixfmt_info *info = pixfmt_lookup(dev->pixelformat);
+
+	memset(ic, 0, sizeof *ic);
+
+	if (info)
+		ic->expected = pixfmt_image_size(info, dev->bytesperline, dev->height);
+
+	if (crc_log) {
+		ic->crc_log = fopen(crc_log, "w");
+		if (ic->crc_log == NULL) {
+			printf("Unable to open %s: %s (%d).\n", crc_log,
+				strerror(errno), errno);
+			return -errno;
+		}
+		fprintf(ic->crc_log, "sequence,bytesused,crc32c\n");
+	}
+
+	return 0;
+}
+
+/* Check a dequeued buffer, returns the INTEGRITY_* problems found. */
+unsigned int integrity_check(struct integrity *ic, const struct v4l2_buffer *buf,
+	const struct buffer *buffer)
+{
+	uint64_t start = integrity_now();
+	unsigned int problems = 0;
+
+	if (ic->frames++ == 0)
+		ic->first = start;
+
+	if (ic->started && buf->sequence != ic->next_sequence) {
+		int missing = (int)(buf->sequence - ic->next_sequence);
+
+		/* Going backwards means the device restarted counting. */
+		if (missing > 0)
+			ic->dropped += missing;
+		ic->gaps++;
+		problems |= INTEGRITY_GAP;
+	}
+	ic->started = true;
+	ic->next_sequence = buf->sequence + 1;
+
+	if (buf->flags & V4L2_BUF_FLAG_ERROR) {
+		ic->errors++;
+		problems |= INTEGRITY_ERROR;
+	}
+
+	if (buf->bytesused > buf->length) {
+		ic->overruns++;
+		problems |= INTEGRITY_SIZE;
+	} else if (ic->expected && buf->bytesused < ic->expected) {
+		ic->short_frames++;
+		problems |= INTEGRITY_SIZE;
+	}
+
+	if (buffer->padding) {
+		const uint8_t *guard = (const uint8_t *)buffer->mem + buffer->size;
+
+		if (simd_find_mismatch(guard, buffer->padding, 0x55) != buffer->padding) {
+			ic->padding++;
+			problems |= INTEGRITY_PADDING;
+		}
+	}
+
+	if (ic->crc_log && !(problems & INTEGRITY_CORRUPT))
+		fprintf(ic->crc_log, "%u,%u,%08x\n", buf->sequence, buf->bytesused,
+			crc32c(0, buffer->mem, buf->bytesused));
+
+	ic->last = integrity_now();
+	ic->check_ns += ic->last - start;
+	return problems;
+}
+
+void integrity_print(const struct integrity *ic, const char *name)
+{
+	uint64_t span = ic->last - ic->first;
+
+	if (ic->frames == 0)
+		return;
+
+	printf("%s: %u frames, %u dropped in %u gaps, %u errors, %u short, "
+		"%u overruns, %u padding overwritten\n", name, ic->frames,
+		ic->dropped, ic->gaps, ic->errors, ic->short_frames, ic->overruns,
+		ic->padding);
+	printf("%s: checks %.1f us/frame, %.2f%% of a core\n", name,
+		ic->check_ns / 1e3 / ic->frames,
+		span ? ic->check_ns * 100.0 / span : 0.0);
+}
+
+void integrity_cleanup(struct integrity *ic)
+{
+	if (ic->crc_log)
+		fclose(ic->crc_log);
+	ic->crc_log = NULL;
+}
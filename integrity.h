@@ -0,0 +1,59 @@
+/*
+ * integrity.h -- per frame capture integrity checks
+ *
+ * Checks every dequeued buffer for
+ *	- gaps in the sequence numbers, frames the driver dropped,
+ *	- V4L2_BUF_FLAG_ERROR, frames the driver knows are corrupted,
+ *	- a bytesused short of a full frame, or beyond the buffer,
+ *	- overwritten guard bytes after userptr buffers (BUFFER_FILL_PADDING),
+ * and optionally logs a CRC32C of the payload of every good frame, so a
+ * recording can be verified against what was captured. All checks but
+ * the CRC cost next to nothing; the CRC uses the ARMv8 CRC32 or SSE4.2
+ * instructions when available, a table otherwise.
+ */
+
+#ifndef __INTEGRITY_H__
+#define __INTEGRITY_H__
+
+#include "yavtalib.h"
+
+#define INTEGRITY_GAP		(1 << 0)
+#define INTEGRITY_ERROR		(1 << 1)
+#define INTEGRITY_SIZE		(1 << 2)
+#define INTEGRITY_PADDING	(1 << 3)
+
+/* Frames with these problems should not be shown or passed on. */
+#define INTEGRITY_CORRUPT	(INTEGRITY_ERROR | INTEGRITY_SIZE)
+
+struct integrity
+{
+	/* bytesused of a complete frame, 0 for compressed formats. */
+	unsigned int expected;
+	FILE *crc_log;
+
+	bool started;
+	unsigned int next_sequence;
+
+	/* Statistics. */
+	unsigned int frames;
+	unsigned int dropped;
+	unsigned int gaps;
+	unsigned int errors;
+	unsigned int short_frames;
+	unsigned int overruns;
+	unsigned int padding;
+	uint64_t check_ns;
+	uint64_t first;
+	uint64_t last;
+};
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t size);
+
+int integrity_init(struct integrity *ic, const struct device *dev,
+	const char *crc_log);
+unsigned int integrity_check(struct integrity *ic, const struct v4l2_buffer *buf,
+	const struct buffer *buffer);
+void integrity_print(const struct integrity *ic, const char *name);
+void integrity_cleanup(struct integrity *ic);
+
+#endif /* __INTEGRITY_H__ */
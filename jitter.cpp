@@ -0,0 +1,112 @@
+/*
+ * jitter.cpp -- capture timing probe
+ */
+
+#include "yavtalib.h"
+#include "jitter.h"
+
+static uint64_t jitter_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned int jitter_bucket(uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	unsigned int bucket = 0;
+
+	while (us && bucket < JITTER_BUCKETS - 1) {
+		us >>= 1;
+		bucket++;
+	}
+
+	return bucket;
+}
+
+void jitter_init(struct jitter_probe *probe)
+{
+	memset(probe, 0, sizeof *probe);
+}
+
+/* Call straight after VIDIOC_DQBUF returns. */
+void jitter_record(struct jitter_probe *probe, const struct v4l2_buffer *buf)
+{
+	uint64_t now = jitter_now();
+	uint64_t timestamp = buf->timestamp.tv_sec * 1000000000ULL +
+			     buf->timestamp.tv_usec * 1000ULL;
+
+	/*
+	 * Latency is only meaningful when the driver stamps buffers with
+	 * CLOCK_MONOTONIC, older drivers used the wall clock.
+	 */
+	probe->monotonic = (buf->flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) ==
+			   V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+	if (probe->monotonic && now >= timestamp) {
+		uint64_t latency = now - timestamp;
+
+		probe->latency[jitter_bucket(latency)]++;
+		if (latency > probe->latency_max)
+			probe->latency_max = latency;
+	}
+
+	if (probe->prev_dqbuf) {
+		int64_t period = timestamp - probe->prev_timestamp;
+		int64_t delta = (int64_t)(now - probe->prev_dqbuf) - period;
+		uint64_t jitter = delta < 0 ? -delta : delta;
+
+		probe->samples++;
+		probe->period_sum += period;
+		probe->jitter[jitter_bucket(jitter)]++;
+		probe->jitter_sum += jitter;
+		if (jitter > probe->jitter_max)
+			probe->jitter_max = jitter;
+	}
+
+	probe->prev_dqbuf = now;
+	probe->prev_timestamp = timestamp;
+}
+
+static void jitter_print_histogram(const unsigned int *hist, unsigned int total)
+{
+	unsigned int first = JITTER_BUCKETS, last = 0;
+	unsigned int i;
+
+	for (i = 0; i < JITTER_BUCKETS; ++i) {
+		if (hist[i]) {
+			if (first == JITTER_BUCKETS)
+				first = i;
+			last = i;
+		}
+	}
+
+	for (i = first; i <= last && first < JITTER_BUCKETS; ++i) {
+		unsigned int width = total ? hist[i] * 50 / total : 0;
+
+		if (i == 0)
+			printf("  %8s ", "< 1 us");
+		else
+			printf("  %5u us ", 1U << (i - 1));
+		printf("%7u %-50.*s\n", hist[i], width,
+			"##################################################");
+	}
+}
+
+void jitter_print(const struct jitter_probe *probe, const char *name)
+{
+	if (probe->samples == 0)
+		return;
+
+	printf("%s: %u intervals, period %.3f ms, jitter mean %.1f us max %.1f us\n",
+		name, probe->samples, probe->period_sum / 1e6 / probe->samples,
+		probe->jitter_sum / 1e3 / probe->samples, probe->jitter_max / 1e3);
+	printf("DQBUF interval - timestamp interval:\n");
+	jitter_print_histogram(probe->jitter, probe->samples);
+
+	if (probe->monotonic) {
+		printf("DQBUF - timestamp, max %.1f us:\n", probe->latency_max / 1e3);
+		jitter_print_histogram(probe->latency, probe->samples + 1);
+	}
+}
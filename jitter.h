@@ -0,0 +1,42 @@
+/*
+ * jitter.h -- capture timing probe
+ *
+ * Records, for every dequeued buffer, how much later than the driver
+ * timestamp the application got hold of it, and how much the interval
+ * between two DQBUF calls differs from the interval between the two
+ * buffer timestamps. The driver timestamps the frame in interrupt
+ * context, so any difference is added by scheduling the capture thread.
+ * Both are kept as log2 histograms in microseconds, cheap enough to run
+ * in the capture loop.
+ */
+
+#ifndef __JITTER_H__
+#define __JITTER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/videodev2.h>
+
+#define JITTER_BUCKETS		18	/* < 1 us to >= 65.536 ms */
+
+struct jitter_probe
+{
+	uint64_t prev_dqbuf;
+	uint64_t prev_timestamp;
+	bool monotonic;
+
+	unsigned int samples;
+	uint64_t period_sum;
+
+	unsigned int latency[JITTER_BUCKETS];
+	uint64_t latency_max;
+	unsigned int jitter[JITTER_BUCKETS];
+	uint64_t jitter_max;
+	uint64_t jitter_sum;
+};
+
+void jitter_init(struct jitter_probe *probe);
+void jitter_record(struct jitter_probe *probe, const struct v4l2_buffer *buf);
+void jitter_print(const struct jitter_probe *probe, const char *name);
+
+#endif /* __JITTER_H__ */
@@ -0,0 +1,198 @@
+/*
+ * latency.cpp -- per frame latency breakdown
+ */
+
+#include "yavtalib.h"
+#include "latency.h"
+
+static uint64_t latency_clock(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t latency_now(void)
+{
+	return latency_clock(CLOCK_MONOTONIC);
+}
+
+/* Capture time of a buffer on CLOCK_MONOTONIC, 0 when unknown. */
+uint64_t latency_capture_time(const struct v4l2_buffer *buf)
+{
+	uint64_t timestamp = buf->timestamp.tv_sec * 1000000000ULL +
+			     buf->timestamp.tv_usec * 1000ULL;
+	uint64_t offset;
+
+	switch (buf->flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) {
+	case V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC:
+		return timestamp;
+
+	case V4L2_BUF_FLAG_TIMESTAMP_UNKNOWN:
+		/* Wall clock, as gettimeofday() in drivers before 3.9. */
+		offset = latency_clock(CLOCK_REALTIME) - latency_now();
+		return timestamp > offset ? timestamp - offset : 0;
+
+	default:
+		return 0;
+	}
+}
+
+const char *latency_clock_name(unsigned int flags)
+{
+	switch (flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) {
+	case V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC:
+		return "monotonic";
+	case V4L2_BUF_FLAG_TIMESTAMP_UNKNOWN:
+		return "realtime";
+	case V4L2_BUF_FLAG_TIMESTAMP_COPY:
+		return "copy";
+	default:
+		return "unknown";
+	}
+}
+
+/* Stage i goes from stamp i to stamp i + 1, a CSV file name is optional. */
+int latency_init(struct latency_stats *lat, const char *const *names,
+	unsigned int nstages, const char *csv)
+{
+	unsigned int i;
+
+	memset(lat, 0, sizeof *lat);
+
+	if (nstages > LATENCY_MAX_STAGES)
+		return -EINVAL;
+
+	lat->nstages = nstages;
+	for (i = 0; i <= nstages; ++i) {
+		lat->stages[i].name = i < nstages ? names[i] : "total";
+		lat->stages[i].min = ~0ULL;
+	}
+
+	if (csv) {
+		lat->csv = fopen(csv, "w");
+		if (lat->csv == NULL) {
+			printf("Unable to open %s: %s (%d).\n", csv, strerror(errno), errno);
+			return -errno;
+		}
+
+		fprintf(lat->csv, "sequence,clock");
+		for (i = 0; i <= nstages; ++i)
+			fprintf(lat->csv, ",%s_us", lat->stages[i].name);
+		fprintf(lat->csv, "\n");
+	}
+
+	return 0;
+}
+
+static void latency_add(struct latency_stage *stage, uint64_t ns)
+{
+	uint64_t bucket = ns / 100000;
+
+	stage->count++;
+	stage->sum += ns;
+	if (ns < stage->min)
+		stage->min = ns;
+	if (ns > stage->max)
+		stage->max = ns;
+	stage->hist[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS]++;
+}
+
+/*
+ * stamps holds nstages + 1 monotonic times. A first stamp of 0 is an
+ * unknown capture time.
+ */
+void latency_record(struct latency_stats *lat, unsigned int sequence,
+	unsigned int flags, const uint64_t *stamps)
+{
+	unsigned int first = stamps[0] ? 0 : 1;
+	unsigned int i;
+
+	lat->frames++;
+	lat->flags = flags;
+	if (first)
+		lat->unknown++;
+
+	if (lat->csv)
+		fprintf(lat->csv, "%u,%s", sequence, latency_clock_name(flags));
+
+	for (i = 0; i < lat->nstages; ++i) {
+		/* Stamps out of order, e.g. a clock mix-up, count as 0. */
+		uint64_t ns = stamps[i + 1] > stamps[i] ? stamps[i + 1] - stamps[i] : 0;
+
+		if (i < first) {
+			if (lat->csv)
+				fprintf(lat->csv, ",");
+			continue;
+		}
+
+		latency_add(&lat->stages[i], ns);
+		if (lat->csv)
+			fprintf(lat->csv, ",%.1f", ns / 1e3);
+	}
+
+	if (first == 0) {
+		uint64_t ns = stamps[lat->nstages] > stamps[0] ?
+			      stamps[lat->nstages] - stamps[0] : 0;
+
+		latency_add(&lat->stages[lat->nstages], ns);
+		if (lat->csv)
+			fprintf(lat->csv, ",%.1f\n", ns / 1e3);
+	} else if (lat->csv) {
+		fprintf(lat->csv, ",\n");
+	}
+}
+
+static double latency_percentile(const struct latency_stage *stage,
+	unsigned int percent)
+{
+	unsigned int target = (stage->count * percent + 99) / 100;
+	unsigned int sum = 0;
+	unsigned int i;
+
+	for (i = 0; i <= LATENCY_BUCKETS; ++i) {
+		sum += stage->hist[i];
+		if (sum >= target)
+			break;
+	}
+
+	/* Upper edge of the bucket, in ms, but never above the maximum. */
+	if (i < LATENCY_BUCKETS && (i + 1) * 100000ULL < stage->max)
+		return (i + 1) / 10.0;
+	return stage->max / 1e6;
+}
+
+void latency_print(const struct latency_stats *lat, const char *name)
+{
+	unsigned int i;
+
+	if (lat->frames == 0)
+		return;
+
+	printf("%s: %u frames, %s timestamps", name, lat->frames,
+		latency_clock_name(lat->flags));
+	if (lat->unknown)
+		printf(", %u without capture time", lat->unknown);
+	printf("\n%-20s %8s %8s %8s %8s %8s\n", "latency (ms)", "min", "mean",
+		"p50", "p99", "max");
+
+	for (i = 0; i <= lat->nstages; ++i) {
+		const struct latency_stage *stage = &lat->stages[i];
+
+		if (stage->count == 0)
+			continue;
+
+		printf("%-20s %8.2f %8.2f %8.1f %8.1f %8.2f\n", stage->name,
+			stage->min / 1e6, stage->sum / 1e6 / stage->count,
+			latency_percentile(stage, 50), latency_percentile(stage, 99),
+			stage->max / 1e6);
+	}
+}
+
+void latency_cleanup(struct latency_stats *lat)
+{
+	if (lat->csv)
+		fclose(lat->csv);
+	lat->csv = NULL;
+}
@@ -0,0 +1,59 @@
+/*
+ * latency.h -- per frame latency breakdown
+ *
+ * A frame collects CLOCK_MONOTONIC time stamps as it moves along, the
+ * first one being the driver capture time (the end of exposure, or the
+ * first byte received, depending on the driver). The difference between
+ * consecutive stamps is one stage; every stage and the total are kept as
+ * 0.1 ms histograms for min/mean/p50/p99/max, and optionally written to a
+ * CSV file, one line per frame.
+ *
+ * Drivers stamp with CLOCK_MONOTONIC when V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC
+ * is set. Older drivers used the wall clock, those stamps are moved to the
+ * monotonic clock. Copied timestamps (memory-to-memory devices) say
+ * nothing about capture; the capture stage and total are then left out.
+ */
+
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <linux/videodev2.h>
+
+#define LATENCY_MAX_STAGES	4
+#define LATENCY_BUCKETS		2000	/* 0.1 ms each, then overflow */
+
+struct latency_stage
+{
+	const char *name;
+	unsigned int count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t sum;
+	unsigned int hist[LATENCY_BUCKETS + 1];
+};
+
+struct latency_stats
+{
+	/* Stages, followed by the total. */
+	struct latency_stage stages[LATENCY_MAX_STAGES + 1];
+	unsigned int nstages;
+	unsigned int frames;
+	unsigned int unknown;
+	unsigned int flags;
+	FILE *csv;
+};
+
+uint64_t latency_now(void);
+uint64_t latency_capture_time(const struct v4l2_buffer *buf);
+const char *latency_clock_name(unsigned int flags);
+
+int latency_init(struct latency_stats *lat, const char *const *names,
+	unsigned int nstages, const char *csv);
+void latency_record(struct latency_stats *lat, unsigned int sequence,
+	unsigned int flags, const uint64_t *stamps);
+void latency_print(const struct latency_stats *lat, const char *name);
+void latency_cleanup(struct latency_stats *lat);
+
+#endif /* __LATENCY_H__ */
@@ -0,0 +1,395 @@
+/*
+ * motion.cpp -- motion detection on decimated luma
+ */
+
+#include "motion.h"
+
+static uint64_t motion_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* -----------------------------------------------------------------------------
+ * Kernels
+ */
+
+/*
+ * Mean of every four luma samples of a packed 4:2:2 line, n outputs. The
+ * SIMD paths sum the four samples of each 8 byte group with one SAD
+ * against zero (SSE2) or pairwise adds (NEON).
+ */
+template<bool Uyvy>
+static void motion_decimate4(const uint8_t *s, uint8_t *d, unsigned int n)
+{
+	unsigned int i = 0;
+
+#if defined(SIMD_SSE2)
+	const __m128i mask = _mm_set1_epi16(0x00ff);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi16(2);
+
+	for (; i + 8 <= n; i += 8, s += 64, d += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i *)s);
+		__m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+		__m128i c = _mm_loadu_si128((const __m128i *)(s + 32));
+		__m128i e = _mm_loadu_si128((const __m128i *)(s + 48));
+
+		if (Uyvy) {
+			a = _mm_srli_epi16(a, 8);
+			b = _mm_srli_epi16(b, 8);
+			c = _mm_srli_epi16(c, 8);
+			e = _mm_srli_epi16(e, 8);
+		} else {
+			a = _mm_and_si128(a, mask);
+			b = _mm_and_si128(b, mask);
+			c = _mm_and_si128(c, mask);
+			e = _mm_and_si128(e, mask);
+		}
+
+		/* Two sums per register, in the low 16 bits of each half. */
+		a = _mm_packs_epi32(_mm_sad_epu8(a, zero), _mm_sad_epu8(b, zero));
+		c = _mm_packs_epi32(_mm_sad_epu8(c, zero), _mm_sad_epu8(e, zero));
+		a = _mm_packs_epi32(a, c);
+		a = _mm_srli_epi16(_mm_add_epi16(a, round), 2);
+		_mm_storel_epi64((__m128i *)d, _mm_packus_epi16(a, a));
+	}
+#elif defined(SIMD_NEON)
+	for (; i + 8 <= n; i += 8, s += 64, d += 8) {
+		uint8x16x2_t a = vld2q_u8(s);
+		uint8x16x2_t b = vld2q_u8(s + 32);
+		uint8x16_t ya = Uyvy ? a.val[1] : a.val[0];
+		uint8x16_t yb = Uyvy ? b.val[1] : b.val[0];
+		uint32x4_t sa = vpaddlq_u16(vpaddlq_u8(ya));
+		uint32x4_t sb = vpaddlq_u16(vpaddlq_u8(yb));
+		uint16x8_t sum = vcombine_u16(vmovn_u32(sa), vmovn_u32(sb));
+
+		vst1_u8(d, vrshrn_n_u16(sum, 2));
+	}
+#endif
+
+	for (; i < n; ++i, s += 8, ++d)
+		*d = (s[Uyvy] + s[Uyvy + 2] + s[Uyvy + 4] + s[Uyvy + 6] + 2) >> 2;
+}
+
+/*
+ * Add the absolute differences between a decimated line and the
+ * background to the SADs of its cells, then move the background towards
+ * the line by 2^-rate. n is a multiple of MOTION_CELL.
+ */
+static void motion_sad_update(const uint8_t *cur, uint16_t *bg, uint8_t *bg8,
+	uint32_t *sad, unsigned int n, unsigned int rate)
+{
+	unsigned int i = 0;
+
+#if defined(SIMD_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i shift = _mm_cvtsi32_si128(rate);
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i c = _mm_loadu_si128((const __m128i *)(cur + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(bg8 + i));
+		__m128i s = _mm_sad_epu8(c, b);
+		__m128i lo = _mm_loadu_si128((const __m128i *)(bg + i));
+		__m128i hi = _mm_loadu_si128((const __m128i *)(bg + i + 8));
+		__m128i clo = _mm_slli_epi16(_mm_unpacklo_epi8(c, zero), 7);
+		__m128i chi = _mm_slli_epi16(_mm_unpackhi_epi8(c, zero), 7);
+
+		sad[i / MOTION_CELL] += _mm_cvtsi128_si32(s);
+		sad[i / MOTION_CELL + 1] += _mm_cvtsi128_si32(_mm_srli_si128(s, 8));
+
+		lo = _mm_add_epi16(lo, _mm_sra_epi16(_mm_sub_epi16(clo, lo), shift));
+		hi = _mm_add_epi16(hi, _mm_sra_epi16(_mm_sub_epi16(chi, hi), shift));
+		_mm_storeu_si128((__m128i *)(bg + i), lo);
+		_mm_storeu_si128((__m128i *)(bg + i + 8), hi);
+		_mm_storeu_si128((__m128i *)(bg8 + i),
+			_mm_packus_epi16(_mm_srli_epi16(lo, 7), _mm_srli_epi16(hi, 7)));
+	}
+#elif defined(SIMD_NEON)
+	const int16x8_t shift = vdupq_n_s16(-(int)rate);
+
+	for (; i + 16 <= n; i += 16) {
+		uint8x16_t c = vld1q_u8(cur + i);
+		uint64x2_t s = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vabdq_u8(c, vld1q_u8(bg8 + i)))));
+		int16x8_t lo = vreinterpretq_s16_u16(vld1q_u16(bg + i));
+		int16x8_t hi = vreinterpretq_s16_u16(vld1q_u16(bg + i + 8));
+		int16x8_t clo = vreinterpretq_s16_u16(vshll_n_u8(vget_low_u8(c), 7));
+		int16x8_t chi = vreinterpretq_s16_u16(vshll_n_u8(vget_high_u8(c), 7));
+
+		sad[i / MOTION_CELL] += vgetq_lane_u64(s, 0);
+		sad[i / MOTION_CELL + 1] += vgetq_lane_u64(s, 1);
+
+		lo = vaddq_s16(lo, vshlq_s16(vsubq_s16(clo, lo), shift));
+		hi = vaddq_s16(hi, vshlq_s16(vsubq_s16(chi, hi), shift));
+		vst1q_u16(bg + i, vreinterpretq_u16_s16(lo));
+		vst1q_u16(bg + i + 8, vreinterpretq_u16_s16(hi));
+		vst1q_u8(bg8 + i, vcombine_u8(vshrn_n_u16(vreinterpretq_u16_s16(lo), 7),
+					      vshrn_n_u16(vreinterpretq_u16_s16(hi), 7)));
+	}
+#endif
+
+	for (; i < n; ++i) {
+		int diff = cur[i] - bg8[i];
+
+		sad[i / MOTION_CELL] += diff < 0 ? -diff : diff;
+		bg[i] += ((int16_t)((cur[i] << 7) - bg[i])) >> rate;
+		bg8[i] = bg[i] >> 7;
+	}
+}
+
+/* -----------------------------------------------------------------------------
+ * Regions
+ */
+
+/* Keep the largest regions, sorted by size. */
+static void motion_add_region(struct motion_result *result,
+	const struct motion_region *region)
+{
+	unsigned int i;
+
+	if (result->nregions == MOTION_MAX_REGIONS &&
+	    region->cells <= result->regions[MOTION_MAX_REGIONS - 1].cells)
+		return;
+
+	if (result->nregions < MOTION_MAX_REGIONS)
+		result->nregions++;
+
+	for (i = result->nregions - 1; i > 0; --i) {
+		if (result->regions[i - 1].cells >= region->cells)
+			break;
+		result->regions[i] = result->regions[i - 1];
+	}
+
+	result->regions[i] = *region;
+}
+
+/* Group 4-connected active cells, with an explicit stack. */
+static void motion_find_regions(struct motion *md, struct motion_result *result)
+{
+	unsigned int cells = md->cols * md->rows;
+	unsigned int i;
+
+	memset(md->label, 0, cells * sizeof *md->label);
+
+	for (i = 0; i < cells; ++i) {
+		unsigned int c0 = md->cols, c1 = 0, r0 = md->rows, r1 = 0;
+		unsigned int count = 0, top = 0;
+		uint64_t score = 0;
+		struct motion_region region;
+
+		if (md->label[i] || md->sad[i] == 0)
+			continue;
+
+		md->label[i] = 1;
+		md->stack[top++] = i;
+
+		while (top) {
+			unsigned int cell = md->stack[--top];
+			unsigned int col = cell % md->cols;
+			unsigned int row = cell / md->cols;
+			unsigned int next[4];
+			unsigned int n = 0, j;
+
+			count++;
+			score += md->sad[cell];
+			if (col < c0) c0 = col;
+			if (col > c1) c1 = col;
+			if (row < r0) r0 = row;
+			if (row > r1) r1 = row;
+
+			if (col > 0)
+				next[n++] = cell - 1;
+			if (col + 1 < md->cols)
+				next[n++] = cell + 1;
+			if (row > 0)
+				next[n++] = cell - md->cols;
+			if (row + 1 < md->rows)
+				next[n++] = cell + md->cols;
+
+			for (j = 0; j < n; ++j) {
+				if (md->label[next[j]] || md->sad[next[j]] == 0)
+					continue;
+				md->label[next[j]] = 1;
+				md->stack[top++] = next[j];
+			}
+		}
+
+		if (count < md->min_cells)
+			continue;
+
+		region.x = c0 * MOTION_CELL * md->factor;
+		region.y = r0 * MOTION_CELL * md->factor;
+		region.width = (c1 + 1 - c0) * MOTION_CELL * md->factor;
+		region.height = (r1 + 1 - r0) * MOTION_CELL * md->factor;
+		if (region.x + region.width > md->width * md->factor)
+			region.width = md->width * md->factor - region.x;
+		if (region.y + region.height > md->height * md->factor)
+			region.height = md->height * md->factor - region.y;
+		region.cells = count;
+		region.score = score / count;
+		motion_add_region(result, &region);
+	}
+}
+
+/* -----------------------------------------------------------------------------
+ * API
+ */
+
+/*
+ * Prepare for YUYV or UYVY frames of the given size, decimated 4x or 8x.
+ * Cells at the right and bottom edges may be partial.
+ */
+int motion_init(struct motion *md, unsigned int fourcc, unsigned int width,
+	unsigned int height, unsigned int factor)
+{
+	unsigned int padded;
+
+	memset(md, 0, sizeof *md);
+
+	if (fourcc != V4L2_PIX_FMT_YUYV && fourcc != V4L2_PIX_FMT_UYVY)
+		return -EINVAL;
+	if (factor != 4 && factor != 8)
+		return -EINVAL;
+
+	md->fourcc = fourcc;
+	md->factor = factor;
+	md->threshold = 12;
+	md->rate = 4;
+	md->min_cells = 2;
+	md->width = width / factor;
+	md->height = height / factor;
+	md->cols = (md->width + MOTION_CELL - 1) / MOTION_CELL;
+	md->rows = (md->height + MOTION_CELL - 1) / MOTION_CELL;
+
+	if (md->cols * md->rows == 0 || md->cols * md->rows > 65535)
+		return -EINVAL;
+
+	/* Padding pixels are 0 in both the line and the background. */
+	padded = md->cols * MOTION_CELL;
+	md->line = (uint8_t *)calloc(width / 4 + padded, 1);
+	md->background = (uint16_t *)malloc(padded * md->height * sizeof *md->background);
+	md->background8 = (uint8_t *)malloc(padded * md->height);
+	md->sad = (uint32_t *)calloc(md->cols * md->rows, sizeof *md->sad);
+	md->label = (uint16_t *)calloc(md->cols * md->rows, sizeof *md->label);
+	md->stack = (uint16_t *)calloc(md->cols * md->rows, sizeof *md->stack);
+	if (!md->line || !md->background || !md->background8 || !md->sad ||
+	    !md->label || !md->stack) {
+		motion_cleanup(md);
+		return -ENOMEM;
+	}
+
+	/* Fault the background in now rather than on the first frame. */
+	memset(md->background, 0, padded * md->height * sizeof *md->background);
+	memset(md->background8, 0, padded * md->height);
+
+	return 0;
+}
+
+/*
+ * Compare a frame with the background and update it. The first frame
+ * only seeds the background.
+ */
+void motion_detect(struct motion *md, const struct image *img,
+	struct motion_result *result)
+{
+	unsigned int padded = md->cols * MOTION_CELL;
+	unsigned int cells = md->cols * md->rows;
+	uint64_t start = motion_now();
+	uint64_t total = 0;
+	unsigned int y, i;
+	uint64_t time;
+
+	memset(result, 0, sizeof *result);
+	memset(md->sad, 0, cells * sizeof *md->sad);
+
+	for (y = 0; y < md->height; ++y) {
+		const uint8_t *src = img->data + (y * md->factor + md->factor / 2) * img->stride;
+		uint16_t *bg = md->background + y * padded;
+		uint8_t *bg8 = md->background8 + y * padded;
+
+		if (md->fourcc == V4L2_PIX_FMT_UYVY)
+			motion_decimate4<true>(src, md->line, img->width / 4);
+		else
+			motion_decimate4<false>(src, md->line, img->width / 4);
+
+		if (md->factor == 8) {
+			for (i = 0; i < md->width; ++i)
+				md->line[i] = (md->line[2 * i] + md->line[2 * i + 1] + 1) >> 1;
+		}
+		memset(md->line + md->width, 0, padded - md->width);
+
+		if (!md->started) {
+			for (i = 0; i < md->width; ++i) {
+				bg[i] = md->line[i] << 7;
+				bg8[i] = md->line[i];
+			}
+			continue;
+		}
+
+		motion_sad_update(md->line, bg, bg8, &md->sad[(y / MOTION_CELL) * md->cols],
+				  padded, md->rate);
+	}
+
+	if (md->started) {
+		/* Keep the SADs of active cells only, as mean differences. */
+		for (i = 0; i < cells; ++i) {
+			unsigned int col = i % md->cols, row = i / md->cols;
+			unsigned int w = col + 1 == md->cols ? md->width - col * MOTION_CELL : MOTION_CELL;
+			unsigned int h = row + 1 == md->rows ? md->height - row * MOTION_CELL : MOTION_CELL;
+			unsigned int mean = md->sad[i] * 256 / (w * h);
+
+			total += md->sad[i];
+			if (mean >= md->threshold * 256) {
+				md->sad[i] = mean;
+				result->active++;
+			} else {
+				md->sad[i] = 0;
+			}
+		}
+
+		result->score = total * 256 / (md->width * md->height);
+		if (result->active)
+			motion_find_regions(md, result);
+		result->motion = result->nregions > 0;
+	}
+
+	md->started = true;
+	md->frames++;
+	if (result->motion)
+		md->motion_frames++;
+
+	time = motion_now() - start;
+	md->detect_ns += time;
+	if (time > md->max_ns)
+		md->max_ns = time;
+}
+
+void motion_print(const struct motion *md, const char *name)
+{
+	if (md->frames == 0)
+		return;
+
+	printf("%s: %u frames, %u with motion, %ux%u cells of %u pixels\n", name,
+		md->frames, md->motion_frames, md->cols, md->rows,
+		MOTION_CELL * md->factor);
+	printf("%s: detection %.1f us/frame, %.1f us max\n", name,
+		md->detect_ns / 1e3 / md->frames, md->max_ns / 1e3);
+}
+
+void motion_cleanup(struct motion *md)
+{
+	free(md->line);
+	free(md->background);
+	free(md->background8);
+	free(md->sad);
+	free(md->label);
+	free(md->stack);
+	md->line = NULL;
+	md->background = NULL;
+	md->background8 = NULL;
+	md->sad = NULL;
+	md->label = NULL;
+	md->stack = NULL;
+}
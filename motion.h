@@ -0,0 +1,81 @@
+/*
+ * motion.h -- motion detection on decimated luma
+ *
+ * Reads Y straight from packed 4:2:2 buffers, one line in every factor
+ * lines and the mean of factor pixels across it, so at 4x a frame costs
+ * a quarter of its lines and chroma is never looked at. The decimated
+ * image is compared with a running background by sums of absolute
+ * differences over cells of MOTION_CELL x MOTION_CELL decimated pixels,
+ * then folded into it. Cells whose mean difference exceeds the threshold
+ * are active; adjacent active cells make up the regions reported.
+ *
+ * All buffers are sized once by motion_init(), a frame allocates
+ * nothing.
+ */
+
+#ifndef __MOTION_H__
+#define __MOTION_H__
+
+#include "convert.h"
+
+#define MOTION_CELL		8
+#define MOTION_MAX_REGIONS	8
+
+/* Rectangle in source pixels, mean absolute difference of its cells. */
+struct motion_region
+{
+	unsigned int x, y;
+	unsigned int width, height;
+	unsigned int cells;
+	unsigned int score;
+};
+
+struct motion_result
+{
+	/* Mean absolute difference over the frame, in 1/256 levels. */
+	unsigned int score;
+	unsigned int active;
+	bool motion;
+	/* The largest regions, largest first. */
+	unsigned int nregions;
+	struct motion_region regions[MOTION_MAX_REGIONS];
+};
+
+struct motion
+{
+	unsigned int fourcc;
+	unsigned int factor;
+	unsigned int threshold;
+	unsigned int rate;
+	unsigned int min_cells;
+
+	/* Decimated size and cell grid. */
+	unsigned int width, height;
+	unsigned int cols, rows;
+
+	/* Current line, background (7 fractional bits) and its integer part. */
+	uint8_t *line;
+	uint16_t *background;
+	uint8_t *background8;
+	bool started;
+
+	/* Cell SADs, flood fill labels and stack. */
+	uint32_t *sad;
+	uint16_t *label;
+	uint16_t *stack;
+
+	/* Statistics. */
+	unsigned int frames;
+	unsigned int motion_frames;
+	uint64_t detect_ns;
+	uint64_t max_ns;
+};
+
+int motion_init(struct motion *md, unsigned int fourcc, unsigned int width,
+	unsigned int height, unsigned int factor);
+void motion_detect(struct motion *md, const struct image *img,
+	struct motion_result *result);
+void motion_print(const struct motion *md, const char *name);
+void motion_cleanup(struct motion *md);
+
+#endif /* __MOTION_H__ */
@@ -0,0 +1,1901 @@
+/*
+ * nodes.cpp -- pipeline node types
+ *
+ *	pattern   source, synthetic YUYV colour bars
+ *	          width=640 height=480 fps=30 (0 to run unpaced), with
+ *	          interlaced=1 the bottom field is half a frame later
+ *	capture   source, V4L2 mmap capture, buffers are passed on in place,
+ *	          jitter=1 prints the DQBUF timing histograms at the end,
+ *	          check=1 drops frames that fail the integrity checks and
+ *	          crc=<file> logs the CRC32C of every other one, see integrity.h
+ *	          fps=<n> sets the frame rate, the driver default otherwise;
+ *	          adapt=<min>-<max> adapts the buffer count within the range,
+ *	          and the frame rate up to the initial one, to the load
+ *	          downstream, see capctl.h
+ *	          device=/dev/video6 buffers=8 fps= adapt= jitter=0 check=0 crc=
+ *	convert   colour conversion on the CPU, in row bands on several
+ *	          threads with threads=<n> (0 for all CPUs) and cpus=<list>
+ *	          and the thread scheduling policy with rt=<setting>,
+ *	          dirty=1 converts only the tiles that changed into output
+ *	          frames no longer used downstream, see dirtymap.h
+ *	          stats=<columns>x<rows> takes the statistics of the stats
+ *	          node in the same pass, printed at the end, rotate=<degrees>
+ *	          and hflip=1 or vflip=1 orient the output in the same pass
+ *	          too, the flips first
+ *	          format=RGB24 threads=1 cpus= rt= dirty=0 stats= rotate=0
+ *	          hflip=0 vflip=0
+ *	display   software display sink, see swsink.h
+ *	          type=x11|fb device= refresh=0
+ *	output    V4L2 output or mem2mem device, e.g. v4l2loopback or an
+ *	          encoder, frames are converted into the mmapped buffers,
+ *	          in the source format unless format= is given; codec= sets
+ *	          the coded format of a mem2mem device and file=<file>
+ *	          saves its coded buffers, see v4l2out.h
+ *	          device=/dev/video10 buffers=4 format= threads=1 cpus=
+ *	          codec= file=
+ *	bus       shared memory frame bus, see framebus.h
+ *	          name=<bus name> slots=4
+ *	motion    motion detection on YUYV or UYVY luma, see motion.h,
+ *	          passes frames on, with gate=1 only frames with motion and
+ *	          the hold=<n> frames after, log=<file> logs the regions
+ *	          factor=4 threshold=12 rate=4 gate=0 hold=30 log=
+ *	denoise   temporal denoise of YUYV or UYVY fused with the conversion
+ *	          to RGB, see denoise.h, strength=0 passes the frames through
+ *	          format=RGB24 strength=128 threshold=24
+ *	filter    3x3 or 5x5 luma filter of YUYV or UYVY, see filter.h, into
+ *	          the source format or, with format=, converted in the same
+ *	          pass; amount is in 1/16
+ *	          mode=sharpen|unsharp|sobel size=3 amount=16 format=
+ *	deinterlace  interlaced frames into progressive ones, see deint.h,
+ *	          one per frame or per field with rate=field; order is the
+ *	          field order of V4L2_FIELD_INTERLACED frames
+ *	          mode=adaptive rate=frame order=tb threshold=12
+ *	stats     luma histogram and zone means of YUYV or UYVY for
+ *	          exposure and white balance, see yuvstats.h, passes frames
+ *	          on, log=<file> logs the range, mean and zones of each
+ *	          zones=8x8 log=
+ *	pyramid   YUYV or UYVY into full size RGB, 1/2 and 1/4 scale levels
+ *	          and optionally a planar float16 or int8 tensor of one level
+ *	          normalized as (value - mean) * scale per R, G, B channel,
+ *	          from one read of the source, see pyramid.h; level n goes
+ *	          out on port n and the tensor on the port after the last
+ *	          level, three planes stacked in a Y16 (f16) or Y8 (i8) frame
+ *	          format=RGB24 levels=3 tensor=none|f16|i8 level=<levels - 1>
+ *	          mean=0,0,0 scale=1,1,1
+ *	gpu       colour conversion of YUYV on the GPU without a display,
+ *	          into BGR32 or RGB32, read back slots - 1 frames behind the
+ *	          one drawn and drained at the end of the stream, see
+ *	          gpuconv.h; not built with NODES_NO_GLES
+ *	          format=BGR32 slots=2 shader=yuv2rgb.frag
+ *	null      discards frames
+ */
+
+#include <poll.h>
+
+#include "yavtalib.h"
+#include "pipeline.h"
+#include "pattern.h"
+#include "swsink.h"
+#include "framebus.h"
+#include "bandconv.h"
+#include "jitter.h"
+#include "latency.h"
+#include "integrity.h"
+#include "capctl.h"
+#include "dirtymap.h"
+#include "motion.h"
+#include "denoise.h"
+#include "filter.h"
+#include "deint.h"
+#include "yuvstats.h"
+#include "pyramid.h"
+#include "v4l2out.h"
+#ifndef NODES_NO_GLES
+#include "gpuconv.h"
+#endif
+
+/* -----------------------------------------------------------------------------
+ * pattern
+ */
+
+struct pattern_node
+{
+	unsigned int width;
+	unsigned int height;
+	unsigned int fps;
+	bool interlaced;
+	uint64_t start;
+	unsigned int sequence;
+};
+
+static int pattern_init(struct pipeline_node *node)
+{
+	struct pattern_node *pattern;
+
+	pattern = (struct pattern_node *)calloc(1, sizeof *pattern);
+	if (pattern == NULL)
+		return -ENOMEM;
+
+	pattern->width = pipeline_node_arg_uint(node, "width", 640);
+	pattern->height = pipeline_node_arg_uint(node, "height", 480);
+	pattern->fps = pipeline_node_arg_uint(node, "fps", 30);
+	pattern->interlaced = pipeline_node_arg_uint(node, "interlaced", 0);
+	if (pattern->width == 0 || pattern->height == 0 || pattern->width & 1) {
+		printf("Invalid pattern size %ux%u.\n", pattern->width, pattern->height);
+		free(pattern);
+		return -EINVAL;
+	}
+
+	node->priv = pattern;
+	return 0;
+}
+
+static struct frame *pattern_produce(struct pipeline_node *node)
+{
+	struct pattern_node *pattern = (struct pattern_node *)node->priv;
+	struct frame *frame;
+	uint64_t next;
+
+	if (pattern->sequence == 0)
+		pattern->start = pipeline_now();
+
+	/*
+	 * Behave like a camera running at a fixed frame rate, with the frame
+	 * "captured" at the start of its period.
+	 */
+	next = pipeline_now();
+	if (pattern->fps) {
+		struct timespec ts;
+
+		next = pattern->start +
+		       (uint64_t)pattern->sequence * 1000000000ULL / pattern->fps;
+		ts.tv_sec = next / 1000000000ULL;
+		ts.tv_nsec = next % 1000000000ULL;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	}
+
+	frame = frame_alloc(V4L2_PIX_FMT_YUYV, pattern->width, pattern->height);
+	if (frame == NULL)
+		return NULL;
+
+	if (pattern->interlaced)
+		pattern_fill_interlaced(&frame->image, pattern->sequence);
+	else
+		pattern_fill(&frame->image, pattern->sequence);
+	frame->sequence = pattern->sequence++;
+	frame->flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+	frame->field = pattern->interlaced ? V4L2_FIELD_INTERLACED_TB : V4L2_FIELD_NONE;
+	frame->timestamp = next;
+	frame->dequeued = pipeline_now();
+	return frame;
+}
+
+static void pattern_cleanup(struct pipeline_node *node)
+{
+	free(node->priv);
+}
+
+/* -----------------------------------------------------------------------------
+ * capture
+ */
+
+struct capture_node
+{
+	struct device dev;
+	struct frame *frames;
+	bool jitter;
+	struct jitter_probe probe;
+	bool check;
+	struct integrity integrity;
+
+	/*
+	 * Adaptive control: buffers held downstream, protected by lock against
+	 * a restart, sequence numbers to count driver drops, and the load of
+	 * the nodes downstream at the last window.
+	 */
+	bool adapt;
+	struct capctl ctl;
+	unsigned int action;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool held[V4L_BUFFERS_MAX];
+	unsigned int nheld;
+	bool started;
+	unsigned int next_sequence;
+	bool primed;
+	uint64_t node_busy[PIPELINE_MAX_NODES];
+	unsigned int node_frames[PIPELINE_MAX_NODES];
+	unsigned int node_dropped[PIPELINE_MAX_NODES];
+	unsigned int restarts;
+};
+
+static void capture_release(struct frame *frame)
+{
+	struct capture_node *capture = (struct capture_node *)frame->priv;
+
+	if (!capture->adapt) {
+		video_queue_buffer(&capture->dev, frame->index, BUFFER_FILL_NONE);
+		return;
+	}
+
+	pthread_mutex_lock(&capture->lock);
+	capture->held[frame->index] = false;
+	capture->nheld--;
+	video_queue_buffer(&capture->dev, frame->index, BUFFER_FILL_NONE);
+	pthread_cond_signal(&capture->cond);
+	pthread_mutex_unlock(&capture->lock);
+}
+
+static void capture_setup_frames(struct capture_node *capture)
+{
+	struct device *dev = &capture->dev;
+	unsigned int i;
+
+	for (i = 0; i < dev->nbufs; ++i) {
+		struct frame *frame = &capture->frames[i];
+
+		image_init(&frame->image, dev->pixelformat, dev->width, dev->height,
+			   dev->bytesperline, dev->buffers[i].mem);
+		frame->release = capture_release;
+		frame->priv = capture;
+		frame->index = i;
+	}
+}
+
+/*
+ * Set up the adaptive control, adapt=<min>-<max>, before the buffers are
+ * allocated: the controller picks the initial count within the range.
+ */
+static int capture_init_adapt(struct pipeline_node *node, unsigned int *nbufs)
+{
+	struct capture_node *capture = (struct capture_node *)node->priv;
+	struct device *dev = &capture->dev;
+	struct v4l2_fract intervals[CAPCTL_MAX_INTERVALS];
+	struct v4l2_fract current;
+	unsigned int nintervals;
+	unsigned int min, max;
+	bool known;
+
+	if (sscanf(pipeline_node_arg(node, "adapt", ""), "%u-%u", &min, &max) != 2 ||
+	    min < 2 || min > max || max > V4L_BUFFERS_MAX) {
+		printf("Invalid adapt range '%s', expected <min>-<max> within 2-%u.\n",
+			pipeline_node_arg(node, "adapt", ""), V4L_BUFFERS_MAX);
+		return -EINVAL;
+	}
+
+	known = video_get_framerate(dev, &current) == 0;
+	nintervals = video_get_frame_intervals(dev, dev->pixelformat, dev->width,
+					       dev->height, intervals,
+					       CAPCTL_MAX_INTERVALS);
+	if (!known)
+		printf("%s: no frame interval control, adapting the buffers only.\n",
+			node->name);
+
+	capctl_init(&capture->ctl, intervals, nintervals, known ? &current : NULL,
+		    *nbufs, min, max);
+	*nbufs = capture->ctl.nbufs;
+
+	pthread_mutex_init(&capture->lock, NULL);
+	pthread_cond_init(&capture->cond, NULL);
+	capture->adapt = true;
+	return 0;
+}
+
+/* Slowest node per frame and frames dropped by the queues downstream of node. */
+static void capture_load(struct capture_node *capture, struct pipeline_node *node,
+	uint64_t *busy, unsigned int *dropped)
+{
+	unsigned int i;
+
+	for (i = 0; i < node->noutputs; ++i) {
+		struct pipeline_node *output = node->outputs[i];
+		unsigned int n = output - output->pipeline->nodes;
+		unsigned int frames = output->frames - capture->node_frames[n];
+		uint64_t time = output->busy - capture->node_busy[n];
+
+		if (frames && time / frames > *busy)
+			*busy = time / frames;
+		*dropped += output->input.dropped - capture->node_dropped[n];
+
+		capture->node_busy[n] = output->busy;
+		capture->node_frames[n] = output->frames;
+		capture->node_dropped[n] = output->input.dropped;
+
+		capture_load(capture, output, busy, dropped);
+	}
+}
+
+/* Account a dequeued buffer, and decide at the end of a window. */
+static void capture_account(struct pipeline_node *node, const struct v4l2_buffer *buf)
+{
+	struct capture_node *capture = (struct capture_node *)node->priv;
+	unsigned int dropped = 0;
+	unsigned int lost = 0;
+	unsigned int held;
+	uint64_t busy = 0;
+
+	if (capture->started && (int)(buf->sequence - capture->next_sequence) > 0)
+		lost = buf->sequence - capture->next_sequence;
+	capture->started = true;
+	capture->next_sequence = buf->sequence + 1;
+
+	pthread_mutex_lock(&capture->lock);
+	capture->held[buf->index] = true;
+	held = ++capture->nheld;
+	pthread_mutex_unlock(&capture->lock);
+
+	if (!capctl_record(&capture->ctl, lost, held))
+		return;
+
+	/*
+	 * The first window after a (re)start only takes the load as a base,
+	 * it includes the lazy initialization of the nodes downstream.
+	 */
+	capture_load(capture, node, &busy, &dropped);
+	if (!capture->primed) {
+		capture->primed = true;
+		capctl_restart_window(&capture->ctl);
+		return;
+	}
+
+	capture->action = capctl_decide(&capture->ctl, busy, dropped);
+}
+
+/*
+ * Apply the controller decision: stop the stream, set the new frame
+ * interval, reallocate the buffers for a new count, and start again. The
+ * buffers held downstream stay with their frames and are queued when
+ * released; a new count has to wait until all of them are back.
+ */
+static int capture_restart(struct pipeline_node *node)
+{
+	struct capture_node *capture = (struct capture_node *)node->priv;
+	struct device *dev = &capture->dev;
+	unsigned int action = capture->action;
+	struct v4l2_fract interval;
+	unsigned int i;
+	int ret = 0;
+
+	capture->action = CAPCTL_NONE;
+
+	pthread_mutex_lock(&capture->lock);
+
+	if (action & CAPCTL_BUFFERS) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += 1;
+		while (capture->nheld && !node->pipeline->stop &&
+		       pthread_cond_timedwait(&capture->cond, &capture->lock, &ts) != ETIMEDOUT)
+			;
+
+		if (capture->nheld) {
+			printf("%s: %u buffers still held downstream, keeping %u buffers.\n",
+				node->name, capture->nheld, dev->nbufs);
+			capture->ctl.nbufs = dev->nbufs;
+			action &= ~CAPCTL_BUFFERS;
+		}
+	}
+
+	if (action == CAPCTL_NONE || node->pipeline->stop)
+		goto done;
+
+	video_enable(dev, 0);
+
+	if (action & CAPCTL_INTERVAL) {
+		interval = *capctl_interval(&capture->ctl);
+		video_set_framerate(dev, &interval);
+	}
+
+	if (action & CAPCTL_BUFFERS) {
+		video_free_buffers(dev);
+		ret = video_prepare_capture(dev, capture->ctl.nbufs, 0, NULL, BUFFER_FILL_NONE);
+		if (ret < 0)
+			goto done;
+
+		capture_setup_frames(capture);
+		capture->ctl.nbufs = dev->nbufs;
+	} else {
+		for (i = 0; i < dev->nbufs; ++i) {
+			if (!capture->held[i])
+				video_queue_buffer(dev, i, BUFFER_FILL_NONE);
+		}
+	}
+
+	ret = video_enable(dev, 1);
+
+	/* Sequence numbers start over with the stream. */
+	capture->started = false;
+	capture->integrity.started = false;
+	capture->primed = false;
+	capctl_restart_window(&capture->ctl);
+	capture->restarts++;
+
+done:
+	pthread_mutex_unlock(&capture->lock);
+	return ret;
+}
+
+static int capture_init(struct pipeline_node *node)
+{
+	struct capture_node *capture;
+	struct device *dev;
+	unsigned int nbufs;
+	unsigned int fps;
+	int ret;
+
+	capture = (struct capture_node *)calloc(1, sizeof *capture);
+	if (capture == NULL)
+		return -ENOMEM;
+
+	dev = &capture->dev;
+	ret = video_open(dev, pipeline_node_arg(node, "device", "/dev/video6"), 0);
+	if (ret < 0) {
+		free(capture);
+		return ret;
+	}
+
+	dev->memtype = V4L2_MEMORY_MMAP;
+	video_get_format(dev);
+	node->priv = capture;
+
+	capture->jitter = pipeline_node_arg_uint(node, "jitter", 0);
+	jitter_init(&capture->probe);
+
+	fps = pipeline_node_arg_uint(node, "fps", 0);
+	if (fps) {
+		struct v4l2_fract interval = { 1, fps };
+
+		video_set_framerate(dev, &interval);
+	}
+
+	nbufs = pipeline_node_arg_uint(node, "buffers", V4L_BUFFERS_DEFAULT);
+	if (pipeline_node_arg(node, "adapt", NULL)) {
+		ret = capture_init_adapt(node, &nbufs);
+		if (ret < 0)
+			goto error;
+	}
+
+	ret = video_prepare_capture(dev, nbufs, 0, NULL, BUFFER_FILL_NONE);
+	if (ret < 0)
+		goto error;
+
+	/* Room for every count the controller may pick. */
+	capture->frames = (struct frame *)calloc(capture->adapt ? V4L_BUFFERS_MAX : dev->nbufs,
+						 sizeof *capture->frames);
+	if (capture->frames == NULL) {
+		ret = -ENOMEM;
+		goto error;
+	}
+
+	capture_setup_frames(capture);
+	capture->ctl.nbufs = dev->nbufs;
+
+	capture->check = pipeline_node_arg_uint(node, "check", 0) ||
+			 pipeline_node_arg(node, "crc", NULL);
+	if (capture->check) {
+		ret = integrity_init(&capture->integrity, dev,
+				     pipeline_node_arg(node, "crc", NULL));
+		if (ret < 0)
+			goto error;
+	}
+
+	ret = video_enable(dev, 1);
+	if (ret < 0)
+		goto error;
+
+	return 0;
+
+error:
+	if (capture->adapt) {
+		pthread_mutex_destroy(&capture->lock);
+		pthread_cond_destroy(&capture->cond);
+	}
+	integrity_cleanup(&capture->integrity);
+	free(capture->frames);
+	video_free_buffers(dev);
+	video_close(dev);
+	free(capture);
+	node->priv = NULL;
+	return ret;
+}
+
+static struct frame *capture_produce(struct pipeline_node *node)
+{
+	struct capture_node *capture = (struct capture_node *)node->priv;
+	struct device *dev = &capture->dev;
+	struct v4l2_buffer buf;
+	struct frame *frame;
+	struct pollfd pfd;
+	int ret;
+
+	if (capture->action && capture_restart(node) < 0)
+		return NULL;
+
+	/* Corrupt frames go straight back to the driver. */
+	while (1) {
+		/* Wake up regularly to notice when the pipeline stops. */
+		pfd.fd = dev->fd;
+		pfd.events = POLLIN;
+		do {
+			ret = poll(&pfd, 1, 100);
+			if (node->pipeline->stop)
+				return NULL;
+		} while (ret == 0 || (ret < 0 && errno == EINTR));
+
+		memset(&buf, 0, sizeof buf);
+		buf.type = dev->type;
+		buf.memory = dev->memtype;
+		if (ioctl(dev->fd, VIDIOC_DQBUF, &buf) < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			printf("Unable to dequeue buffer: %s (%d).\n",
+				strerror(errno), errno);
+			return NULL;
+		}
+
+		if (capture->jitter)
+			jitter_record(&capture->probe, &buf);
+
+		if (!capture->check ||
+		    !(integrity_check(&capture->integrity, &buf,
+				      &dev->buffers[buf.index]) & INTEGRITY_CORRUPT))
+			break;
+
+		video_queue_buffer(dev, buf.index, BUFFER_FILL_NONE);
+	}
+
+	if (capture->adapt)
+		capture_account(node, &buf);
+
+	frame = &capture->frames[buf.index];
+	frame->refcount = 1;
+	frame->bytesused = buf.bytesused;
+	frame->sequence = buf.sequence;
+	frame->flags = buf.flags;
+	frame->field = buf.field;
+	frame->timestamp = latency_capture_time(&buf);
+	frame->dequeued = pipeline_now();
+	return frame;
+}
+
+static void capture_cleanup(struct pipeline_node *node)
+{
+	struct capture_node *capture = (struct capture_node *)node->priv;
+
+	if (capture->jitter)
+		jitter_print(&capture->probe, node->name);
+	if (capture->check)
+		integrity_print(&capture->integrity, node->name);
+	integrity_cleanup(&capture->integrity);
+
+	if (capture->adapt) {
+		capctl_print(&capture->ctl, node->name);
+		printf("%s: %u stream restarts\n", node->name, capture->restarts);
+		pthread_mutex_destroy(&capture->lock);
+		pthread_cond_destroy(&capture->cond);
+	}
+
+	video_enable(&capture->dev, 0);
+	video_free_buffers(&capture->dev);
+	video_close(&capture->dev);
+	free(capture->frames);
+	free(capture);
+}
+
+/* -----------------------------------------------------------------------------
+ * convert
+ */
+
+#define CONVERT_DIRTY_OUTPUTS	4
+
+struct convert_node
+{
+	unsigned int fourcc;
+	unsigned int src_fourcc;
+	convert_fn convert;
+	bool parallel;
+	struct bandconv bands;
+
+	/* Output orientation, converted with convert_oriented if not upright. */
+	unsigned int orientation;
+	struct orient_map orient;
+	convert_orient_fn convert_oriented;
+
+	/* Exposure statistics of the source taken along, with stats=. */
+	unsigned int zones_x;
+	unsigned int zones_y;
+	bool stats;
+	struct yuvstats st;
+
+	/* Output frames kept with dirty=1, and the frame of the map they hold. */
+	bool dirty;
+	struct dirtymap map;
+	struct frame *outputs[CONVERT_DIRTY_OUTPUTS];
+	unsigned int output_frame[CONVERT_DIRTY_OUTPUTS];
+	unsigned int frames;
+	unsigned int reused;
+	uint64_t tiles_converted;
+};
+
+static int convert_init(struct pipeline_node *node)
+{
+	struct convert_node *conv;
+	const char *format;
+	unsigned int threads;
+	int ret;
+
+	conv = (struct convert_node *)calloc(1, sizeof *conv);
+	if (conv == NULL)
+		return -ENOMEM;
+
+	format = pipeline_node_arg(node, "format", "RGB24");
+	conv->fourcc = v4l2_format_code(format);
+	if (conv->fourcc == 0) {
+		printf("Unsupported format %s.\n", format);
+		free(conv);
+		return -EINVAL;
+	}
+
+	conv->dirty = pipeline_node_arg_uint(node, "dirty", 0);
+
+	if (orientation_parse(pipeline_node_arg(node, "rotate", NULL),
+			      pipeline_node_arg_uint(node, "hflip", 0),
+			      pipeline_node_arg_uint(node, "vflip", 0),
+			      &conv->orientation) < 0) {
+		free(conv);
+		return -EINVAL;
+	}
+
+	/* Tiles are converted where they are in the source. */
+	if (conv->dirty && conv->orientation) {
+		printf("dirty=1 cannot be combined with rotate or flips.\n");
+		free(conv);
+		return -EINVAL;
+	}
+
+	if (pipeline_node_arg(node, "stats", NULL) &&
+	    yuvstats_parse_zones(pipeline_node_arg(node, "stats", NULL),
+				 &conv->zones_x, &conv->zones_y) < 0) {
+		printf("Invalid statistics zones %s.\n", pipeline_node_arg(node, "stats", NULL));
+		free(conv);
+		return -EINVAL;
+	}
+
+	threads = pipeline_node_arg_uint(node, "threads", 1);
+	if (threads != 1) {
+		ret = bandconv_init(&conv->bands, threads,
+				    pipeline_node_arg(node, "cpus", NULL));
+		if (ret < 0) {
+			free(conv);
+			return ret;
+		}
+		conv->parallel = true;
+
+		if (pipeline_node_arg(node, "rt", NULL))
+			bandconv_set_sched(&conv->bands, pipeline_node_arg(node, "rt", NULL));
+	}
+
+	node->priv = conv;
+	return 0;
+}
+
+static void convert_drop_outputs(struct convert_node *conv)
+{
+	unsigned int i;
+
+	for (i = 0; i < CONVERT_DIRTY_OUTPUTS; ++i) {
+		if (conv->outputs[i])
+			frame_put(conv->outputs[i]);
+		conv->outputs[i] = NULL;
+	}
+}
+
+/*
+ * Pick the output frame to convert into: the most recent one nobody else
+ * holds any more, a new one while there is room, or a new one in place
+ * of the oldest. Returns a new reference, and in since the frame of the
+ * map the output holds.
+ */
+static struct frame *convert_dirty_output(struct convert_node *conv,
+	const struct image *src, unsigned int *since)
+{
+	int best = -1, empty = -1, oldest = -1;
+	unsigned int i;
+
+	for (i = 0; i < CONVERT_DIRTY_OUTPUTS; ++i) {
+		struct frame *out = conv->outputs[i];
+
+		if (out == NULL) {
+			if (empty < 0)
+				empty = i;
+			continue;
+		}
+
+		if (oldest < 0 || conv->output_frame[i] < conv->output_frame[oldest])
+			oldest = i;
+
+		/* Only holders can take references, so this one is ours alone. */
+		if (out->refcount == 1 &&
+		    (best < 0 || conv->output_frame[i] > conv->output_frame[best]))
+			best = i;
+	}
+
+	if (best >= 0) {
+		conv->reused++;
+	} else {
+		best = empty >= 0 ? empty : oldest;
+		if (conv->outputs[best])
+			frame_put(conv->outputs[best]);
+		conv->outputs[best] = frame_alloc(conv->fourcc, src->width, src->height);
+		conv->output_frame[best] = 0;
+		if (conv->outputs[best] == NULL)
+			return NULL;
+	}
+
+	*since = conv->output_frame[best];
+	conv->output_frame[best] = conv->map.frame;
+	return frame_get(conv->outputs[best]);
+}
+
+static void convert_process(struct pipeline_node *node, struct frame *frame)
+{
+	struct convert_node *conv = (struct convert_node *)node->priv;
+	const struct image *src = &frame->image;
+	struct frame *out;
+
+	/* The source format is only known once the first frame arrives. */
+	if (conv->src_fourcc != src->fourcc) {
+		conv->src_fourcc = src->fourcc;
+		conv->convert = convert_lookup(src->fourcc, conv->fourcc);
+		if (conv->orientation) {
+			conv->convert_oriented = convert_orient_lookup(src->fourcc, conv->fourcc);
+			if (conv->convert_oriented == NULL)
+				conv->convert = NULL;
+		}
+		orient_map_init(&conv->orient, conv->orientation, src->width, src->height);
+		if (conv->convert == NULL)
+			printf("%s: no conversion from %s to %s.\n", node->name,
+				v4l2_format_name(src->fourcc),
+				v4l2_format_name(conv->fourcc));
+
+		if (conv->dirty) {
+			convert_drop_outputs(conv);
+			dirtymap_cleanup(&conv->map);
+			if (dirtymap_init(&conv->map, src->fourcc, src->width, src->height) < 0)
+				conv->dirty = false;
+		}
+
+		if (conv->zones_x) {
+			if (conv->stats)
+				yuvstats_cleanup(&conv->st);
+			conv->stats = yuvstats_init(&conv->st, src->fourcc, src->width,
+				src->height, conv->zones_x, conv->zones_y,
+				conv->parallel ? conv->bands.nthreads : 1) == 0;
+			if (!conv->stats)
+				printf("%s: no statistics of %ux%u %s.\n", node->name,
+					src->width, src->height, v4l2_format_name(src->fourcc));
+			if (conv->parallel && !conv->dirty)
+				bandconv_set_hook(&conv->bands, conv->stats ? yuvstats_band : NULL,
+						  &conv->st);
+		}
+	}
+
+	if (conv->convert == NULL)
+		return;
+
+	if (conv->dirty) {
+		unsigned int tiles = conv->map.cols * conv->map.rows;
+		unsigned int since;
+
+		/* Only part of the frame is converted, statistics take a pass of their own. */
+		if (conv->stats)
+			yuvstats_run(&conv->st, src, frame->sequence, frame->timestamp);
+
+		dirtymap_update(&conv->map, src);
+		out = convert_dirty_output(conv, src, &since);
+		if (out == NULL)
+			return;
+
+		/* Threads only pay off when most of the frame changed. */
+		if (conv->parallel && dirtymap_count_since(&conv->map, since) * 2 > tiles) {
+			bandconv_run(&conv->bands, conv->convert, src, &out->image);
+			conv->tiles_converted += tiles;
+		} else {
+			conv->tiles_converted += dirtymap_convert(&conv->map, since,
+				conv->convert, src, &out->image);
+		}
+		conv->frames++;
+	} else {
+		out = frame_alloc(conv->fourcc, conv->orient.width, conv->orient.height);
+		if (out == NULL)
+			return;
+
+		if (conv->parallel) {
+			if (conv->stats)
+				yuvstats_begin(&conv->st);
+			if (conv->convert_oriented)
+				bandconv_run_oriented(&conv->bands, conv->convert_oriented,
+						      &conv->orient, src, &out->image);
+			else
+				bandconv_run(&conv->bands, conv->convert, src, &out->image);
+			if (conv->stats)
+				yuvstats_end(&conv->st, frame->sequence, frame->timestamp);
+		} else if (conv->convert_oriented) {
+			if (conv->stats)
+				yuvstats_run(&conv->st, src, frame->sequence, frame->timestamp);
+			conv->convert_oriented(src, &out->image, &conv->orient, 0, src->height);
+		} else if (conv->stats) {
+			yuvstats_convert(&conv->st, conv->convert, src, &out->image,
+					 frame->sequence, frame->timestamp);
+		} else {
+			conv->convert(src, &out->image, 0, src->height);
+		}
+	}
+	out->sequence = frame->sequence;
+	out->flags = frame->flags;
+	out->field = frame->field;
+	out->timestamp = frame->timestamp;
+	out->dequeued = frame->dequeued;
+
+	pipeline_emit(node, out);
+	frame_put(out);
+}
+
+static void convert_cleanup(struct pipeline_node *node)
+{
+	struct convert_node *conv = (struct convert_node *)node->priv;
+
+	if (conv->parallel) {
+		printf("%s: ", node->name);
+		bandconv_print_stats(&conv->bands);
+		bandconv_cleanup(&conv->bands);
+	}
+
+	if (conv->dirty && conv->frames) {
+		dirtymap_print(&conv->map, node->name);
+		printf("%s: %u of %u outputs updated in place, %.1f%% of tiles converted\n",
+			node->name, conv->reused, conv->frames,
+			conv->map.tiles ? conv->tiles_converted * 100.0 / conv->map.tiles : 0.0);
+	}
+	if (conv->stats) {
+		yuvstats_print(&conv->st, node->name);
+		yuvstats_cleanup(&conv->st);
+	}
+	convert_drop_outputs(conv);
+	dirtymap_cleanup(&conv->map);
+	free(conv);
+}
+
+/* -----------------------------------------------------------------------------
+ * display
+ */
+
+#define DISPLAY_NODE_FRAMES	8
+
+struct display_node
+{
+	struct swsink_config config;
+	struct swsink *sink;
+	unsigned int fourcc;
+	bool failed;
+
+	/* Frames held by the sink, indexed by the sink buffer index. */
+	pthread_mutex_t lock;
+	struct frame *held[DISPLAY_NODE_FRAMES];
+};
+
+static void display_release(void *priv, unsigned int index)
+{
+	struct display_node *display = (struct display_node *)priv;
+	struct frame *frame;
+
+	pthread_mutex_lock(&display->lock);
+	frame = display->held[index];
+	display->held[index] = NULL;
+	pthread_mutex_unlock(&display->lock);
+
+	frame_put(frame);
+}
+
+static int display_init(struct pipeline_node *node)
+{
+	struct display_node *display;
+	const char *type;
+
+	display = (struct display_node *)calloc(1, sizeof *display);
+	if (display == NULL)
+		return -ENOMEM;
+
+	type = pipeline_node_arg(node, "type", "x11");
+	if (strcmp(type, "x11") == 0) {
+		display->config.type = SWSINK_X11;
+	} else if (strcmp(type, "fb") == 0) {
+		display->config.type = SWSINK_FBDEV;
+	} else {
+		printf("Invalid display type %s.\n", type);
+		free(display);
+		return -EINVAL;
+	}
+
+	display->config.device = pipeline_node_arg(node, "device", NULL);
+	display->config.refresh = pipeline_node_arg_uint(node, "refresh", 0);
+	pthread_mutex_init(&display->lock, NULL);
+
+	node->priv = display;
+	return 0;
+}
+
+static void display_process(struct pipeline_node *node, struct frame *frame)
+{
+	struct display_node *display = (struct display_node *)node->priv;
+	const struct image *img = &frame->image;
+	unsigned int index;
+
+	/* The sink is opened for the format of the first frame. */
+	if (display->sink == NULL && !display->failed) {
+		if (swsink_open(&display->sink, &display->config, img->fourcc,
+				img->width, img->height, display_release, display) < 0)
+			display->failed = true;
+		display->fourcc = img->fourcc;
+	}
+
+	if (display->sink == NULL || img->fourcc != display->fourcc)
+		return;
+
+	pthread_mutex_lock(&display->lock);
+	for (index = 0; index < DISPLAY_NODE_FRAMES; ++index) {
+		if (display->held[index] == NULL)
+			break;
+	}
+	if (index < DISPLAY_NODE_FRAMES)
+		display->held[index] = frame_get(frame);
+	pthread_mutex_unlock(&display->lock);
+
+	if (index < DISPLAY_NODE_FRAMES)
+		swsink_submit(display->sink, img, index);
+}
+
+static void display_cleanup(struct pipeline_node *node)
+{
+	struct display_node *display = (struct display_node *)node->priv;
+
+	if (display->sink) {
+		struct swsink_stats stats;
+
+		swsink_get_stats(display->sink, &stats);
+		printf("%s: %u shown, %u dropped, %u late.\n", node->name,
+			stats.shown, stats.dropped, stats.late);
+		swsink_close(display->sink);
+	}
+
+	pthread_mutex_destroy(&display->lock);
+	free(display);
+}
+
+/* -----------------------------------------------------------------------------
+ * output
+ */
+
+struct output_node
+{
+	struct v4l2out out;
+	unsigned int fourcc;
+	unsigned int codec;
+	bool parallel;
+	struct bandconv bands;
+	bool started;
+	bool failed;
+};
+
+static int output_init(struct pipeline_node *node)
+{
+	struct output_node *output;
+	const char *format;
+	const char *codec;
+	unsigned int threads;
+	int ret;
+
+	output = (struct output_node *)calloc(1, sizeof *output);
+	if (output == NULL)
+		return -ENOMEM;
+
+	format = pipeline_node_arg(node, "format", NULL);
+	codec = pipeline_node_arg(node, "codec", NULL);
+	if (format)
+		output->fourcc = v4l2_format_code(format);
+	if (codec)
+		output->codec = v4l2_format_code(codec);
+	if ((format && output->fourcc == 0) || (codec && output->codec == 0)) {
+		printf("Unsupported format %s.\n",
+			format && output->fourcc == 0 ? format : codec);
+		free(output);
+		return -EINVAL;
+	}
+
+	ret = v4l2out_open(&output->out, pipeline_node_arg(node, "device", "/dev/video10"),
+			   pipeline_node_arg_uint(node, "buffers", 4),
+			   pipeline_node_arg(node, "file", NULL));
+	if (ret < 0) {
+		free(output);
+		return ret;
+	}
+
+	threads = pipeline_node_arg_uint(node, "threads", 1);
+	if (threads != 1) {
+		ret = bandconv_init(&output->bands, threads,
+				    pipeline_node_arg(node, "cpus", NULL));
+		if (ret < 0) {
+			v4l2out_close(&output->out);
+			free(output);
+			return ret;
+		}
+		output->parallel = true;
+	}
+
+	node->priv = output;
+	return 0;
+}
+
+static void output_process(struct pipeline_node *node, struct frame *frame)
+{
+	struct output_node *output = (struct output_node *)node->priv;
+	const struct image *img = &frame->image;
+	int index;
+
+	/* The device format follows the first frame. */
+	if (!output->started && !output->failed) {
+		if (output->fourcc == 0)
+			output->fourcc = img->fourcc;
+		if (v4l2out_start(&output->out, img->fourcc, output->fourcc,
+				  img->width, img->height, output->codec) < 0)
+			output->failed = true;
+		else
+			output->started = true;
+	}
+
+	if (!output->started || img->width != output->out.dev.width ||
+	    img->height != output->out.dev.height)
+		return;
+
+	/* Wake up regularly to notice when the pipeline stops. */
+	do {
+		index = v4l2out_get(&output->out, 100);
+		if (node->pipeline->stop)
+			return;
+	} while (index == -EAGAIN);
+
+	if (index < 0)
+		return;
+
+	v4l2out_render(&output->out, index, img,
+		       output->parallel ? &output->bands : NULL);
+	v4l2out_queue(&output->out, index, frame->field, frame->sequence,
+		      frame->timestamp);
+}
+
+static void output_cleanup(struct pipeline_node *node)
+{
+	struct output_node *output = (struct output_node *)node->priv;
+
+	v4l2out_print(&output->out, node->name);
+	v4l2out_close(&output->out);
+	if (output->parallel)
+		bandconv_cleanup(&output->bands);
+	free(output);
+}
+
+/* -----------------------------------------------------------------------------
+ * bus
+ */
+
+struct bus_node
+{
+	struct framebus bus;
+	bool created;
+	bool failed;
+};
+
+static int bus_init(struct pipeline_node *node)
+{
+	struct bus_node *bus;
+
+	bus = (struct bus_node *)calloc(1, sizeof *bus);
+	if (bus == NULL)
+		return -ENOMEM;
+
+	node->priv = bus;
+	return 0;
+}
+
+static void bus_process(struct pipeline_node *node, struct frame *frame)
+{
+	struct bus_node *bus = (struct bus_node *)node->priv;
+	const struct image *img = &frame->image;
+
+	/* Slots are sized for the first frame. */
+	if (!bus->created && !bus->failed) {
+		if (framebus_create(&bus->bus, pipeline_node_arg(node, "name", node->name),
+				    pipeline_node_arg_uint(node, "slots", 4),
+				    img->stride * img->height) < 0)
+			bus->failed = true;
+		else
+			bus->created = true;
+	}
+
+	if (bus->created)
+		framebus_put(&bus->bus, img, frame->sequence, frame->timestamp);
+}
+
+static void bus_cleanup(struct pipeline_node *node)
+{
+	struct bus_node *bus = (struct bus_node *)node->priv;
+
+	if (bus->created)
+		framebus_close(&bus->bus);
+	free(bus);
+}
+
+/* -----------------------------------------------------------------------------
+ * motion
+ */
+
+struct motion_node
+{
+	struct motion md;
+	bool created;
+	bool failed;
+	bool gate;
+	unsigned int hold;
+	unsigned int remaining;
+	unsigned int passed;
+	FILE *log;
+};
+
+static int motion_node_init(struct pipeline_node *node)
+{
+	struct motion_node *motion;
+	const char *log;
+
+	motion = (struct motion_node *)calloc(1, sizeof *motion);
+	if (motion == NULL)
+		return -ENOMEM;
+
+	motion->gate = pipeline_node_arg_uint(node, "gate", 0);
+	motion->hold = pipeline_node_arg_uint(node, "hold", 30);
+
+	log = pipeline_node_arg(node, "log", NULL);
+	if (log) {
+		motion->log = fopen(log, "w");
+		if (motion->log == NULL) {
+			printf("Unable to open %s: %s (%d).\n", log, strerror(errno), errno);
+			free(motion);
+			return -errno;
+		}
+		fprintf(motion->log, "sequence,score,active,regions,[x,y,width,height,score]...\n");
+	}
+
+	node->priv = motion;
+	return 0;
+}
+
+static void motion_node_process(struct pipeline_node *node, struct frame *frame)
+{
+	struct motion_node *motion = (struct motion_node *)node->priv;
+	const struct image *img = &frame->image;
+	struct motion_result result;
+	unsigned int i;
+
+	/* Buffers are sized for the first frame. */
+	if (!motion->created && !motion->failed) {
+		if (motion_init(&motion->md, img->fourcc, img->width, img->height,
+				pipeline_node_arg_uint(node, "factor", 4)) < 0) {
+			printf("%s: no motion detection on %ux%u %s.\n", node->name,
+				img->width, img->height, v4l2_format_name(img->fourcc));
+			motion->failed = true;
+		} else {
+			motion->md.threshold = pipeline_node_arg_uint(node, "threshold", 12);
+			motion->md.rate = pipeline_node_arg_uint(node, "rate", 4);
+			motion->created = true;
+		}
+	}
+
+	if (!motion->created)
+		return;
+
+	motion_detect(&motion->md, img, &result);
+
+	if (motion->log) {
+		fprintf(motion->log, "%u,%.2f,%u,%u", frame->sequence, result.score / 256.0,
+			result.active, result.nregions);
+		for (i = 0; i < result.nregions; ++i) {
+			const struct motion_region *region = &result.regions[i];
+
+			fprintf(motion->log, ",%u,%u,%u,%u,%.2f", region->x, region->y,
+				region->width, region->height, region->score / 256.0);
+		}
+		fprintf(motion->log, "\n");
+	}
+
+	if (result.motion)
+		motion->remaining = motion->hold + 1;
+
+	if (!motion->gate || motion->remaining) {
+		if (motion->remaining)
+			motion->remaining--;
+		motion->passed++;
+		pipeline_emit(node, frame);
+	}
+}
+
+static void motion_node_cleanup(struct pipeline_node *node)
+{
+	struct motion_node *motion = (struct motion_node *)node->priv;
+
+	if (motion->created) {
+		motion_print(&motion->md, node->name);
+		printf("%s: %u frames passed on\n", node->name, motion->passed);
+		motion_cleanup(&motion->md);
+	}
+	if (motion->log)
+		fclose(motion->log);
+	free(motion);
+}
+
+/* -----------------------------------------------------------------------------
+ * denoise
+ */
+
+struct denoise_node
+{
+	struct denoise dn;
+	unsigned int fourcc;
+	bool created;
+	bool failed;
+};
+
+static int denoise_node_init(struct pipeline_node *node)
+{
+	struct denoise_node *denoise;
+	const char *format;
+
+	denoise = (struct denoise_node *)calloc(1, sizeof *denoise);
+	if (denoise == NULL)
+		return -ENOMEM;
+
+	format = pipeline_node_arg(node, "format", "RGB24");
+	denoise->fourcc = v4l2_format_code(format);
+	if (denoise->fourcc == 0) {
+		printf("Unsupported format %s.\n", format);
+		free(denoise);
+		return -EINVAL;
+	}
+
+	node->priv = denoise;
+	return 0;
+}
+
+static void denoise_node_process(struct pipeline_node *node, struct frame *frame)
+{
+	struct denoise_node *denoise = (struct denoise_node *)node->priv;
+	const struct image *img = &frame->image;
+	struct frame *out;
+
+	/* The history is sized for the first frame. */
+	if (!denoise->created && !denoise->failed) {
+		if (denoise_init(&denoise->dn, img->fourcc, denoise->fourcc,
+				 img->width, img->height) < 0) {
+			printf("%s: no denoise from %ux%u %s to %s.\n", node->name,
+				img->width, img->height, v4l2_format_name(img->fourcc),
+				v4l2_format_name(denoise->fourcc));
+			denoise->failed = true;
+		} else {
+			denoise_set_strength(&denoise->dn,
+				pipeline_node_arg_uint(node, "strength", 128),
+				pipeline_node_arg_uint(node, "threshold", 24));
+			denoise->created = true;
+		}
+	}
+
+	if (!denoise->created)
+		return;
+
+	out = frame_alloc(denoise->fourcc, img->width, img->height);
+	if (out == NULL)
+		return;
+
+	denoise_convert(&denoise->dn, img, &out->image);
+	out->sequence = frame->sequence;
+	out->flags = frame->flags;
+	out->field = frame->field;
+	out->timestamp = frame->timestamp;
+	out->dequeued = frame->dequeued;
+
+	pipeline_emit(node, out);
+	frame_put(out);
+}
+
+static void denoise_node_cleanup(struct pipeline_node *node)
+{
+	struct denoise_node *denoise = (struct denoise_node *)node->priv;
+
+	if (denoise->created) {
+		denoise_print(&denoise->dn, node->name);
+		denoise_cleanup(&denoise->dn);
+	}
+	free(denoise);
+}
+
+/* -----------------------------------------------------------------------------
+ * filter
+ */
+
+struct filter_node
+{
+	struct filter flt;
+	enum filter_mode mode;
+	unsigned int fourcc;
+	bool created;
+	bool failed;
+};
+
+static int filter_node_init(struct pipeline_node *node)
+{
+	struct filter_node *filter;
+	const char *mode;
+	const char *format;
+
+	filter = (struct filter_node *)calloc(1, sizeof *filter);
+	if (filter == NULL)
+		return -ENOMEM;
+
+	mode = pipeline_node_arg(node, "mode", "sharpen");
+	if (filter_parse_mode(mode, &filter->mode) < 0) {
+		printf("Unsupported filter %s.\n", mode);
+		free(filter);
+		return -EINVAL;
+	}
+
+	format = pipeline_node_arg(node, "format", NULL);
+	if (format) {
+		filter->fourcc = v4l2_format_code(format);
+		if (filter->fourcc == 0) {
+			printf("Unsupported format %s.\n", format);
+			free(filter);
+			return -EINVAL;
+		}
+	}
+
+	node->priv = filter;
+	return 0;
+}
+
+static void filter_node_process(struct pipeline_node *node, struct frame *frame)
+{
+	struct filter_node *filter = (struct filter_node *)node->priv;
+	const struct image *img = &frame->image;
+	unsigned int fourcc = filter->fourcc ? filter->fourcc : img->fourcc;
+	struct frame *out;
+
+	/* The line buffers are sized for the first frame. */
+	if (!filter->created && !filter->failed) {
+		if (filter_init(&filter->flt, filter->mode,
+				pipeline_node_arg_uint(node, "size", 3), img->fourcc,
+				fourcc, img->width, img->height) < 0) {
+			printf("%s: no filter from %ux%u %s to %s.\n", node->name,
+				img->width, img->height, v4l2_format_name(img->fourcc),
+				v4l2_format_name(fourcc));
+			filter->failed = true;
+		} else {
+			filter_set_amount(&filter->flt,
+				pipeline_node_arg_uint(node, "amount", FILTER_AMOUNT_ONE));
+			filter->created = true;
+		}
+	}
+
+	if (!filter->created)
+		return;
+
+	out = frame_alloc(fourcc, img->width, img->height);
+	if (out == NULL)
+		return;
+
+	filter_run(&filter->flt, img, &out->image);
+	out->sequence = frame->sequence;
+	out->flags = frame->flags;
+	out->field = frame->field;
+	out->timestamp = frame->timestamp;
+	out->dequeued = frame->dequeued;
+
+	pipeline_emit(node, out);
+	frame_put(out);
+}
+
+static void filter_node_cleanup(struct pipeline_node *node)
+{
+	struct filter_node *filter = (struct filter_node *)node->priv;
+
+	if (filter->created) {
+		filter_print(&filter->flt, node->name);
+		filter_cleanup(&filter->flt);
+	}
+	free(filter);
+}
+
+/* -----------------------------------------------------------------------------
+ * deinterlace
+ */
+
+static int deint_node_init(struct pipeline_node *node)
+{
+	enum deint_mode mode;
+	const char *name;
+	const char *rate;
+	const char *order;
+	struct deint *di;
+
+	name = pipeline_node_arg(node, "mode", "adaptive");
+	if (deint_parse_mode(name, &mode) < 0) {
+		printf("Unsupported deinterlacing mode %s.\n", name);
+		return -EINVAL;
+	}
+
+	rate = pipeline_node_arg(node, "rate", "frame");
+	order = pipeline_node_arg(node, "order", "tb");
+	if ((strcmp(rate, "frame") && strcmp(rate, "field")) ||
+	    (strcmp(order, "tb") && strcmp(order, "bt"))) {
+		printf("Invalid deinterlacing rate %s or order %s.\n", rate, order);
+		return -EINVAL;
+	}
+
+	di = (struct deint *)malloc(sizeof *di);
+	if (di == NULL)
+		return -ENOMEM;
+
+	deint_init(di, mode, strcmp(rate, "field") == 0,
+		   strcmp(order, "bt") ? V4L2_FIELD_INTERLACED_TB : V4L2_FIELD_INTERLACED_BT);
+	di->threshold = pipeline_node_arg_uint(node, "threshold", 12);
+
+	/* Both fields of a frame at field rate. */
+	node->emits = di->field_rate ? 2 : 1;
+	node->priv = di;
+	return 0;
+}
+
+static void deint_node_process(struct pipeline_node *node, struct frame *frame)
+{
+	struct deint *di = (struct deint *)node->priv;
+	unsigned int width, height;
+	int outputs;
+	int i;
+
+	if (deint_progressive(frame)) {
+		pipeline_emit(node, frame);
+		return;
+	}
+
+	outputs = deint_push(di, frame);
+	if (outputs < 0) {
+		printf("%s: cannot deinterlace %ux%u %s frames.\n", node->name,
+			frame->image.width, frame->image.height,
+			v4l2_format_name(frame->image.fourcc));
+		return;
+	}
+
+	deint_output_size(di, &width, &height);
+
+	for (i = 0; i < outputs; ++i) {
+		struct frame *out;
+
+		out = frame_alloc(frame->image.fourcc, width, height);
+		if (out == NULL)
+			return;
+
+		deint_render(di, i, out);
+		pipeline_emit(node, out);
+		frame_put(out);
+	}
+}
+
+static void deint_node_cleanup(struct pipeline_node *node)
+{
+	struct deint *di = (struct deint *)node->priv;
+
+	deint_print(di, node->name);
+	deint_reset(di);
+	free(di);
+}
+
+/* -----------------------------------------------------------------------------
+ * stats
+ */
+
+struct stats_node
+{
+	struct yuvstats st;
+	unsigned int zones_x;
+	unsigned int zones_y;
+	bool created;
+	bool failed;
+	FILE *log;
+};
+
+static int stats_node_init(struct pipeline_node *node)
+{
+	struct stats_node *stats;
+	const char *zones;
+	const char *log;
+
+	stats = (struct stats_node *)calloc(1, sizeof *stats);
+	if (stats == NULL)
+		return -ENOMEM;
+
+	zones = pipeline_node_arg(node, "zones", "8x8");
+	if (yuvstats_parse_zones(zones, &stats->zones_x, &stats->zones_y) < 0) {
+		printf("Invalid statistics zones %s.\n", zones);
+		free(stats);
+		return -EINVAL;
+	}
+
+	log = pipeline_node_arg(node, "log", NULL);
+	if (log) {
+		stats->log = fopen(log, "w");
+		if (stats->log == NULL) {
+			printf("Unable to open %s: %s (%d).\n", log, strerror(errno), errno);
+			free(stats);
+			return -errno;
+		}
+		fprintf(stats->log, "sequence,min,max,mean,[y,u,v]...\n");
+	}
+
+	node->priv = stats;
+	return 0;
+}
+
+/* Log the latest result the way a consumer on another thread would. */
+static void stats_node_log(struct stats_node *stats)
+{
+	const struct yuvstats_result *result;
+	uint32_t number;
+	unsigned int i;
+
+	result = yuvstats_latest(&stats->st, &number);
+	if (result == NULL)
+		return;
+
+	fprintf(stats->log, "%u,%u,%u,%.2f", result->sequence, result->min,
+		result->max, result->mean / 256.0);
+	for (i = 0; i < result->zones_x * result->zones_y; ++i)
+		fprintf(stats->log, ",%.1f,%.1f,%.1f", result->zones[i].y / 256.0,
+			result->zones[i].u / 256.0, result->zones[i].v / 256.0);
+	fprintf(stats->log, "\n");
+
+	if (!yuvstats_done(&stats->st, number))
+		fprintf(stats->log, "# result %u rewritten while logged\n", number);
+}
+
+static void stats_node_process(struct pipeline_node *node, struct frame *frame)
+{
+	struct stats_node *stats = (struct stats_node *)node->priv;
+	const struct image *img = &frame->image;
+
+	if (!stats->created && !stats->failed) {
+		if (yuvstats_init(&stats->st, img->fourcc, img->width, img->height,
+				  stats->zones_x, stats->zones_y, 1) < 0) {
+			printf("%s: no statistics of %ux%u %s.\n", node->name,
+				img->width, img->height, v4l2_format_name(img->fourcc));
+			stats->failed = true;
+		} else {
+			stats->created = true;
+		}
+	}
+
+	if (stats->created) {
+		yuvstats_run(&stats->st, img, frame->sequence, frame->timestamp);
+		if (stats->log)
+			stats_node_log(stats);
+	}
+
+	pipeline_emit(node, frame);
+}
+
+static void stats_node_cleanup(struct pipeline_node *node)
+{
+	struct stats_node *stats = (struct stats_node *)node->priv;
+
+	if (stats->created) {
+		yuvstats_print(&stats->st, node->name);
+		yuvstats_cleanup(&stats->st);
+	}
+	if (stats->log)
+		fclose(stats->log);
+	free(stats);
+}
+
+/* -----------------------------------------------------------------------------
+ * pyramid
+ */
+
+struct pyramid_node
+{
+	struct pyramid_config config;
+	unsigned int tensor_fourcc;
+	struct pyramid pyr;
+	bool created;
+	bool failed;
+};
+
+static int pyramid_node_init(struct pipeline_node *node)
+{
+	struct pyramid_node *pn;
+	struct pyramid_config *config;
+	const char *format;
+	const char *tensor;
+	unsigned int ports;
+	unsigned int i;
+
+	pn = (struct pyramid_node *)calloc(1, sizeof *pn);
+	if (pn == NULL)
+		return -ENOMEM;
+
+	config = &pn->config;
+
+	format = pipeline_node_arg(node, "format", "RGB24");
+	config->fourcc = v4l2_format_code(format);
+	if (config->fourcc == 0) {
+		printf("Unsupported format %s.\n", format);
+		free(pn);
+		return -EINVAL;
+	}
+
+	config->levels = pipeline_node_arg_uint(node, "levels", PYRAMID_MAX_LEVELS);
+	config->tensor_level = pipeline_node_arg_uint(node, "level", config->levels - 1);
+
+	tensor = pipeline_node_arg(node, "tensor", "none");
+	if (strcmp(tensor, "f16") == 0) {
+		config->tensor = TENSOR_FLOAT16;
+		pn->tensor_fourcc = V4L2_PIX_FMT_Y16;
+	} else if (strcmp(tensor, "i8") == 0) {
+		config->tensor = TENSOR_INT8;
+		pn->tensor_fourcc = V4L2_PIX_FMT_GREY;
+	} else if (strcmp(tensor, "none") != 0) {
+		printf("Unsupported tensor type %s.\n", tensor);
+		free(pn);
+		return -EINVAL;
+	}
+
+	if (sscanf(pipeline_node_arg(node, "mean", "0,0,0"), "%f,%f,%f",
+		   &config->mean[0], &config->mean[1], &config->mean[2]) != 3 ||
+	    sscanf(pipeline_node_arg(node, "scale", "1,1,1"), "%f,%f,%f",
+		   &config->scale[0], &config->scale[1], &config->scale[2]) != 3) {
+		printf("Invalid mean or scale, expected <r>,<g>,<b>.\n");
+		free(pn);
+		return -EINVAL;
+	}
+
+	ports = config->levels + (config->tensor != TENSOR_NONE);
+	for (i = 0; i < node->noutputs; ++i) {
+		if (node->outputs[i]->port >= ports) {
+			printf("%s has no output port %u.\n", node->name,
+				node->outputs[i]->port);
+			free(pn);
+			return -EINVAL;
+		}
+	}
+
+	node->priv = pn;
+	return 0;
+}
+
+static void pyramid_node_process(struct pipeline_node *node, struct frame *frame)
+{
+	struct pyramid_node *pn = (struct pyramid_node *)node->priv;
+	struct pyramid *pyr = &pn->pyr;
+	const struct image *src = &frame->image;
+	struct frame *out[PYRAMID_MAX_LEVELS + 1];
+	unsigned int nout = 0;
+	unsigned int i;
+
+	/* The layout follows the source, known once the first frame arrives. */
+	if (!pn->created && !pn->failed) {
+		if (pyramid_init(pyr, &pn->config, src->fourcc, src->width, src->height) < 0)
+			pn->failed = true;
+		else
+			pn->created = true;
+	}
+
+	if (!pn->created)
+		return;
+
+	for (i = 0; i < pn->config.levels; ++i) {
+		out[nout] = frame_alloc(pn->config.fourcc, pyr->level[i].width,
+					pyr->level[i].height);
+		if (out[nout] == NULL)
+			goto done;
+		pyr->level[i].data = out[nout++]->image.data;
+	}
+
+	if (pn->config.tensor != TENSOR_NONE) {
+		out[nout] = frame_alloc(pn->tensor_fourcc, pyr->tensor_width,
+					3 * pyr->tensor_height);
+		if (out[nout] == NULL)
+			goto done;
+		pyr->tensor = out[nout++]->image.data;
+	}
+
+	pyramid_process(pyr, src, 0, src->height);
+
+	for (i = 0; i < nout; ++i) {
+		out[i]->sequence = frame->sequence;
+		out[i]->flags = frame->flags;
+		out[i]->field = frame->field;
+		out[i]->timestamp = frame->timestamp;
+		out[i]->dequeued = frame->dequeued;
+		pipeline_emit_port(node, i, out[i]);
+	}
+
+done:
+	for (i = 0; i < nout; ++i)
+		frame_put(out[i]);
+}
+
+static void pyramid_node_cleanup(struct pipeline_node *node)
+{
+	free(node->priv);
+}
+
+#ifndef NODES_NO_GLES
+/* -----------------------------------------------------------------------------
+ * gpu
+ */
+
+struct gpu_node
+{
+	struct gpuconv gc;
+	unsigned int fourcc;
+	unsigned int slots;
+	const char *shader;
+	bool created;
+	bool failed;
+};
+
+static int gpu_node_init(struct pipeline_node *node)
+{
+	struct gpu_node *gpu;
+	const char *format;
+
+	gpu = (struct gpu_node *)calloc(1, sizeof *gpu);
+	if (gpu == NULL)
+		return -ENOMEM;
+
+	format = pipeline_node_arg(node, "format", "BGR32");
+	gpu->fourcc = v4l2_format_code(format);
+	if (gpu->fourcc != V4L2_PIX_FMT_BGR32 && gpu->fourcc != V4L2_PIX_FMT_RGB32) {
+		printf("Unsupported GPU output format %s.\n", format);
+		free(gpu);
+		return -EINVAL;
+	}
+
+	gpu->slots = pipeline_node_arg_uint(node, "slots", 2);
+	gpu->shader = pipeline_node_arg(node, "shader", "yuv2rgb.frag");
+
+	node->priv = gpu;
+	return 0;
+}
+
+static void gpu_node_process(struct pipeline_node *node, struct frame *frame)
+{
+	struct gpu_node *gpu = (struct gpu_node *)node->priv;
+	const struct image *src = &frame->image;
+	struct frame *out;
+
+	/* The context is created on the first frame, once its size is known. */
+	if (!gpu->created && !gpu->failed) {
+		if (gpuconv_init(&gpu->gc, src->fourcc, gpu->fourcc, src->width,
+				 src->height, gpu->slots, gpu->shader) < 0) {
+			printf("%s: no GPU conversion of %ux%u %s.\n", node->name,
+				src->width, src->height, v4l2_format_name(src->fourcc));
+			gpu->failed = true;
+		} else {
+			gpu->created = true;
+		}
+	}
+
+	if (!gpu->created)
+		return;
+
+	/* Any thread of the pool may run the node, the context follows it. */
+	gpuconv_acquire(&gpu->gc);
+
+	if (gpuconv_submit(&gpu->gc, frame) == 0 &&
+	    gpu->gc.pending == gpu->gc.nslots) {
+		out = frame_alloc(gpu->fourcc, src->width, src->height);
+		if (out) {
+			if (gpuconv_readback(&gpu->gc, out) == 0)
+				pipeline_emit(node, out);
+			frame_put(out);
+		}
+	}
+
+	gpuconv_release(&gpu->gc);
+}
+
+/* Read back the frames still in flight, oldest first, one per call. */
+static bool gpu_node_flush(struct pipeline_node *node)
+{
+	struct gpu_node *gpu = (struct gpu_node *)node->priv;
+	struct frame *out;
+	bool emitted = false;
+
+	if (!gpu->created || gpu->gc.pending == 0)
+		return false;
+
+	gpuconv_acquire(&gpu->gc);
+
+	out = frame_alloc(gpu->fourcc, gpu->gc.width, gpu->gc.height);
+	if (out) {
+		if (gpuconv_readback(&gpu->gc, out) == 0) {
+			pipeline_emit(node, out);
+			emitted = true;
+		}
+		frame_put(out);
+	}
+
+	gpuconv_release(&gpu->gc);
+	return emitted;
+}
+
+static void gpu_node_cleanup(struct pipeline_node *node)
+{
+	struct gpu_node *gpu = (struct gpu_node *)node->priv;
+
+	if (gpu->created) {
+		gpuconv_print(&gpu->gc, node->name);
+		gpuconv_cleanup(&gpu->gc);
+	}
+	free(gpu);
+}
+#endif
+
+/* -----------------------------------------------------------------------------
+ * null
+ */
+
+static void null_process(struct pipeline_node *, struct frame *)
+{
+}
+
+/* -----------------------------------------------------------------------------
+ * Types
+ */
+
+static const struct pipeline_node_ops pipeline_types[] = {
+	{ "pattern", true, pattern_init, pattern_produce, NULL, NULL, pattern_cleanup },
+	{ "capture", true, capture_init, capture_produce, NULL, NULL, capture_cleanup },
+	{ "convert", false, convert_init, NULL, convert_process, NULL, convert_cleanup },
+	{ "display", false, display_init, NULL, display_process, NULL, display_cleanup },
+	{ "output", false, output_init, NULL, output_process, NULL, output_cleanup },
+	{ "bus", false, bus_init, NULL, bus_process, NULL, bus_cleanup },
+	{ "motion", false, motion_node_init, NULL, motion_node_process, NULL, motion_node_cleanup },
+	{ "denoise", false, denoise_node_init, NULL, denoise_node_process, NULL, denoise_node_cleanup },
+	{ "filter", false, filter_node_init, NULL, filter_node_process, NULL, filter_node_cleanup },
+	{ "deinterlace", false, deint_node_init, NULL, deint_node_process, NULL, deint_node_cleanup },
+	{ "stats", false, stats_node_init, NULL, stats_node_process, NULL, stats_node_cleanup },
+	{ "pyramid", false, pyramid_node_init, NULL, pyramid_node_process, NULL, pyramid_node_cleanup },
+#ifndef NODES_NO_GLES
+	{ "gpu", false, gpu_node_init, NULL, gpu_node_process, gpu_node_flush, gpu_node_cleanup },
+#endif
+	{ "null", false, NULL, NULL, null_process, NULL, NULL },
+};
+
+const struct pipeline_node_ops *pipeline_find_type(const char *type)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(pipeline_types); ++i) {
+		if (strcmp(pipeline_types[i].type, type) == 0)
+			return &pipeline_types[i];
+	}
+
+	return NULL;
+}
@@ -0,0 +1,54 @@
+/*
+ * pattern.cpp -- synthetic test pattern
+ */
+
+#include "pattern.h"
+
+static const uint8_t pattern_bars[8][3] = {
+	{ 180, 128, 128 }, { 162, 44, 142 }, { 131, 156, 44 }, { 112, 72, 58 },
+	{ 84, 184, 198 }, { 65, 100, 212 }, { 35, 212, 114 }, { 16, 128, 128 },
+};
+
+static void pattern_line(uint8_t *p, unsigned int width, unsigned int sweep)
+{
+	unsigned int x;
+
+	for (x = 0; x < width; x += 2, p += 4) {
+		const uint8_t *c = pattern_bars[x * 8 / width];
+
+		if (x >= sweep && x < sweep + 8) {
+			p[0] = p[2] = 235;
+			p[1] = p[3] = 128;
+		} else {
+			p[0] = p[2] = c[0];
+			p[1] = c[1];
+			p[3] = c[2];
+		}
+	}
+}
+
+/*
+ * 75% colour bars in YUYV with a white bar sweeping across, so tearing
+ * and pacing problems are easy to spot.
+ */
+void pattern_fill(const struct image *img, unsigned int frame)
+{
+	unsigned int sweep = (frame * 4) % img->width & ~1;
+	unsigned int y;
+
+	for (y = 0; y < img->height; ++y)
+		pattern_line(img->data + y * img->stride, img->width, sweep);
+}
+
+/*
+ * The same as an interlaced camera sees it, top field first: the bottom
+ * lines are captured half a frame later, with the bar 2 pixels further.
+ */
+void pattern_fill_interlaced(const struct image *img, unsigned int frame)
+{
+	unsigned int y;
+
+	for (y = 0; y < img->height; ++y)
+		pattern_line(img->data + y * img->stride, img->width,
+			     (frame * 4 + (y & 1) * 2) % img->width & ~1);
+}
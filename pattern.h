@@ -0,0 +1,13 @@
+/*
+ * pattern.h -- synthetic test pattern
+ */
+
+#ifndef __PATTERN_H__
+#define __PATTERN_H__
+
+#include "convert.h"
+
+void pattern_fill(const struct image *img, unsigned int frame);
+void pattern_fill_interlaced(const struct image *img, unsigned int frame);
+
+#endif /* __PATTERN_H__ */
@@ -0,0 +1,643 @@
+/*
+ * pipeline.cpp -- pipeline graph executor
+ *
+ * Each queue has a single producer, the upstream node, and only the
+ * consumer task removes frames from it. A producer that sees room in its
+ * blocking outputs before it runs therefore still has that room when it
+ * emits, and a consumer that makes room kicks its producer.
+ */
+
+#include <ctype.h>
+
+#include "yavtalib.h"
+#include "pipeline.h"
+
+uint64_t pipeline_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* -----------------------------------------------------------------------------
+ * Queues
+ */
+
+static struct frame *pipeline_queue_pop(struct pipeline_queue *queue)
+{
+	struct frame *frame;
+
+	if (queue->count == 0)
+		return NULL;
+
+	frame = queue->frames[queue->first];
+	queue->first = (queue->first + 1) % queue->depth;
+	queue->count--;
+	return frame;
+}
+
+static void pipeline_queue_push(struct pipeline_queue *queue, struct frame *frame)
+{
+	queue->frames[(queue->first + queue->count) % queue->depth] = frame;
+	queue->count++;
+}
+
+/*
+ * Room for the frames the node may emit in every output that holds its
+ * producer back when full. A queue shallower than that is only asked to
+ * be empty.
+ */
+static bool pipeline_has_room(struct pipeline_node *node)
+{
+	unsigned int i;
+
+	for (i = 0; i < node->noutputs; ++i) {
+		struct pipeline_queue *queue = &node->outputs[i]->input;
+		unsigned int room = node->emits < queue->depth ? node->emits : queue->depth;
+
+		if (queue->policy == QUEUE_BLOCK && queue->count + room > queue->depth)
+			return false;
+	}
+
+	return true;
+}
+
+/* -----------------------------------------------------------------------------
+ * Scheduling
+ */
+
+static void pipeline_task(void *arg);
+
+/* Schedule a node if it has input and room for its output. */
+static void pipeline_kick(struct pipeline_node *node)
+{
+	bool submit = false;
+
+	pthread_mutex_lock(&node->lock);
+	if (node->ops->source) {
+		pthread_cond_signal(&node->cond);
+	} else if (!node->scheduled && node->input.count && pipeline_has_room(node)) {
+		node->scheduled = true;
+		submit = true;
+	}
+	pthread_mutex_unlock(&node->lock);
+
+	if (submit)
+		workpool_submit(&node->pipeline->pool, pipeline_task, node);
+}
+
+static void pipeline_task(void *arg)
+{
+	struct pipeline_node *node = (struct pipeline_node *)arg;
+	struct frame *frame;
+
+	pthread_mutex_lock(&node->lock);
+	frame = pipeline_queue_pop(&node->input);
+	pthread_mutex_unlock(&node->lock);
+
+	if (frame) {
+		uint64_t stamps[4];
+
+		stamps[0] = frame->timestamp;
+		stamps[1] = frame->dequeued;
+		stamps[2] = pipeline_now();
+
+		pipeline_kick(node->upstream);
+
+		node->ops->process(node, frame);
+		stamps[3] = pipeline_now();
+		node->busy += stamps[3] - stamps[2];
+		node->frames++;
+
+		if (node->latency)
+			latency_record(node->latency, frame->sequence, frame->flags, stamps);
+		frame_put(frame);
+
+		/*
+		 * The next task on this worker is likely another node's, so
+		 * nothing cached here would be reused. The free stacks are
+		 * LIFO and still hand the same memory out next.
+		 */
+		slotpool_flush(frame_pool());
+	}
+
+	pthread_mutex_lock(&node->lock);
+	node->scheduled = false;
+	pthread_mutex_unlock(&node->lock);
+
+	pipeline_kick(node);
+}
+
+/*
+ * Pass a frame on to every output of a node linked to port. Each queue
+ * takes its own reference; the caller keeps its reference.
+ */
+void pipeline_emit_port(struct pipeline_node *node, unsigned int port,
+	struct frame *frame)
+{
+	unsigned int i;
+
+	for (i = 0; i < node->noutputs; ++i) {
+		struct pipeline_node *output = node->outputs[i];
+		struct pipeline_queue *queue = &output->input;
+		struct frame *dropped = NULL;
+
+		if (output->port != port)
+			continue;
+
+		pthread_mutex_lock(&output->lock);
+		if (queue->count == queue->depth) {
+			queue->dropped++;
+			if (queue->policy != QUEUE_DROP_OLDEST) {
+				pthread_mutex_unlock(&output->lock);
+				continue;
+			}
+			dropped = pipeline_queue_pop(queue);
+		}
+		pipeline_queue_push(queue, frame_get(frame));
+		pthread_mutex_unlock(&output->lock);
+
+		if (dropped)
+			frame_put(dropped);
+
+		pipeline_kick(output);
+	}
+}
+
+/* Outputs are on port 0 unless the node has several. */
+void pipeline_emit(struct pipeline_node *node, struct frame *frame)
+{
+	pipeline_emit_port(node, 0, frame);
+}
+
+static void *pipeline_source_thread(void *arg)
+{
+	struct pipeline_node *node = (struct pipeline_node *)arg;
+	struct pipeline *pipe = node->pipeline;
+
+	while (!pipe->stop && (pipe->max_frames == 0 || node->frames < pipe->max_frames)) {
+		struct frame *frame;
+
+		/* Back-pressure from blocking outputs. */
+		pthread_mutex_lock(&node->lock);
+		while (!pipeline_has_room(node) && !pipe->stop) {
+			struct timespec ts;
+
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += 100000000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&node->cond, &node->lock, &ts);
+		}
+		pthread_mutex_unlock(&node->lock);
+
+		if (pipe->stop)
+			break;
+
+		frame = node->ops->produce(node);
+		if (frame == NULL)
+			break;
+
+		node->frames++;
+		pipeline_emit(node, frame);
+		frame_put(frame);
+	}
+
+	__sync_fetch_and_sub(&pipe->sources, 1);
+	return NULL;
+}
+
+/* -----------------------------------------------------------------------------
+ * Configuration
+ */
+
+static struct pipeline_node *pipeline_find_node(struct pipeline *pipe,
+	const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < pipe->nnodes; ++i) {
+		if (strcmp(pipe->nodes[i].name, name) == 0)
+			return &pipe->nodes[i];
+	}
+
+	return NULL;
+}
+
+static int pipeline_add_node(struct pipeline *pipe, char **words,
+	unsigned int nwords)
+{
+	const struct pipeline_node_ops *ops;
+	struct pipeline_node *node;
+	unsigned int i;
+
+	if (nwords < 3)
+		return -EINVAL;
+
+	if (pipeline_find_node(pipe, words[1])) {
+		printf("Node %s declared twice.\n", words[1]);
+		return -EINVAL;
+	}
+
+	ops = pipeline_find_type(words[2]);
+	if (ops == NULL) {
+		printf("Unknown node type %s.\n", words[2]);
+		return -EINVAL;
+	}
+
+	if (pipe->nnodes == PIPELINE_MAX_NODES || nwords - 3 > PIPELINE_MAX_ARGS)
+		return -E2BIG;
+
+	node = &pipe->nodes[pipe->nnodes++];
+	node->pipeline = pipe;
+	node->name = strdup(words[1]);
+	node->ops = ops;
+	node->emits = 1;
+	pthread_mutex_init(&node->lock, NULL);
+	pthread_cond_init(&node->cond, NULL);
+
+	for (i = 3; i < nwords; ++i) {
+		char *value = strchr(words[i], '=');
+
+		if (value == NULL) {
+			printf("Invalid argument %s for node %s.\n", words[i], node->name);
+			return -EINVAL;
+		}
+
+		*value++ = '\0';
+		node->args[node->nargs].key = strdup(words[i]);
+		node->args[node->nargs].value = strdup(value);
+		node->nargs++;
+	}
+
+	return 0;
+}
+
+static int pipeline_add_link(struct pipeline *pipe, char **words,
+	unsigned int nwords)
+{
+	struct pipeline_node *from, *to;
+	struct pipeline_queue *queue;
+	unsigned int i;
+
+	if (nwords < 3)
+		return -EINVAL;
+
+	from = pipeline_find_node(pipe, words[1]);
+	to = pipeline_find_node(pipe, words[2]);
+	if (from == NULL || to == NULL) {
+		printf("Link between undeclared nodes %s and %s.\n", words[1], words[2]);
+		return -EINVAL;
+	}
+
+	if (to->ops->source || to->upstream) {
+		printf("Node %s cannot take another input.\n", to->name);
+		return -EINVAL;
+	}
+
+	if (from->noutputs == PIPELINE_MAX_OUTPUTS)
+		return -E2BIG;
+
+	queue = &to->input;
+	queue->depth = 4;
+	queue->policy = QUEUE_BLOCK;
+
+	for (i = 3; i < nwords; ++i) {
+		if (strncmp(words[i], "depth=", 6) == 0) {
+			queue->depth = atoi(words[i] + 6);
+		} else if (strcmp(words[i], "policy=block") == 0) {
+			queue->policy = QUEUE_BLOCK;
+		} else if (strcmp(words[i], "policy=drop-oldest") == 0) {
+			queue->policy = QUEUE_DROP_OLDEST;
+		} else if (strcmp(words[i], "policy=drop-newest") == 0) {
+			queue->policy = QUEUE_DROP_NEWEST;
+		} else if (strncmp(words[i], "port=", 5) == 0) {
+			to->port = atoi(words[i] + 5);
+		} else {
+			printf("Invalid link option %s.\n", words[i]);
+			return -EINVAL;
+		}
+	}
+
+	if (queue->depth < 1 || queue->depth > PIPELINE_MAX_DEPTH) {
+		printf("Queue depth must be between 1 and %u.\n", PIPELINE_MAX_DEPTH);
+		return -EINVAL;
+	}
+
+	to->upstream = from;
+	from->outputs[from->noutputs++] = to;
+	return 0;
+}
+
+int pipeline_load(struct pipeline *pipe, const char *filename)
+{
+	char line[512];
+	unsigned int lineno = 0;
+	unsigned int i;
+	FILE *file;
+	int ret = 0;
+
+	memset(pipe, 0, sizeof *pipe);
+
+	file = fopen(filename, "r");
+	if (file == NULL) {
+		printf("Unable to open %s: %s (%d).\n", filename, strerror(errno), errno);
+		return -errno;
+	}
+
+	while (ret == 0 && fgets(line, sizeof line, file)) {
+		char *words[PIPELINE_MAX_ARGS + 3];
+		unsigned int nwords = 0;
+		char *p = line;
+
+		lineno++;
+
+		if (strchr(line, '#'))
+			*strchr(line, '#') = '\0';
+
+		while (nwords < ARRAY_SIZE(words)) {
+			while (isspace(*p))
+				p++;
+			if (*p == '\0')
+				break;
+			words[nwords++] = p;
+			while (*p && !isspace(*p))
+				p++;
+			if (*p)
+				*p++ = '\0';
+		}
+
+		if (nwords == 0)
+			continue;
+
+		if (strcmp(words[0], "node") == 0)
+			ret = pipeline_add_node(pipe, words, nwords);
+		else if (strcmp(words[0], "link") == 0)
+			ret = pipeline_add_link(pipe, words, nwords);
+		else
+			ret = -EINVAL;
+
+		if (ret < 0)
+			printf("%s:%u: invalid line.\n", filename, lineno);
+	}
+
+	fclose(file);
+
+	for (i = 0; ret == 0 && i < pipe->nnodes; ++i) {
+		struct pipeline_node *node = &pipe->nodes[i];
+
+		if (!node->ops->source && node->upstream == NULL) {
+			printf("Node %s has no input.\n", node->name);
+			ret = -EINVAL;
+		}
+	}
+
+	if (ret < 0)
+		pipeline_cleanup(pipe);
+
+	return ret;
+}
+
+const char *pipeline_node_arg(struct pipeline_node *node, const char *key,
+	const char *def)
+{
+	unsigned int i;
+
+	for (i = 0; i < node->nargs; ++i) {
+		if (strcmp(node->args[i].key, key) == 0)
+			return node->args[i].value;
+	}
+
+	return def;
+}
+
+unsigned int pipeline_node_arg_uint(struct pipeline_node *node, const char *key,
+	unsigned int def)
+{
+	const char *value = pipeline_node_arg(node, key, NULL);
+
+	return value ? strtoul(value, NULL, 0) : def;
+}
+
+/* -----------------------------------------------------------------------------
+ * Execution
+ */
+
+static int pipeline_init_latency(struct pipeline_node *node)
+{
+	static const char *const stages[] = {
+		"capture>dequeue", "dequeue>node", "node",
+	};
+	const char *csv = pipeline_node_arg(node, "latency", NULL);
+	int ret;
+
+	if (csv == NULL || node->ops->source)
+		return 0;
+
+	node->latency = (struct latency_stats *)malloc(sizeof *node->latency);
+	if (node->latency == NULL)
+		return -ENOMEM;
+
+	ret = latency_init(node->latency, stages, ARRAY_SIZE(stages),
+			   strcmp(csv, "1") ? csv : NULL);
+	if (ret < 0) {
+		free(node->latency);
+		node->latency = NULL;
+	}
+
+	return ret;
+}
+
+int pipeline_start(struct pipeline *pipe, unsigned int nthreads)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < pipe->nnodes; ++i) {
+		struct pipeline_node *node = &pipe->nodes[i];
+
+		ret = pipeline_init_latency(node);
+		if (ret < 0)
+			return ret;
+
+		ret = node->ops->init ? node->ops->init(node) : 0;
+		if (ret < 0) {
+			printf("Unable to initialize node %s.\n", node->name);
+			return ret;
+		}
+		node->initialized = true;
+	}
+
+	ret = workpool_init(&pipe->pool, nthreads);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < pipe->nnodes; ++i) {
+		struct pipeline_node *node = &pipe->nodes[i];
+
+		if (!node->ops->source)
+			continue;
+
+		__sync_fetch_and_add(&pipe->sources, 1);
+		ret = pthread_create(&node->thread, NULL, pipeline_source_thread, node);
+		if (ret) {
+			__sync_fetch_and_sub(&pipe->sources, 1);
+			pipeline_stop(pipe);
+			return -ret;
+		}
+		node->started = true;
+
+		if (pipeline_node_arg(node, "rt", NULL)) {
+			struct rt_config config;
+
+			ret = rt_parse(pipeline_node_arg(node, "rt", NULL), &config);
+			if (ret < 0) {
+				pipeline_stop(pipe);
+				return ret;
+			}
+			/* Running without the privilege is not fatal. */
+			rt_apply(node->thread, &config);
+		}
+	}
+
+	return 0;
+}
+
+/* Ask the sources to stop. Safe to call from a signal handler. */
+void pipeline_stop(struct pipeline *pipe)
+{
+	pipe->stop = true;
+}
+
+static bool pipeline_idle(struct pipeline *pipe)
+{
+	bool idle = true;
+	unsigned int i;
+
+	for (i = 0; i < pipe->nnodes && idle; ++i) {
+		struct pipeline_node *node = &pipe->nodes[i];
+
+		pthread_mutex_lock(&node->lock);
+		idle = !node->scheduled && node->input.count == 0;
+		pthread_mutex_unlock(&node->lock);
+	}
+
+	return idle;
+}
+
+/*
+ * Wait for the sources to end and for every queued frame to be processed,
+ * along with the frames the nodes still held then. Flushing an idle
+ * pipeline leaves every queue empty, so nothing flushed is dropped.
+ */
+void pipeline_wait(struct pipeline *pipe)
+{
+	bool flushed;
+	unsigned int i;
+
+	while (pipe->sources)
+		usleep(10000);
+
+	do {
+		while (!pipeline_idle(pipe))
+			usleep(1000);
+
+		flushed = false;
+		for (i = 0; i < pipe->nnodes; ++i) {
+			struct pipeline_node *node = &pipe->nodes[i];
+
+			if (node->ops->flush && node->initialized && node->ops->flush(node))
+				flushed = true;
+		}
+	} while (flushed);
+}
+
+void pipeline_print_stats(struct pipeline *pipe)
+{
+	static const char *policies[] = { "block", "drop-oldest", "drop-newest" };
+	unsigned int i;
+
+	printf("%-12s %-10s %8s %10s %8s  %s\n", "node", "type", "frames",
+		"ms/frame", "dropped", "input");
+
+	for (i = 0; i < pipe->nnodes; ++i) {
+		struct pipeline_node *node = &pipe->nodes[i];
+
+		printf("%-12s %-10s %8u %10.3f %8u  ", node->name, node->ops->type,
+			node->frames, node->frames ? node->busy / 1e6 / node->frames : 0.0,
+			node->input.dropped);
+		if (node->upstream && node->port)
+			printf("%s port %u, depth %u, %s\n", node->upstream->name,
+				node->port, node->input.depth, policies[node->input.policy]);
+		else if (node->upstream)
+			printf("%s, depth %u, %s\n", node->upstream->name,
+				node->input.depth, policies[node->input.policy]);
+		else
+			printf("-\n");
+	}
+
+	for (i = 0; i < pipe->pool.nthreads; ++i)
+		printf("worker %u: %u tasks, %u stolen\n", i,
+			pipe->pool.workers[i].executed, pipe->pool.workers[i].stolen);
+
+	for (i = 0; i < pipe->nnodes; ++i) {
+		if (pipe->nodes[i].latency)
+			latency_print(pipe->nodes[i].latency, pipe->nodes[i].name);
+	}
+}
+
+void pipeline_cleanup(struct pipeline *pipe)
+{
+	unsigned int i, j;
+
+	pipe->stop = true;
+
+	for (i = 0; i < pipe->nnodes; ++i) {
+		if (pipe->nodes[i].started)
+			pthread_join(pipe->nodes[i].thread, NULL);
+	}
+
+	if (pipe->pool.nthreads)
+		workpool_cleanup(&pipe->pool);
+
+	/* Frames still queued, then consumers before the sources they hold. */
+	for (i = 0; i < pipe->nnodes; ++i) {
+		struct frame *frame;
+
+		while ((frame = pipeline_queue_pop(&pipe->nodes[i].input)))
+			frame_put(frame);
+	}
+
+	for (j = 0; j < 2; ++j) {
+		for (i = 0; i < pipe->nnodes; ++i) {
+			struct pipeline_node *node = &pipe->nodes[i];
+
+			if (node->ops->source != (j == 1) || !node->initialized)
+				continue;
+			if (node->ops->cleanup)
+				node->ops->cleanup(node);
+			node->initialized = false;
+		}
+	}
+
+	for (i = 0; i < pipe->nnodes; ++i) {
+		struct pipeline_node *node = &pipe->nodes[i];
+
+		for (j = 0; j < node->nargs; ++j) {
+			free(node->args[j].key);
+			free(node->args[j].value);
+		}
+		if (node->latency) {
+			latency_cleanup(node->latency);
+			free(node->latency);
+		}
+		free(node->name);
+		pthread_cond_destroy(&node->cond);
+		pthread_mutex_destroy(&node->lock);
+	}
+
+	pipe->nnodes = 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * pipeline.h -- pipeline graph executor
+ *
+ * A pipeline is a graph of nodes declared in a configuration file:
+ *
+ *	# node <name> <type> [key=value ...]
+ *	node cam  capture device=/dev/video6
+ *	node rgb  convert format=BGR32
+ *	node show display type=x11
+ *	node pub  bus name=cam0
+ *	# link <from> <to> [depth=<n>] [policy=block|drop-oldest|drop-newest]
+ *	#      [port=<n>]
+ *	link cam rgb depth=2 policy=block
+ *	link rgb show depth=1 policy=drop-oldest
+ *	link cam pub depth=4 policy=drop-oldest
+ *
+ * Nodes with several outputs, such as the levels of a pyramid, emit each
+ * on a numbered port; a link takes port 0 unless port= says otherwise.
+ *
+ * Sources run on their own thread each, since they block on the device.
+ * Every other node has a single input queue and runs as a task on a
+ * work-stealing pool whenever it has input; a node never runs twice at
+ * once, but different nodes, and thus consecutive frames at different
+ * stages, run on all cores. Frames travel as reference counted handles
+ * and are never copied; an output can feed any number of nodes.
+ *
+ * Queues are bounded. A full "block" queue holds its producer back (a
+ * source waits, a task is not scheduled), the "drop" policies discard the
+ * oldest or the newest frame instead and count it.
+ *
+ * Source nodes take an rt=<setting> argument for the scheduling policy
+ * and CPUs of their thread, see rtsched.h. Other nodes take latency=1, or
+ * latency=<file.csv> for a per frame log, to break down the latency from
+ * capture to the end of their processing, see latency.h.
+ */
+
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include "frame.h"
+#include "workpool.h"
+#include "rtsched.h"
+#include "latency.h"
+
+#define PIPELINE_MAX_NODES	32
+#define PIPELINE_MAX_OUTPUTS	8
+#define PIPELINE_MAX_ARGS	8
+#define PIPELINE_MAX_DEPTH	32
+
+enum queue_policy
+{
+	QUEUE_BLOCK,
+	QUEUE_DROP_OLDEST,
+	QUEUE_DROP_NEWEST
+};
+
+struct pipeline_queue
+{
+	struct frame *frames[PIPELINE_MAX_DEPTH];
+	unsigned int depth;
+	unsigned int first;
+	volatile unsigned int count;
+	enum queue_policy policy;
+	unsigned int dropped;
+};
+
+struct pipeline;
+struct pipeline_node;
+
+struct pipeline_node_ops
+{
+	const char *type;
+	bool source;
+	int (*init)(struct pipeline_node *node);
+	/* Sources: wait for the next frame, NULL at the end of the stream. */
+	struct frame *(*produce)(struct pipeline_node *node);
+	/*
+	 * Others: handle one frame and pipeline_emit() at most one frame per
+	 * port in return, or as many as the node set in emits at init time.
+	 * The reference to the input frame stays with the caller.
+	 */
+	void (*process)(struct pipeline_node *node, struct frame *frame);
+	/*
+	 * Others, optional: once the sources have ended and the pipeline is
+	 * idle, emit like process() the frames the node still holds. Called
+	 * again as long as it returns true.
+	 */
+	bool (*flush)(struct pipeline_node *node);
+	void (*cleanup)(struct pipeline_node *node);
+};
+
+struct pipeline_arg
+{
+	char *key;
+	char *value;
+};
+
+struct pipeline_node
+{
+	struct pipeline *pipeline;
+	char *name;
+	const struct pipeline_node_ops *ops;
+	struct pipeline_arg args[PIPELINE_MAX_ARGS];
+	unsigned int nargs;
+	void *priv;
+	bool initialized;
+	/* Most frames one process() call emits per port, 1 unless init says more. */
+	unsigned int emits;
+
+	struct pipeline_node *upstream;
+	unsigned int port;
+	struct pipeline_node *outputs[PIPELINE_MAX_OUTPUTS];
+	unsigned int noutputs;
+
+	/* Protects input and scheduled; sources wait on cond for room. */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct pipeline_queue input;
+	bool scheduled;
+
+	pthread_t thread;
+	bool started;
+
+	/* Statistics. */
+	unsigned int frames;
+	uint64_t busy;
+	struct latency_stats *latency;
+};
+
+struct pipeline
+{
+	struct pipeline_node nodes[PIPELINE_MAX_NODES];
+	unsigned int nnodes;
+	struct workpool pool;
+
+	/* Sources stop after this many frames, 0 for no limit. */
+	unsigned int max_frames;
+	volatile bool stop;
+	volatile unsigned int sources;
+};
+
+int pipeline_load(struct pipeline *pipe, const char *filename);
+int pipeline_start(struct pipeline *pipe, unsigned int nthreads);
+void pipeline_stop(struct pipeline *pipe);
+void pipeline_wait(struct pipeline *pipe);
+void pipeline_print_stats(struct pipeline *pipe);
+void pipeline_cleanup(struct pipeline *pipe);
+
+void pipeline_emit(struct pipeline_node *node, struct frame *frame);
+void pipeline_emit_port(struct pipeline_node *node, unsigned int port,
+	struct frame *frame);
+const char *pipeline_node_arg(struct pipeline_node *node, const char *key,
+	const char *def);
+unsigned int pipeline_node_arg_uint(struct pipeline_node *node, const char *key,
+	unsigned int def);
+uint64_t pipeline_now(void);
+
+/* Node types, see nodes.cpp. */
+const struct pipeline_node_ops *pipeline_find_type(const char *type);
+
+#endif /* __PIPELINE_H__ */
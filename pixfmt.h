@@ -0,0 +1,176 @@
+/*
+ * pixfmt.h -- compile-time pixel format traits
+ *
+ * Every format known to the application is described once in PIXFMT_LIST.
+ * The list expands both into pixfmt_traits<> specializations, used to pick
+ * converters, upload paths and buffer sizes at compile time, and into the
+ * runtime pixfmt_info table behind the constant-time fourcc and name
+ * lookups in yavtalib.cpp.
+ */
+
+#ifndef __PIXFMT_H__
+#define __PIXFMT_H__
+
+#include "yavtalib.h"
+
+#ifndef V4L2_PIX_FMT_SGRBG10DPCM8
+#define V4L2_PIX_FMT_SGRBG10DPCM8	v4l2_fourcc('B', 'D', '1', '0')
+#endif
+
+enum pixfmt_class
+{
+	PIXFMT_CLASS_RGB,
+	PIXFMT_CLASS_YUV,
+	PIXFMT_CLASS_LUMA,
+	PIXFMT_CLASS_BAYER,
+	PIXFMT_CLASS_COMPRESSED
+};
+
+/* Memory layout of the components of one pixel (or pixel pair). */
+enum pixfmt_order
+{
+	ORDER_NONE,
+	ORDER_RGB332,
+	ORDER_RGB555,
+	ORDER_RGB565,
+	ORDER_RGB555X,
+	ORDER_RGB565X,
+	ORDER_RGB,
+	ORDER_BGR,
+	ORDER_XRGB,
+	ORDER_BGRX,
+	ORDER_Y,
+	ORDER_YUYV,
+	ORDER_UYVY,
+	ORDER_RAW
+};
+
+enum pixfmt_bayer
+{
+	BAYER_NONE,
+	BAYER_BGGR,
+	BAYER_GBRG,
+	BAYER_GRBG,
+	BAYER_RGGB
+};
+
+/*
+ * X(name, fourcc, class, bits per pixel, planes, horizontal chroma
+ *   subsampling, vertical chroma subsampling, order, bayer phase)
+ *
+ * Compressed formats have no fixed size and report 0 bits per pixel.
+ */
+#define PIXFMT_LIST(X) \
+	X("RGB332", V4L2_PIX_FMT_RGB332, PIXFMT_CLASS_RGB, 8, 1, 1, 1, ORDER_RGB332, BAYER_NONE) \
+	X("RGB555", V4L2_PIX_FMT_RGB555, PIXFMT_CLASS_RGB, 16, 1, 1, 1, ORDER_RGB555, BAYER_NONE) \
+	X("RGB565", V4L2_PIX_FMT_RGB565, PIXFMT_CLASS_RGB, 16, 1, 1, 1, ORDER_RGB565, BAYER_NONE) \
+	X("RGB555X", V4L2_PIX_FMT_RGB555X, PIXFMT_CLASS_RGB, 16, 1, 1, 1, ORDER_RGB555X, BAYER_NONE) \
+	X("RGB565X", V4L2_PIX_FMT_RGB565X, PIXFMT_CLASS_RGB, 16, 1, 1, 1, ORDER_RGB565X, BAYER_NONE) \
+	X("BGR24", V4L2_PIX_FMT_BGR24, PIXFMT_CLASS_RGB, 24, 1, 1, 1, ORDER_BGR, BAYER_NONE) \
+	X("RGB24", V4L2_PIX_FMT_RGB24, PIXFMT_CLASS_RGB, 24, 1, 1, 1, ORDER_RGB, BAYER_NONE) \
+	X("BGR32", V4L2_PIX_FMT_BGR32, PIXFMT_CLASS_RGB, 32, 1, 1, 1, ORDER_BGRX, BAYER_NONE) \
+	X("RGB32", V4L2_PIX_FMT_RGB32, PIXFMT_CLASS_RGB, 32, 1, 1, 1, ORDER_XRGB, BAYER_NONE) \
+	X("Y8", V4L2_PIX_FMT_GREY, PIXFMT_CLASS_LUMA, 8, 1, 1, 1, ORDER_Y, BAYER_NONE) \
+	X("Y16", V4L2_PIX_FMT_Y16, PIXFMT_CLASS_LUMA, 16, 1, 1, 1, ORDER_Y, BAYER_NONE) \
+	X("YUYV", V4L2_PIX_FMT_YUYV, PIXFMT_CLASS_YUV, 16, 1, 2, 1, ORDER_YUYV, BAYER_NONE) \
+	X("UYVY", V4L2_PIX_FMT_UYVY, PIXFMT_CLASS_YUV, 16, 1, 2, 1, ORDER_UYVY, BAYER_NONE) \
+	X("SBGGR8", V4L2_PIX_FMT_SBGGR8, PIXFMT_CLASS_BAYER, 8, 1, 1, 1, ORDER_RAW, BAYER_BGGR) \
+	X("SGBRG8", V4L2_PIX_FMT_SGBRG8, PIXFMT_CLASS_BAYER, 8, 1, 1, 1, ORDER_RAW, BAYER_GBRG) \
+	X("SGRBG8", V4L2_PIX_FMT_SGRBG8, PIXFMT_CLASS_BAYER, 8, 1, 1, 1, ORDER_RAW, BAYER_GRBG) \
+	X("SRGGB8", V4L2_PIX_FMT_SRGGB8, PIXFMT_CLASS_BAYER, 8, 1, 1, 1, ORDER_RAW, BAYER_RGGB) \
+	X("SGRBG10_DPCM8", V4L2_PIX_FMT_SGRBG10DPCM8, PIXFMT_CLASS_BAYER, 8, 1, 1, 1, ORDER_RAW, BAYER_GRBG) \
+	X("SBGGR10", V4L2_PIX_FMT_SBGGR10, PIXFMT_CLASS_BAYER, 16, 1, 1, 1, ORDER_RAW, BAYER_BGGR) \
+	X("SGBRG10", V4L2_PIX_FMT_SGBRG10, PIXFMT_CLASS_BAYER, 16, 1, 1, 1, ORDER_RAW, BAYER_GBRG) \
+	X("SGRBG10", V4L2_PIX_FMT_SGRBG10, PIXFMT_CLASS_BAYER, 16, 1, 1, 1, ORDER_RAW, BAYER_GRBG) \
+	X("SRGGB10", V4L2_PIX_FMT_SRGGB10, PIXFMT_CLASS_BAYER, 16, 1, 1, 1, ORDER_RAW, BAYER_RGGB) \
+	X("SBGGR12", V4L2_PIX_FMT_SBGGR12, PIXFMT_CLASS_BAYER, 16, 1, 1, 1, ORDER_RAW, BAYER_BGGR) \
+	X("SGBRG12", V4L2_PIX_FMT_SGBRG12, PIXFMT_CLASS_BAYER, 16, 1, 1, 1, ORDER_RAW, BAYER_GBRG) \
+	X("SGRBG12", V4L2_PIX_FMT_SGRBG12, PIXFMT_CLASS_BAYER, 16, 1, 1, 1, ORDER_RAW, BAYER_GRBG) \
+	X("SRGGB12", V4L2_PIX_FMT_SRGGB12, PIXFMT_CLASS_BAYER, 16, 1, 1, 1, ORDER_RAW, BAYER_RGGB) \
+	X("DV", V4L2_PIX_FMT_DV, PIXFMT_CLASS_COMPRESSED, 0, 1, 1, 1, ORDER_NONE, BAYER_NONE) \
+	X("MJPEG", V4L2_PIX_FMT_MJPEG, PIXFMT_CLASS_COMPRESSED, 0, 1, 1, 1, ORDER_NONE, BAYER_NONE) \
+	X("MPEG", V4L2_PIX_FMT_MPEG, PIXFMT_CLASS_COMPRESSED, 0, 1, 1, 1, ORDER_NONE, BAYER_NONE)
+
+struct pixfmt_info
+{
+	const char *name;
+	unsigned int fourcc;
+	unsigned char cls;
+	unsigned char bpp;
+	unsigned char planes;
+	unsigned char hsub;
+	unsigned char vsub;
+	unsigned char order;
+	unsigned char bayer;
+};
+
+/*
+ * Compile-time view. Only formats present in PIXFMT_LIST have a
+ * specialization, so using an unknown fourcc is a compile error.
+ */
+template<unsigned int FourCC> struct pixfmt_traits;
+
+#define PIXFMT_TRAITS(_name, _fourcc, _cls, _bpp, _planes, _hsub, _vsub, _order, _bayer) \
+template<> struct pixfmt_traits<_fourcc> \
+{ \
+	enum { \
+		fourcc = _fourcc, \
+		cls = _cls, \
+		bpp = _bpp, \
+		planes = _planes, \
+		hsub = _hsub, \
+		vsub = _vsub, \
+		order = _order, \
+		bayer = _bayer \
+	}; \
+	static const char *name() { return _name; } \
+	static unsigned int bytesperline(unsigned int width) \
+	{ \
+		return width * _bpp / 8; \
+	} \
+	static unsigned int image_size(unsigned int bpl, unsigned int height) \
+	{ \
+		return bpl * height; \
+	} \
+};
+
+PIXFMT_LIST(PIXFMT_TRAITS)
+
+#undef PIXFMT_TRAITS
+
+/*
+ * Byte offsets of the components of one pixel pair in packed 4:2:2
+ * formats, selected by pixfmt_traits<>::order.
+ */
+template<int Order> struct yuv422_layout;
+
+template<> struct yuv422_layout<ORDER_YUYV>
+{
+	enum { y0 = 0, u = 1, y1 = 2, v = 3 };
+};
+
+template<> struct yuv422_layout<ORDER_UYVY>
+{
+	enum { u = 0, y0 = 1, v = 2, y1 = 3 };
+};
+
+/*
+ * Runtime view. Both lookups are constant time and return NULL for
+ * unknown formats.
+ */
+const struct pixfmt_info *pixfmt_lookup(unsigned int fourcc);
+const struct pixfmt_info *pixfmt_lookup_name(const char *name);
+
+static inline unsigned int pixfmt_bytesperline(const struct pixfmt_info *info,
+	unsigned int width)
+{
+	return width * info->bpp / 8;
+}
+
+static inline unsigned int pixfmt_image_size(const struct pixfmt_info *info,
+	unsigned int bpl, unsigned int height)
+{
+	return info->bpp ? bpl * height : 0;
+}
+
+#endif /* __PIXFMT_H__ */
@@ -0,0 +1,296 @@
+/*
+ * pyramid.cpp -- fused conversion and downscale pyramid
+ *
+ * The source is consumed in strips of 2^(levels - 1) lines. Each strip is
+ * converted to full size first, which pulls it into the cache; the 1/2
+ * level is then box-filtered from the same lines, and the 1/4 level from
+ * the 1/2 level sums, so every source byte is read from memory once. The
+ * sums are kept on the stack for PYRAMID_CHUNK columns at a time.
+ */
+
+#include <math.h>
+
+#include "pyramid.h"
+
+/* Columns of the 1/2 level whose sums are kept at once. */
+#define PYRAMID_CHUNK		128
+#define PYRAMID_SUM_LINES	(1 << (PYRAMID_MAX_LEVELS - 2))
+
+uint16_t float_to_half(float value)
+{
+	union { float f; uint32_t u; } v;
+	uint32_t sign, mant, half;
+	int exp;
+
+	v.f = value;
+	sign = (v.u >> 16) & 0x8000;
+	exp = (int)((v.u >> 23) & 0xff) - 127 + 15;
+	mant = v.u & 0x7fffff;
+
+	if (((v.u >> 23) & 0xff) == 0xff)
+		return sign | 0x7c00 | (mant ? 0x200 : 0);
+	if (exp >= 31)
+		return sign | 0x7c00;
+
+	if (exp <= 0) {
+		unsigned int shift;
+
+		/* Denormal or zero. */
+		if (exp < -10)
+			return sign;
+
+		mant |= 0x800000;
+		shift = 14 - exp;
+		half = mant >> shift;
+		if ((mant >> (shift - 1)) & 1)
+			half++;
+		return sign | half;
+	}
+
+	half = sign | (exp << 10) | (mant >> 13);
+	/* Round to nearest, a carry correctly bumps the exponent. */
+	if (mant & 0x1000)
+		half++;
+	return half;
+}
+
+template<class Writer>
+static void pyramid_tensor_rows(struct pyramid *pyr, const struct image *level,
+	unsigned int first, unsigned int last)
+{
+	unsigned int plane = pyr->tensor_width * pyr->tensor_height;
+	unsigned int x, y;
+
+	for (y = first; y < last; ++y) {
+		const uint8_t *s = level->data + y * level->stride;
+		unsigned int offset = y * pyr->tensor_width;
+
+		if (pyr->config.tensor == TENSOR_FLOAT16) {
+			uint16_t *r = (uint16_t *)pyr->tensor + offset;
+			uint16_t *g = r + plane;
+			uint16_t *b = g + plane;
+
+			for (x = 0; x < level->width; ++x, s += Writer::bytes) {
+				r[x] = pyr->tensor_f16[0][s[Writer::r]];
+				g[x] = pyr->tensor_f16[1][s[Writer::g]];
+				b[x] = pyr->tensor_f16[2][s[Writer::b]];
+			}
+		} else {
+			int8_t *r = (int8_t *)pyr->tensor + offset;
+			int8_t *g = r + plane;
+			int8_t *b = g + plane;
+
+			for (x = 0; x < level->width; ++x, s += Writer::bytes) {
+				r[x] = pyr->tensor_i8[0][s[Writer::r]];
+				g[x] = pyr->tensor_i8[1][s[Writer::g]];
+				b[x] = pyr->tensor_i8[2][s[Writer::b]];
+			}
+		}
+	}
+}
+
+template<unsigned int Src, unsigned int Dst>
+struct pyramid_kernel
+{
+	typedef yuv422_layout<pixfmt_traits<Src>::order> layout;
+	typedef rgb_writer<pixfmt_traits<Dst>::order> writer;
+
+	/*
+	 * Columns [x0, x1) of the 1/2 level from a full strip, keeping the
+	 * sums for the 1/4 level, PYRAMID_CHUNK columns per line.
+	 */
+	static void half(struct pyramid *pyr, const struct image *src,
+		unsigned int y, unsigned int x0, unsigned int x1, int32_t *sums)
+	{
+		struct image *level = &pyr->level[1];
+		unsigned int pairs = pyr->strip / 2;
+		unsigned int p, x;
+
+		for (p = 0; p < pairs; ++p) {
+			const uint8_t *a = src->data + (y + 2 * p) * src->stride + x0 * 4;
+			const uint8_t *b = a + src->stride;
+			uint8_t *d = level->data + (y / 2 + p) * level->stride +
+				     x0 * writer::bytes;
+			int32_t *sum = sums + p * PYRAMID_CHUNK * 3;
+
+			for (x = x0; x < x1; ++x) {
+				int ys = a[layout::y0] + a[layout::y1]
+				       + b[layout::y0] + b[layout::y1];
+				int us = a[layout::u] + b[layout::u];
+				int vs = a[layout::v] + b[layout::v];
+				struct yuv_chroma c;
+
+				sum[0] = ys;
+				sum[1] = us;
+				sum[2] = vs;
+
+				yuv_chroma_terms((us + 1) >> 1, (vs + 1) >> 1, &c);
+				yuv_store<writer>(d, (ys + 2) >> 2, &c);
+
+				a += 4;
+				b += 4;
+				d += writer::bytes;
+				sum += 3;
+			}
+		}
+	}
+
+	/* The 1/4 level below 1/2 level columns [x0, x1), x0 even. */
+	static void quarter(struct pyramid *pyr, unsigned int y, unsigned int x0,
+		unsigned int x1, const int32_t *sums)
+	{
+		struct image *level = &pyr->level[2];
+		const int32_t *a = sums;
+		const int32_t *b = a + PYRAMID_CHUNK * 3;
+		unsigned int end = x1 / 2 < level->width ? x1 / 2 : level->width;
+		uint8_t *d = level->data + (y / 4) * level->stride +
+			     x0 / 2 * writer::bytes;
+		unsigned int x;
+
+		for (x = x0 / 2; x < end; ++x) {
+			int ys = a[0] + a[3] + b[0] + b[3];
+			int us = a[1] + a[4] + b[1] + b[4];
+			int vs = a[2] + a[5] + b[2] + b[5];
+			struct yuv_chroma c;
+
+			yuv_chroma_terms((us + 4) >> 3, (vs + 4) >> 3, &c);
+			yuv_store<writer>(d, (ys + 8) >> 4, &c);
+
+			a += 6;
+			b += 6;
+			d += writer::bytes;
+		}
+	}
+
+	static void process(struct pyramid *pyr, const struct image *src,
+		unsigned int first, unsigned int last)
+	{
+		unsigned int levels = pyr->config.levels;
+		unsigned int tl = pyr->config.tensor_level;
+		/* 0 without a 1/2 level. */
+		unsigned int width = pyr->level[1].width;
+		int32_t sums[PYRAMID_SUM_LINES * PYRAMID_CHUNK * 3];
+		unsigned int x, y;
+
+		for (y = first; y < last; y += pyr->strip) {
+			unsigned int end = last - y < pyr->strip ? last : y + pyr->strip;
+			bool full = end - y == pyr->strip &&
+				    end <= pyr->level[levels - 1].height << (levels - 1);
+
+			simd_converter<Src, Dst>::convert(src, &pyr->level[0], y, end);
+
+			for (x = 0; full && x < width; x += PYRAMID_CHUNK) {
+				unsigned int x1 = width - x < PYRAMID_CHUNK
+						? width : x + PYRAMID_CHUNK;
+
+				half(pyr, src, y, x, x1, sums);
+				if (levels > 2)
+					quarter(pyr, y, x, x1, sums);
+			}
+
+			if (pyr->config.tensor == TENSOR_NONE || (!full && tl > 0))
+				continue;
+
+			pyramid_tensor_rows<writer>(pyr, &pyr->level[tl],
+						    y >> tl, end >> tl);
+		}
+	}
+};
+
+struct pyramid_entry
+{
+	unsigned int src;
+	unsigned int dst;
+	pyramid_fn fn;
+};
+
+#define PYRAMID(_src, _dst) \
+	{ _src, _dst, pyramid_kernel<_src, _dst>::process }
+
+static const struct pyramid_entry pyramid_kernels[] = {
+	PYRAMID(V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_RGB24),
+	PYRAMID(V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_BGR24),
+	PYRAMID(V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_BGR32),
+	PYRAMID(V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_RGB32),
+	PYRAMID(V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_RGB24),
+	PYRAMID(V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_BGR24),
+	PYRAMID(V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_BGR32),
+	PYRAMID(V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_RGB32),
+};
+
+#undef PYRAMID
+
+int pyramid_init(struct pyramid *pyr, const struct pyramid_config *config,
+	unsigned int src_fourcc, unsigned int width, unsigned int height)
+{
+	unsigned int height_full;
+	unsigned int i;
+	int ret;
+
+	memset(pyr, 0, sizeof *pyr);
+
+	if (config->levels < 1 || config->levels > PYRAMID_MAX_LEVELS ||
+	    (config->tensor != TENSOR_NONE && config->tensor_level >= config->levels) ||
+	    width & 1) {
+		printf("Invalid pyramid configuration.\n");
+		return -EINVAL;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(pyramid_kernels); ++i) {
+		if (pyramid_kernels[i].src == src_fourcc &&
+		    pyramid_kernels[i].dst == config->fourcc)
+			pyr->fn = pyramid_kernels[i].fn;
+	}
+
+	if (pyr->fn == NULL) {
+		printf("No pyramid kernel for %s to %s.\n",
+			v4l2_format_name(src_fourcc), v4l2_format_name(config->fourcc));
+		return -EINVAL;
+	}
+
+	pyr->config = *config;
+	pyr->strip = 1 << (config->levels - 1);
+
+	/* Lower levels only cover complete strips. */
+	height_full = height / pyr->strip * pyr->strip;
+
+	for (i = 0; i < config->levels; ++i) {
+		struct image *level = &pyr->level[i];
+
+		ret = image_init(level, config->fourcc, width >> i,
+				 i ? height_full >> i : height, 0, NULL);
+		if (ret < 0)
+			return ret;
+	}
+
+	if (config->tensor != TENSOR_NONE) {
+		unsigned int size = config->tensor == TENSOR_FLOAT16 ? 2 : 1;
+
+		pyr->tensor_width = pyr->level[config->tensor_level].width;
+		pyr->tensor_height = pyr->level[config->tensor_level].height;
+		pyr->tensor_size = 3 * size * pyr->tensor_width * pyr->tensor_height;
+
+		/* The normalization is a per-channel function of one byte. */
+		for (i = 0; i < 3 * 256; ++i) {
+			unsigned int c = i / 256;
+			float value = ((i % 256) - config->mean[c]) * config->scale[c];
+			long q = lrintf(value);
+
+			pyr->tensor_f16[c][i % 256] = float_to_half(value);
+			pyr->tensor_i8[c][i % 256] = q < -128 ? -128 : q > 127 ? 127 : q;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Process source lines [first, last) into the memory set in level[].data
+ * and tensor. Bands handed to concurrent callers must start on a multiple
+ * of pyr->strip, they then share no line of any level nor of the tensor.
+ */
+void pyramid_process(struct pyramid *pyr, const struct image *src,
+	unsigned int first, unsigned int last)
+{
+	pyr->fn(pyr, src, first, last);
+}
@@ -0,0 +1,73 @@
+/*
+ * pyramid.h -- fused conversion and downscale pyramid
+ *
+ * Converts a packed 4:2:2 frame to full size RGB and, in the same pass
+ * over the source, to 1/2 and 1/4 scale levels box-filtered in the YUV
+ * domain. One level can additionally be written as a planar (CHW) float16
+ * or int8 tensor normalized with per-channel mean and scale, ready to be
+ * handed to an inference engine.
+ *
+ * pyramid_init() only lays the levels and the tensor out; the caller
+ * provides their memory, level[i].stride * level[i].height and
+ * tensor_size bytes, by setting level[].data and tensor before calling
+ * pyramid_process(), for instance frames from frame_alloc() that are
+ * then handed on without a copy.
+ */
+
+#ifndef __PYRAMID_H__
+#define __PYRAMID_H__
+
+#include "convert.h"
+
+#define PYRAMID_MAX_LEVELS	3
+
+enum tensor_type
+{
+	TENSOR_NONE,
+	TENSOR_FLOAT16,
+	TENSOR_INT8
+};
+
+struct pyramid_config
+{
+	unsigned int fourcc;		/* RGB24, BGR24, RGB32 or BGR32 */
+	unsigned int levels;		/* 1 to PYRAMID_MAX_LEVELS */
+	enum tensor_type tensor;
+	unsigned int tensor_level;
+	/* tensor = (component - mean) * scale, in R, G, B order */
+	float mean[3];
+	float scale[3];
+};
+
+struct pyramid;
+
+typedef void (*pyramid_fn)(struct pyramid *pyr, const struct image *src,
+	unsigned int first, unsigned int last);
+
+struct pyramid
+{
+	struct pyramid_config config;
+	struct image level[PYRAMID_MAX_LEVELS];
+
+	/* Planar tensor, three planes of tensor_width x tensor_height. */
+	void *tensor;
+	unsigned int tensor_width;
+	unsigned int tensor_height;
+	unsigned int tensor_size;
+
+	/* Lines of the source consumed by one pass of the kernel. */
+	unsigned int strip;
+
+	pyramid_fn fn;
+	uint16_t tensor_f16[3][256];
+	int8_t tensor_i8[3][256];
+};
+
+int pyramid_init(struct pyramid *pyr, const struct pyramid_config *config,
+	unsigned int src_fourcc, unsigned int width, unsigned int height);
+void pyramid_process(struct pyramid *pyr, const struct image *src,
+	unsigned int first, unsigned int last);
+
+uint16_t float_to_half(float value);
+
+#endif /* __PYRAMID_H__ */
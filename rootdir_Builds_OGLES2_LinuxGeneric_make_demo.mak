@@ -26,7 +26,7 @@ endif
 SHELLOSPATH = $(SDKDIR)/Shell/OS/$(SHELLOS)
 
 CONTENT := $(addprefix ../../Content/, $(subst .o,.cpp, $(OBJECTS)))
-OBJECTS += $(OUTNAME).o PVRShell.o PVRShellAPI.o PVRShellOS.o yavtalib.o
+OBJECTS += $(OUTNAME).o PVRShell.o PVRShellAPI.o PVRShellOS.o yavtalib.o convert.o pyramid.o tiledtex.o framebus.o bandconv.o rtsched.o jitter.o latency.o integrity.o dirtymap.o dmatex.o
 OBJECTS := $(addprefix $(PLAT_OBJPATH)/, $(OBJECTS))
 
 INCLUDES += -I$(SDKDIR)/Tools/OGLES2 						\
@@ -43,7 +43,7 @@ VPATH += ../..                      : \
 		 $(SDKDIR)/Shell/API/KEGL   : \
 		 $(SHELLOSPATH)
 
-LINK         += -L$(SDKDIR)/Tools/OGLES2/Build/LinuxGeneric/$(PLAT_OBJPATH) -logles2tools -lrt
+LINK         += -L$(SDKDIR)/Tools/OGLES2/Build/LinuxGeneric/$(PLAT_OBJPATH) -logles2tools -lrt -lpthread
 ifeq  ($(PLATFORM),LinuxX86_64)
 TEXTOOL_PATH  =  $(SDKDIR)/Utilities/PVRTexTool/PVRTexToolCL/Linux_x86_64/PVRTexTool
 FILEWRAP_PATH =  $(SDKDIR)/Utilities/Filewrap/Linux_x86_64/Filewrap
@@ -0,0 +1,177 @@
+/*
+ * rtsched.cpp -- real-time scheduling and CPU affinity
+ */
+
+#include <sys/mman.h>
+
+#include "yavtalib.h"
+#include "rtsched.h"
+
+/* Parse a CPU list such as "0-3,6". */
+int cpulist_parse(const char *list, cpu_set_t *set)
+{
+	const char *p = list;
+
+	CPU_ZERO(set);
+
+	while (*p) {
+		unsigned int first, last;
+		char *end;
+
+		first = last = strtoul(p, &end, 10);
+		if (end == p)
+			return -EINVAL;
+		p = end;
+
+		if (*p == '-') {
+			last = strtoul(++p, &end, 10);
+			if (end == p || last < first)
+				return -EINVAL;
+			p = end;
+		}
+
+		if (last >= CPU_SETSIZE)
+			return -EINVAL;
+
+		for (; first <= last; ++first)
+			CPU_SET(first, set);
+
+		if (*p == ',')
+			p++;
+		else if (*p)
+			return -EINVAL;
+	}
+
+	return CPU_COUNT(set) ? 0 : -EINVAL;
+}
+
+int rt_parse(const char *spec, struct rt_config *config)
+{
+	static const struct {
+		const char *name;
+		int policy;
+	} policies[] = {
+		{ "other", SCHED_OTHER },
+		{ "fifo", SCHED_FIFO },
+		{ "rr", SCHED_RR },
+	};
+	const char *cpus = strchr(spec, '@');
+	size_t len = cpus ? (size_t)(cpus - spec) : strlen(spec);
+	const char *prio = (const char *)memchr(spec, ':', len);
+	size_t namelen = prio ? (size_t)(prio - spec) : len;
+	unsigned int i;
+
+	memset(config, 0, sizeof *config);
+
+	if (namelen) {
+		for (i = 0; i < ARRAY_SIZE(policies); ++i) {
+			if (strlen(policies[i].name) == namelen &&
+			    strncmp(policies[i].name, spec, namelen) == 0)
+				break;
+		}
+		if (i == ARRAY_SIZE(policies))
+			goto error;
+
+		config->set_policy = true;
+		config->policy = policies[i].policy;
+	}
+
+	if (prio) {
+		char *end;
+
+		config->priority = strtol(prio + 1, &end, 10);
+		if (end != spec + len || !config->set_policy ||
+		    config->priority < sched_get_priority_min(config->policy) ||
+		    config->priority > sched_get_priority_max(config->policy))
+			goto error;
+	} else if (config->set_policy && config->policy != SCHED_OTHER) {
+		config->priority = sched_get_priority_min(config->policy);
+	}
+
+	if (cpus) {
+		if (cpulist_parse(cpus + 1, &config->cpus) < 0)
+			goto error;
+		config->set_cpus = true;
+	}
+
+	return 0;
+
+error:
+	printf("Invalid scheduling setting '%s'.\n", spec);
+	return -EINVAL;
+}
+
+int rt_apply(pthread_t thread, const struct rt_config *config)
+{
+	int ret;
+
+	if (config->set_policy) {
+		struct sched_param param;
+
+		memset(&param, 0, sizeof param);
+		param.sched_priority = config->priority;
+		ret = pthread_setschedparam(thread, config->policy, &param);
+		if (ret) {
+			printf("Unable to set scheduling policy: %s (%d).\n",
+				strerror(ret), ret);
+			return -ret;
+		}
+	}
+
+	if (config->set_cpus) {
+		ret = pthread_setaffinity_np(thread, sizeof config->cpus, &config->cpus);
+		if (ret) {
+			printf("Unable to set CPU affinity: %s (%d).\n",
+				strerror(ret), ret);
+			return -ret;
+		}
+	}
+
+	return 0;
+}
+
+int rt_apply_spec(pthread_t thread, const char *spec)
+{
+	struct rt_config config;
+	int ret;
+
+	ret = rt_parse(spec, &config);
+	if (ret < 0)
+		return ret;
+
+	return rt_apply(thread, &config);
+}
+
+/* Keep all current and future pages resident, no page faults in the loop. */
+int rt_lock_memory(void)
+{
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+		printf("Unable to lock memory: %s (%d).\n", strerror(errno), errno);
+		return -errno;
+	}
+
+	return 0;
+}
+
+/* Show the settings a thread ended up with. */
+void rt_print(pthread_t thread, const char *name)
+{
+	struct sched_param param;
+	cpu_set_t cpus;
+	int policy;
+	int i;
+
+	if (pthread_getschedparam(thread, &policy, &param) ||
+	    pthread_getaffinity_np(thread, sizeof cpus, &cpus))
+		return;
+
+	printf("%s: %s priority %d, CPUs", name,
+		policy == SCHED_FIFO ? "fifo" : policy == SCHED_RR ? "rr" : "other",
+		param.sched_priority);
+
+	for (i = 0; i < CPU_SETSIZE; ++i) {
+		if (CPU_ISSET(i, &cpus))
+			printf(" %d", i);
+	}
+	printf("\n");
+}
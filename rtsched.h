@@ -0,0 +1,37 @@
+/*
+ * rtsched.h -- real-time scheduling and CPU affinity
+ *
+ * Thread settings are given as "<policy>[:<priority>][@<cpus>]", with a
+ * policy of other, fifo or rr and a CPU list such as "2-3,6", e.g.
+ *
+ *	fifo:50@2	SCHED_FIFO at priority 50, pinned to CPU 2
+ *	rr:10		SCHED_RR at priority 10, on any CPU
+ *	@0-1		default policy, on CPU 0 or 1
+ *
+ * Real-time policies need CAP_SYS_NICE or an RLIMIT_RTPRIO.
+ */
+
+#ifndef __RTSCHED_H__
+#define __RTSCHED_H__
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+
+struct rt_config
+{
+	bool set_policy;
+	int policy;
+	int priority;
+	bool set_cpus;
+	cpu_set_t cpus;
+};
+
+int cpulist_parse(const char *list, cpu_set_t *set);
+int rt_parse(const char *spec, struct rt_config *config);
+int rt_apply(pthread_t thread, const struct rt_config *config);
+int rt_apply_spec(pthread_t thread, const char *spec);
+int rt_lock_memory(void);
+void rt_print(pthread_t thread, const char *name);
+
+#endif /* __RTSCHED_H__ */
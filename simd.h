@@ -0,0 +1,578 @@
+/*
+ * simd.h -- NEON/SSE2 helpers shared by the CPU kernels
+ *
+ * Kernels include this header and test HAVE_SIMD; builds without either
+ * instruction set fall back to the scalar code paths.
+ */
+
+#ifndef __SIMD_H__
+#define __SIMD_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SIMD_NEON	1
+#define HAVE_SIMD	1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD_SSE2	1
+#define HAVE_SIMD	1
+#endif
+
+#define SIMD_ALIGN	__attribute__((aligned(16)))
+
+#ifdef HAVE_SIMD
+
+/*
+ * YUV to RGB giving the same result as the 16.16 scalar kernel in
+ * convert.h. Its coefficients are split into a multiple of 1 << 16,
+ * added in 16-bit lanes, and a remainder that fits in 16 bits, whose
+ * products are summed in 32-bit lanes and rounded the same way.
+ */
+#define SIMD_YUV_Y	10768	/* YUV_FIX_Y - (1 << 16) */
+#define SIMD_YUV_RV	-26490	/* YUV_FIX_RV - (2 << 16) */
+#define SIMD_YUV_GU	-25672	/* -YUV_FIX_GU */
+#define SIMD_YUV_GV	12262	/* (1 << 16) - YUV_FIX_GV */
+#define SIMD_YUV_BU	1114	/* YUV_FIX_BU - (2 << 16) */
+
+#if defined(SIMD_NEON)
+typedef uint8x16_t simd_u8;
+
+static inline simd_u8 simd_load(const uint8_t *p)
+{
+	return vld1q_u8(p);
+}
+
+static inline void simd_store(uint8_t *p, simd_u8 v)
+{
+	vst1q_u8(p, v);
+}
+#else
+typedef __m128i simd_u8;
+
+static inline simd_u8 simd_load(const uint8_t *p)
+{
+	return _mm_loadu_si128((const __m128i *)p);
+}
+
+static inline void simd_store(uint8_t *p, simd_u8 v)
+{
+	_mm_storeu_si128((__m128i *)p, v);
+}
+#endif
+
+struct simd_rgb
+{
+	simd_u8 r;
+	simd_u8 g;
+	simd_u8 b;
+};
+
+#if defined(SIMD_NEON)
+/*
+ * One channel of 8 pixels from luma less 16, the chroma remainder
+ * products c and the chroma multiples base.
+ */
+static inline uint8x8_t simd_yuv_channel(int16x8_t y, const int32x4_t *c,
+	int16x8_t base)
+{
+	int32x4_t lo = vmlal_n_s16(c[0], vget_low_s16(y), SIMD_YUV_Y);
+	int32x4_t hi = vmlal_n_s16(c[1], vget_high_s16(y), SIMD_YUV_Y);
+	int16x8_t v = vcombine_s16(vrshrn_n_s32(lo, 16), vrshrn_n_s32(hi, 16));
+
+	return vqmovun_s16(vaddq_s16(vaddq_s16(v, y), base));
+}
+
+/* Convert 16 pixels (32 bytes) of packed 4:2:2 YUV. */
+template<class Layout>
+static inline void simd_yuv422_to_rgb(const uint8_t *s, struct simd_rgb *rgb)
+{
+	uint8x8x4_t in = vld4_u8(s);
+	int16x8_t bias = vdupq_n_s16(128);
+	int16x8_t u = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(in.val[Layout::u])), bias);
+	int16x8_t v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(in.val[Layout::v])), bias);
+	int16x8_t y0 = vreinterpretq_s16_u16(vmovl_u8(in.val[Layout::y0]));
+	int16x8_t y1 = vreinterpretq_s16_u16(vmovl_u8(in.val[Layout::y1]));
+	int32x4_t rc[2], gc[2], bc[2];
+	int16x8_t rb, gb, bb;
+	uint8x8x2_t r, g, b;
+
+	rc[0] = vmull_n_s16(vget_low_s16(v), SIMD_YUV_RV);
+	rc[1] = vmull_n_s16(vget_high_s16(v), SIMD_YUV_RV);
+	gc[0] = vmlal_n_s16(vmull_n_s16(vget_low_s16(u), SIMD_YUV_GU),
+			    vget_low_s16(v), SIMD_YUV_GV);
+	gc[1] = vmlal_n_s16(vmull_n_s16(vget_high_s16(u), SIMD_YUV_GU),
+			    vget_high_s16(v), SIMD_YUV_GV);
+	bc[0] = vmull_n_s16(vget_low_s16(u), SIMD_YUV_BU);
+	bc[1] = vmull_n_s16(vget_high_s16(u), SIMD_YUV_BU);
+
+	rb = vshlq_n_s16(v, 1);
+	gb = vnegq_s16(v);
+	bb = vshlq_n_s16(u, 1);
+
+	y0 = vsubq_s16(y0, vdupq_n_s16(16));
+	y1 = vsubq_s16(y1, vdupq_n_s16(16));
+
+	r = vzip_u8(simd_yuv_channel(y0, rc, rb), simd_yuv_channel(y1, rc, rb));
+	g = vzip_u8(simd_yuv_channel(y0, gc, gb), simd_yuv_channel(y1, gc, gb));
+	b = vzip_u8(simd_yuv_channel(y0, bc, bb), simd_yuv_channel(y1, bc, bb));
+
+	rgb->r = vcombine_u8(r.val[0], r.val[1]);
+	rgb->g = vcombine_u8(g.val[0], g.val[1]);
+	rgb->b = vcombine_u8(b.val[0], b.val[1]);
+}
+
+static inline void simd_store4(uint8_t *d, simd_u8 c0, simd_u8 c1,
+	simd_u8 c2, simd_u8 c3)
+{
+	uint8x16x4_t out = { { c0, c1, c2, c3 } };
+
+	vst4q_u8(d, out);
+}
+
+static inline void simd_store3(uint8_t *d, simd_u8 c0, simd_u8 c1, simd_u8 c2)
+{
+	uint8x16x3_t out = { { c0, c1, c2 } };
+
+	vst3q_u8(d, out);
+}
+#else
+/* a * ca + b * cb of 8 pairs of 16-bit lanes, in two 32-bit halves. */
+static inline void simd_madd(__m128i a, __m128i b, short ca, short cb,
+	__m128i *lo, __m128i *hi)
+{
+	__m128i c = _mm_set_epi16(cb, ca, cb, ca, cb, ca, cb, ca);
+
+	*lo = _mm_madd_epi16(_mm_unpacklo_epi16(a, b), c);
+	*hi = _mm_madd_epi16(_mm_unpackhi_epi16(a, b), c);
+}
+
+/* (lo, hi) rounded to 16-bit lanes and added to the multiples in base. */
+static inline __m128i simd_yuv_channel(__m128i lo, __m128i hi, __m128i base)
+{
+	__m128i round = _mm_set1_epi32(1 << 15);
+
+	lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 16);
+	hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 16);
+	return _mm_add_epi16(_mm_packs_epi32(lo, hi), base);
+}
+
+/* Convert 8 pixels held as 16-bit luma and pair-wise interleaved chroma. */
+static inline void simd_yuv_8px(__m128i y, __m128i uv, __m128i *r,
+	__m128i *g, __m128i *b)
+{
+	__m128i u = _mm_shufflehi_epi16(_mm_shufflelo_epi16(uv, _MM_SHUFFLE(2, 2, 0, 0)),
+					_MM_SHUFFLE(2, 2, 0, 0));
+	__m128i v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(uv, _MM_SHUFFLE(3, 3, 1, 1)),
+					_MM_SHUFFLE(3, 3, 1, 1));
+	__m128i bias = _mm_set1_epi16(128);
+	__m128i lo, hi, lo2, hi2;
+
+	u = _mm_sub_epi16(u, bias);
+	v = _mm_sub_epi16(v, bias);
+	y = _mm_sub_epi16(y, _mm_set1_epi16(16));
+
+	simd_madd(y, v, SIMD_YUV_Y, SIMD_YUV_RV, &lo, &hi);
+	*r = simd_yuv_channel(lo, hi, _mm_add_epi16(y, _mm_add_epi16(v, v)));
+
+	simd_madd(y, u, SIMD_YUV_Y, SIMD_YUV_GU, &lo, &hi);
+	simd_madd(v, _mm_setzero_si128(), SIMD_YUV_GV, 0, &lo2, &hi2);
+	*g = simd_yuv_channel(_mm_add_epi32(lo, lo2), _mm_add_epi32(hi, hi2),
+			      _mm_sub_epi16(y, v));
+
+	simd_madd(y, u, SIMD_YUV_Y, SIMD_YUV_BU, &lo, &hi);
+	*b = simd_yuv_channel(lo, hi, _mm_add_epi16(y, _mm_add_epi16(u, u)));
+}
+
+/* Convert 16 pixels (32 bytes) of packed 4:2:2 YUV. */
+template<class Layout>
+static inline void simd_yuv422_to_rgb(const uint8_t *s, struct simd_rgb *rgb)
+{
+	__m128i mask = _mm_set1_epi16(0x00ff);
+	__m128i a = _mm_loadu_si128((const __m128i *)s);
+	__m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+	__m128i ya, yb, ca, cb;
+	__m128i ra, ga, ba, rb, gb, bb;
+
+	if (Layout::y0 == 0) {
+		ya = _mm_and_si128(a, mask);
+		yb = _mm_and_si128(b, mask);
+		ca = _mm_srli_epi16(a, 8);
+		cb = _mm_srli_epi16(b, 8);
+	} else {
+		ya = _mm_srli_epi16(a, 8);
+		yb = _mm_srli_epi16(b, 8);
+		ca = _mm_and_si128(a, mask);
+		cb = _mm_and_si128(b, mask);
+	}
+
+	simd_yuv_8px(ya, ca, &ra, &ga, &ba);
+	simd_yuv_8px(yb, cb, &rb, &gb, &bb);
+
+	rgb->r = _mm_packus_epi16(ra, rb);
+	rgb->g = _mm_packus_epi16(ga, gb);
+	rgb->b = _mm_packus_epi16(ba, bb);
+}
+
+static inline void simd_store4(uint8_t *d, simd_u8 c0, simd_u8 c1,
+	simd_u8 c2, simd_u8 c3)
+{
+	__m128i lo01 = _mm_unpacklo_epi8(c0, c1);
+	__m128i hi01 = _mm_unpackhi_epi8(c0, c1);
+	__m128i lo23 = _mm_unpacklo_epi8(c2, c3);
+	__m128i hi23 = _mm_unpackhi_epi8(c2, c3);
+
+	_mm_storeu_si128((__m128i *)d, _mm_unpacklo_epi16(lo01, lo23));
+	_mm_storeu_si128((__m128i *)(d + 16), _mm_unpackhi_epi16(lo01, lo23));
+	_mm_storeu_si128((__m128i *)(d + 32), _mm_unpacklo_epi16(hi01, hi23));
+	_mm_storeu_si128((__m128i *)(d + 48), _mm_unpackhi_epi16(hi01, hi23));
+}
+
+static inline void simd_store3(uint8_t *d, simd_u8 c0, simd_u8 c1, simd_u8 c2)
+{
+	uint8_t a[16] SIMD_ALIGN, b[16] SIMD_ALIGN, c[16] SIMD_ALIGN;
+	unsigned int i;
+
+	_mm_store_si128((__m128i *)a, c0);
+	_mm_store_si128((__m128i *)b, c1);
+	_mm_store_si128((__m128i *)c, c2);
+
+	for (i = 0; i < 16; ++i) {
+		d[i * 3] = a[i];
+		d[i * 3 + 1] = b[i];
+		d[i * 3 + 2] = c[i];
+	}
+}
+#endif
+
+static inline simd_u8 simd_splat(uint8_t v)
+{
+#if defined(SIMD_NEON)
+	return vdupq_n_u8(v);
+#else
+	return _mm_set1_epi8((char)v);
+#endif
+}
+
+/* Pack 16 pixels to little endian RGB565, 32 bytes. */
+static inline void simd_store565(uint8_t *d, simd_u8 r, simd_u8 g, simd_u8 b)
+{
+#if defined(SIMD_NEON)
+	uint16x8x2_t out;
+
+	out.val[0] = vsriq_n_u16(vshll_n_u8(vget_low_u8(r), 8),
+				 vshll_n_u8(vget_low_u8(g), 8), 5);
+	out.val[0] = vsriq_n_u16(out.val[0], vshll_n_u8(vget_low_u8(b), 8), 11);
+	out.val[1] = vsriq_n_u16(vshll_n_u8(vget_high_u8(r), 8),
+				 vshll_n_u8(vget_high_u8(g), 8), 5);
+	out.val[1] = vsriq_n_u16(out.val[1], vshll_n_u8(vget_high_u8(b), 8), 11);
+
+	vst1q_u16((uint16_t *)d, out.val[0]);
+	vst1q_u16((uint16_t *)(d + 16), out.val[1]);
+#else
+	__m128i zero = _mm_setzero_si128();
+	__m128i rmask = _mm_set1_epi16((short)0xf800);
+	__m128i gmask = _mm_set1_epi16(0x07e0);
+	__m128i lo, hi;
+
+	lo = _mm_or_si128(_mm_and_si128(_mm_unpacklo_epi8(zero, r), rmask),
+			  _mm_and_si128(_mm_slli_epi16(_mm_unpacklo_epi8(g, zero), 3), gmask));
+	lo = _mm_or_si128(lo, _mm_srli_epi16(_mm_unpacklo_epi8(b, zero), 3));
+	hi = _mm_or_si128(_mm_and_si128(_mm_unpackhi_epi8(zero, r), rmask),
+			  _mm_and_si128(_mm_slli_epi16(_mm_unpackhi_epi8(g, zero), 3), gmask));
+	hi = _mm_or_si128(hi, _mm_srli_epi16(_mm_unpackhi_epi8(b, zero), 3));
+
+	_mm_storeu_si128((__m128i *)d, lo);
+	_mm_storeu_si128((__m128i *)(d + 16), hi);
+#endif
+}
+
+/*
+ * Eight signed 16-bit lanes, for filters that need headroom above 8 bits.
+ * Shift counts may be variables; multiplications keep the low 16 bits.
+ */
+#if defined(SIMD_NEON)
+typedef int16x8_t simd_s16;
+
+static inline simd_s16 simd_s16_load(const int16_t *p) { return vld1q_s16(p); }
+static inline void simd_s16_store(int16_t *p, simd_s16 v) { vst1q_s16(p, v); }
+static inline simd_s16 simd_s16_splat(int16_t v) { return vdupq_n_s16(v); }
+static inline simd_s16 simd_s16_add(simd_s16 a, simd_s16 b) { return vaddq_s16(a, b); }
+static inline simd_s16 simd_s16_sub(simd_s16 a, simd_s16 b) { return vsubq_s16(a, b); }
+static inline simd_s16 simd_s16_mul(simd_s16 a, simd_s16 b) { return vmulq_s16(a, b); }
+static inline simd_s16 simd_s16_min(simd_s16 a, simd_s16 b) { return vminq_s16(a, b); }
+static inline simd_s16 simd_s16_max(simd_s16 a, simd_s16 b) { return vmaxq_s16(a, b); }
+static inline simd_s16 simd_s16_abs(simd_s16 a) { return vabsq_s16(a); }
+static inline simd_s16 simd_s16_and(simd_s16 a, simd_s16 b) { return vandq_s16(a, b); }
+static inline simd_s16 simd_s16_or(simd_s16 a, simd_s16 b) { return vorrq_s16(a, b); }
+
+static inline simd_s16 simd_s16_sra(simd_s16 v, unsigned int n)
+{
+	return vshlq_s16(v, vdupq_n_s16(-(int)n));
+}
+
+static inline simd_s16 simd_s16_srl(simd_s16 v, unsigned int n)
+{
+	return vreinterpretq_s16_u16(vshlq_u16(vreinterpretq_u16_s16(v),
+					       vdupq_n_s16(-(int)n)));
+}
+
+static inline simd_s16 simd_s16_sll(simd_s16 v, unsigned int n)
+{
+	return vshlq_s16(v, vdupq_n_s16(n));
+}
+#else
+typedef __m128i simd_s16;
+
+static inline simd_s16 simd_s16_load(const int16_t *p) { return _mm_loadu_si128((const __m128i *)p); }
+static inline void simd_s16_store(int16_t *p, simd_s16 v) { _mm_storeu_si128((__m128i *)p, v); }
+static inline simd_s16 simd_s16_splat(int16_t v) { return _mm_set1_epi16(v); }
+static inline simd_s16 simd_s16_add(simd_s16 a, simd_s16 b) { return _mm_add_epi16(a, b); }
+static inline simd_s16 simd_s16_sub(simd_s16 a, simd_s16 b) { return _mm_sub_epi16(a, b); }
+static inline simd_s16 simd_s16_mul(simd_s16 a, simd_s16 b) { return _mm_mullo_epi16(a, b); }
+static inline simd_s16 simd_s16_min(simd_s16 a, simd_s16 b) { return _mm_min_epi16(a, b); }
+static inline simd_s16 simd_s16_max(simd_s16 a, simd_s16 b) { return _mm_max_epi16(a, b); }
+static inline simd_s16 simd_s16_and(simd_s16 a, simd_s16 b) { return _mm_and_si128(a, b); }
+static inline simd_s16 simd_s16_or(simd_s16 a, simd_s16 b) { return _mm_or_si128(a, b); }
+
+static inline simd_s16 simd_s16_abs(simd_s16 a)
+{
+	return _mm_max_epi16(a, _mm_sub_epi16(_mm_setzero_si128(), a));
+}
+
+static inline simd_s16 simd_s16_sra(simd_s16 v, unsigned int n)
+{
+	return _mm_sra_epi16(v, _mm_cvtsi32_si128(n));
+}
+
+static inline simd_s16 simd_s16_srl(simd_s16 v, unsigned int n)
+{
+	return _mm_srl_epi16(v, _mm_cvtsi32_si128(n));
+}
+
+static inline simd_s16 simd_s16_sll(simd_s16 v, unsigned int n)
+{
+	return _mm_sll_epi16(v, _mm_cvtsi32_si128(n));
+}
+#endif
+
+#endif /* HAVE_SIMD */
+
+/*
+ * Copy to write-combined memory (framebuffers) with full, aligned 16 byte
+ * stores that bypass the cache. SSE2 uses non-temporal stores; NEON has
+ * none in AArch32, but sequential vst1q stores fill the write-combining
+ * buffers just as well. simd_stream_fence() must be called before the
+ * memory is handed to another agent.
+ */
+static inline void simd_stream_copy(uint8_t *d, const uint8_t *s, unsigned int n)
+{
+#if defined(SIMD_SSE2)
+	unsigned int head = (16 - ((uintptr_t)d & 15)) & 15;
+
+	if (head > n)
+		head = n;
+	memcpy(d, s, head);
+	d += head;
+	s += head;
+	n -= head;
+
+	for (; n >= 64; n -= 64, d += 64, s += 64) {
+		__m128i a = _mm_loadu_si128((const __m128i *)s);
+		__m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+		__m128i c = _mm_loadu_si128((const __m128i *)(s + 32));
+		__m128i e = _mm_loadu_si128((const __m128i *)(s + 48));
+
+		_mm_stream_si128((__m128i *)d, a);
+		_mm_stream_si128((__m128i *)(d + 16), b);
+		_mm_stream_si128((__m128i *)(d + 32), c);
+		_mm_stream_si128((__m128i *)(d + 48), e);
+	}
+
+	for (; n >= 16; n -= 16, d += 16, s += 16)
+		_mm_stream_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+
+	memcpy(d, s, n);
+#elif defined(SIMD_NEON)
+	for (; n >= 64; n -= 64, d += 64, s += 64) {
+		uint8x16_t a = vld1q_u8(s);
+		uint8x16_t b = vld1q_u8(s + 16);
+		uint8x16_t c = vld1q_u8(s + 32);
+		uint8x16_t e = vld1q_u8(s + 48);
+
+		vst1q_u8(d, a);
+		vst1q_u8(d + 16, b);
+		vst1q_u8(d + 32, c);
+		vst1q_u8(d + 48, e);
+	}
+
+	memcpy(d, s, n);
+#else
+	memcpy(d, s, n);
+#endif
+}
+
+static inline void simd_stream_fence(void)
+{
+#if defined(SIMD_SSE2)
+	_mm_sfence();
+#else
+	__sync_synchronize();
+#endif
+}
+
+/*
+ * Offset of the first byte of p differing from value, n if there is none.
+ * Compares 64 bytes per iteration and only looks at single bytes in the
+ * block that differs.
+ */
+static inline unsigned int simd_find_mismatch(const uint8_t *p, unsigned int n,
+	uint8_t value)
+{
+	unsigned int i = 0;
+
+#if defined(SIMD_SSE2)
+	__m128i v = _mm_set1_epi8(value);
+
+	for (; i + 64 <= n; i += 64) {
+		__m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i)), v);
+		__m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i + 16)), v);
+		__m128i c = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i + 32)), v);
+		__m128i d = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i + 48)), v);
+
+		a = _mm_and_si128(_mm_and_si128(a, b), _mm_and_si128(c, d));
+		if (_mm_movemask_epi8(a) != 0xffff)
+			break;
+	}
+#elif defined(SIMD_NEON)
+	uint8x16_t v = vdupq_n_u8(value);
+
+	for (; i + 64 <= n; i += 64) {
+		uint8x16_t a = vceqq_u8(vld1q_u8(p + i), v);
+		uint8x16_t b = vceqq_u8(vld1q_u8(p + i + 16), v);
+		uint8x16_t c = vceqq_u8(vld1q_u8(p + i + 32), v);
+		uint8x16_t d = vceqq_u8(vld1q_u8(p + i + 48), v);
+		uint8x8_t m;
+
+		a = vandq_u8(vandq_u8(a, b), vandq_u8(c, d));
+		m = vand_u8(vget_low_u8(a), vget_high_u8(a));
+		if (vget_lane_u64(vreinterpret_u64_u8(m), 0) != ~0ULL)
+			break;
+	}
+#endif
+
+	for (; i < n; ++i) {
+		if (p[i] != value)
+			break;
+	}
+
+	return i;
+}
+
+/*
+ * Accumulate n bytes into a two lane hash, acc and key are two 64-bit
+ * lanes each. Every 16 bytes are xored with a key that advances with
+ * their position, so swapped blocks hash differently, and the 32x32-bit
+ * product of the halves of each lane is added to it together with the
+ * other lane's data, as in XXH3. The SSE2, NEON and scalar paths give
+ * the same result; a tail shorter than 16 bytes is padded with zeroes.
+ */
+#define SIMD_HASH_STEP0		0x165667b19e3779f9ULL
+#define SIMD_HASH_STEP1		0x85ebca77c2b2ae63ULL
+
+static inline void simd_hash_mix(uint64_t *acc, const uint8_t *p, unsigned int n,
+	const uint64_t *key)
+{
+	uint8_t tail[16] SIMD_ALIGN;
+	unsigned int i = 0;
+
+#if defined(SIMD_SSE2)
+	__m128i a = _mm_loadu_si128((const __m128i *)acc);
+	__m128i k = _mm_loadu_si128((const __m128i *)key);
+	__m128i step = _mm_set_epi64x(SIMD_HASH_STEP1, SIMD_HASH_STEP0);
+
+	for (;; i += 16) {
+		__m128i v, x;
+
+		if (i + 16 <= n) {
+			v = _mm_loadu_si128((const __m128i *)(p + i));
+		} else if (i < n) {
+			memset(tail, 0, sizeof tail);
+			memcpy(tail, p + i, n - i);
+			v = _mm_load_si128((const __m128i *)tail);
+		} else {
+			break;
+		}
+
+		x = _mm_xor_si128(v, k);
+		a = _mm_add_epi64(a, _mm_mul_epu32(x, _mm_srli_epi64(x, 32)));
+		a = _mm_add_epi64(a, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+		k = _mm_add_epi64(k, step);
+	}
+
+	_mm_storeu_si128((__m128i *)acc, a);
+#elif defined(SIMD_NEON)
+	uint64x2_t a = vld1q_u64(acc);
+	uint64x2_t k = vld1q_u64(key);
+	uint64x2_t step = vcombine_u64(vcreate_u64(SIMD_HASH_STEP0),
+				       vcreate_u64(SIMD_HASH_STEP1));
+
+	for (;; i += 16) {
+		uint64x2_t v, x;
+
+		if (i + 16 <= n) {
+			v = vreinterpretq_u64_u8(vld1q_u8(p + i));
+		} else if (i < n) {
+			memset(tail, 0, sizeof tail);
+			memcpy(tail, p + i, n - i);
+			v = vreinterpretq_u64_u8(vld1q_u8(tail));
+		} else {
+			break;
+		}
+
+		x = veorq_u64(v, k);
+		a = vmlal_u32(a, vmovn_u64(x), vshrn_n_u64(x, 32));
+		a = vaddq_u64(a, vextq_u64(v, v, 1));
+		k = vaddq_u64(k, step);
+	}
+
+	vst1q_u64(acc, a);
+#else
+	uint64_t k0 = key[0], k1 = key[1];
+
+	for (;; i += 16) {
+		uint64_t w[2], x;
+
+		if (i + 16 <= n) {
+			memcpy(w, p + i, sizeof w);
+		} else if (i < n) {
+			memset(tail, 0, sizeof tail);
+			memcpy(tail, p + i, n - i);
+			memcpy(w, tail, sizeof w);
+		} else {
+			break;
+		}
+
+		x = w[0] ^ k0;
+		acc[0] += (x & 0xffffffff) * (x >> 32) + w[1];
+		x = w[1] ^ k1;
+		acc[1] += (x & 0xffffffff) * (x >> 32) + w[0];
+		k0 += SIMD_HASH_STEP0;
+		k1 += SIMD_HASH_STEP1;
+	}
+#endif
+}
+
+/* Fold the two lanes of simd_hash_mix() into one 64-bit hash. */
+static inline uint64_t simd_hash_final(const uint64_t *acc)
+{
+	uint64_t h = acc[0] ^ (acc[1] * 0x9e3779b97f4a7c15ULL);
+
+	h ^= h >> 29;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	return h ^ (h >> 32);
+}
+
+#endif /* __SIMD_H__ */
@@ -0,0 +1,385 @@
+/*
+ * slotpool.cpp -- pool of frame sized memory slots
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "slotpool.h"
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB		0x40000
+#endif
+
+#define SLOTPOOL_PAGE_SIZE	4096
+#define SLOTPOOL_HUGE_SIZE	(2 * 1024 * 1024)
+#define SLOTPOOL_HEADER_SIZE	64
+#define SLOTPOOL_NO_CLASS	0xffffffffU
+
+/* Sits in the 64 bytes in front of every slot. */
+struct slotpool_header
+{
+	uint32_t cls;
+	uint32_t index;
+};
+
+struct slotpool_cache
+{
+	struct slotpool *pool;
+	unsigned int count[SLOTPOOL_MAX_CLASSES];
+	uint32_t slots[SLOTPOOL_MAX_CLASSES][SLOTPOOL_CACHE_SLOTS];
+	/* Classes acquired from since the last flush. */
+	bool acquired[SLOTPOOL_MAX_CLASSES];
+};
+
+/*
+ * A thread caches slots for the first pool it uses, which in practice is
+ * the only one. The key hands the cache back to the pool when the thread
+ * exits.
+ */
+static __thread struct slotpool_cache slotpool_cache;
+static pthread_key_t slotpool_key;
+static pthread_once_t slotpool_once = PTHREAD_ONCE_INIT;
+
+static inline size_t slotpool_round(size_t size, size_t align)
+{
+	return (size + align - 1) & ~(align - 1);
+}
+
+static inline struct slotpool_header *slotpool_header(void *mem)
+{
+	return (struct slotpool_header *)((uint8_t *)mem - SLOTPOOL_HEADER_SIZE);
+}
+
+/* -----------------------------------------------------------------------------
+ * Free stacks
+ */
+
+static void slotpool_push(struct slotpool_class *cls, uint32_t index)
+{
+	uint64_t head, next;
+
+	do {
+		head = cls->head;
+		cls->next[index] = (uint32_t)head;
+		next = ((head >> 32) + 1) << 32 | (index + 1);
+	} while (!__sync_bool_compare_and_swap(&cls->head, head, next));
+}
+
+/*
+ * The tag changes with every operation, so a slot popped and pushed back
+ * by another thread between reading head and next does not go unnoticed.
+ */
+static bool slotpool_pop(struct slotpool_class *cls, uint32_t *index)
+{
+	uint64_t head, next;
+
+	do {
+		head = cls->head;
+		if ((uint32_t)head == 0)
+			return false;
+		next = ((head >> 32) + 1) << 32 | cls->next[(uint32_t)head - 1];
+	} while (!__sync_bool_compare_and_swap(&cls->head, head, next));
+
+	*index = (uint32_t)head - 1;
+	return true;
+}
+
+/* -----------------------------------------------------------------------------
+ * Thread caches
+ */
+
+static void slotpool_cache_flush(struct slotpool_cache *cache)
+{
+	unsigned int i;
+
+	for (i = 0; i < SLOTPOOL_MAX_CLASSES; ++i) {
+		while (cache->count[i])
+			slotpool_push(&cache->pool->classes[i],
+				      cache->slots[i][--cache->count[i]]);
+		cache->acquired[i] = false;
+	}
+}
+
+static void slotpool_thread_exit(void *arg)
+{
+	struct slotpool_cache *cache = (struct slotpool_cache *)arg;
+
+	if (cache->pool == NULL)
+		return;
+
+	slotpool_cache_flush(cache);
+	cache->pool = NULL;
+}
+
+static void slotpool_key_init(void)
+{
+	pthread_key_create(&slotpool_key, slotpool_thread_exit);
+}
+
+static struct slotpool_cache *slotpool_get_cache(struct slotpool *pool)
+{
+	struct slotpool_cache *cache = &slotpool_cache;
+
+	if (cache->pool == pool)
+		return cache;
+	if (cache->pool != NULL)
+		return NULL;
+
+	pthread_once(&slotpool_once, slotpool_key_init);
+	pthread_setspecific(slotpool_key, cache);
+	cache->pool = pool;
+	return cache;
+}
+
+/* -----------------------------------------------------------------------------
+ * Growing
+ */
+
+static void *slotpool_map(struct slotpool *pool, size_t *size)
+{
+	void *mem = MAP_FAILED;
+
+	if (pool->flags & SLOTPOOL_HUGEPAGES) {
+		*size = slotpool_round(*size, SLOTPOOL_HUGE_SIZE);
+		mem = mmap(NULL, *size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (mem != MAP_FAILED)
+			pool->hugepages += *size / SLOTPOOL_HUGE_SIZE;
+	}
+
+	if (mem == MAP_FAILED) {
+		mem = mmap(NULL, *size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mem == MAP_FAILED)
+			return NULL;
+#ifdef MADV_HUGEPAGE
+		if (pool->flags & SLOTPOOL_HUGEPAGES)
+			madvise(mem, *size, MADV_HUGEPAGE);
+#endif
+	}
+
+	return mem;
+}
+
+/*
+ * Map at least a huge page worth of slots, all but one of which go on the
+ * free stack. Called with the pool lock held.
+ */
+static uint8_t *slotpool_grow(struct slotpool *pool, unsigned int index)
+{
+	struct slotpool_class *cls = &pool->classes[index];
+	unsigned int count;
+	unsigned int first;
+	unsigned int i;
+	size_t size;
+	uint8_t *mem;
+
+	if (cls->nslots == SLOTPOOL_MAX_SLOTS || pool->nchunks == SLOTPOOL_MAX_CHUNKS)
+		return NULL;
+
+	count = SLOTPOOL_HUGE_SIZE / cls->stride;
+	if (count == 0)
+		count = 1;
+	if (count > SLOTPOOL_MAX_SLOTS - cls->nslots)
+		count = SLOTPOOL_MAX_SLOTS - cls->nslots;
+
+	size = count * cls->stride;
+	mem = (uint8_t *)slotpool_map(pool, &size);
+	if (mem == NULL)
+		return NULL;
+
+	pool->chunks[pool->nchunks].mem = mem;
+	pool->chunks[pool->nchunks].size = size;
+	pool->nchunks++;
+	pool->mapped += size;
+	__sync_fetch_and_add(&pool->allocations, 1);
+
+	first = cls->nslots;
+	for (i = 0; i < count; ++i) {
+		struct slotpool_header *header;
+
+		cls->slots[first + i] = mem + i * cls->stride + SLOTPOOL_HEADER_SIZE;
+		header = slotpool_header(cls->slots[first + i]);
+		header->cls = index;
+		header->index = first + i;
+	}
+
+	__sync_synchronize();
+	cls->nslots = first + count;
+
+	for (i = 1; i < count; ++i)
+		slotpool_push(cls, first + i);
+
+	return cls->slots[first];
+}
+
+static int slotpool_find_class(struct slotpool *pool, size_t size)
+{
+	unsigned int nclasses = pool->nclasses;
+	unsigned int i;
+
+	for (i = 0; i < nclasses; ++i) {
+		if (pool->classes[i].size == size)
+			return i;
+	}
+
+	return -1;
+}
+
+/* -----------------------------------------------------------------------------
+ * API
+ */
+
+int slotpool_init(struct slotpool *pool, unsigned int flags)
+{
+	memset(pool, 0, sizeof *pool);
+	pool->flags = flags;
+	pthread_mutex_init(&pool->lock, NULL);
+	return 0;
+}
+
+/* All threads but the caller must have exited or called slotpool_flush(). */
+void slotpool_cleanup(struct slotpool *pool)
+{
+	unsigned int i;
+
+	if (slotpool_cache.pool == pool)
+		slotpool_thread_exit(&slotpool_cache);
+
+	for (i = 0; i < pool->nchunks; ++i)
+		munmap(pool->chunks[i].mem, pool->chunks[i].size);
+
+	pthread_mutex_destroy(&pool->lock);
+	memset(pool, 0, sizeof *pool);
+}
+
+/* Return a 64 byte aligned slot of at least size bytes. */
+void *slotpool_acquire(struct slotpool *pool, size_t size)
+{
+	struct slotpool_cache *cache;
+	struct slotpool_class *cls;
+	struct slotpool_header *header;
+	unsigned int in_use, high_water;
+	uint8_t *mem = NULL;
+	uint32_t index;
+	int ci;
+
+	size = slotpool_round(size, SLOTPOOL_PAGE_SIZE);
+
+	ci = slotpool_find_class(pool, size);
+	if (ci < 0) {
+		pthread_mutex_lock(&pool->lock);
+		ci = slotpool_find_class(pool, size);
+		if (ci < 0 && pool->nclasses < SLOTPOOL_MAX_CLASSES) {
+			ci = pool->nclasses;
+			pool->classes[ci].size = size;
+			pool->classes[ci].stride = size + SLOTPOOL_HEADER_SIZE;
+			__sync_synchronize();
+			pool->nclasses++;
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	if (ci < 0)
+		goto fallback;
+
+	cls = &pool->classes[ci];
+	cache = slotpool_get_cache(pool);
+	if (cache)
+		cache->acquired[ci] = true;
+
+	if (cache && cache->count[ci]) {
+		mem = cls->slots[cache->slots[ci][--cache->count[ci]]];
+		__sync_fetch_and_add(&cls->cache_hits, 1);
+	} else if (slotpool_pop(cls, &index)) {
+		mem = cls->slots[index];
+	} else {
+		pthread_mutex_lock(&pool->lock);
+		/* Another thread may have grown the class meanwhile. */
+		if (slotpool_pop(cls, &index))
+			mem = cls->slots[index];
+		else
+			mem = slotpool_grow(pool, ci);
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	if (mem == NULL)
+		goto fallback;
+
+	__sync_fetch_and_add(&cls->acquires, 1);
+	in_use = __sync_add_and_fetch(&cls->in_use, 1);
+	do {
+		high_water = cls->high_water;
+	} while (in_use > high_water &&
+		 !__sync_bool_compare_and_swap(&cls->high_water, high_water, in_use));
+
+	return mem;
+
+fallback:
+	/* Out of classes or slots, every such frame shows up as an allocation. */
+	if (posix_memalign((void **)&mem, 64, size + SLOTPOOL_HEADER_SIZE))
+		return NULL;
+
+	__sync_fetch_and_add(&pool->allocations, 1);
+	mem += SLOTPOOL_HEADER_SIZE;
+	header = slotpool_header(mem);
+	header->cls = SLOTPOOL_NO_CLASS;
+	return mem;
+}
+
+void slotpool_release(struct slotpool *pool, void *mem)
+{
+	struct slotpool_header *header = slotpool_header(mem);
+	struct slotpool_cache *cache;
+	struct slotpool_class *cls;
+
+	if (header->cls == SLOTPOOL_NO_CLASS) {
+		free(header);
+		return;
+	}
+
+	cls = &pool->classes[header->cls];
+	__sync_fetch_and_sub(&cls->in_use, 1);
+
+	/*
+	 * A thread that only releases a class, such as the last stage of a
+	 * pipeline, would strand slots in its cache that the threads acquiring
+	 * them never see, so those go straight back on the free stack.
+	 */
+	cache = slotpool_get_cache(pool);
+	if (cache && cache->acquired[header->cls] &&
+	    cache->count[header->cls] < SLOTPOOL_CACHE_SLOTS)
+		cache->slots[header->cls][cache->count[header->cls]++] = header->index;
+	else
+		slotpool_push(cls, header->index);
+}
+
+/* Hand the slots cached by the calling thread back to the pool. */
+void slotpool_flush(struct slotpool *pool)
+{
+	if (slotpool_cache.pool == pool)
+		slotpool_cache_flush(&slotpool_cache);
+}
+
+void slotpool_print_stats(struct slotpool *pool)
+{
+	unsigned int i;
+
+	printf("%-10s %6s %6s %10s %10s %8s\n", "slot size", "slots", "in use",
+		"high water", "acquires", "cached");
+
+	for (i = 0; i < pool->nclasses; ++i) {
+		struct slotpool_class *cls = &pool->classes[i];
+
+		printf("%-10zu %6u %6u %10u %10u %7.1f%%\n", cls->size, cls->nslots,
+			cls->in_use, cls->high_water, cls->acquires,
+			cls->acquires ? cls->cache_hits * 100.0 / cls->acquires : 0.0);
+	}
+
+	printf("%u heap allocations, %zu kB mapped, %u huge pages.\n",
+		pool->allocations, pool->mapped / 1024, pool->hugepages);
+}
@@ -0,0 +1,87 @@
+/*
+ * slotpool.h -- pool of frame sized memory slots
+ *
+ * Slots are grouped in size classes, one per distinct size rounded up to
+ * a page, since a video pipeline only ever asks for a handful of sizes.
+ * Memory is mapped in chunks the first time a class runs dry and never
+ * given back while the pool lives, so once every stage has seen its
+ * first few frames streaming does no heap allocation at all; the
+ * allocations counter makes that visible.
+ *
+ * Every slot is 64 byte aligned. With SLOTPOOL_HUGEPAGES chunks are
+ * backed by huge pages when the system has some reserved, and marked for
+ * transparent huge pages otherwise.
+ *
+ * Acquire and release are lock-free: each class keeps its free slots on a
+ * tagged stack, and every thread keeps a few slots per class in a cache
+ * of its own, so a stage that releases a frame and acquires the next one
+ * gets the same, still cached, memory back. Only classes the thread has
+ * acquired from since its last slotpool_flush() are cached on release;
+ * the rest go back on the stack for the threads that do acquire them.
+ * Only growing a class takes a lock.
+ */
+
+#ifndef __SLOTPOOL_H__
+#define __SLOTPOOL_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SLOTPOOL_MAX_CLASSES	16
+#define SLOTPOOL_MAX_SLOTS	256
+#define SLOTPOOL_MAX_CHUNKS	256
+#define SLOTPOOL_CACHE_SLOTS	2
+
+#define SLOTPOOL_HUGEPAGES	(1 << 0)
+
+struct slotpool_class
+{
+	size_t size;
+	size_t stride;
+
+	/* Free stack: tag << 32 | (index + 1), 0 when empty. */
+	volatile uint64_t head;
+	uint32_t next[SLOTPOOL_MAX_SLOTS];
+	uint8_t *slots[SLOTPOOL_MAX_SLOTS];
+	volatile unsigned int nslots;
+
+	/* Statistics. */
+	volatile unsigned int in_use;
+	volatile unsigned int high_water;
+	volatile unsigned int acquires;
+	volatile unsigned int cache_hits;
+};
+
+struct slotpool_chunk
+{
+	void *mem;
+	size_t size;
+};
+
+struct slotpool
+{
+	unsigned int flags;
+	struct slotpool_class classes[SLOTPOOL_MAX_CLASSES];
+	volatile unsigned int nclasses;
+
+	/* Protects growing the pool. */
+	pthread_mutex_t lock;
+	struct slotpool_chunk chunks[SLOTPOOL_MAX_CHUNKS];
+	unsigned int nchunks;
+
+	/* Heap allocations and mapped bytes since the pool was created. */
+	volatile unsigned int allocations;
+	size_t mapped;
+	unsigned int hugepages;
+};
+
+int slotpool_init(struct slotpool *pool, unsigned int flags);
+void slotpool_cleanup(struct slotpool *pool);
+void *slotpool_acquire(struct slotpool *pool, size_t size);
+void slotpool_release(struct slotpool *pool, void *mem);
+void slotpool_flush(struct slotpool *pool);
+void slotpool_print_stats(struct slotpool *pool);
+
+#endif /* __SLOTPOOL_H__ */
@@ -0,0 +1,221 @@
+/*
+ * swdisplay.cpp -- show a capture device without a GPU
+ *
+ * Captures from a V4L2 device, or generates a synthetic YUYV test pattern,
+ * and hands every frame to the software display sink. Capture buffers are
+ * read in place by the sink and queued back once converted.
+ *
+ * Run against Xvfb for testing, e.g.
+ *	Xvfb :99 -screen 0 1280x720x24 &
+ *	DISPLAY=:99 ./swdisplay -p 640x480 -n 300
+ */
+
+#include <signal.h>
+
+#include "yavtalib.h"
+#include "swsink.h"
+#include "pattern.h"
+
+#define SWDISPLAY_PATTERN_BUFFERS	3
+#define SWDISPLAY_PATTERN_FPS		30
+
+static volatile sig_atomic_t swdisplay_stop;
+/* Pattern buffers held by the sink, one bit per buffer. */
+static volatile unsigned int swdisplay_busy;
+
+static void swdisplay_signal(int)
+{
+	swdisplay_stop = 1;
+}
+
+static void swdisplay_requeue(void *priv, unsigned int index)
+{
+	struct device *dev = (struct device *)priv;
+
+	video_queue_buffer(dev, index, BUFFER_FILL_NONE);
+}
+
+static void swdisplay_pattern_release(void *, unsigned int index)
+{
+	__sync_fetch_and_and(&swdisplay_busy, ~(1U << index));
+}
+
+static void usage(const char *argv0)
+{
+	printf("Usage: %s [options] [device]\n", argv0);
+	printf("Show a V4L2 capture device (default /dev/video6) without a GPU.\n\n");
+	printf("Supported options:\n");
+	printf("-d, --display name		X display to show on (default $DISPLAY)\n");
+	printf("-f, --fbdev[=device]		Show on a framebuffer (default /dev/fb0)\n");
+	printf("-h, --help			Show this help screen\n");
+	printf("-n, --nframes n			Stop after n frames\n");
+	printf("-p, --pattern wxh		Show a synthetic YUYV pattern instead of capturing\n");
+	printf("-r, --refresh hz		Refresh rate to pace the display at\n");
+}
+
+static struct option opts[] = {
+	{"display", 1, 0, 'd'},
+	{"fbdev", 2, 0, 'f'},
+	{"help", 0, 0, 'h'},
+	{"nframes", 1, 0, 'n'},
+	{"pattern", 1, 0, 'p'},
+	{"refresh", 1, 0, 'r'},
+	{0, 0, 0, 0}
+};
+
+int main(int argc, char *argv[])
+{
+	struct swsink_config config;
+	struct swsink_stats stats;
+	struct swsink *sink;
+	struct device dev;
+	const char *devname = "/dev/video6";
+	unsigned int nframes = (unsigned int)-1;
+	unsigned int width = 0, height = 0;
+	unsigned int frame;
+	uint8_t *pattern = NULL;
+	struct timespec start, end;
+	double duration;
+	int ret;
+	int c;
+
+	memset(&config, 0, sizeof config);
+	memset(&dev, 0, sizeof dev);
+	config.type = SWSINK_X11;
+
+	while ((c = getopt_long(argc, argv, "d:f::hn:p:r:", opts, NULL)) != -1) {
+		switch (c) {
+		case 'd':
+			config.type = SWSINK_X11;
+			config.device = optarg;
+			break;
+		case 'f':
+			config.type = SWSINK_FBDEV;
+			config.device = optarg;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		case 'n':
+			nframes = atoi(optarg);
+			break;
+		case 'p':
+			if (sscanf(optarg, "%ux%u", &width, &height) != 2 ||
+			    width == 0 || height == 0 || width & 1) {
+				printf("Invalid pattern size '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'r':
+			config.refresh = atoi(optarg);
+			break;
+		default:
+			printf("Invalid option -%c\n", c);
+			printf("Run %s -h for help.\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind < argc)
+		devname = argv[optind];
+
+	signal(SIGINT, swdisplay_signal);
+	signal(SIGTERM, swdisplay_signal);
+
+	if (width) {
+		struct image img;
+
+		image_init(&img, V4L2_PIX_FMT_YUYV, width, height, 0, NULL);
+		pattern = (uint8_t *)malloc(SWDISPLAY_PATTERN_BUFFERS * img.stride * height);
+		if (pattern == NULL)
+			return 1;
+
+		ret = swsink_open(&sink, &config, V4L2_PIX_FMT_YUYV, width, height,
+				  swdisplay_pattern_release, NULL);
+	} else {
+		if (video_open(&dev, devname, 0) < 0)
+			return 1;
+		dev.memtype = V4L2_MEMORY_MMAP;
+
+		video_get_format(&dev);
+		if (video_prepare_capture(&dev, V4L_BUFFERS_DEFAULT, 0, NULL,
+					  BUFFER_FILL_NONE) < 0) {
+			video_close(&dev);
+			return 1;
+		}
+
+		ret = swsink_open(&sink, &config, dev.pixelformat, dev.width, dev.height,
+				  swdisplay_requeue, &dev);
+		if (ret == 0)
+			video_enable(&dev, 1);
+	}
+
+	if (ret < 0)
+		goto done;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (frame = 0; frame < nframes && !swdisplay_stop; ++frame) {
+		struct image img;
+
+		if (pattern) {
+			/* Behave like a camera running at a fixed frame rate. */
+			uint64_t next = (start.tv_sec * 1000000000ULL + start.tv_nsec) +
+					(uint64_t)frame * 1000000000ULL / SWDISPLAY_PATTERN_FPS;
+			struct timespec ts = { (time_t)(next / 1000000000ULL),
+					       (long)(next % 1000000000ULL) };
+			unsigned int index;
+
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+			for (index = 0; index < SWDISPLAY_PATTERN_BUFFERS; ++index) {
+				if (!(swdisplay_busy & (1U << index)))
+					break;
+			}
+			/* Like a camera, drop the frame when no buffer is free. */
+			if (index == SWDISPLAY_PATTERN_BUFFERS)
+				continue;
+
+			image_init(&img, V4L2_PIX_FMT_YUYV, width, height, 0, NULL);
+			img.data = pattern + index * img.stride * height;
+			pattern_fill(&img, frame);
+			__sync_fetch_and_or(&swdisplay_busy, 1U << index);
+			swsink_submit(sink, &img, index);
+		} else {
+			struct v4l2_buffer buf;
+
+			memset(&buf, 0, sizeof buf);
+			buf.type = dev.type;
+			buf.memory = dev.memtype;
+			if (ioctl(dev.fd, VIDIOC_DQBUF, &buf) < 0) {
+				if (errno != EINTR)
+					printf("Unable to dequeue buffer: %s (%d).\n",
+						strerror(errno), errno);
+				break;
+			}
+
+			image_init(&img, dev.pixelformat, dev.width, dev.height,
+				   dev.bytesperline, dev.buffers[buf.index].mem);
+			swsink_submit(sink, &img, buf.index);
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	swsink_get_stats(sink, &stats);
+	swsink_close(sink);
+
+	duration = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%u frames in %.3f seconds: %u shown (%.2f fps), %u dropped, %u late.\n",
+		frame, duration, stats.shown, stats.shown / duration, stats.dropped,
+		stats.late);
+
+done:
+	if (pattern == NULL) {
+		video_enable(&dev, 0);
+		video_free_buffers(&dev);
+		video_close(&dev);
+	}
+	free(pattern);
+	return ret < 0 ? 1 : 0;
+}
@@ -0,0 +1,637 @@
+/*
+ * swsink.cpp -- software display sink
+ *
+ * The framebuffer backend flips between two pages with FBIOPAN_DISPLAY
+ * when the driver offers a virtual screen twice the visible height, and
+ * otherwise converts into the visible page right after the refresh.
+ * Framebuffer memory is usually mapped write-combined, so frames go in
+ * through the streaming converter. The X11 backend double buffers two
+ * shared memory XImages and reuses one only after the server reported
+ * the put as complete; it also works against Xvfb.
+ */
+
+#include <pthread.h>
+#include <linux/fb.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#ifndef SWSINK_NO_X11
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#endif
+
+#include "swsink.h"
+
+#ifndef FBIO_WAITFORVSYNC
+#define FBIO_WAITFORVSYNC	_IOW('F', 0x20, __u32)
+#endif
+
+#define SWSINK_MAX_BUFFERS	2
+
+struct swsink_buffer
+{
+	uint8_t *data;
+	/* Framebuffer: first line of the page in the virtual screen. */
+	unsigned int yoffset;
+	/* X11: image handed to the server and not completed yet. */
+	bool busy;
+#ifndef SWSINK_NO_X11
+	XImage *ximage;
+	XShmSegmentInfo shm;
+#endif
+};
+
+struct swsink
+{
+	struct swsink_config config;
+	unsigned int src_fourcc;
+	unsigned int width;
+	unsigned int height;
+
+	/* Display pixel format and geometry. */
+	unsigned int fourcc;
+	unsigned int disp_width;
+	unsigned int disp_height;
+	unsigned int stride;
+	unsigned int bytes_per_pixel;
+	convert_fn convert;
+
+	struct swsink_buffer buffers[SWSINK_MAX_BUFFERS];
+	unsigned int nbuffers;
+	unsigned int back;
+
+	/* Framebuffer backend. */
+	int fd;
+	uint8_t *fbmem;
+	size_t fbsize;
+	struct fb_var_screeninfo var;
+	bool vsync_ioctl;
+
+#ifndef SWSINK_NO_X11
+	Display *display;
+	Window window;
+	GC gc;
+	int completion;
+#endif
+
+	/* Pacing, in nanoseconds. */
+	uint64_t period;
+	uint64_t deadline;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool started;
+	bool stop;
+
+	/* Latest submitted frame, protected by lock. */
+	struct image pending;
+	unsigned int pending_index;
+	bool has_pending;
+	struct swsink_stats stats;
+
+	swsink_release_fn release;
+	void *priv;
+};
+
+static uint64_t swsink_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* -----------------------------------------------------------------------------
+ * Framebuffer backend
+ */
+
+static unsigned int swsink_fb_format(const struct fb_var_screeninfo *var)
+{
+	if (var->bits_per_pixel == 16 && var->red.offset == 11 &&
+	    var->green.length == 6 && var->blue.offset == 0)
+		return V4L2_PIX_FMT_RGB565;
+	/* XRGB8888, B G R X in memory. */
+	if (var->bits_per_pixel == 32 && var->red.offset == 16 &&
+	    var->green.offset == 8 && var->blue.offset == 0)
+		return V4L2_PIX_FMT_BGR32;
+	if (var->bits_per_pixel == 32 && var->red.offset == 8 &&
+	    var->green.offset == 16 && var->blue.offset == 24)
+		return V4L2_PIX_FMT_RGB32;
+
+	return 0;
+}
+
+static int swsink_fb_open(struct swsink *sink)
+{
+	const char *device = sink->config.device ? sink->config.device : "/dev/fb0";
+	struct fb_var_screeninfo *var = &sink->var;
+	struct fb_fix_screeninfo fix;
+	unsigned int page;
+	unsigned int i;
+
+	sink->fd = open(device, O_RDWR);
+	if (sink->fd < 0) {
+		printf("Unable to open %s: %s (%d).\n", device, strerror(errno), errno);
+		return -errno;
+	}
+
+	if (ioctl(sink->fd, FBIOGET_FSCREENINFO, &fix) < 0 ||
+	    ioctl(sink->fd, FBIOGET_VSCREENINFO, var) < 0) {
+		printf("Unable to get framebuffer information: %s (%d).\n",
+			strerror(errno), errno);
+		return -errno;
+	}
+
+	sink->fourcc = swsink_fb_format(var);
+	if (sink->fourcc == 0) {
+		printf("Unsupported framebuffer format (%u bpp).\n", var->bits_per_pixel);
+		return -EINVAL;
+	}
+
+	sink->disp_width = var->xres;
+	sink->disp_height = var->yres;
+	sink->stride = fix.line_length;
+	page = var->yres * fix.line_length;
+
+	/* Ask for a second page to flip to, stay single buffered if refused. */
+	if (var->yres_virtual < 2 * var->yres && fix.smem_len >= 2 * page) {
+		struct fb_var_screeninfo flip = *var;
+
+		flip.yres_virtual = 2 * var->yres;
+		if (ioctl(sink->fd, FBIOPUT_VSCREENINFO, &flip) == 0)
+			ioctl(sink->fd, FBIOGET_VSCREENINFO, var);
+	}
+
+	sink->nbuffers = var->yres_virtual >= 2 * var->yres && fix.smem_len >= 2 * page
+		       ? 2 : 1;
+
+	sink->fbsize = fix.smem_len;
+	sink->fbmem = (uint8_t *)mmap(NULL, sink->fbsize, PROT_READ | PROT_WRITE,
+				      MAP_SHARED, sink->fd, 0);
+	if (sink->fbmem == MAP_FAILED) {
+		sink->fbmem = NULL;
+		printf("Unable to map framebuffer: %s (%d).\n", strerror(errno), errno);
+		return -errno;
+	}
+
+	for (i = 0; i < sink->nbuffers; ++i) {
+		sink->buffers[i].data = sink->fbmem + i * page;
+		sink->buffers[i].yoffset = i * var->yres;
+	}
+
+	/* Borders around a smaller frame stay black. */
+	memset(sink->fbmem, 0, sink->nbuffers * page);
+
+	/* Draw into the page that is not on screen. */
+	sink->back = sink->nbuffers > 1 && var->yoffset == 0 ? 1 : 0;
+
+	/* Refresh period from the mode timings, pixclock is in picoseconds. */
+	if (sink->config.refresh == 0 && var->pixclock) {
+		uint64_t htotal = var->xres + var->left_margin + var->right_margin +
+				  var->hsync_len;
+		uint64_t vtotal = var->yres + var->upper_margin + var->lower_margin +
+				  var->vsync_len;
+
+		sink->period = var->pixclock * htotal * vtotal / 1000;
+	}
+
+	sink->vsync_ioctl = true;
+	sink->convert = convert_lookup_variant(sink->src_fourcc, sink->fourcc,
+					       CONVERT_STREAM);
+	return 0;
+}
+
+static void swsink_fb_close(struct swsink *sink)
+{
+	if (sink->fbmem)
+		munmap(sink->fbmem, sink->fbsize);
+	if (sink->fd >= 0)
+		close(sink->fd);
+}
+
+static void swsink_fb_present(struct swsink *sink, struct swsink_buffer *buf)
+{
+	if (sink->nbuffers < 2)
+		return;
+
+	sink->var.yoffset = buf->yoffset;
+	if (ioctl(sink->fd, FBIOPAN_DISPLAY, &sink->var) < 0)
+		printf("Unable to pan framebuffer: %s (%d).\n", strerror(errno), errno);
+}
+
+/* -----------------------------------------------------------------------------
+ * X11 backend
+ */
+
+#ifndef SWSINK_NO_X11
+static unsigned int swsink_x11_format(const Visual *visual, const XImage *ximage)
+{
+	if (ximage->byte_order != LSBFirst)
+		return 0;
+	if (ximage->bits_per_pixel == 16 && visual->red_mask == 0xf800 &&
+	    visual->green_mask == 0x07e0 && visual->blue_mask == 0x001f)
+		return V4L2_PIX_FMT_RGB565;
+	if (ximage->bits_per_pixel == 32 && visual->red_mask == 0xff0000 &&
+	    visual->green_mask == 0x00ff00 && visual->blue_mask == 0x0000ff)
+		return V4L2_PIX_FMT_BGR32;
+
+	return 0;
+}
+
+static int swsink_x11_open(struct swsink *sink)
+{
+	Visual *visual;
+	int screen;
+	int depth;
+	unsigned int i;
+
+	XInitThreads();
+
+	sink->display = XOpenDisplay(sink->config.device);
+	if (sink->display == NULL) {
+		printf("Unable to open X display %s.\n", XDisplayName(sink->config.device));
+		return -ENODEV;
+	}
+
+	if (!XShmQueryExtension(sink->display)) {
+		printf("X server does not support MIT-SHM.\n");
+		return -ENOTSUP;
+	}
+
+	screen = DefaultScreen(sink->display);
+	visual = DefaultVisual(sink->display, screen);
+	depth = DefaultDepth(sink->display, screen);
+
+	sink->nbuffers = SWSINK_MAX_BUFFERS;
+	sink->disp_width = sink->width;
+	sink->disp_height = sink->height;
+
+	for (i = 0; i < sink->nbuffers; ++i) {
+		struct swsink_buffer *buf = &sink->buffers[i];
+		XImage *ximage;
+
+		ximage = XShmCreateImage(sink->display, visual, depth, ZPixmap, NULL,
+					 &buf->shm, sink->width, sink->height);
+		if (ximage == NULL) {
+			printf("Unable to create shared memory image.\n");
+			return -ENOMEM;
+		}
+		buf->ximage = ximage;
+
+		buf->shm.shmid = shmget(IPC_PRIVATE, ximage->bytes_per_line * ximage->height,
+					IPC_CREAT | 0600);
+		if (buf->shm.shmid < 0) {
+			printf("Unable to allocate shared memory: %s (%d).\n",
+				strerror(errno), errno);
+			return -errno;
+		}
+
+		buf->shm.shmaddr = ximage->data = (char *)shmat(buf->shm.shmid, NULL, 0);
+		if (buf->shm.shmaddr == (char *)-1) {
+			buf->shm.shmaddr = ximage->data = NULL;
+			shmctl(buf->shm.shmid, IPC_RMID, NULL);
+			printf("Unable to attach shared memory: %s (%d).\n",
+				strerror(errno), errno);
+			return -errno;
+		}
+		buf->shm.readOnly = False;
+		XShmAttach(sink->display, &buf->shm);
+		buf->data = (uint8_t *)ximage->data;
+	}
+
+	/* Once the server is attached the segments can go with the last user. */
+	XSync(sink->display, False);
+	for (i = 0; i < sink->nbuffers; ++i)
+		shmctl(sink->buffers[i].shm.shmid, IPC_RMID, NULL);
+
+	sink->fourcc = swsink_x11_format(visual, sink->buffers[0].ximage);
+	if (sink->fourcc == 0) {
+		printf("Unsupported X visual (depth %d).\n", depth);
+		return -EINVAL;
+	}
+	sink->stride = sink->buffers[0].ximage->bytes_per_line;
+
+	sink->window = XCreateSimpleWindow(sink->display, RootWindow(sink->display, screen),
+					   0, 0, sink->width, sink->height, 0,
+					   BlackPixel(sink->display, screen),
+					   BlackPixel(sink->display, screen));
+	XStoreName(sink->display, sink->window, "yuv2rgb");
+	XMapWindow(sink->display, sink->window);
+	sink->gc = XCreateGC(sink->display, sink->window, 0, NULL);
+	sink->completion = XShmGetEventBase(sink->display) + ShmCompletion;
+	XFlush(sink->display);
+
+	sink->convert = convert_lookup_variant(sink->src_fourcc, sink->fourcc,
+					       CONVERT_SIMD);
+	return 0;
+}
+
+/* Wait until the server is done reading a buffer. */
+static void swsink_x11_wait(struct swsink *sink, struct swsink_buffer *buf)
+{
+	while (buf->busy) {
+		XShmCompletionEvent *done;
+		XEvent event;
+		unsigned int i;
+
+		XNextEvent(sink->display, &event);
+		if (event.type != sink->completion)
+			continue;
+
+		done = (XShmCompletionEvent *)&event;
+		for (i = 0; i < sink->nbuffers; ++i) {
+			if (sink->buffers[i].shm.shmseg == done->shmseg)
+				sink->buffers[i].busy = false;
+		}
+	}
+}
+
+static void swsink_x11_present(struct swsink *sink, struct swsink_buffer *buf)
+{
+	XShmPutImage(sink->display, sink->window, sink->gc, buf->ximage, 0, 0, 0, 0,
+		     sink->width, sink->height, True);
+	XFlush(sink->display);
+	buf->busy = true;
+}
+
+static void swsink_x11_close(struct swsink *sink)
+{
+	unsigned int i;
+
+	if (sink->display == NULL)
+		return;
+
+	for (i = 0; i < sink->nbuffers; ++i) {
+		struct swsink_buffer *buf = &sink->buffers[i];
+
+		if (buf->ximage == NULL)
+			continue;
+
+		swsink_x11_wait(sink, buf);
+		if (buf->shm.shmaddr) {
+			XShmDetach(sink->display, &buf->shm);
+			shmdt(buf->shm.shmaddr);
+		}
+		/* The data is not ours to free(). */
+		buf->ximage->data = NULL;
+		XDestroyImage(buf->ximage);
+	}
+
+	if (sink->gc)
+		XFreeGC(sink->display, sink->gc);
+	if (sink->window)
+		XDestroyWindow(sink->display, sink->window);
+	XCloseDisplay(sink->display);
+}
+#endif
+
+/* -----------------------------------------------------------------------------
+ * Sink thread
+ */
+
+/*
+ * Block until the next refresh: the framebuffer vsync ioctl when the
+ * driver has it, an absolute timer on the refresh period otherwise.
+ */
+static void swsink_wait_refresh(struct swsink *sink)
+{
+	struct timespec ts;
+	uint64_t now;
+
+	if (sink->config.type == SWSINK_FBDEV && sink->vsync_ioctl) {
+		__u32 crtc = 0;
+
+		if (ioctl(sink->fd, FBIO_WAITFORVSYNC, &crtc) == 0)
+			return;
+		sink->vsync_ioctl = false;
+	}
+
+	/* Skip to the first refresh tick after now if we fell behind. */
+	now = swsink_now();
+	if (now > sink->deadline)
+		sink->deadline += ((now - sink->deadline) / sink->period + 1) * sink->period;
+
+	ts.tv_sec = sink->deadline / 1000000000ULL;
+	ts.tv_nsec = sink->deadline % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+
+	sink->deadline += sink->period;
+}
+
+static void swsink_convert(struct swsink *sink, struct swsink_buffer *buf,
+	const struct image *frame)
+{
+	struct image src = *frame;
+	struct image dst;
+	unsigned int dx, dy;
+
+	/* Centre smaller frames, crop larger ones. */
+	if (src.width > sink->disp_width)
+		src.width = sink->disp_width & ~1;
+	if (src.height > sink->disp_height)
+		src.height = sink->disp_height;
+
+	dx = (sink->disp_width - src.width) / 2;
+	dy = (sink->disp_height - src.height) / 2;
+
+	image_init(&dst, sink->fourcc, src.width, src.height, sink->stride,
+		   buf->data + dy * sink->stride + dx * sink->bytes_per_pixel);
+	sink->convert(&src, &dst, 0, src.height);
+}
+
+static void *swsink_thread(void *arg)
+{
+	struct swsink *sink = (struct swsink *)arg;
+
+	while (1) {
+		struct swsink_buffer *buf = &sink->buffers[sink->back];
+		struct image frame;
+		unsigned int index;
+		uint64_t start;
+		bool late;
+
+		pthread_mutex_lock(&sink->lock);
+		while (!sink->has_pending && !sink->stop)
+			pthread_cond_wait(&sink->cond, &sink->lock);
+		if (sink->stop) {
+			pthread_mutex_unlock(&sink->lock);
+			break;
+		}
+		frame = sink->pending;
+		index = sink->pending_index;
+		sink->has_pending = false;
+		pthread_mutex_unlock(&sink->lock);
+
+#ifndef SWSINK_NO_X11
+		if (sink->config.type == SWSINK_X11)
+			swsink_x11_wait(sink, buf);
+#endif
+		/* A single page is written right after the refresh. */
+		if (sink->nbuffers == 1)
+			swsink_wait_refresh(sink);
+
+		start = swsink_now();
+		swsink_convert(sink, buf, &frame);
+		late = swsink_now() - start > sink->period;
+		sink->release(sink->priv, index);
+
+		if (sink->nbuffers > 1)
+			swsink_wait_refresh(sink);
+
+		if (sink->config.type == SWSINK_FBDEV)
+			swsink_fb_present(sink, buf);
+#ifndef SWSINK_NO_X11
+		else
+			swsink_x11_present(sink, buf);
+#endif
+		sink->back = (sink->back + 1) % sink->nbuffers;
+
+		pthread_mutex_lock(&sink->lock);
+		sink->stats.shown++;
+		if (late)
+			sink->stats.late++;
+		pthread_mutex_unlock(&sink->lock);
+	}
+
+	return NULL;
+}
+
+/* -----------------------------------------------------------------------------
+ * API
+ */
+
+int swsink_open(struct swsink **sinkp, const struct swsink_config *config,
+	unsigned int src_fourcc, unsigned int width, unsigned int height,
+	swsink_release_fn release, void *priv)
+{
+	struct swsink *sink;
+	int ret;
+
+	*sinkp = NULL;
+
+	sink = (struct swsink *)calloc(1, sizeof *sink);
+	if (sink == NULL)
+		return -ENOMEM;
+
+	sink->config = *config;
+	sink->src_fourcc = src_fourcc;
+	sink->width = width;
+	sink->height = height;
+	sink->fd = -1;
+	sink->release = release;
+	sink->priv = priv;
+	pthread_mutex_init(&sink->lock, NULL);
+	pthread_cond_init(&sink->cond, NULL);
+
+	switch (config->type) {
+	case SWSINK_FBDEV:
+		ret = swsink_fb_open(sink);
+		break;
+#ifndef SWSINK_NO_X11
+	case SWSINK_X11:
+		ret = swsink_x11_open(sink);
+		break;
+#endif
+	default:
+		printf("Display sink not supported in this build.\n");
+		ret = -ENOTSUP;
+		break;
+	}
+	if (ret < 0)
+		goto error;
+
+	if (sink->convert == NULL) {
+		printf("No converter from %s to %s.\n", v4l2_format_name(src_fourcc),
+			v4l2_format_name(sink->fourcc));
+		ret = -EINVAL;
+		goto error;
+	}
+
+	sink->bytes_per_pixel = pixfmt_lookup(sink->fourcc)->bpp / 8;
+
+	if (sink->config.refresh)
+		sink->period = 1000000000ULL / sink->config.refresh;
+	else if (sink->period == 0)
+		sink->period = 1000000000ULL / 60;
+
+	ret = -pthread_create(&sink->thread, NULL, swsink_thread, sink);
+	if (ret < 0)
+		goto error;
+	sink->started = true;
+
+	printf("Display sink: %ux%u %s, %u buffer(s), %.2f Hz.\n", sink->disp_width,
+		sink->disp_height, v4l2_format_name(sink->fourcc), sink->nbuffers,
+		1e9 / sink->period);
+
+	*sinkp = sink;
+	return 0;
+
+error:
+	swsink_close(sink);
+	return ret;
+}
+
+void swsink_close(struct swsink *sink)
+{
+	if (sink == NULL)
+		return;
+
+	if (sink->started) {
+		pthread_mutex_lock(&sink->lock);
+		sink->stop = true;
+		pthread_cond_signal(&sink->cond);
+		pthread_mutex_unlock(&sink->lock);
+		pthread_join(sink->thread, NULL);
+	}
+
+	if (sink->has_pending)
+		sink->release(sink->priv, sink->pending_index);
+
+	if (sink->config.type == SWSINK_FBDEV)
+		swsink_fb_close(sink);
+#ifndef SWSINK_NO_X11
+	else
+		swsink_x11_close(sink);
+#endif
+
+	pthread_cond_destroy(&sink->cond);
+	pthread_mutex_destroy(&sink->lock);
+	free(sink);
+}
+
+/*
+ * Hand a frame over to the sink, which reads it in place until it calls
+ * release(priv, index). A frame still waiting from an earlier call is
+ * released at once and counted as dropped, so the display always shows
+ * the latest frame and never queues up latency.
+ */
+void swsink_submit(struct swsink *sink, const struct image *frame,
+	unsigned int index)
+{
+	unsigned int dropped = 0;
+	bool drop;
+
+	pthread_mutex_lock(&sink->lock);
+	drop = sink->has_pending;
+	if (drop) {
+		dropped = sink->pending_index;
+		sink->stats.dropped++;
+	}
+	sink->pending = *frame;
+	sink->pending_index = index;
+	sink->has_pending = true;
+	pthread_cond_signal(&sink->cond);
+	pthread_mutex_unlock(&sink->lock);
+
+	if (drop)
+		sink->release(sink->priv, dropped);
+}
+
+void swsink_get_stats(struct swsink *sink, struct swsink_stats *stats)
+{
+	pthread_mutex_lock(&sink->lock);
+	*stats = sink->stats;
+	pthread_mutex_unlock(&sink->lock);
+}
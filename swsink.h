@@ -0,0 +1,58 @@
+/*
+ * swsink.h -- software display sink
+ *
+ * Shows frames on systems without a usable GLES driver, either through an
+ * MIT-SHM XImage or in a memory mapped framebuffer device. The sink runs
+ * its own thread: it converts the latest submitted frame straight from
+ * the capture buffer into display memory, in the display's own pixel
+ * format (RGB565 or XRGB8888), and presents it at most once per refresh
+ * period. Display memory is written once per frame and nothing is copied.
+ */
+
+#ifndef __SWSINK_H__
+#define __SWSINK_H__
+
+#include "convert.h"
+
+enum swsink_type
+{
+	SWSINK_X11,
+	SWSINK_FBDEV
+};
+
+struct swsink_config
+{
+	enum swsink_type type;
+	/* X display name or framebuffer device, NULL for the default. */
+	const char *device;
+	/* Refresh rate in Hz, 0 to use the display timings or 60. */
+	unsigned int refresh;
+};
+
+struct swsink_stats
+{
+	unsigned int shown;
+	/* Frames replaced by a newer one before the sink picked them up. */
+	unsigned int dropped;
+	/* Frames whose conversion took longer than a refresh period. */
+	unsigned int late;
+};
+
+/*
+ * Called once a submitted frame is no longer needed and its buffer can be
+ * reused: from the sink thread after conversion, or from swsink_submit()
+ * when the frame is dropped.
+ */
+typedef void (*swsink_release_fn)(void *priv, unsigned int index);
+
+struct swsink;
+
+int swsink_open(struct swsink **sinkp, const struct swsink_config *config,
+	unsigned int src_fourcc, unsigned int width, unsigned int height,
+	swsink_release_fn release, void *priv);
+void swsink_close(struct swsink *sink);
+void swsink_submit(struct swsink *sink, const struct image *frame,
+	unsigned int index);
+void swsink_get_stats(struct swsink *sink, struct swsink_stats *stats);
+
+#endif /* __SWSINK_H__ */
@@ -0,0 +1,245 @@
+/******************************************************************************
+
+ @File         tiledtex.cpp
+
+ @Title        Tiled frame texture
+
+ @Description  Splits a video frame into textures no larger than
+               GL_MAX_TEXTURE_SIZE and keeps them up to date from the
+               capture buffer.
+
+******************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+
+#include "tiledtex.h"
+
+#ifndef GL_UNPACK_ROW_LENGTH_EXT
+#define GL_UNPACK_ROW_LENGTH_EXT	0x0CF2
+#define GL_UNPACK_SKIP_ROWS_EXT		0x0CF3
+#define GL_UNPACK_SKIP_PIXELS_EXT	0x0CF4
+#endif
+
+CTiledTexture::CTiledTexture()
+	: m_psTiles(NULL), m_uiNumTiles(0), m_uiWidth(0), m_uiHeight(0),
+	  m_eFormat(0), m_uiBytesPerTexel(0), m_bUnpackSubimage(false), m_pu8Staging(NULL), m_uiStagingSize(0),
+	  m_u64BytesUploaded(0), m_u64BytesSkipped(0)
+{
+}
+
+CTiledTexture::~CTiledTexture()
+{
+	Release();
+}
+
+/*!****************************************************************************
+ @Function		Init
+ @Input			uiWidth, uiHeight	Frame size in pixels
+ @Input			eFormat			Texture format
+ @Input			uiBytesPerTexel		Size of one texel in the frame
+ @Input			uiMaxSize		Largest texture dimension, 0 to query GL
+ @Return		bool			true if no error occured
+ @Description	Creates the tile textures. Tile widths are kept even so that
+				no 4:2:2 pixel pair, and thus no chroma neighbour lookup
+				in the shader, ever straddles a tile seam.
+******************************************************************************/
+bool CTiledTexture::Init(unsigned int uiWidth, unsigned int uiHeight, GLenum eFormat,
+			 unsigned int uiBytesPerTexel, unsigned int uiMaxSize)
+{
+	Release();
+
+	if (uiMaxSize == 0)
+	{
+		GLint i32MaxSize;
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &i32MaxSize);
+		uiMaxSize = i32MaxSize;
+	}
+	uiMaxSize &= ~1;
+
+	const char* pszExtensions = (const char*)glGetString(GL_EXTENSIONS);
+	m_bUnpackSubimage = pszExtensions && strstr(pszExtensions, "GL_EXT_unpack_subimage");
+
+	unsigned int uiCols = (uiWidth + uiMaxSize - 1) / uiMaxSize;
+	unsigned int uiRows = (uiHeight + uiMaxSize - 1) / uiMaxSize;
+	unsigned int uiTileW = ((uiWidth + uiCols - 1) / uiCols + 1) & ~1;
+	unsigned int uiTileH = (uiHeight + uiRows - 1) / uiRows;
+
+	m_psTiles = new STile[uiCols * uiRows];
+	m_uiNumTiles = uiCols * uiRows;
+	m_uiWidth = uiWidth;
+	m_uiHeight = uiHeight;
+	m_eFormat = eFormat;
+	m_uiBytesPerTexel = uiBytesPerTexel;
+	m_u64BytesUploaded = 0;
+	m_u64BytesSkipped = 0;
+
+	// Large enough for any tile, only allocated if a stride needs repacking
+	m_uiStagingSize = uiTileW * uiTileH * uiBytesPerTexel;
+
+	for (unsigned int j = 0; j < uiRows; ++j)
+	{
+		for (unsigned int i = 0; i < uiCols; ++i)
+		{
+			STile& sTile = m_psTiles[j * uiCols + i];
+
+			sTile.uiX = i * uiTileW;
+			sTile.uiY = j * uiTileH;
+			sTile.uiWidth = (i == uiCols - 1) ? uiWidth - sTile.uiX : uiTileW;
+			sTile.uiHeight = (j == uiRows - 1) ? uiHeight - sTile.uiY : uiTileH;
+
+			glGenTextures(1, &sTile.uiTexture);
+			glBindTexture(GL_TEXTURE_2D, sTile.uiTexture);
+			glTexImage2D(GL_TEXTURE_2D, 0, eFormat, sTile.uiWidth, sTile.uiHeight, 0,
+				     eFormat, GL_UNSIGNED_BYTE, NULL);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		}
+	}
+
+	return true;
+}
+
+void CTiledTexture::Release()
+{
+	for (unsigned int i = 0; i < m_uiNumTiles; ++i)
+		glDeleteTextures(1, &m_psTiles[i].uiTexture);
+
+	delete [] m_psTiles;
+	m_psTiles = NULL;
+	m_uiNumTiles = 0;
+
+	free(m_pu8Staging);
+	m_pu8Staging = NULL;
+}
+
+/*!****************************************************************************
+ @Function		Upload
+ @Input			pData		First line of the frame
+ @Input			uiStride	Bytes per frame line
+ @Input			uiX0, uiY0, uiX1, uiY1	Frame rectangle to refresh
+ @Input			psDirty		Changed tiles of the frame, or NULL
+ @Input			uiSince		Frame of psDirty the textures hold, 0 for none
+ @Return		unsigned int	Number of tiles sent to GL
+ @Description	Refreshes the lines [uiY0, uiY1) of every tile intersecting
+				the rectangle. With a dirty map only the runs of tile rows
+				with a tile changed after uiSince are sent.
+******************************************************************************/
+unsigned int CTiledTexture::Upload(const unsigned char* pData, unsigned int uiStride,
+				   unsigned int uiX0, unsigned int uiY0,
+				   unsigned int uiX1, unsigned int uiY1,
+				   const struct dirtymap* psDirty, unsigned int uiSince)
+{
+	unsigned int uiUploaded = 0;
+
+	for (unsigned int i = 0; i < m_uiNumTiles; ++i)
+	{
+		STile& sTile = m_psTiles[i];
+		unsigned int uiFirst = uiY0 > sTile.uiY ? uiY0 : sTile.uiY;
+		unsigned int uiLast = uiY1 < sTile.uiY + sTile.uiHeight ? uiY1 : sTile.uiY + sTile.uiHeight;
+
+		if (uiFirst >= uiLast || uiX1 <= sTile.uiX || uiX0 >= sTile.uiX + sTile.uiWidth)
+			continue;
+
+		unsigned int uiBytes = sTile.uiWidth * m_uiBytesPerTexel;
+
+		if (psDirty == NULL)
+		{
+			UploadTile(sTile, pData, uiStride, uiFirst, uiLast);
+			m_u64BytesUploaded += (uint64_t)uiBytes * (uiLast - uiFirst);
+			uiUploaded++;
+			continue;
+		}
+
+		// Columns of the dirty map under the tile, then runs of changed rows
+		unsigned int uiCol0 = sTile.uiX / DIRTYMAP_TILE_WIDTH;
+		unsigned int uiCol1 = (sTile.uiX + sTile.uiWidth + DIRTYMAP_TILE_WIDTH - 1) / DIRTYMAP_TILE_WIDTH;
+		unsigned int uiRow = uiFirst / DIRTYMAP_TILE_LINES;
+		unsigned int uiRowEnd = (uiLast + DIRTYMAP_TILE_LINES - 1) / DIRTYMAP_TILE_LINES;
+		unsigned int uiSent = 0;
+
+		while (uiRow < uiRowEnd)
+		{
+			if (!dirtymap_row_changed(psDirty, uiRow, uiCol0, uiCol1, uiSince))
+			{
+				uiRow++;
+				continue;
+			}
+
+			unsigned int uiRunEnd = uiRow + 1;
+			while (uiRunEnd < uiRowEnd && dirtymap_row_changed(psDirty, uiRunEnd, uiCol0, uiCol1, uiSince))
+				uiRunEnd++;
+
+			unsigned int uiRunFirst = uiRow * DIRTYMAP_TILE_LINES;
+			unsigned int uiRunLast = uiRunEnd * DIRTYMAP_TILE_LINES;
+			if (uiRunFirst < uiFirst)
+				uiRunFirst = uiFirst;
+			if (uiRunLast > uiLast)
+				uiRunLast = uiLast;
+
+			UploadTile(sTile, pData, uiStride, uiRunFirst, uiRunLast);
+			uiSent += uiRunLast - uiRunFirst;
+			uiRow = uiRunEnd;
+		}
+
+		m_u64BytesUploaded += (uint64_t)uiBytes * uiSent;
+		m_u64BytesSkipped += (uint64_t)uiBytes * (uiLast - uiFirst - uiSent);
+		if (uiSent)
+			uiUploaded++;
+	}
+
+	return uiUploaded;
+}
+
+/*!****************************************************************************
+ @Function		UploadTile
+ @Description	Sends frame lines [uiFirst, uiLast) of a tile. Lines are
+				sent straight from the frame when they are contiguous or
+				GL_EXT_unpack_subimage can describe the frame stride, and
+				through the staging buffer otherwise.
+******************************************************************************/
+void CTiledTexture::UploadTile(STile& sTile, const unsigned char* pData, unsigned int uiStride,
+			       unsigned int uiFirst, unsigned int uiLast)
+{
+	unsigned int uiBytes = sTile.uiWidth * m_uiBytesPerTexel;
+	unsigned int uiRows = uiLast - uiFirst;
+	const unsigned char* pSrc = pData + uiFirst * uiStride + sTile.uiX * m_uiBytesPerTexel;
+
+	glBindTexture(GL_TEXTURE_2D, sTile.uiTexture);
+
+	if (uiStride == uiBytes)
+	{
+		glPixelStorei(GL_UNPACK_ALIGNMENT, (uiBytes & 3) ? 1 : 4);
+	}
+	else if (m_bUnpackSubimage && uiStride % m_uiBytesPerTexel == 0)
+	{
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, uiStride / m_uiBytesPerTexel);
+	}
+	else
+	{
+		unsigned char* pDst = m_pu8Staging;
+
+		if (pDst == NULL)
+			pDst = m_pu8Staging = (unsigned char*)malloc(m_uiStagingSize);
+		if (pDst == NULL)
+			return;
+
+		for (unsigned int y = 0; y < uiRows; ++y)
+			memcpy(pDst + y * uiBytes, pSrc + y * uiStride, uiBytes);
+
+		pSrc = pDst;
+		glPixelStorei(GL_UNPACK_ALIGNMENT, (uiBytes & 3) ? 1 : 4);
+	}
+
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, uiFirst - sTile.uiY, sTile.uiWidth, uiRows,
+			m_eFormat, GL_UNSIGNED_BYTE, pSrc);
+
+	if (m_bUnpackSubimage && uiStride != uiBytes)
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+}
+
+/******************************************************************************
+ End of file (tiledtex.cpp)
+******************************************************************************/
@@ -0,0 +1,74 @@
+/******************************************************************************
+
+ @File         tiledtex.h
+
+ @Title        Tiled frame texture
+
+ @Description  Splits a video frame into textures no larger than
+               GL_MAX_TEXTURE_SIZE and keeps them up to date from the
+               capture buffer.
+
+******************************************************************************/
+#ifndef _TILEDTEX_H_
+#define _TILEDTEX_H_
+
+#include <stdint.h>
+#include <GLES2/gl2.h>
+
+#include "dirtymap.h"
+
+/*!****************************************************************************
+ Class managing the textures covering one video frame
+******************************************************************************/
+class CTiledTexture
+{
+public:
+	struct STile
+	{
+		GLuint uiTexture;
+		// Frame rectangle covered by the tile, in pixels
+		unsigned int uiX, uiY, uiWidth, uiHeight;
+	};
+
+	CTiledTexture();
+	~CTiledTexture();
+
+	bool Init(unsigned int uiWidth, unsigned int uiHeight, GLenum eFormat,
+		  unsigned int uiBytesPerTexel, unsigned int uiMaxSize);
+	void Release();
+
+	unsigned int Upload(const unsigned char* pData, unsigned int uiStride,
+			    unsigned int uiX0, unsigned int uiY0,
+			    unsigned int uiX1, unsigned int uiY1,
+			    const struct dirtymap* psDirty = NULL, unsigned int uiSince = 0);
+
+	unsigned int GetTileCount() const { return m_uiNumTiles; }
+	const STile& GetTile(unsigned int i) const { return m_psTiles[i]; }
+
+	// Statistics since Init()
+	uint64_t GetBytesUploaded() const { return m_u64BytesUploaded; }
+	uint64_t GetBytesSkipped() const { return m_u64BytesSkipped; }
+
+private:
+	void UploadTile(STile& sTile, const unsigned char* pData, unsigned int uiStride,
+			unsigned int uiFirst, unsigned int uiLast);
+
+	STile* m_psTiles;
+	unsigned int m_uiNumTiles;
+	unsigned int m_uiWidth, m_uiHeight;
+	GLenum m_eFormat;
+	unsigned int m_uiBytesPerTexel;
+
+	bool m_bUnpackSubimage;
+	unsigned char* m_pu8Staging;
+	unsigned int m_uiStagingSize;
+
+	uint64_t m_u64BytesUploaded;
+	uint64_t m_u64BytesSkipped;
+};
+
+#endif /* _TILEDTEX_H_ */
+
+/******************************************************************************
+ End of file (tiledtex.h)
+******************************************************************************/
@@ -0,0 +1,327 @@
+/*
+ * v4l2out.cpp -- V4L2 video output sink
+ */
+
+#include <poll.h>
+
+#include "v4l2out.h"
+
+static uint64_t v4l2out_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Lines [first, last) of frames already in the output format. */
+static void v4l2out_copy(const struct image *src, struct image *dst,
+	unsigned int first, unsigned int last)
+{
+	unsigned int bytes = pixfmt_bytesperline(pixfmt_lookup(src->fourcc), src->width);
+	unsigned int y;
+
+	for (y = first; y < last; ++y)
+		memcpy(dst->data + y * dst->stride, src->data + y * src->stride, bytes);
+}
+
+/*
+ * Open an output or mem2mem device. Buffers are only allocated by
+ * v4l2out_start(), once the frame size is known.
+ */
+int v4l2out_open(struct v4l2out *out, const char *devname, unsigned int nbufs,
+	const char *filename)
+{
+	int ret;
+
+	memset(out, 0, sizeof *out);
+	out->nbufs = nbufs;
+
+	ret = video_open(&out->dev, devname, 0);
+	if (ret < 0)
+		return ret;
+
+	if (!(out->dev.capabilities & (V4L2_CAP_VIDEO_OUTPUT | V4L2_CAP_VIDEO_M2M))) {
+		printf("Device %s has no video output.\n", devname);
+		video_close(&out->dev);
+		return -EINVAL;
+	}
+
+	out->dev.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	out->dev.memtype = V4L2_MEMORY_MMAP;
+	out->m2m = out->dev.capabilities & V4L2_CAP_VIDEO_M2M;
+
+	if (out->m2m) {
+		out->cap = out->dev;
+		out->cap.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	}
+
+	if (filename) {
+		out->file = fopen(filename, "wb");
+		if (out->file == NULL) {
+			printf("Unable to open %s: %s (%d).\n", filename,
+				strerror(errno), errno);
+			ret = -errno;
+			video_close(&out->dev);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/* Run the capture queue of a mem2mem device. */
+static int v4l2out_start_capture(struct v4l2out *out)
+{
+	struct device *cap = &out->cap;
+	unsigned int i;
+	int ret;
+
+	ret = video_alloc_buffers(cap, out->nbufs, 0, 0);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < cap->nbufs; ++i) {
+		ret = video_queue_buffer(cap, i, BUFFER_FILL_NONE);
+		if (ret < 0)
+			return ret;
+	}
+
+	return video_enable(cap, 1);
+}
+
+/*
+ * Set the output format for frames of src_fourcc and map the buffers.
+ * The frames are converted when the formats differ. codec is the capture
+ * format of a mem2mem device, 0 to keep the driver's.
+ */
+int v4l2out_start(struct v4l2out *out, unsigned int src_fourcc,
+	unsigned int fourcc, unsigned int width, unsigned int height,
+	unsigned int codec)
+{
+	struct device *dev = &out->dev;
+	unsigned int i;
+	int ret;
+
+	if (fourcc == src_fourcc) {
+		out->convert = v4l2out_copy;
+	} else {
+		out->convert = convert_lookup(src_fourcc, fourcc);
+		if (out->convert == NULL) {
+			printf("No conversion from %s to %s.\n",
+				v4l2_format_name(src_fourcc), v4l2_format_name(fourcc));
+			return -EINVAL;
+		}
+	}
+
+	/* Encoders want the coded format first, it limits the raw ones. */
+	if (out->m2m && codec) {
+		ret = video_set_format(&out->cap, width, height, codec);
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = video_set_format(dev, width, height, fourcc);
+	if (ret < 0)
+		return ret;
+
+	/* The line length and image size are the driver's. */
+	ret = video_get_format(dev);
+	if (ret < 0)
+		return ret;
+
+	if (dev->pixelformat != fourcc || dev->width != width ||
+	    dev->height != height) {
+		printf("Output format %s %ux%u not supported.\n",
+			v4l2_format_name(fourcc), width, height);
+		return -EINVAL;
+	}
+
+	ret = video_alloc_buffers(dev, out->nbufs, 0, 0);
+	if (ret < 0)
+		return ret;
+
+	out->images = (struct image *)calloc(dev->nbufs, sizeof *out->images);
+	out->free = (unsigned int *)calloc(dev->nbufs, sizeof *out->free);
+	if (out->images == NULL || out->free == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < dev->nbufs; ++i) {
+		image_init(&out->images[i], fourcc, width, height,
+			   dev->bytesperline, dev->buffers[i].mem);
+		out->free[out->nfree++] = dev->nbufs - 1 - i;
+	}
+
+	out->bytesused = dev->imagesize ? dev->imagesize : dev->bytesperline * height;
+	if (out->bytesused > dev->buffers[0].size)
+		out->bytesused = dev->buffers[0].size;
+
+	if (out->m2m) {
+		ret = v4l2out_start_capture(out);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int v4l2out_dequeue(struct device *dev, struct v4l2_buffer *buf)
+{
+	memset(buf, 0, sizeof *buf);
+	buf->type = dev->type;
+	buf->memory = dev->memtype;
+	if (ioctl(dev->fd, VIDIOC_DQBUF, buf) < 0) {
+		printf("Unable to dequeue buffer: %s (%d).\n", strerror(errno),
+			errno);
+		return -errno;
+	}
+
+	return 0;
+}
+
+/*
+ * Take back the buffers the driver is done with, and save and requeue
+ * the coded ones of a mem2mem device. Waits up to timeout ms while no
+ * output buffer is free.
+ */
+static int v4l2out_reclaim(struct v4l2out *out, int timeout)
+{
+	struct v4l2_buffer buf;
+	struct pollfd pfd;
+	int ret;
+
+	while (out->streaming) {
+		pfd.fd = out->dev.fd;
+		pfd.events = POLLOUT | (out->m2m ? POLLIN : 0);
+		ret = poll(&pfd, 1, out->nfree ? 0 : timeout);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+
+		if (pfd.revents & POLLERR)
+			return -EIO;
+
+		if (pfd.revents & POLLIN) {
+			ret = v4l2out_dequeue(&out->cap, &buf);
+			if (ret < 0)
+				return ret;
+
+			if (out->file)
+				fwrite(out->cap.buffers[buf.index].mem, buf.bytesused, 1,
+				       out->file);
+			out->coded++;
+			out->coded_bytes += buf.bytesused;
+			video_queue_buffer(&out->cap, buf.index, BUFFER_FILL_NONE);
+		}
+
+		if (pfd.revents & POLLOUT) {
+			ret = v4l2out_dequeue(&out->dev, &buf);
+			if (ret < 0)
+				return ret;
+
+			out->free[out->nfree++] = buf.index;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * A free output buffer to render into, waiting up to timeout ms for the
+ * driver to return one. -EAGAIN when none came back in time.
+ */
+int v4l2out_get(struct v4l2out *out, int timeout)
+{
+	int ret;
+
+	ret = v4l2out_reclaim(out, timeout);
+	if (ret < 0)
+		return ret;
+
+	if (out->nfree == 0) {
+		out->waits++;
+		return -EAGAIN;
+	}
+
+	return out->free[--out->nfree];
+}
+
+/* Convert src into buffer index, on the threads of bc if not NULL. */
+void v4l2out_render(struct v4l2out *out, unsigned int index,
+	const struct image *src, struct bandconv *bc)
+{
+	uint64_t start = v4l2out_now();
+	uint64_t elapsed;
+
+	if (bc)
+		bandconv_run(bc, out->convert, src, &out->images[index]);
+	else
+		out->convert(src, &out->images[index], 0, src->height);
+
+	elapsed = v4l2out_now() - start;
+	out->render_ns += elapsed;
+	if (elapsed > out->max_ns)
+		out->max_ns = elapsed;
+}
+
+/* Hand a rendered buffer to the driver, streaming starts with the first. */
+int v4l2out_queue(struct v4l2out *out, unsigned int index, unsigned int field,
+	unsigned int sequence, uint64_t timestamp)
+{
+	int ret;
+
+	ret = video_queue_output(&out->dev, index, out->bytesused, field,
+				 sequence, timestamp);
+	if (ret < 0) {
+		out->free[out->nfree++] = index;
+		return ret;
+	}
+
+	out->frames++;
+
+	if (!out->streaming) {
+		ret = video_enable(&out->dev, 1);
+		if (ret < 0)
+			return ret;
+		out->streaming = true;
+	}
+
+	return 0;
+}
+
+void v4l2out_print(const struct v4l2out *out, const char *name)
+{
+	if (out->frames == 0)
+		return;
+
+	printf("%s: %u frames queued, %u times without a free buffer\n", name,
+		out->frames, out->waits);
+	printf("%s: %.1f us/frame (max %.1f), %.2f ns/pixel\n", name,
+		out->render_ns / 1e3 / out->frames, out->max_ns / 1e3,
+		(double)out->render_ns / out->frames /
+		(out->images[0].width * out->images[0].height));
+	if (out->m2m)
+		printf("%s: %u coded buffers, %llu bytes\n", name, out->coded,
+			(unsigned long long)out->coded_bytes);
+}
+
+void v4l2out_close(struct v4l2out *out)
+{
+	if (out->streaming)
+		video_enable(&out->dev, 0);
+	video_free_buffers(&out->dev);
+
+	/* The capture side shares the file descriptor, only its buffers go. */
+	if (out->m2m) {
+		if (out->cap.nbufs)
+			video_enable(&out->cap, 0);
+		video_free_buffers(&out->cap);
+	}
+
+	if (out->file)
+		fclose(out->file);
+	free(out->images);
+	free(out->free);
+	video_close(&out->dev);
+}
@@ -0,0 +1,61 @@
+/*
+ * v4l2out.h -- V4L2 video output sink
+ *
+ * Feeds frames to a V4L2 output device, such as v4l2loopback, or to the
+ * output queue of a memory to memory device, such as a hardware encoder.
+ * Frames are converted, or copied when the formats match, straight into
+ * the mmapped buffers of the device: a free buffer is taken, rendered in
+ * place and queued with the size, field, sequence number and timestamp
+ * of its frame. Buffers come back to the free list when the driver is
+ * done with them.
+ *
+ * The capture queue of a mem2mem device is run too: its buffers are
+ * appended to a file, when one is given, and queued back.
+ */
+
+#ifndef __V4L2OUT_H__
+#define __V4L2OUT_H__
+
+#include "bandconv.h"
+
+struct v4l2out
+{
+	struct device dev;
+	unsigned int nbufs;
+	bool streaming;
+
+	/* Capture queue of a mem2mem device, on the same file descriptor. */
+	bool m2m;
+	struct device cap;
+	FILE *file;
+
+	/* Buffers not owned by the driver. */
+	struct image *images;
+	unsigned int *free;
+	unsigned int nfree;
+	unsigned int bytesused;
+	convert_fn convert;
+
+	/* Statistics. */
+	unsigned int frames;
+	unsigned int waits;
+	uint64_t render_ns;
+	uint64_t max_ns;
+	unsigned int coded;
+	uint64_t coded_bytes;
+};
+
+int v4l2out_open(struct v4l2out *out, const char *devname, unsigned int nbufs,
+	const char *filename);
+int v4l2out_start(struct v4l2out *out, unsigned int src_fourcc,
+	unsigned int fourcc, unsigned int width, unsigned int height,
+	unsigned int codec);
+int v4l2out_get(struct v4l2out *out, int timeout);
+void v4l2out_render(struct v4l2out *out, unsigned int index,
+	const struct image *src, struct bandconv *bc);
+int v4l2out_queue(struct v4l2out *out, unsigned int index, unsigned int field,
+	unsigned int sequence, uint64_t timestamp);
+void v4l2out_print(const struct v4l2out *out, const char *name);
+void v4l2out_close(struct v4l2out *out);
+
+#endif /* __V4L2OUT_H__ */
@@ -0,0 +1,140 @@
+/*
+ * vpipe.cpp -- run a pipeline graph
+ *
+ * Loads a pipeline description (see pipeline.h and pipeline.conf), runs
+ * it until its sources end, the frame limit is reached or it is
+ * interrupted, and prints per node statistics.
+ *
+ * The frame pool is watched for heap allocations after the first second,
+ * when every stage has had a chance to reach its steady state; there
+ * should be none.
+ *
+ * -R sets the scheduling policy and CPUs of the worker threads, sources
+ * take theirs from the configuration; -m locks all memory.
+ */
+
+#include <signal.h>
+
+#include "yavtalib.h"
+#include "pipeline.h"
+
+static struct pipeline vpipe;
+
+static void vpipe_signal(int)
+{
+	pipeline_stop(&vpipe);
+}
+
+static void usage(const char *argv0)
+{
+	printf("Usage: %s [options] config\n", argv0);
+	printf("Run the pipeline described in config.\n\n");
+	printf("Supported options:\n");
+	printf("-h, --help			Show this help screen\n");
+	printf("-H, --hugepages			Back frames with huge pages\n");
+	printf("-m, --mlock			Lock all memory, avoid page faults\n");
+	printf("-n, --nframes n			Stop the sources after n frames\n");
+	printf("-R, --rt setting		Worker scheduling, e.g. fifo:50@2-3 (see rtsched.h)\n");
+	printf("-t, --threads n			Number of worker threads (default one per CPU)\n");
+}
+
+static struct option opts[] = {
+	{"help", 0, 0, 'h'},
+	{"hugepages", 0, 0, 'H'},
+	{"mlock", 0, 0, 'm'},
+	{"nframes", 1, 0, 'n'},
+	{"rt", 1, 0, 'R'},
+	{"threads", 1, 0, 't'},
+	{0, 0, 0, 0}
+};
+
+int main(int argc, char *argv[])
+{
+	unsigned int nframes = 0;
+	unsigned int nthreads = 0;
+	unsigned int warm = 0;
+	struct rt_config rt;
+	bool set_rt = false;
+	bool mlock = false;
+	unsigned int i;
+	struct timespec start, end;
+	double duration;
+	int ret;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "hHmn:R:t:", opts, NULL)) != -1) {
+		switch (c) {
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		case 'H':
+			frame_pool_setup(SLOTPOOL_HUGEPAGES);
+			break;
+		case 'm':
+			mlock = true;
+			break;
+		case 'n':
+			nframes = atoi(optarg);
+			break;
+		case 'R':
+			if (rt_parse(optarg, &rt) < 0)
+				return 1;
+			set_rt = true;
+			break;
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		default:
+			printf("Invalid option -%c\n", c);
+			printf("Run %s -h for help.\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	ret = pipeline_load(&vpipe, argv[optind]);
+	if (ret < 0)
+		return 1;
+
+	vpipe.max_frames = nframes;
+
+	signal(SIGINT, vpipe_signal);
+	signal(SIGTERM, vpipe_signal);
+
+	if (mlock)
+		rt_lock_memory();
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	ret = pipeline_start(&vpipe, nthreads);
+	if (ret == 0) {
+		for (i = 0; set_rt && i < vpipe.pool.nthreads; ++i)
+			rt_apply(vpipe.pool.workers[i].thread, &rt);
+		if (set_rt)
+			rt_print(vpipe.pool.workers[0].thread, "workers");
+
+		for (i = 0; i < 100 && vpipe.sources; ++i)
+			usleep(10000);
+		warm = frame_pool()->allocations;
+
+		pipeline_wait(&vpipe);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (ret == 0) {
+		duration = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+		printf("Ran for %.3f seconds.\n", duration);
+		pipeline_print_stats(&vpipe);
+		slotpool_print_stats(frame_pool());
+		printf("%u heap allocations after the first second.\n",
+			frame_pool()->allocations - warm);
+	}
+
+	pipeline_cleanup(&vpipe);
+	return ret < 0 ? 1 : 0;
+}
@@ -0,0 +1,187 @@
+/*
+ * workpool.cpp -- work-stealing thread pool
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "workpool.h"
+
+/* Worker running on the current thread, NULL outside the pool. */
+static __thread struct workpool_worker *workpool_current;
+
+static bool workpool_push(struct workpool_worker *worker, workpool_fn fn, void *arg)
+{
+	bool ret = false;
+
+	pthread_mutex_lock(&worker->lock);
+	if (worker->count < WORKPOOL_QUEUE_SIZE) {
+		struct workpool_task *task;
+
+		task = &worker->tasks[(worker->first + worker->count) % WORKPOOL_QUEUE_SIZE];
+		task->fn = fn;
+		task->arg = arg;
+		worker->count++;
+		ret = true;
+	}
+	pthread_mutex_unlock(&worker->lock);
+
+	return ret;
+}
+
+/* The owner takes the newest task, thieves the oldest. */
+static bool workpool_pop(struct workpool_worker *worker, bool steal,
+	struct workpool_task *task)
+{
+	bool ret = false;
+
+	pthread_mutex_lock(&worker->lock);
+	if (worker->count) {
+		if (steal) {
+			*task = worker->tasks[worker->first];
+			worker->first = (worker->first + 1) % WORKPOOL_QUEUE_SIZE;
+		} else {
+			*task = worker->tasks[(worker->first + worker->count - 1) %
+					      WORKPOOL_QUEUE_SIZE];
+		}
+		worker->count--;
+		ret = true;
+	}
+	pthread_mutex_unlock(&worker->lock);
+
+	return ret;
+}
+
+static bool workpool_take(struct workpool_worker *worker, struct workpool_task *task)
+{
+	struct workpool *pool = worker->pool;
+	unsigned int i;
+
+	if (workpool_pop(worker, false, task))
+		return true;
+
+	for (i = 1; i < pool->nthreads; ++i) {
+		struct workpool_worker *victim;
+
+		victim = &pool->workers[(worker->index + i) % pool->nthreads];
+		if (workpool_pop(victim, true, task)) {
+			worker->stolen++;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void *workpool_thread(void *arg)
+{
+	struct workpool_worker *worker = (struct workpool_worker *)arg;
+	struct workpool *pool = worker->pool;
+
+	workpool_current = worker;
+
+	while (1) {
+		struct workpool_task task;
+
+		if (workpool_take(worker, &task)) {
+			__sync_fetch_and_sub(&pool->pending, 1);
+			task.fn(task.arg);
+			worker->executed++;
+			continue;
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		while (pool->pending == 0 && !pool->stop)
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		pthread_mutex_unlock(&pool->lock);
+
+		if (pool->stop && pool->pending == 0)
+			break;
+	}
+
+	return NULL;
+}
+
+int workpool_init(struct workpool *pool, unsigned int nthreads)
+{
+	unsigned int i;
+	int ret;
+
+	memset(pool, 0, sizeof *pool);
+
+	if (nthreads == 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads > WORKPOOL_MAX_THREADS)
+		nthreads = WORKPOOL_MAX_THREADS;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	for (i = 0; i < nthreads; ++i) {
+		struct workpool_worker *worker = &pool->workers[i];
+
+		worker->pool = pool;
+		worker->index = i;
+		pthread_mutex_init(&worker->lock, NULL);
+
+		ret = pthread_create(&worker->thread, NULL, workpool_thread, worker);
+		if (ret) {
+			printf("Unable to start worker thread: %s (%d).\n",
+				strerror(ret), ret);
+			pthread_mutex_destroy(&worker->lock);
+			workpool_cleanup(pool);
+			return -ret;
+		}
+
+		pool->nthreads++;
+	}
+
+	return 0;
+}
+
+/*
+ * Queue a task. Tasks submitted from a worker stay on that worker unless
+ * stolen; others are spread over the workers round robin. A full deque
+ * runs the task in the caller.
+ */
+void workpool_submit(struct workpool *pool, workpool_fn fn, void *arg)
+{
+	struct workpool_worker *worker = workpool_current;
+
+	if (worker == NULL || worker->pool != pool)
+		worker = &pool->workers[__sync_fetch_and_add(&pool->next, 1) % pool->nthreads];
+
+	__sync_fetch_and_add(&pool->pending, 1);
+
+	if (!workpool_push(worker, fn, arg)) {
+		__sync_fetch_and_sub(&pool->pending, 1);
+		fn(arg);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* Run the remaining tasks and stop the workers. */
+void workpool_cleanup(struct workpool *pool)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nthreads; ++i) {
+		pthread_join(pool->workers[i].thread, NULL);
+		pthread_mutex_destroy(&pool->workers[i].lock);
+	}
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+	pool->nthreads = 0;
+}
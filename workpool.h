@@ -0,0 +1,63 @@
+/*
+ * workpool.h -- work-stealing thread pool
+ *
+ * Every worker owns a deque of tasks. Tasks submitted from a worker go to
+ * the back of its own deque and are popped from there again, so a frame
+ * handed from one pipeline stage to the next is usually processed on the
+ * core that still has it in cache. Idle workers steal from the front of
+ * the other deques, the oldest work first, and sleep when there is none.
+ */
+
+#ifndef __WORKPOOL_H__
+#define __WORKPOOL_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#define WORKPOOL_MAX_THREADS	32
+#define WORKPOOL_QUEUE_SIZE	256
+
+typedef void (*workpool_fn)(void *arg);
+
+struct workpool_task
+{
+	workpool_fn fn;
+	void *arg;
+};
+
+struct workpool;
+
+struct workpool_worker
+{
+	struct workpool *pool;
+	unsigned int index;
+	pthread_t thread;
+
+	pthread_mutex_t lock;
+	struct workpool_task tasks[WORKPOOL_QUEUE_SIZE];
+	unsigned int first;
+	unsigned int count;
+
+	/* Statistics. */
+	unsigned int executed;
+	unsigned int stolen;
+};
+
+struct workpool
+{
+	struct workpool_worker workers[WORKPOOL_MAX_THREADS];
+	unsigned int nthreads;
+	unsigned int next;
+
+	/* Idle workers sleep on cond until pending becomes non-zero. */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	volatile unsigned int pending;
+	volatile bool stop;
+};
+
+int workpool_init(struct workpool *pool, unsigned int nthreads);
+void workpool_submit(struct workpool *pool, workpool_fn fn, void *arg);
+void workpool_cleanup(struct workpool *pool);
+
+#endif /* __WORKPOOL_H__ */
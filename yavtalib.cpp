@@ -18,39 +18,97 @@
  */
 
 #include "yavtalib.h"
+#include "pixfmt.h"
+#include "simd.h"
 
-struct PixelFormat pixel_formats[] = {
-	{ "RGB332", V4L2_PIX_FMT_RGB332 },
-	{ "RGB555", V4L2_PIX_FMT_RGB555 },
-	{ "RGB565", V4L2_PIX_FMT_RGB565 },
-	{ "RGB555X", V4L2_PIX_FMT_RGB555X },
-	{ "RGB565X", V4L2_PIX_FMT_RGB565X },
-	{ "BGR24", V4L2_PIX_FMT_BGR24 },
-	{ "RGB24", V4L2_PIX_FMT_RGB24 },
-	{ "BGR32", V4L2_PIX_FMT_BGR32 },
-	{ "RGB32", V4L2_PIX_FMT_RGB32 },
-	{ "Y8", V4L2_PIX_FMT_GREY },
-	{ "Y16", V4L2_PIX_FMT_Y16 },
-	{ "YUYV", V4L2_PIX_FMT_YUYV },
-	{ "UYVY", V4L2_PIX_FMT_UYVY },
-	{ "SBGGR8", V4L2_PIX_FMT_SBGGR8 },
-	{ "SGBRG8", V4L2_PIX_FMT_SGBRG8 },
-	{ "SGRBG8", V4L2_PIX_FMT_SGRBG8 },
-	{ "SRGGB8", V4L2_PIX_FMT_SRGGB8 },
-	{ "SGRBG10_DPCM8", V4L2_PIX_FMT_SGRBG10DPCM8 },
-	{ "SBGGR10", V4L2_PIX_FMT_SBGGR10 },
-	{ "SGBRG10", V4L2_PIX_FMT_SGBRG10 },
-	{ "SGRBG10", V4L2_PIX_FMT_SGRBG10 },
-	{ "SRGGB10", V4L2_PIX_FMT_SRGGB10 },
-	{ "SBGGR12", V4L2_PIX_FMT_SBGGR12 },
-	{ "SGBRG12", V4L2_PIX_FMT_SGBRG12 },
-	{ "SGRBG12", V4L2_PIX_FMT_SGRBG12 },
-	{ "SRGGB12", V4L2_PIX_FMT_SRGGB12 },
-	{ "DV", V4L2_PIX_FMT_DV },
-	{ "MJPEG", V4L2_PIX_FMT_MJPEG },
-	{ "MPEG", V4L2_PIX_FMT_MPEG },
+#define PIXFMT_INFO(_name, _fourcc, _cls, _bpp, _planes, _hsub, _vsub, _order, _bayer) \
+	{ _name, _fourcc, _cls, _bpp, _planes, _hsub, _vsub, _order, _bayer },
+
+static const struct pixfmt_info pixel_formats[] = {
+	PIXFMT_LIST(PIXFMT_INFO)
 };
 
+#undef PIXFMT_INFO
+
+/*
+ * Open addressing hash tables indexing pixel_formats[] by fourcc and by
+ * name. Entries store the table index plus one, zero marks a free slot.
+ * The tables are filled before main() runs and are read-only afterwards,
+ * lookups are thus lock-free and bounded by the (fixed) longest probe
+ * sequence.
+ */
+#define PIXFMT_HASH_BITS	7
+#define PIXFMT_HASH_SIZE	(1 << PIXFMT_HASH_BITS)
+#define PIXFMT_HASH_MASK	(PIXFMT_HASH_SIZE - 1)
+
+static unsigned char pixfmt_fourcc_hash[PIXFMT_HASH_SIZE];
+static unsigned char pixfmt_name_hash[PIXFMT_HASH_SIZE];
+
+static inline unsigned int pixfmt_hash_fourcc(unsigned int fourcc)
+{
+	return (fourcc * 2654435761U) >> (32 - PIXFMT_HASH_BITS);
+}
+
+static inline unsigned int pixfmt_hash_name(const char *name)
+{
+	unsigned int hash = 2166136261U;
+
+	while (*name) {
+		unsigned char c = *name++;
+		if (c >= 'a' && c <= 'z')
+			c -= 'a' - 'A';
+		hash = (hash ^ c) * 16777619U;
+	}
+
+	return hash >> (32 - PIXFMT_HASH_BITS);
+}
+
+static void __attribute__((constructor)) pixfmt_init_hash(void)
+{
+	unsigned int i;
+	unsigned int h;
+
+	for (i = 0; i < ARRAY_SIZE(pixel_formats); ++i) {
+		h = pixfmt_hash_fourcc(pixel_formats[i].fourcc);
+		while (pixfmt_fourcc_hash[h])
+			h = (h + 1) & PIXFMT_HASH_MASK;
+		pixfmt_fourcc_hash[h] = i + 1;
+
+		h = pixfmt_hash_name(pixel_formats[i].name);
+		while (pixfmt_name_hash[h])
+			h = (h + 1) & PIXFMT_HASH_MASK;
+		pixfmt_name_hash[h] = i + 1;
+	}
+}
+
+const struct pixfmt_info *pixfmt_lookup(unsigned int fourcc)
+{
+	unsigned int h = pixfmt_hash_fourcc(fourcc);
+	unsigned int index;
+
+	while ((index = pixfmt_fourcc_hash[h]) != 0) {
+		if (pixel_formats[index - 1].fourcc == fourcc)
+			return &pixel_formats[index - 1];
+		h = (h + 1) & PIXFMT_HASH_MASK;
+	}
+
+	return NULL;
+}
+
+const struct pixfmt_info *pixfmt_lookup_name(const char *name)
+{
+	unsigned int h = pixfmt_hash_name(name);
+	unsigned int index;
+
+	while ((index = pixfmt_name_hash[h]) != 0) {
+		if (strcasecmp(pixel_formats[index - 1].name, name) == 0)
+			return &pixel_formats[index - 1];
+		h = (h + 1) & PIXFMT_HASH_MASK;
+	}
+
+	return NULL;
+}
+
 const char *v4l2_buf_type_name(enum v4l2_buf_type type)
 {
 	static struct {
@@ -75,15 +133,37 @@ const char *v4l2_buf_type_name(enum v4l2_buf_type type)
 		return "Unknown";
 }
 
+const char *v4l2_field_name(enum v4l2_field field)
+{
+	static const char *names[] = {
+		"any",
+		"none",
+		"top",
+		"bottom",
+		"interlaced",
+		"seq-tb",
+		"seq-bt",
+		"alternate",
+		"interlaced-tb",
+		"interlaced-bt",
+	};
+
+	if ((unsigned int)field >= ARRAY_SIZE(names))
+		return "unknown";
+
+	return names[field];
+}
+
 const char *v4l2_format_name(unsigned int fourcc)
 {
-	static char name[5];
+	/* Per-thread storage for fourccs not found in the format table. */
+	static __thread char name[5];
+	const struct pixfmt_info *info;
 	unsigned int i;
 
-	for (i = 0; i < ARRAY_SIZE(pixel_formats); ++i) {
-		if (pixel_formats[i].fourcc == fourcc)
-			return pixel_formats[i].name;
-	}
+	info = pixfmt_lookup(fourcc);
+	if (info != NULL)
+		return info->name;
 
 	for (i = 0; i < 4; ++i) {
 		name[i] = fourcc & 0xff;
@@ -96,14 +176,10 @@ const char *v4l2_format_name(unsigned int fourcc)
 
 unsigned int v4l2_format_code(const char *name)
 {
-	unsigned int i;
-
-	for (i = 0; i < ARRAY_SIZE(pixel_formats); ++i) {
-		if (strcasecmp(pixel_formats[i].name, name) == 0)
-			return pixel_formats[i].fourcc;
-	}
+	const struct pixfmt_info *info;
 
-	return 0;
+	info = pixfmt_lookup_name(name);
+	return info ? info->fourcc : 0;
 }
 
 int video_open(struct device *dev, const char *devname, int no_query)
@@ -137,7 +213,10 @@ int video_open(struct device *dev, const char *devname, int no_query)
 	if (ret < 0)
 		return 0;
 
-	if (cap.capabilities & V4L2_CAP_VIDEO_CAPTURE)
+	dev->capabilities = cap.capabilities;
+
+	/* Memory to memory devices have both queues, capture is the default. */
+	if (cap.capabilities & (V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_M2M))
 		dev->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	else if (cap.capabilities & V4L2_CAP_VIDEO_OUTPUT)
 		dev->type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
@@ -150,6 +229,7 @@ int video_open(struct device *dev, const char *devname, int no_query)
 
 	printf("Device `%s' on `%s' is a video %s device.\n",
 		cap.card, cap.bus_info,
+		cap.capabilities & V4L2_CAP_VIDEO_M2M ? "mem2mem" :
 		dev->type == V4L2_BUF_TYPE_VIDEO_CAPTURE ? "capture" : "output");
 	return 0;
 }
@@ -212,14 +292,18 @@ int video_get_format(struct device *dev)
 		return ret;
 	}
 
+	dev->pixelformat = fmt.fmt.pix.pixelformat;
 	dev->width = fmt.fmt.pix.width;
 	dev->height = fmt.fmt.pix.height;
 	dev->bytesperline = fmt.fmt.pix.bytesperline;
 	dev->imagesize = fmt.fmt.pix.bytesperline ? fmt.fmt.pix.sizeimage : 0;
+	dev->field = fmt.fmt.pix.field;
 
-	printf("Video format: %s (%08x) %ux%u buffer size %u\n",
+	printf("Video format: %s (%08x) %ux%u field %s buffer size %u\n",
 		v4l2_format_name(fmt.fmt.pix.pixelformat), fmt.fmt.pix.pixelformat,
-		fmt.fmt.pix.width, fmt.fmt.pix.height, fmt.fmt.pix.sizeimage);
+		fmt.fmt.pix.width, fmt.fmt.pix.height,
+		v4l2_field_name((enum v4l2_field)fmt.fmt.pix.field),
+		fmt.fmt.pix.sizeimage);
 	return 0;
 }
 
@@ -242,9 +326,14 @@ int video_set_format(struct device *dev, unsigned int w, unsigned int h, unsigne
 		return ret;
 	}
 
-	printf("Video format set: %s (%08x) %ux%u buffer size %u\n",
+	/* The driver picks the field order, interlaced sources need to know. */
+	dev->field = fmt.fmt.pix.field;
+
+	printf("Video format set: %s (%08x) %ux%u field %s buffer size %u\n",
 		v4l2_format_name(fmt.fmt.pix.pixelformat), fmt.fmt.pix.pixelformat,
-		fmt.fmt.pix.width, fmt.fmt.pix.height, fmt.fmt.pix.sizeimage);
+		fmt.fmt.pix.width, fmt.fmt.pix.height,
+		v4l2_field_name((enum v4l2_field)fmt.fmt.pix.field),
+		fmt.fmt.pix.sizeimage);
 	return 0;
 }
 
@@ -291,6 +380,32 @@ int video_set_framerate(struct device *dev, struct v4l2_fract *time_per_frame)
 	printf("Frame rate set: %u/%u\n",
 		parm.parm.capture.timeperframe.numerator,
 		parm.parm.capture.timeperframe.denominator);
+
+	/* What the driver made of it. */
+	*time_per_frame = parm.parm.capture.timeperframe;
+	return 0;
+}
+
+int video_get_framerate(struct device *dev, struct v4l2_fract *time_per_frame)
+{
+	struct v4l2_streamparm parm;
+	int ret;
+
+	memset(&parm, 0, sizeof parm);
+	parm.type = dev->type;
+
+	ret = ioctl(dev->fd, VIDIOC_G_PARM, &parm);
+	if (ret < 0) {
+		printf("Unable to get frame rate: %s (%d).\n",
+			strerror(errno), errno);
+		return -errno;
+	}
+
+	if (!(parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME) ||
+	    parm.parm.capture.timeperframe.denominator == 0)
+		return -ENOTTY;
+
+	*time_per_frame = parm.parm.capture.timeperframe;
 	return 0;
 }
 
@@ -458,6 +573,64 @@ int video_queue_buffer(struct device *dev, int index, enum buffer_fill_mode fill
 	return ret;
 }
 
+/*
+ * Queue an output buffer the application filled in place, with the
+ * metadata of the frame it holds. V4L2_FIELD_ANY stands for the field of
+ * the format.
+ */
+int video_queue_output(struct device *dev, int index, unsigned int bytesused,
+	unsigned int field, unsigned int sequence, uint64_t timestamp)
+{
+	struct v4l2_buffer buf;
+	int ret;
+
+	memset(&buf, 0, sizeof buf);
+	buf.index = index;
+	buf.type = dev->type;
+	buf.memory = dev->memtype;
+	buf.length = dev->buffers[index].size;
+	if (dev->memtype == V4L2_MEMORY_USERPTR)
+		buf.m.userptr = (unsigned long)dev->buffers[index].mem;
+
+	buf.bytesused = bytesused;
+	buf.field = field != V4L2_FIELD_ANY ? field : dev->field;
+	buf.sequence = sequence;
+	buf.timestamp.tv_sec = timestamp / 1000000000ULL;
+	buf.timestamp.tv_usec = timestamp % 1000000000ULL / 1000;
+
+	ret = ioctl(dev->fd, VIDIOC_QBUF, &buf);
+	if (ret < 0)
+		printf("Unable to queue buffer: %s (%d).\n",
+			strerror(errno), errno);
+
+	return ret;
+}
+
+/*
+ * Export an mmap buffer as a DMABUF file descriptor, owned by the caller,
+ * for other devices or the GPU to access the memory in place.
+ */
+int video_export_buffer(struct device *dev, int index, int *fd)
+{
+	struct v4l2_exportbuffer expbuf;
+	int ret;
+
+	memset(&expbuf, 0, sizeof expbuf);
+	expbuf.type = dev->type;
+	expbuf.index = index;
+	expbuf.flags = O_CLOEXEC | O_RDONLY;
+
+	ret = ioctl(dev->fd, VIDIOC_EXPBUF, &expbuf);
+	if (ret < 0) {
+		printf("Unable to export buffer %d: %s (%d).\n", index,
+			strerror(errno), errno);
+		return -errno;
+	}
+
+	*fd = expbuf.fd;
+	return 0;
+}
+
 int video_enable(struct device *dev, int enable)
 {
 	int type = dev->type;
@@ -606,6 +779,93 @@ void video_enum_frame_intervals(struct device *dev, __u32 pixelformat,
 	}
 }
 
+/*
+ * The frame intervals video_enum_frame_intervals() shows, at most max of
+ * them, in the driver order. Stepwise and continuous ranges give their
+ * minimum and its multiples up to the maximum, on a step where there is
+ * one. Returns the number of intervals, 0 when the driver lists none.
+ */
+unsigned int video_get_frame_intervals(struct device *dev, __u32 pixelformat,
+	unsigned int width, unsigned int height, struct v4l2_fract *intervals,
+	unsigned int max)
+{
+	struct v4l2_frmivalenum ival;
+	unsigned int count = 0;
+	unsigned int i;
+
+	for (i = 0; count < max; ++i) {
+		memset(&ival, 0, sizeof ival);
+		ival.index = i;
+		ival.pixel_format = pixelformat;
+		ival.width = width;
+		ival.height = height;
+		if (ioctl(dev->fd, VIDIOC_ENUM_FRAMEINTERVALS, &ival) < 0)
+			break;
+
+		if (ival.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+			if (ival.discrete.denominator)
+				intervals[count++] = ival.discrete;
+			continue;
+		}
+
+		/* Ranges in the units of their minimum. */
+		const struct v4l2_fract *min = &ival.stepwise.min;
+		const struct v4l2_fract *top = &ival.stepwise.max;
+		const struct v4l2_fract *step = &ival.stepwise.step;
+		unsigned int k;
+
+		if (min->numerator == 0 || min->denominator == 0 || top->denominator == 0)
+			break;
+
+		for (k = 1; count < max; ++k) {
+			uint64_t num = (uint64_t)min->numerator * k;
+			uint64_t den = min->denominator;
+
+			/* num/den rounded up to a multiple of the step past the minimum. */
+			if (ival.type == V4L2_FRMIVAL_TYPE_STEPWISE && step->numerator &&
+			    step->denominator && k > 1) {
+				uint64_t s = (uint64_t)step->numerator * den;
+				uint64_t d = (num - min->numerator) * step->denominator;
+
+				num = min->numerator * (uint64_t)step->denominator +
+				      (d + s - 1) / s * s;
+				den *= step->denominator;
+			}
+
+			if (num * top->denominator > (uint64_t)top->numerator * den)
+				break;
+
+			for (uint64_t x = num, y = den; ; ) {
+				uint64_t r = x % y;
+
+				if (r == 0) {
+					num /= y;
+					den /= y;
+					break;
+				}
+				x = y;
+				y = r;
+			}
+			while (num > 0xffffffffULL || den > 0xffffffffULL) {
+				num = (num + 1) / 2;
+				den = (den + 1) / 2;
+			}
+
+			/* Steps longer than the minimum round several multiples alike. */
+			if (count && num * intervals[count - 1].denominator ==
+				     (uint64_t)intervals[count - 1].numerator * den)
+				continue;
+
+			intervals[count].numerator = num;
+			intervals[count].denominator = den;
+			count++;
+		}
+		break;
+	}
+
+	return count;
+}
+
 void video_enum_frame_sizes(struct device *dev, __u32 pixelformat)
 {
 	struct v4l2_frmsizeenum frame;
@@ -690,7 +950,7 @@ void video_enum_formats(struct device *dev, enum v4l2_buf_type type)
 				"%u.\n", fmt.type);
 
 		printf("\tFormat %u: %s (%08x)\n", i, v4l2_format_name(fmt.pixelformat), fmt.pixelformat);
-		printf("\tType: %s (%u)\n", v4l2_buf_type_name(fmt.type), fmt.type);
+		printf("\tType: %s (%u)\n", v4l2_buf_type_name((enum v4l2_buf_type)fmt.type), fmt.type);
 		printf("\tName: %.32s\n", fmt.description);
 		video_enum_frame_sizes(dev, fmt.pixelformat);
 		printf("\n");
@@ -864,7 +1124,12 @@ void video_verify_buffer(struct device *dev, int index)
 	if (buffer->padding == 0)
 		return;
 
-	for (i = 0; i < buffer->padding; ++i) {
+	/* Intact padding, the common case, is checked with SIMD. */
+	i = simd_find_mismatch(data, buffer->padding, 0x55);
+	if (i == buffer->padding)
+		return;
+
+	for (; i < buffer->padding; ++i) {
 		if (data[i] != 0x55) {
 			errors++;
 			dirty = i + 1;
@@ -1,3 +1,6 @@
+#ifndef __YAVTALIB_H__
+#define __YAVTALIB_H__
+
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
@@ -26,7 +29,7 @@ enum buffer_fill_mode
 {
 	BUFFER_FILL_NONE = 0,
 	BUFFER_FILL_FRAME = 1 << 0,
-	BUFFER_FILL_PADDING = 1 << 1,
+	BUFFER_FILL_PADDING = 1 << 1
 };
 
 struct buffer
@@ -39,16 +42,21 @@ struct buffer
 struct device
 {
 	int fd;
+	/* V4L2_CAP_* of VIDIOC_QUERYCAP, 0 when not queried. */
+	unsigned int capabilities;
 
 	enum v4l2_buf_type type;
 	enum v4l2_memory memtype;
 	unsigned int nbufs;
 	struct buffer *buffers;
 
+	unsigned int pixelformat;
 	unsigned int width;
 	unsigned int height;
 	unsigned int bytesperline;
 	unsigned int imagesize;
+	/* enum v4l2_field of the format, buffers say what they hold. */
+	unsigned int field;
 
 	void *pattern;
 	unsigned int patternsize;
@@ -70,10 +78,28 @@ struct device
 #define V4L2_PIX_FMT_SRGGB12	v4l2_fourcc('R', 'G', '1', '2')
 #endif
 
-struct PixelFormat {
-	const char *name;
-	unsigned int fourcc;
+#ifndef V4L2_CAP_VIDEO_M2M		/* 3.1 */
+#define V4L2_CAP_VIDEO_M2M		0x00008000
+#endif
+
+#ifndef V4L2_BUF_FLAG_TIMESTAMP_MASK	/* 3.9 */
+#define V4L2_BUF_FLAG_TIMESTAMP_MASK		0xe000
+#define V4L2_BUF_FLAG_TIMESTAMP_UNKNOWN		0x0000
+#define V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC	0x2000
+#define V4L2_BUF_FLAG_TIMESTAMP_COPY		0x4000
+#endif
+
+#ifndef VIDIOC_EXPBUF			/* 3.8 */
+struct v4l2_exportbuffer {
+	__u32 type;
+	__u32 index;
+	__u32 plane;
+	__u32 flags;
+	__s32 fd;
+	__u32 reserved[11];
 };
+#define VIDIOC_EXPBUF	_IOWR('V', 16, struct v4l2_exportbuffer)
+#endif
 
 #define V4L_BUFFERS_DEFAULT	8
 #define V4L_BUFFERS_MAX		32
@@ -88,6 +114,7 @@ struct PixelFormat {
 
 const char *v4l2_buf_type_name(enum v4l2_buf_type type);
 const char *v4l2_format_name(unsigned int fourcc);
+const char *v4l2_field_name(enum v4l2_field field);
 unsigned int v4l2_format_code(const char *name);
 int video_open(struct device *dev, const char *devname, int no_query);
 void video_close(struct device *dev);
@@ -96,13 +123,20 @@ void uvc_set_control(struct device *dev, unsigned int id, int value);
 int video_get_format(struct device *dev);
 int video_set_format(struct device *dev, unsigned int w, unsigned int h, unsigned int format);
 int video_set_framerate(struct device *dev, struct v4l2_fract *time_per_frame);
+int video_get_framerate(struct device *dev, struct v4l2_fract *time_per_frame);
 int video_alloc_buffers(struct device *dev, int nbufs, unsigned int offset, unsigned int padding);
 int video_free_buffers(struct device *dev);
 int video_queue_buffer(struct device *dev, int index, enum buffer_fill_mode fill);
+int video_queue_output(struct device *dev, int index, unsigned int bytesused,
+	unsigned int field, unsigned int sequence, uint64_t timestamp);
+int video_export_buffer(struct device *dev, int index, int *fd);
 int video_enable(struct device *dev, int enable);
 void video_query_menu(struct device *dev, unsigned int id, unsigned int min, unsigned int max);
 void video_list_controls(struct device *dev);
 void video_enum_frame_intervals(struct device *dev, __u32 pixelformat, unsigned int width, unsigned int height);
+unsigned int video_get_frame_intervals(struct device *dev, __u32 pixelformat,
+	unsigned int width, unsigned int height, struct v4l2_fract *intervals,
+	unsigned int max);
 void video_enum_frame_sizes(struct device *dev, __u32 pixelformat);
 void video_enum_formats(struct device *dev, enum v4l2_buf_type type);
 void video_enum_inputs(struct device *dev);
@@ -115,4 +149,4 @@ void video_verify_buffer(struct device *dev, int index);
 void video_save_image(struct device *dev, struct v4l2_buffer *buf, const char *pattern, unsigned int sequence);
 int video_do_capture(struct device *dev, unsigned int nframes, unsigned int skip, unsigned int delay, const char *pattern, int do_requeue_last, enum buffer_fill_mode fill);
 
-
+#endif /* __YAVTALIB_H__ */
@@ -28,11 +28,23 @@ using namespace std;
 using namespace Osp::Graphics::Opengl;
 #else
 #include <GLES2/gl2.h>
+#include <EGL/egl.h>
 #endif
 #endif
 
 #include "PVRShell.h"
 #include "yavtalib.h"
+#include "pixfmt.h"
+#include "convert.h"
+#include "tiledtex.h"
+#include "framebus.h"
+#include "bandconv.h"
+#include "rtsched.h"
+#include "jitter.h"
+#include "latency.h"
+#include "integrity.h"
+#include "dirtymap.h"
+#include "dmatex.h"
 
 /******************************************************************************
  Defines
@@ -51,6 +63,65 @@ using namespace Osp::Graphics::Opengl;
 #define FTHEIGHT 480.0
 static int gCount = 0;
 
+// -filter modes and the yuv2rgb.frag defines selecting them
+static const char* const c_apszFilterModes[] = { "sharpen", "unsharp", "sobel" };
+static const char* const c_apszFilterDefines[] = { "SHARPEN", "UNSHARP", "SOBEL" };
+
+// -deinterlace modes and the yuv2rgb.frag defines selecting them
+static const char* const c_apszDeintModes[] = { "weave", "bob", "adaptive" };
+static const char* const c_apszDeintDefines[] = { "WEAVE", "BOB", "ADAPTIVE" };
+
+// Whether a buffer of that V4L2 field layout carries both fields of a frame
+static bool HasTwoFields(unsigned int uiField)
+{
+	return uiField != V4L2_FIELD_NONE && uiField != V4L2_FIELD_TOP &&
+	       uiField != V4L2_FIELD_BOTTOM && uiField != V4L2_FIELD_ALTERNATE;
+}
+
+/******************************************************************************
+ Texture upload paths, selected from the capture format traits
+******************************************************************************/
+template<unsigned int FourCC> struct GLUploadTraits;
+
+// Packed 4:2:2 YUV goes up as a luminance/alpha texture with one texel per
+// pixel; yuv2rgb.frag picks U and V from neighbouring texels.
+template<> struct GLUploadTraits<V4L2_PIX_FMT_YUYV>
+{
+	static GLenum Format() { return GL_LUMINANCE_ALPHA; }
+	enum { BytesPerTexel = 2 };
+};
+
+struct SUploadFormat
+{
+	GLenum eFormat;
+	unsigned int uiBytesPerTexel;
+};
+
+template<unsigned int FourCC>
+static void GetUploadFormat(SUploadFormat* psFormat)
+{
+	typedef pixfmt_traits<FourCC> Traits;
+	typedef GLUploadTraits<FourCC> Upload;
+	// The texel size must match the capture pixel size
+	typedef char CheckTexelSize[Traits::bpp / 8 == Upload::BytesPerTexel ? 1 : -1];
+	(void)sizeof(CheckTexelSize);
+
+	psFormat->eFormat = Upload::Format();
+	psFormat->uiBytesPerTexel = Upload::BytesPerTexel;
+}
+
+static bool SelectUploadFormat(unsigned int uiFourCC, SUploadFormat* psFormat)
+{
+	switch (uiFourCC)
+	{
+	case V4L2_PIX_FMT_YUYV:
+		GetUploadFormat<V4L2_PIX_FMT_YUYV>(psFormat);
+		return true;
+	default:
+		return false;
+	}
+}
+
 /*!****************************************************************************
  Class implementing the PVRShell functions.
 ******************************************************************************/
@@ -62,8 +133,24 @@ class yuv2rgb : public PVRShell
 	// The program object containing the 2 shader objects
 	GLuint m_uiProgramObject;
 
-	// Texture handle
-	GLuint	m_uiTexture;
+	// Frame textures, split when the frame exceeds GL_MAX_TEXTURE_SIZE
+	CTiledTexture m_cFrame;
+
+	// Capture buffers drawn in place with -dmabuf, the buffer drawn last
+	// held back from the driver until the next one replaces it
+	bool m_bDmabuf;
+	struct dmatex m_sDmatex;
+	int m_iDmabufIndex;
+	unsigned int m_uiDmabufFrames;
+	bool InitDmabuf( void );
+
+	// Changed tiles of each frame with -skipstatic, the frame the textures
+	// hold, and whether the surface keeps its content over a swap
+	bool m_bSkipStatic;
+	struct dirtymap m_sDirty;
+	unsigned int m_uiTexturesFrame;
+	bool m_bStatic, m_bPreserved;
+	unsigned int m_uiSkippedDraws, m_uiSkippedPasses;
 
 	// VBO handle
 	GLuint m_ui32Vbo;
@@ -71,6 +158,27 @@ class yuv2rgb : public PVRShell
 	GLint m_ibaseMapLoc;
 	GLint m_iTextureWidthLoc;
 	GLint m_iTexelWidthLoc;
+	GLint m_iTexelHeightLoc;
+
+	// Luma filter in the conversion pass, -filter=<mode>[,<size>[,<amount>]]
+	// with the amount in 1/16
+	int m_iFilterMode;
+	unsigned int m_uiFilterSize, m_uiFilterAmount;
+	GLint m_iFilterAmountLoc;
+	void UpdateFilter( void );
+
+	// Deinterlacing in the conversion pass,
+	// -deinterlace=<mode>[,<frame|field>[,<tb|bt>[,<threshold>]]]: the
+	// field of the last buffer, and at field rate whether its second field
+	// is the next one to show
+	int m_iDeintMode;
+	bool m_bDeintFieldRate, m_bDeintBottomFirst;
+	unsigned int m_uiDeintThreshold;
+	unsigned int m_uiVideoField;
+	bool m_bSecondField;
+	unsigned int m_uiDeintFields;
+	GLint m_iFieldParityLoc, m_iFieldLayoutLoc, m_iCombThresholdLoc;
+	void UpdateDeinterlace( bool bSecondField );
 
 	//
 	unsigned int m_ui32VertexStride;
@@ -80,8 +188,85 @@ class yuv2rgb : public PVRShell
 	GLuint LoadTexture ( std::string fileName );
 	
 	struct device Device;
+	// Texture format for the negotiated capture format
+	SUploadFormat m_sUploadFormat;
 	void InitV4L( void );
-	GLuint DequeueVideo( void );
+	bool DequeueVideo( void );
+
+	// Output orientation, and where it sends the corners of the unit square
+	unsigned int m_uiOrientation;
+	struct orient_map m_sOrientMap;
+	bool ParseOptions( void );
+	void SetOrientation( unsigned int uiOrientation );
+
+	// Region of interest (in frame pixels), digital zoom and letterboxing
+	unsigned int m_uiRoiX, m_uiRoiY, m_uiRoiW, m_uiRoiH;
+	float m_fZoom;
+	bool m_bLetterbox;
+	// Frame rectangle actually sampled and the frame lines it touches
+	float m_fCropX, m_fCropY, m_fCropW, m_fCropH;
+	unsigned int m_uiUploadFirst, m_uiUploadLast;
+	void UpdateCrop( void );
+	void GetViewport( unsigned int uiWidth, unsigned int uiHeight, float fAspect, GLint* piViewport );
+
+	// Optional render target at a fixed resolution, shown with a blit
+	GLuint m_uiFbo, m_uiFboTexture;
+	unsigned int m_uiFboWidth, m_uiFboHeight;
+	GLuint m_uiBlitVertShader, m_uiBlitFragShader, m_uiBlitProgram;
+	const char* m_pszReadback;
+	unsigned char* m_pu8Readback;
+	bool InitFbo( void );
+	bool CreateRenderTarget( GLuint* puiFbo, GLuint* puiTexture );
+	void ReadbackFbo( void );
+
+	// Temporal denoise, -denoise[=<strength>[,<threshold>]], blending each
+	// conversion with the previous one held by a second render target
+	bool m_bDenoise;
+	unsigned int m_uiDenoiseStrength, m_uiDenoiseThreshold;
+	GLuint m_uiPrevFbo, m_uiPrevTexture;
+	GLint m_iWeightMinLoc, m_iThresholdLoc;
+	unsigned int m_uiDenoisedFrames;
+	void UpdateDenoise( void );
+
+	// Frame buses exporting raw and CPU converted frames to other processes
+	const char* m_pszBus;
+	const char* m_pszRgbBus;
+	unsigned int m_uiRgbBusFourCC;
+	struct framebus m_sBus, m_sRgbBus;
+	convert_fn m_pfnRgbBusConvert;
+	bool InitBuses( void );
+
+	// Row band threads for the CPU conversion, -convthreads and -convcpus
+	unsigned int m_uiConvThreads;
+	const char* m_pszConvCpus;
+	bool m_bBands;
+	struct bandconv m_sBands;
+
+	// Real-time settings, -rtrender, -rtconv and -mlock, and -jitter probe
+	const char* m_pszRtRender;
+	const char* m_pszRtConv;
+	bool m_bMlock;
+	bool m_bJitter;
+	struct jitter_probe m_sJitter;
+	bool InitRealtime( void );
+
+	// Latency breakdown of the frame on screen, -latency[=<file.csv>]
+	bool m_bLatency;
+	const char* m_pszLatencyCsv;
+	struct latency_stats m_sLatency;
+	uint64_t m_au64Stamps[4];
+	unsigned int m_uiStampSequence, m_uiStampFlags;
+	bool m_bStampPending;
+	void PublishFrame( const struct v4l2_buffer* psBuf );
+
+	// Capture integrity checks, -check[=<crc.csv>]
+	bool m_bCheck;
+	const char* m_pszCheckCrc;
+	struct integrity m_sIntegrity;
+
+	bool BuildProgram( const char* pszVertSrc, const char* pszFragSrc, GLuint* puiVert, GLuint* puiFrag, GLuint* puiProgram );
+	void DrawQuad( GLuint uiProgram, GLuint uiTexture, const GLfloat* pfPositions, const GLfloat* pfTexCoords );
+	void DrawFrame( void );
 
 public:
 	virtual bool InitApplication();
@@ -105,13 +290,226 @@ public:
 bool yuv2rgb::InitApplication()
 {
 	struct device* dev = &Device;
-	
+
+	if (!ParseOptions())
+		return false;
+
 	InitV4L();
+
+	if (!SelectUploadFormat(dev->pixelformat, &m_sUploadFormat))
+	{
+		PVRShellSet(prefExitMessage, "Unsupported capture format, only YUYV can be uploaded.\n");
+		return false;
+	}
+
+	if (m_uiRoiW == 0 || m_uiRoiX + m_uiRoiW > dev->width)
+	{
+		m_uiRoiX = 0;
+		m_uiRoiW = dev->width;
+	}
+	if (m_uiRoiH == 0 || m_uiRoiY + m_uiRoiH > dev->height)
+	{
+		m_uiRoiY = 0;
+		m_uiRoiH = dev->height;
+	}
+	UpdateCrop();
+
+	if (!InitBuses())
+		return false;
+
+	if (!InitRealtime())
+		return false;
+
 	video_enable(dev, 1);
 
 	return true;
 }
 
+/*!****************************************************************************
+ @Function		ParseOptions
+ @Return		bool		true if no error occured
+ @Description	Reads the command line options handed over by PVRShell:
+				-rotate=<0|90|180|270>, -hflip, -vflip,
+				-roi=<x>,<y>,<w>,<h>, -zoom=<factor>, -letterbox,
+				-fbo=<w>x<h>, -readback=<pattern> (with -fbo),
+				-denoise[=<strength 0-255>[,<threshold 1-255>]],
+				-filter=<sharpen|unsharp|sobel>[,<3|5>[,<amount/16>]],
+				-deinterlace=<weave|bob|adaptive>[,<frame|field>[,<tb|bt>[,<threshold>]]],
+				-skipstatic, -bus=<name>, -busrgb=<name>,
+				-busfmt=<fourcc> (with -busrgb), -convthreads=<n>
+				and -convcpus=<list> (CPU conversion threads),
+				-rtrender=<setting>, -rtconv=<setting>, -mlock,
+				-jitter, -latency[=<file.csv>], -check[=<crc.csv>] and
+				-dmabuf (sample the capture buffers without upload).
+******************************************************************************/
+bool yuv2rgb::ParseOptions( void )
+{
+	const SCmdLineOpt* psOpts = (const SCmdLineOpt*)PVRShellGet(prefCommandLineOpts);
+	int i32NumOpts = PVRShellGet(prefCommandLineOptNum);
+	const char* pszRotate = NULL;
+	bool bHFlip = false, bVFlip = false;
+	unsigned int uiOrientation;
+
+	m_uiRoiX = m_uiRoiY = m_uiRoiW = m_uiRoiH = 0;
+	m_fZoom = 1.0f;
+	m_bLetterbox = false;
+	m_uiFbo = m_uiFboTexture = 0;
+	m_uiFboWidth = m_uiFboHeight = 0;
+	m_uiBlitProgram = 0;
+	m_pszReadback = NULL;
+	m_pu8Readback = NULL;
+	m_bSkipStatic = false;
+	m_bDenoise = false;
+	m_uiDenoiseStrength = 128;
+	m_uiDenoiseThreshold = 24;
+	m_uiPrevFbo = m_uiPrevTexture = 0;
+	m_iFilterMode = -1;
+	m_uiFilterSize = 3;
+	m_uiFilterAmount = 16;
+	m_iDeintMode = -1;
+	m_bDeintFieldRate = m_bDeintBottomFirst = false;
+	m_uiDeintThreshold = 12;
+	m_pszBus = m_pszRgbBus = NULL;
+	m_uiRgbBusFourCC = V4L2_PIX_FMT_RGB24;
+	m_uiConvThreads = 1;
+	m_pszConvCpus = NULL;
+	m_bBands = false;
+	m_pszRtRender = m_pszRtConv = NULL;
+	m_bMlock = false;
+	m_bJitter = false;
+	m_bLatency = false;
+	m_pszLatencyCsv = NULL;
+	m_bStampPending = false;
+	m_bCheck = false;
+	m_pszCheckCrc = NULL;
+	m_bDmabuf = false;
+
+	for (int i = 0; i < i32NumOpts; ++i)
+	{
+		const char* pszVal = psOpts[i].pVal;
+
+		if (strcmp(psOpts[i].pArg, "-rotate") == 0)
+			pszRotate = pszVal;
+		else if (strcmp(psOpts[i].pArg, "-hflip") == 0)
+			bHFlip = true;
+		else if (strcmp(psOpts[i].pArg, "-vflip") == 0)
+			bVFlip = true;
+		else if (strcmp(psOpts[i].pArg, "-roi") == 0 && pszVal)
+			sscanf(pszVal, "%u,%u,%u,%u", &m_uiRoiX, &m_uiRoiY, &m_uiRoiW, &m_uiRoiH);
+		else if (strcmp(psOpts[i].pArg, "-zoom") == 0 && pszVal)
+			m_fZoom = (float)atof(pszVal);
+		else if (strcmp(psOpts[i].pArg, "-letterbox") == 0)
+			m_bLetterbox = true;
+		else if (strcmp(psOpts[i].pArg, "-fbo") == 0 && pszVal)
+			sscanf(pszVal, "%ux%u", &m_uiFboWidth, &m_uiFboHeight);
+		else if (strcmp(psOpts[i].pArg, "-readback") == 0)
+			m_pszReadback = pszVal;
+		else if (strcmp(psOpts[i].pArg, "-skipstatic") == 0)
+			m_bSkipStatic = true;
+		else if (strcmp(psOpts[i].pArg, "-denoise") == 0)
+		{
+			m_bDenoise = true;
+			if (pszVal)
+				sscanf(pszVal, "%u,%u", &m_uiDenoiseStrength, &m_uiDenoiseThreshold);
+		}
+		else if (strcmp(psOpts[i].pArg, "-filter") == 0 && pszVal)
+		{
+			char szMode[16] = "";
+
+			sscanf(pszVal, "%15[a-z],%u,%u", szMode, &m_uiFilterSize, &m_uiFilterAmount);
+			for (unsigned int j = 0; j < sizeof c_apszFilterModes / sizeof c_apszFilterModes[0]; ++j)
+			{
+				if (strcmp(szMode, c_apszFilterModes[j]) == 0)
+					m_iFilterMode = j;
+			}
+			if (m_iFilterMode < 0 || (m_uiFilterSize != 3 && m_uiFilterSize != 5))
+			{
+				PVRShellSet(prefExitMessage, "Invalid -filter value.\n");
+				return false;
+			}
+			if (m_uiFilterAmount > 64)
+				m_uiFilterAmount = 64;
+		}
+		else if (strcmp(psOpts[i].pArg, "-deinterlace") == 0 && pszVal)
+		{
+			char szMode[16] = "", szRate[8] = "frame", szOrder[4] = "tb";
+
+			sscanf(pszVal, "%15[a-z],%7[a-z],%3[a-z],%u", szMode, szRate, szOrder, &m_uiDeintThreshold);
+			for (unsigned int j = 0; j < sizeof c_apszDeintModes / sizeof c_apszDeintModes[0]; ++j)
+			{
+				if (strcmp(szMode, c_apszDeintModes[j]) == 0)
+					m_iDeintMode = j;
+			}
+			if (m_iDeintMode < 0 || (strcmp(szRate, "frame") && strcmp(szRate, "field")) ||
+			    (strcmp(szOrder, "tb") && strcmp(szOrder, "bt")))
+			{
+				PVRShellSet(prefExitMessage, "Invalid -deinterlace value.\n");
+				return false;
+			}
+			m_bDeintFieldRate = strcmp(szRate, "field") == 0;
+			m_bDeintBottomFirst = strcmp(szOrder, "bt") == 0;
+		}
+		else if (strcmp(psOpts[i].pArg, "-bus") == 0 && pszVal)
+			m_pszBus = pszVal;
+		else if (strcmp(psOpts[i].pArg, "-busrgb") == 0 && pszVal)
+			m_pszRgbBus = pszVal;
+		else if (strcmp(psOpts[i].pArg, "-busfmt") == 0 && pszVal)
+			m_uiRgbBusFourCC = v4l2_format_code(pszVal);
+		else if (strcmp(psOpts[i].pArg, "-convthreads") == 0 && pszVal)
+			m_uiConvThreads = atoi(pszVal);
+		else if (strcmp(psOpts[i].pArg, "-convcpus") == 0 && pszVal)
+			m_pszConvCpus = pszVal;
+		else if (strcmp(psOpts[i].pArg, "-rtrender") == 0 && pszVal)
+			m_pszRtRender = pszVal;
+		else if (strcmp(psOpts[i].pArg, "-rtconv") == 0 && pszVal)
+			m_pszRtConv = pszVal;
+		else if (strcmp(psOpts[i].pArg, "-mlock") == 0)
+			m_bMlock = true;
+		else if (strcmp(psOpts[i].pArg, "-jitter") == 0)
+			m_bJitter = true;
+		else if (strcmp(psOpts[i].pArg, "-latency") == 0)
+		{
+			m_bLatency = true;
+			m_pszLatencyCsv = pszVal;
+		}
+		else if (strcmp(psOpts[i].pArg, "-check") == 0)
+		{
+			m_bCheck = true;
+			m_pszCheckCrc = pszVal;
+		}
+		else if (strcmp(psOpts[i].pArg, "-dmabuf") == 0)
+			m_bDmabuf = true;
+	}
+
+	if (m_fZoom < 1.0f)
+		m_fZoom = 1.0f;
+
+	if (orientation_parse(pszRotate, bHFlip, bVFlip, &uiOrientation) < 0)
+	{
+		PVRShellSet(prefExitMessage, "Invalid -rotate value.\n");
+		return false;
+	}
+
+	SetOrientation(uiOrientation);
+	return true;
+}
+
+/*!****************************************************************************
+ @Function		SetOrientation
+ @Input			uiOrientation	Rotation and flips, see enum orientation
+ @Description	Rotating and flipping is done by placing the frame tiles on
+				screen through the orientation map, so it costs no extra
+				pass. The fragment shader still works in texture space and
+				its chroma neighbour lookup is unaffected.
+******************************************************************************/
+void yuv2rgb::SetOrientation( unsigned int uiOrientation )
+{
+	m_uiOrientation = uiOrientation;
+
+	// On a 2x2 image the map sends the unit square onto itself
+	orient_map_init(&m_sOrientMap, uiOrientation, 2, 2);
+}
+
 /*!****************************************************************************
  @Function		QuitApplication
  @Return		bool		true if no error occured
@@ -123,6 +521,33 @@ bool yuv2rgb::InitApplication()
 bool yuv2rgb::QuitApplication()
 {
 	struct device* dev = &Device;
+
+	if (m_pszBus)
+		framebus_close(&m_sBus);
+	if (m_pszRgbBus)
+		framebus_close(&m_sRgbBus);
+
+	if (m_bJitter)
+		jitter_print(&m_sJitter, "capture");
+
+	if (m_bLatency)
+	{
+		latency_print(&m_sLatency, "display");
+		latency_cleanup(&m_sLatency);
+	}
+
+	if (m_bCheck)
+	{
+		integrity_print(&m_sIntegrity, "capture");
+		integrity_cleanup(&m_sIntegrity);
+	}
+
+	if (m_bBands)
+	{
+		bandconv_print_stats(&m_sBands);
+		bandconv_cleanup(&m_sBands);
+	}
+
 	video_enable(dev, 0);
 	video_free_buffers(dev);
 	video_close(&Device);
@@ -143,63 +568,53 @@ char* yuv2rgb::LoadShader( std::string filename )
 	lSize = ftell (pFile);
 	rewind (pFile);
 
-	buffer = (char*)malloc( sizeof(char)*lSize );
+	// NUL terminated, the source is used as a C string
+	buffer = (char*)malloc( sizeof(char)*(lSize + 1) );
 
-	if(fread(buffer, 1, lSize, pFile) != (unsigned)lSize)
+	if(buffer == NULL || fread(buffer, 1, lSize, pFile) != (unsigned)lSize)
 	{
 		free(buffer);
+		fclose(pFile);
 		return NULL;
 	}
+	buffer[lSize] = '\0';
 
 	fclose(pFile);
 	return buffer;
 }
 
 /*!****************************************************************************
- @Function		InitView
+ @Function		BuildProgram
+ @Input			pszVertSrc		Vertex shader source
+ @Input			pszFragSrc		Fragment shader source
+ @Output		puiVert, puiFrag, puiProgram	OpenGL handles
  @Return		bool		true if no error occured
- @Description	Code in InitView() will be called by PVRShell upon
-				initialization or after a change in the rendering context.
-				Used to initialize variables that are dependant on the rendering
-				context (e.g. textures, vertex buffers, etc.)
+ @Description	Compiles both shaders and links them into a program. Errors
+				are reported through prefExitMessage.
 ******************************************************************************/
-bool yuv2rgb::InitView()
+bool yuv2rgb::BuildProgram( const char* pszVertSrc, const char* pszFragSrc, GLuint* puiVert, GLuint* puiFrag, GLuint* puiProgram )
 {
-	// Fragment and vertex shaders code
-	const char* pszVertShader = "\
-		attribute vec4 a_position;\
-		attribute vec2 a_texCoord;\
-		varying vec2 v_texCoord;\
-		void main()\
-		{\
-			gl_Position = a_position;\
-			v_texCoord = a_texCoord;\
-		}";
-		
-	char* pszFragShader = LoadShader(std::string("yuv2rgb.frag"));
-
 	// Create the fragment shader object
-	m_uiFragShader = glCreateShader(GL_FRAGMENT_SHADER);
-	//printf("%s(%d): WP - %d\n", __FUNCTION__, __LINE__, m_uiFragShader );
+	*puiFrag = glCreateShader(GL_FRAGMENT_SHADER);
 
 	// Load the source code into it
-	glShaderSource(m_uiFragShader, 1, (const char**)&pszFragShader, NULL);
+	glShaderSource(*puiFrag, 1, (const char**)&pszFragSrc, NULL);
 
 	// Compile the source code
-	glCompileShader(m_uiFragShader);
+	glCompileShader(*puiFrag);
 
 	// Check if compilation succeeded
 	GLint bShaderCompiled;
-	glGetShaderiv(m_uiFragShader, GL_COMPILE_STATUS, &bShaderCompiled);
+	glGetShaderiv(*puiFrag, GL_COMPILE_STATUS, &bShaderCompiled);
 	if (!bShaderCompiled)
 	{
 		// An error happened, first retrieve the length of the log message
 		int i32InfoLogLength, i32CharsWritten;
-		glGetShaderiv(m_uiFragShader, GL_INFO_LOG_LENGTH, &i32InfoLogLength);
+		glGetShaderiv(*puiFrag, GL_INFO_LOG_LENGTH, &i32InfoLogLength);
 
 		// Allocate enough space for the message and retrieve it
 		char* pszInfoLog = new char[i32InfoLogLength];
-		glGetShaderInfoLog(m_uiFragShader, i32InfoLogLength, &i32CharsWritten, pszInfoLog);
+		glGetShaderInfoLog(*puiFrag, i32InfoLogLength, &i32CharsWritten, pszInfoLog);
 
 		/*
 			Displays the message in a dialog box when the application quits
@@ -216,16 +631,16 @@ bool yuv2rgb::InitView()
 	}
 
 	// Loads the vertex shader in the same way
-	m_uiVertexShader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(m_uiVertexShader, 1, (const char**)&pszVertShader, NULL);
-	glCompileShader(m_uiVertexShader);
-	glGetShaderiv(m_uiVertexShader, GL_COMPILE_STATUS, &bShaderCompiled);
+	*puiVert = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(*puiVert, 1, (const char**)&pszVertSrc, NULL);
+	glCompileShader(*puiVert);
+	glGetShaderiv(*puiVert, GL_COMPILE_STATUS, &bShaderCompiled);
 	if (!bShaderCompiled)
 	{
 		int i32InfoLogLength, i32CharsWritten;
-		glGetShaderiv(m_uiVertexShader, GL_INFO_LOG_LENGTH, &i32InfoLogLength);
+		glGetShaderiv(*puiVert, GL_INFO_LOG_LENGTH, &i32InfoLogLength);
 		char* pszInfoLog = new char[i32InfoLogLength];
-		glGetShaderInfoLog(m_uiVertexShader, i32InfoLogLength, &i32CharsWritten, pszInfoLog);
+		glGetShaderInfoLog(*puiVert, i32InfoLogLength, &i32CharsWritten, pszInfoLog);
 		char* pszMsg = new char[i32InfoLogLength+256];
 		strcpy(pszMsg, "Failed to compile vertex shader: ");
 		strcat(pszMsg, pszInfoLog);
@@ -237,30 +652,30 @@ bool yuv2rgb::InitView()
 	}
 
 	// Create the shader program
-	m_uiProgramObject = glCreateProgram();
+	*puiProgram = glCreateProgram();
 
 	// Attach the fragment and vertex shaders to it
-	glAttachShader(m_uiProgramObject, m_uiFragShader);
-	glAttachShader(m_uiProgramObject, m_uiVertexShader);
+	glAttachShader(*puiProgram, *puiFrag);
+	glAttachShader(*puiProgram, *puiVert);
 
 	// Bind the custom vertex attribute "myVertex" to location VERTEX_ARRAY
-	glBindAttribLocation(m_uiProgramObject, VERTEX_ARRAY, "myVertex");
+	glBindAttribLocation(*puiProgram, VERTEX_ARRAY, "myVertex");
 	// Bind the custom vertex attribute "myUV" to location TEXCOORD_ARRAY
-	glBindAttribLocation(m_uiProgramObject, TEXCOORD_ARRAY, "myUV");
+	glBindAttribLocation(*puiProgram, TEXCOORD_ARRAY, "myUV");
 
 	// Link the program
-	glLinkProgram(m_uiProgramObject);
+	glLinkProgram(*puiProgram);
 
 	// Check if linking succeeded in the same way we checked for compilation success
 	GLint bLinked;
-	glGetProgramiv(m_uiProgramObject, GL_LINK_STATUS, &bLinked);
+	glGetProgramiv(*puiProgram, GL_LINK_STATUS, &bLinked);
 
 	if (!bLinked)
 	{
 		int i32InfoLogLength, i32CharsWritten;
-		glGetProgramiv(m_uiProgramObject, GL_INFO_LOG_LENGTH, &i32InfoLogLength);
+		glGetProgramiv(*puiProgram, GL_INFO_LOG_LENGTH, &i32InfoLogLength);
 		char* pszInfoLog = new char[i32InfoLogLength];
-		glGetProgramInfoLog(m_uiProgramObject, i32InfoLogLength, &i32CharsWritten, pszInfoLog);
+		glGetProgramInfoLog(*puiProgram, i32InfoLogLength, &i32CharsWritten, pszInfoLog);
 		
 		char* pszMsg = new char[i32InfoLogLength+256];
 		strcpy(pszMsg, "Failed to link program: ");
@@ -271,17 +686,394 @@ bool yuv2rgb::InitView()
 		return false;
 	}
 
+	return true;
+}
+
+/*!****************************************************************************
+ @Function		InitView
+ @Return		bool		true if no error occured
+ @Description	Code in InitView() will be called by PVRShell upon
+				initialization or after a change in the rendering context.
+				Used to initialize variables that are dependant on the rendering
+				context (e.g. textures, vertex buffers, etc.)
+******************************************************************************/
+bool yuv2rgb::InitView()
+{
+	// Fragment and vertex shaders code
+	const char* pszVertShader = "\
+		attribute vec4 a_position;\
+		attribute vec2 a_texCoord;\
+		varying vec2 v_texCoord;\
+		void main()\
+		{\
+			gl_Position = a_position;\
+			v_texCoord = a_texCoord;\
+		}";
+
+	// Falls back to uploading when the driver cannot import the buffers
+	if (m_bDmabuf && !InitDmabuf())
+		m_bDmabuf = false;
+
+	// The frame textures live as long as the view, only their lines are
+	// updated; imported buffers are a single texture of the frame
+	if (!m_bDmabuf && !m_cFrame.Init(Device.width, Device.height, m_sUploadFormat.eFormat, m_sUploadFormat.uiBytesPerTexel, 0))
+	{
+		PVRShellSet(prefExitMessage, "Failed to create the frame textures.\n");
+		return false;
+	}
+
+	// Fields are found by texture row, the frame must fit in one row of tiles
+	if (m_iDeintMode >= 0 && !m_bDmabuf && m_cFrame.GetTile(m_cFrame.GetTileCount() - 1).uiY)
+	{
+		PVRShellSet(prefExitMessage, "The frame is too high to deinterlace.\n");
+		return false;
+	}
+
+	// The filter taps cannot reach across into the neighbouring tile's
+	// texture, so every tile boundary would show as a seam
+	if (m_iFilterMode >= 0 && !m_bDmabuf && m_cFrame.GetTileCount() > 1)
+	{
+		PVRShellSet(prefExitMessage, "The frame is too large to filter, it needs more than one texture.\n");
+		return false;
+	}
+
+	// Texture coordinates of wider textures need more than mediump
+	unsigned int uiWidest = Device.width;
+	if (!m_bDmabuf)
+	{
+		uiWidest = 0;
+		for (unsigned int i = 0; i < m_cFrame.GetTileCount(); ++i)
+			if (m_cFrame.GetTile(i).uiWidth > uiWidest)
+				uiWidest = m_cFrame.GetTile(i).uiWidth;
+	}
+
+	char* pszFragShader = LoadShader(std::string("yuv2rgb.frag"));
+	if (pszFragShader == NULL)
+	{
+		PVRShellSet(prefExitMessage, "Failed to load yuv2rgb.frag\n");
+		return false;
+	}
+
+	// Variants of the conversion are selected with defines: the denoise one
+	// reads back the previous output, the filter one filters the luma, the
+	// deinterlacing one rebuilds the missing lines of the field shown, and
+	// imported buffers hold the chroma in green rather than alpha
+	std::string sFragShader;
+	if (m_bDmabuf)
+		sFragShader += "#define TEXEL_RG\n";
+	if (uiWidest > 1024)
+		sFragShader += "#define HIGHP\n";
+	if (m_bDenoise)
+		sFragShader += "#define DENOISE\n";
+	if (m_iFilterMode >= 0)
+	{
+		char szDefines[96];
+
+		snprintf(szDefines, sizeof szDefines, "#define FILTER\n#define FILTER_%s\n#define FILTER_SIZE %u\n",
+			 c_apszFilterDefines[m_iFilterMode], m_uiFilterSize);
+		sFragShader += szDefines;
+	}
+	if (m_iDeintMode >= 0)
+	{
+		sFragShader += "#define DEINTERLACE\n#define DEINT_";
+		sFragShader += c_apszDeintDefines[m_iDeintMode];
+		sFragShader += "\n";
+	}
+	sFragShader += pszFragShader;
+	free(pszFragShader);
+
+	if (!BuildProgram(pszVertShader, sFragShader.c_str(), &m_uiVertexShader, &m_uiFragShader, &m_uiProgramObject))
+		return false;
+
 	// Actually use the created program
 	glUseProgram(m_uiProgramObject);
 
 	// Sets the sampler2D variable to the first texture unit
 	glUniform1i(glGetUniformLocation(m_uiProgramObject, "s_baseMap"), 0);
-	glUniform1f(glGetUniformLocation(m_uiProgramObject, "texture_width"), FTWIDTH);
-	glUniform1f(glGetUniformLocation(m_uiProgramObject, "texel_width"), 1.0/FTWIDTH);
+	// The texture width differs per tile and is set when drawing
+	m_iTextureWidthLoc = glGetUniformLocation(m_uiProgramObject, "texture_width");
+	m_iTexelWidthLoc = glGetUniformLocation(m_uiProgramObject, "texel_width");
+	m_iTexelHeightLoc = glGetUniformLocation(m_uiProgramObject, "texel_height");
+	m_iFilterAmountLoc = glGetUniformLocation(m_uiProgramObject, "filter_amount");
+	if (m_iFilterMode >= 0)
+		glUniform1f(m_iFilterAmountLoc, m_uiFilterAmount / 16.0f);
+	m_iFieldParityLoc = glGetUniformLocation(m_uiProgramObject, "field_parity");
+	m_iFieldLayoutLoc = glGetUniformLocation(m_uiProgramObject, "field_layout");
+	m_iCombThresholdLoc = glGetUniformLocation(m_uiProgramObject, "comb_threshold");
+	if (m_iDeintMode >= 0)
+	{
+		float fThreshold = m_uiDeintThreshold / 255.0f;
+
+		glUniform1f(m_iCombThresholdLoc, fThreshold * fThreshold);
+		glUniform1f(m_iFieldParityLoc, -1.0f);
+	}
+	m_uiVideoField = V4L2_FIELD_NONE;
+	m_bSecondField = false;
+	m_uiDeintFields = 0;
+
+	// A static frame needs no draw at all if the last one survives the swap
+	m_uiTexturesFrame = 0;
+	m_bStatic = m_bPreserved = false;
+	m_uiSkippedDraws = m_uiSkippedPasses = 0;
+	if (m_bSkipStatic)
+	{
+		EGLDisplay eglDisplay = eglGetCurrentDisplay();
+		EGLSurface eglSurface = eglGetCurrentSurface(EGL_DRAW);
+		EGLint i32Behavior = EGL_BUFFER_DESTROYED;
+
+		if (dirtymap_init(&m_sDirty, Device.pixelformat, Device.width, Device.height) < 0)
+		{
+			PVRShellSet(prefExitMessage, "Failed to create the dirty tile map.\n");
+			return false;
+		}
+
+		if (eglSurfaceAttrib(eglDisplay, eglSurface, EGL_SWAP_BEHAVIOR, EGL_BUFFER_PRESERVED))
+			eglQuerySurface(eglDisplay, eglSurface, EGL_SWAP_BEHAVIOR, &i32Behavior);
+		m_bPreserved = i32Behavior == EGL_BUFFER_PRESERVED;
+	}
+
+	// Denoising needs its output back, in a render target of the frame size
+	// unless -fbo asked for another one
+	if (m_bDenoise && !(m_uiFboWidth && m_uiFboHeight))
+	{
+		m_uiFboWidth = m_uiOrientation & ORIENT_ROTATE_90 ? Device.height : Device.width;
+		m_uiFboHeight = m_uiOrientation & ORIENT_ROTATE_90 ? Device.width : Device.height;
+	}
+
+	if (m_uiFboWidth && m_uiFboHeight && !InitFbo())
+		return false;
+
+	// Sets the clear color, letterbox bars are black
+	if (m_bLetterbox)
+		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	else
+		glClearColor(0.6f, 0.8f, 1.0f, 1.0f);
+
+	return true;
+}
+
+/*!****************************************************************************
+ @Function		InitFbo
+ @Return		bool		true if no error occured
+ @Description	Creates the fixed resolution render target the frame is
+				converted into once, and the program used to show it.
+******************************************************************************/
+bool yuv2rgb::InitFbo( void )
+{
+	const char* pszBlitVertShader = "\
+		attribute vec4 a_position;\
+		attribute vec2 a_texCoord;\
+		varying vec2 v_texCoord;\
+		void main()\
+		{\
+			gl_Position = a_position;\
+			v_texCoord = a_texCoord;\
+		}";
+	const char* pszBlitFragShader = "\
+		precision mediump float;\
+		uniform sampler2D s_baseMap;\
+		varying vec2 v_texCoord;\
+		void main()\
+		{\
+			gl_FragColor = texture2D(s_baseMap, v_texCoord);\
+		}";
+
+	if (!BuildProgram(pszBlitVertShader, pszBlitFragShader, &m_uiBlitVertShader, &m_uiBlitFragShader, &m_uiBlitProgram))
+		return false;
+
+	glUseProgram(m_uiBlitProgram);
+	glUniform1i(glGetUniformLocation(m_uiBlitProgram, "s_baseMap"), 0);
+
+	if (!CreateRenderTarget(&m_uiFbo, &m_uiFboTexture))
+		return false;
+
+	if (m_pszReadback)
+	{
+		m_pu8Readback = (unsigned char*)malloc(m_uiFboWidth * m_uiFboHeight * 4);
+		if (m_pu8Readback == NULL)
+			return false;
+	}
+
+	glUseProgram(m_uiProgramObject);
+
+	// The two targets swap roles every frame, the previous output is read
+	// at the same window position through the second texture unit
+	if (m_bDenoise)
+	{
+		if (!CreateRenderTarget(&m_uiPrevFbo, &m_uiPrevTexture))
+			return false;
+
+		glUniform1i(glGetUniformLocation(m_uiProgramObject, "s_prevMap"), 1);
+		glUniform2f(glGetUniformLocation(m_uiProgramObject, "prev_texel"), 1.0f / m_uiFboWidth, 1.0f / m_uiFboHeight);
+		m_iWeightMinLoc = glGetUniformLocation(m_uiProgramObject, "weight_min");
+		m_iThresholdLoc = glGetUniformLocation(m_uiProgramObject, "threshold");
+		m_uiDenoisedFrames = 0;
+	}
+
+	return true;
+}
+
+/*!****************************************************************************
+ @Function		CreateRenderTarget
+ @Output		puiFbo, puiTexture	OpenGL handles
+ @Return		bool		true if no error occured
+ @Description	Creates a framebuffer of the render target size with an RGBA
+				texture as its colour buffer.
+******************************************************************************/
+bool yuv2rgb::CreateRenderTarget( GLuint* puiFbo, GLuint* puiTexture )
+{
+	glGenTextures(1, puiTexture);
+	glBindTexture(GL_TEXTURE_2D, *puiTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, m_uiFboWidth, m_uiFboHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri ( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+	glTexParameteri ( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+	glTexParameteri ( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+	glTexParameteri ( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+
+	glGenFramebuffers(1, puiFbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, *puiFbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *puiTexture, 0);
+
+	GLenum eStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (eStatus != GL_FRAMEBUFFER_COMPLETE)
+	{
+		PVRShellSet(prefExitMessage, "Render target is incomplete.\n");
+		return false;
+	}
+
+	return true;
+}
+
+/*!****************************************************************************
+ @Function		UpdateFilter
+ @Description	Adjusts the filter amount with the left and right keys, only
+				a uniform changes.
+******************************************************************************/
+void yuv2rgb::UpdateFilter( void )
+{
+	unsigned int uiAmount = m_uiFilterAmount;
+
+	if (PVRShellIsKeyPressed(PVRShellKeyNameRIGHT) && uiAmount < 64)
+		uiAmount += 2;
+	else if (PVRShellIsKeyPressed(PVRShellKeyNameLEFT) && uiAmount > 0)
+		uiAmount = uiAmount < 2 ? 0 : uiAmount - 2;
+	else
+		return;
+
+	m_uiFilterAmount = uiAmount > 64 ? 64 : uiAmount;
+	printf("Filter amount %u/16\n", m_uiFilterAmount);
+	glUseProgram(m_uiProgramObject);
+	glUniform1f(m_iFilterAmountLoc, m_uiFilterAmount / 16.0f);
+}
 
-	// Sets the clear color
-	glClearColor(0.6f, 0.8f, 1.0f, 1.0f);
+/*!****************************************************************************
+ @Function		UpdateDeinterlace
+ @Description	Tells the shader where the fields of the last buffer are and
+				which one to show: the later one at frame rate, or each in
+				turn at field rate, bSecondField telling which of the
+				two is due. The order of V4L2_FIELD_INTERLACED
+				buffers comes from the command line, frames of one field
+				are shown at twice their height and progressive ones as
+				they are.
+******************************************************************************/
+void yuv2rgb::UpdateDeinterlace( bool bSecondField )
+{
+	float fLines = (float)Device.height;
+	bool bBottomFirst = m_bDeintBottomFirst;
+
+	glUseProgram(m_uiProgramObject);
+
+	switch (m_uiVideoField)
+	{
+	case V4L2_FIELD_NONE:
+		glUniform1f(m_iFieldParityLoc, -1.0f);
+		return;
+
+	case V4L2_FIELD_TOP:
+	case V4L2_FIELD_BOTTOM:
+	case V4L2_FIELD_ALTERNATE:
+		glUniform4f(m_iFieldLayoutLoc, 1.0f, 0.0f, 0.0f, fLines);
+		glUniform1f(m_iFieldParityLoc, m_uiVideoField == V4L2_FIELD_BOTTOM ? 1.0f : 0.0f);
+		m_uiDeintFields++;
+		return;
+
+	case V4L2_FIELD_SEQ_TB:
+	case V4L2_FIELD_SEQ_BT:
+		bBottomFirst = m_uiVideoField == V4L2_FIELD_SEQ_BT;
+		glUniform4f(m_iFieldLayoutLoc, 1.0f, bBottomFirst ? fLines / 2.0f : 0.0f,
+			    bBottomFirst ? 0.0f : fLines / 2.0f, fLines / 2.0f);
+		break;
+
+	default:
+		if (m_uiVideoField == V4L2_FIELD_INTERLACED_TB || m_uiVideoField == V4L2_FIELD_INTERLACED_BT)
+			bBottomFirst = m_uiVideoField == V4L2_FIELD_INTERLACED_BT;
+		glUniform4f(m_iFieldLayoutLoc, 2.0f, 0.0f, 1.0f, fLines / 2.0f);
+		break;
+	}
+
+	// The first field of the buffer, then the second; or the second alone
+	bool bShowSecond = !m_bDeintFieldRate || bSecondField;
+	glUniform1f(m_iFieldParityLoc, bBottomFirst != bShowSecond ? 1.0f : 0.0f);
+	m_uiDeintFields++;
+}
+
+/*!****************************************************************************
+ @Function		UpdateDenoise
+ @Description	Adjusts the denoise strength with the up and down keys and
+				loads the blend parameters for the next conversion. Only
+				uniforms change, nothing is reallocated.
+******************************************************************************/
+void yuv2rgb::UpdateDenoise( void )
+{
+	if (PVRShellIsKeyPressed(PVRShellKeyNameUP) && m_uiDenoiseStrength < 255)
+	{
+		m_uiDenoiseStrength = m_uiDenoiseStrength + 16 > 255 ? 255 : m_uiDenoiseStrength + 16;
+		printf("Denoise strength %u\n", m_uiDenoiseStrength);
+	}
+	else if (PVRShellIsKeyPressed(PVRShellKeyNameDOWN) && m_uiDenoiseStrength > 0)
+	{
+		m_uiDenoiseStrength = m_uiDenoiseStrength < 16 ? 0 : m_uiDenoiseStrength - 16;
+		printf("Denoise strength %u\n", m_uiDenoiseStrength);
+	}
+
+	// Same weights as the CPU kernel in denoise.cpp, the first frame has
+	// no history to blend with
+	float fWeightMin = 1.0f - (m_uiDenoiseStrength * 7 / 16) / 128.0f;
+	unsigned int uiThreshold = m_uiDenoiseThreshold ? m_uiDenoiseThreshold : 1;
+
+	glUseProgram(m_uiProgramObject);
+	glUniform1f(m_iWeightMinLoc, m_uiDenoisedFrames ? fWeightMin : 1.0f);
+	glUniform1f(m_iThresholdLoc, uiThreshold / 255.0f);
+}
+
+/*!****************************************************************************
+ @Function		InitDmabuf
+ @Return		bool		true if the capture buffers were imported
+ @Description	Exports every capture buffer as a DMABUF and binds it to a
+				texture through an EGLImage, so frames are sampled where
+				the driver wrote them. Anything missing, from the EGL
+				extension to the export itself, is reported and the frames
+				are uploaded as without -dmabuf.
+******************************************************************************/
+bool yuv2rgb::InitDmabuf( void )
+{
+	struct device* dev = &Device;
+	unsigned int uiStride = dev->bytesperline ? dev->bytesperline : dev->width * m_sUploadFormat.uiBytesPerTexel;
 
+	m_iDmabufIndex = -1;
+	m_uiDmabufFrames = 0;
+
+	if (dmatex_init(&m_sDmatex, eglGetCurrentDisplay(), dev->pixelformat, dev->width,
+			dev->height, uiStride, dev->nbufs) < 0 ||
+	    dmatex_import_device(&m_sDmatex, dev) < 0)
+	{
+		dmatex_cleanup(&m_sDmatex);
+		printf("Uploading the frames, the capture buffers cannot be imported.\n");
+		return false;
+	}
+
+	printf("Drawing the %u capture buffers in place.\n", m_sDmatex.imported);
 	return true;
 }
 
@@ -293,8 +1085,32 @@ bool yuv2rgb::InitView()
 ******************************************************************************/
 bool yuv2rgb::ReleaseView()
 {
-	// Frees the texture
-	glDeleteTextures(1, &m_uiTexture);
+	// Frees the frame textures
+	if (m_bSkipStatic)
+	{
+		dirtymap_print(&m_sDirty, "frame");
+		printf("Uploaded %llu bytes, skipped %llu unchanged bytes\n",
+		       (unsigned long long)m_cFrame.GetBytesUploaded(),
+		       (unsigned long long)m_cFrame.GetBytesSkipped());
+		printf("Skipped %u draws and %u conversion passes of unchanged frames%s\n",
+		       m_uiSkippedDraws, m_uiSkippedPasses,
+		       m_bPreserved ? "" : ", the surface is not preserved over swaps");
+		dirtymap_cleanup(&m_sDirty);
+	}
+	m_cFrame.Release();
+
+	// The buffer held for the screen goes back before its texture
+	if (m_bDmabuf)
+	{
+		if (m_iDmabufIndex >= 0)
+		{
+			dmatex_wait(&m_sDmatex, m_iDmabufIndex);
+			video_queue_buffer(&Device, m_iDmabufIndex, BUFFER_FILL_NONE);
+			m_iDmabufIndex = -1;
+		}
+		printf("Drew %u frames from the capture buffers without upload\n", m_uiDmabufFrames);
+		dmatex_cleanup(&m_sDmatex);
+	}
 
 	// Release Vertex buffer object.
 	glDeleteBuffers(1, &m_ui32Vbo);
@@ -303,6 +1119,33 @@ bool yuv2rgb::ReleaseView()
 	glDeleteProgram(m_uiProgramObject);
 	glDeleteShader(m_uiVertexShader);
 	glDeleteShader(m_uiFragShader);
+
+	// Frees the render target
+	if (m_uiFbo)
+	{
+		glDeleteFramebuffers(1, &m_uiFbo);
+		glDeleteTextures(1, &m_uiFboTexture);
+		glDeleteProgram(m_uiBlitProgram);
+		glDeleteShader(m_uiBlitVertShader);
+		glDeleteShader(m_uiBlitFragShader);
+		m_uiFbo = 0;
+	}
+
+	if (m_uiPrevFbo)
+	{
+		printf("Denoised %u frames, strength %u threshold %u\n",
+		       m_uiDenoisedFrames, m_uiDenoiseStrength, m_uiDenoiseThreshold);
+		glDeleteFramebuffers(1, &m_uiPrevFbo);
+		glDeleteTextures(1, &m_uiPrevTexture);
+		m_uiPrevFbo = 0;
+	}
+
+	if (m_uiDeintFields)
+		printf("Deinterlaced %u fields (%s, %s rate)\n", m_uiDeintFields,
+		       c_apszDeintModes[m_iDeintMode], m_bDeintFieldRate ? "field" : "frame");
+
+	free(m_pu8Readback);
+	m_pu8Readback = NULL;
 	return true;
 }
 
@@ -374,9 +1217,8 @@ GLuint yuv2rgb::LoadTexture ( std::string fileName )
 	return texId;
 }
 
-GLuint yuv2rgb::DequeueVideo( void )
+bool yuv2rgb::DequeueVideo( void )
 {
-	GLuint texId;
 	int ret;
 	struct v4l2_buffer buf;
 	struct device* dev = &Device;
@@ -386,6 +1228,29 @@ GLuint yuv2rgb::DequeueVideo( void )
 	buf.type = dev->type;
 	buf.memory = dev->memtype;
 	ret = ioctl(dev->fd, VIDIOC_DQBUF, &buf);
+	if (ret < 0)
+		return errno == EINTR || errno == EAGAIN;
+
+	if (m_bJitter)
+		jitter_record(&m_sJitter, &buf);
+
+	if (m_bLatency)
+	{
+		m_au64Stamps[0] = latency_capture_time(&buf);
+		m_au64Stamps[1] = latency_now();
+		m_uiStampSequence = buf.sequence;
+		m_uiStampFlags = buf.flags;
+	}
+
+	// Keep the previous frame on screen rather than show a broken one
+	if (m_bCheck && (integrity_check(&m_sIntegrity, &buf, &dev->buffers[buf.index]) & INTEGRITY_CORRUPT))
+	{
+		video_queue_buffer(dev, buf.index, fill);
+		return true;
+	}
+
+	// What the buffer holds decides how the shader finds its fields
+	m_uiVideoField = buf.field;
 
 	//printf("%s: v4lbuf.sequence=%d\n", __FUNCTION__, buf.sequence );
 	
@@ -395,63 +1260,275 @@ GLuint yuv2rgb::DequeueVideo( void )
 	char* buffer = (char*)Device.buffers[buf.index].mem;
 
 	gCount++;
-	
-	glPixelStorei(GL_UNPACK_ALIGNMENT,4);
 
-	glGenTextures ( 1, &texId );
-	glBindTexture ( GL_TEXTURE_2D, texId );
+	// Only the tiles and lines covered by the region of interest are sent,
+	// and with -skipstatic only the tile rows that changed
+	unsigned int uiStride = dev->bytesperline ? dev->bytesperline : dev->width * m_sUploadFormat.uiBytesPerTexel;
+	if (m_bSkipStatic)
+	{
+		struct image sFrame;
 
-	glTexImage2D ( GL_TEXTURE_2D, 0, GL_LUMINANCE_ALPHA, TWIDTH, THEIGHT, 0, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, buffer );
-	glTexParameteri ( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
-	glTexParameteri ( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
-	glTexParameteri ( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
-	glTexParameteri ( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+		image_init(&sFrame, dev->pixelformat, dev->width, dev->height, uiStride, buffer);
+		dirtymap_update(&m_sDirty, &sFrame);
+		m_bStatic = m_uiTexturesFrame && dirtymap_count_since(&m_sDirty, m_uiTexturesFrame) == 0;
+	}
+	if (!m_bDmabuf)
+		m_cFrame.Upload((const unsigned char*)buffer, uiStride, (unsigned int)m_fCropX,
+				m_uiUploadFirst, (unsigned int)(m_fCropX + m_fCropW + 0.999f), m_uiUploadLast,
+				m_bSkipStatic ? &m_sDirty : NULL, m_uiTexturesFrame);
+	if (m_bSkipStatic)
+		m_uiTexturesFrame = m_sDirty.frame;
+
+	if (m_bLatency)
+	{
+		m_au64Stamps[2] = latency_now();
+		m_bStampPending = true;
+	}
+
+	PublishFrame(&buf);
+
+	// The texture of the new buffer is the frame, the one it replaces goes
+	// back to the driver once the GPU is done reading it
+	if (m_bDmabuf)
+	{
+		if (m_iDmabufIndex >= 0)
+		{
+			dmatex_wait(&m_sDmatex, m_iDmabufIndex);
+			video_queue_buffer(dev, m_iDmabufIndex, fill);
+		}
+		m_iDmabufIndex = buf.index;
+		m_uiDmabufFrames++;
+		return true;
+	}
 	
 	video_queue_buffer(dev, buf.index, fill);
 
-	return texId;
+	return true;
 }
 
 /*!****************************************************************************
- @Function		RenderScene
+ @Function		InitBuses
  @Return		bool		true if no error occured
- @Description	Main rendering loop function of the program. The shell will
-				call this function every frame.
-				eglSwapBuffers() will be performed by PVRShell automatically.
-				PVRShell will also manage important OS events.
-				Will also manage relevent OS events. The user has access to
-				these events through an abstraction layer provided by PVRShell.
+ @Description	Creates the frame buses requested with -bus (raw capture
+				frames) and -busrgb (frames converted on the CPU).
 ******************************************************************************/
-bool yuv2rgb::RenderScene()
+bool yuv2rgb::InitBuses( void )
 {
-#if 0
-	GLuint baseMapTexId = LoadTexture ( std::string("yuv_640x480_1.raw") );
-#else
-	GLuint baseMapTexId = DequeueVideo();
-#endif
+	struct device* dev = &Device;
+	const unsigned int uiSlots = 4;
+
+	// Raw frames are published without line padding
+	const struct pixfmt_info* psRawInfo = pixfmt_lookup(dev->pixelformat);
+	unsigned int uiRawSize = psRawInfo ? pixfmt_bytesperline(psRawInfo, dev->width) * dev->height : 0;
+
+	if (m_pszBus && framebus_create(&m_sBus, m_pszBus, uiSlots, uiRawSize) < 0)
+	{
+		PVRShellSet(prefExitMessage, "Failed to create the frame bus.\n");
+		m_pszBus = NULL;
+		return false;
+	}
+
+	if (m_pszRgbBus == NULL)
+		return true;
+
+	const struct pixfmt_info* psInfo = pixfmt_lookup(m_uiRgbBusFourCC);
+	m_pfnRgbBusConvert = convert_lookup(dev->pixelformat, m_uiRgbBusFourCC);
+	if (psInfo == NULL || m_pfnRgbBusConvert == NULL)
+	{
+		PVRShellSet(prefExitMessage, "Unsupported -busfmt.\n");
+		m_pszRgbBus = NULL;
+		return false;
+	}
+
+	if (framebus_create(&m_sRgbBus, m_pszRgbBus, uiSlots,
+			    pixfmt_bytesperline(psInfo, dev->width) * dev->height) < 0)
+	{
+		PVRShellSet(prefExitMessage, "Failed to create the frame bus.\n");
+		m_pszRgbBus = NULL;
+		return false;
+	}
+
+	if (m_uiConvThreads != 1 || m_pszConvCpus)
+	{
+		if (bandconv_init(&m_sBands, m_uiConvThreads, m_pszConvCpus) < 0)
+		{
+			PVRShellSet(prefExitMessage, "Failed to start the conversion threads.\n");
+			return false;
+		}
+		m_bBands = true;
+	}
+
+	return true;
+}
+
+/*!****************************************************************************
+ @Function		InitRealtime
+ @Return		bool		true if no error occured
+ @Description	Applies -rtrender to the PVRShell thread, which dequeues,
+				uploads and renders, and -rtconv to the conversion
+				threads. Missing privileges only print a warning, so the
+				jitter probe can compare runs with and without them.
+******************************************************************************/
+bool yuv2rgb::InitRealtime( void )
+{
+	struct rt_config sConfig;
+
+	if (m_pszRtRender)
+	{
+		if (rt_parse(m_pszRtRender, &sConfig) < 0)
+		{
+			PVRShellSet(prefExitMessage, "Invalid -rtrender setting.\n");
+			return false;
+		}
+		rt_apply(pthread_self(), &sConfig);
+		rt_print(pthread_self(), "render");
+	}
+
+	if (m_pszRtConv && m_bBands && bandconv_set_sched(&m_sBands, m_pszRtConv) == -EINVAL)
+	{
+		PVRShellSet(prefExitMessage, "Invalid -rtconv setting.\n");
+		return false;
+	}
+
+	// After the buffers are mapped, so they are locked too
+	if (m_bMlock)
+		rt_lock_memory();
 
-	if ( baseMapTexId == 0 )
+	jitter_init(&m_sJitter);
+
+	static const char* const apszStages[] = { "capture>dequeue", "dequeue>upload", "upload>swap" };
+	if (m_bLatency && latency_init(&m_sLatency, apszStages, 3, m_pszLatencyCsv) < 0)
+	{
+		PVRShellSet(prefExitMessage, "Failed to open the -latency file.\n");
 		return false;
+	}
+
+	if (m_bCheck && integrity_init(&m_sIntegrity, &Device, m_pszCheckCrc) < 0)
+	{
+		PVRShellSet(prefExitMessage, "Failed to open the -check file.\n");
+		return false;
+	}
+
+	return true;
+}
+
+/*!****************************************************************************
+ @Function		PublishFrame
+ @Input			psBuf		Dequeued capture buffer
+ @Description	Copies the raw frame into its bus slot and converts straight
+				from the capture buffer into the RGB bus slot, so
+				subscribers read both in place. With -convthreads the
+				conversion is split in row bands over several cores.
+******************************************************************************/
+void yuv2rgb::PublishFrame( const struct v4l2_buffer* psBuf )
+{
+	struct device* dev = &Device;
+	uint64_t u64Timestamp = psBuf->timestamp.tv_sec * 1000000000ULL + psBuf->timestamp.tv_usec * 1000ULL;
+	struct image sSrc;
+
+	if (m_pszBus == NULL && m_pszRgbBus == NULL)
+		return;
+
+	image_init(&sSrc, dev->pixelformat, dev->width, dev->height, dev->bytesperline,
+		   dev->buffers[psBuf->index].mem);
+
+	if (m_pszBus)
+		framebus_put(&m_sBus, &sSrc, psBuf->sequence, u64Timestamp);
+
+	if (m_pszRgbBus)
+	{
+		struct image sDst;
+
+		image_init(&sDst, m_uiRgbBusFourCC, dev->width, dev->height, 0, framebus_begin(&m_sRgbBus));
+		if (m_bBands)
+			bandconv_run(&m_sBands, m_pfnRgbBusConvert, &sSrc, &sDst);
+		else
+			m_pfnRgbBusConvert(&sSrc, &sDst, 0, dev->height);
+		framebus_publish(&m_sRgbBus, &sDst, sDst.stride * sDst.height, psBuf->sequence, u64Timestamp);
+	}
+}
+
+/*!****************************************************************************
+ @Function		UpdateCrop
+ @Description	Derives the sampled frame rectangle from the region of
+				interest and the zoom factor, zooming around the centre of
+				the region, and the range of frame lines it touches.
+******************************************************************************/
+void yuv2rgb::UpdateCrop( void )
+{
+	float fCenterX = m_uiRoiX + m_uiRoiW * 0.5f;
+	float fCenterY = m_uiRoiY + m_uiRoiH * 0.5f;
+
+	m_fCropW = m_uiRoiW / m_fZoom;
+	m_fCropH = m_uiRoiH / m_fZoom;
+	m_fCropX = fCenterX - m_fCropW * 0.5f;
+	m_fCropY = fCenterY - m_fCropH * 0.5f;
+
+	m_uiUploadFirst = (unsigned int)m_fCropY;
+	m_uiUploadLast = (unsigned int)(m_fCropY + m_fCropH + 0.999f);
+	if (m_uiUploadLast > Device.height)
+		m_uiUploadLast = Device.height;
+}
 
-	GLfloat vVertices[] = { -1.0f,  1.0f, 0.0f,  // Position 0
-				0.0f,  0.0f,        // TexCoord 0 
-				-1.0f, -1.0f, 0.0f,  // Position 1
-				0.0f,  1.0f,        // TexCoord 1
-				1.0f, -1.0f, 0.0f,  // Position 2
-				1.0f,  1.0f,        // TexCoord 2
-				1.0f,  1.0f, 0.0f,  // Position 3
-				1.0f,  0.0f         // TexCoord 3
+/*!****************************************************************************
+ @Function		GetViewport
+ @Input			uiWidth, uiHeight	Size of the render target
+ @Input			fAspect			Aspect ratio of the picture
+ @Output		piViewport		x, y, width and height of the viewport
+ @Description	Fills the whole target, or with letterboxing the largest
+				centred rectangle that keeps the picture aspect ratio.
+******************************************************************************/
+void yuv2rgb::GetViewport( unsigned int uiWidth, unsigned int uiHeight, float fAspect, GLint* piViewport )
+{
+	piViewport[0] = 0;
+	piViewport[1] = 0;
+	piViewport[2] = uiWidth;
+	piViewport[3] = uiHeight;
+
+	if (!m_bLetterbox)
+		return;
+
+	if (uiWidth > fAspect * uiHeight)
+	{
+		// Pillarbox
+		piViewport[2] = (GLint)(fAspect * uiHeight + 0.5f);
+		piViewport[0] = (uiWidth - piViewport[2]) / 2;
+	}
+	else
+	{
+		piViewport[3] = (GLint)(uiWidth / fAspect + 0.5f);
+		piViewport[1] = (uiHeight - piViewport[3]) / 2;
+	}
+}
+
+/*!****************************************************************************
+ @Function		DrawQuad
+ @Input			uiProgram		Program to draw with
+ @Input			uiTexture		Texture bound to unit 0
+ @Input			pfPositions		Clip space x, y of the 4 corners
+ @Input			pfTexCoords		Texture coordinates of the 4 corners
+ @Description	Draws a quad, corners in top-left, bottom-left,
+				bottom-right, top-right order.
+******************************************************************************/
+void yuv2rgb::DrawQuad( GLuint uiProgram, GLuint uiTexture, const GLfloat* pfPositions, const GLfloat* pfTexCoords )
+{
+	const GLfloat* p = pfPositions;
+	const GLfloat* t = pfTexCoords;
+	GLfloat vVertices[] = { p[0],  p[1], 0.0f,  // Position 0
+				t[0],  t[1],        // TexCoord 0
+				p[2],  p[3], 0.0f,  // Position 1
+				t[2],  t[3],        // TexCoord 1
+				p[4],  p[5], 0.0f,  // Position 2
+				t[4],  t[5],        // TexCoord 2
+				p[6],  p[7], 0.0f,  // Position 3
+				t[6],  t[7]         // TexCoord 3
 				};
 	GLushort indices[] = { 0, 1, 2, 0, 2, 3 };
 
-	// Set the viewport
-	glViewport ( 0, 0, TWIDTH, THEIGHT );
+	glUseProgram ( uiProgram );
 
-	// Clear the color buffer
-	glClear ( GL_COLOR_BUFFER_BIT );
-
-	GLint positionLoc = glGetAttribLocation ( m_uiProgramObject, "a_position" );
-	GLint texCoordLoc = glGetAttribLocation ( m_uiProgramObject, "a_texCoord" );
+	GLint positionLoc = glGetAttribLocation ( uiProgram, "a_position" );
+	GLint texCoordLoc = glGetAttribLocation ( uiProgram, "a_texCoord" );
 
 	// Load the vertex position
 	glVertexAttribPointer ( positionLoc, 3, GL_FLOAT, 
@@ -465,17 +1542,232 @@ bool yuv2rgb::RenderScene()
 
 	// Bind the base map
 	glActiveTexture ( GL_TEXTURE0 );
-	glBindTexture ( GL_TEXTURE_2D, baseMapTexId );
+	glBindTexture ( GL_TEXTURE_2D, uiTexture );
 
 	glDrawElements ( GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, indices );
+}
+
+/*!****************************************************************************
+ @Function		ReadbackFbo
+ @Description	Reads the converted frame back from the bound render target
+				and saves it to the -readback file pattern, top line first.
+******************************************************************************/
+void yuv2rgb::ReadbackFbo( void )
+{
+	unsigned int uiStride = m_uiFboWidth * 4;
+	char szFileName[256];
+	const char* p;
+	FILE* pFile;
+
+	glReadPixels(0, 0, m_uiFboWidth, m_uiFboHeight, GL_RGBA, GL_UNSIGNED_BYTE, m_pu8Readback);
+
+	p = strchr(m_pszReadback, '#');
+	if (p != NULL)
+		snprintf(szFileName, sizeof szFileName, "%.*s%06u%s", (int)(p - m_pszReadback),
+			 m_pszReadback, gCount, p + 1);
+	else
+		snprintf(szFileName, sizeof szFileName, "%s", m_pszReadback);
+
+	pFile = fopen(szFileName, p != NULL ? "wb" : "ab");
+	if (pFile == NULL)
+		return;
+
+	// GL returns the bottom line first
+	for (unsigned int y = m_uiFboHeight; y > 0; --y)
+		fwrite(m_pu8Readback + (y - 1) * uiStride, 1, uiStride, pFile);
+
+	fclose(pFile);
+}
+
+/*!****************************************************************************
+ @Function		RenderScene
+ @Return		bool		true if no error occured
+ @Description	Main rendering loop function of the program. The shell will
+				call this function every frame.
+				eglSwapBuffers() will be performed by PVRShell automatically.
+				PVRShell will also manage important OS events.
+				Will also manage relevent OS events. The user has access to
+				these events through an abstraction layer provided by PVRShell.
+******************************************************************************/
+bool yuv2rgb::RenderScene()
+{
+	// PVRShell swapped the previous frame between the two calls
+	if (m_bStampPending)
+	{
+		m_au64Stamps[3] = latency_now();
+		latency_record(&m_sLatency, m_uiStampSequence, m_uiStampFlags, m_au64Stamps);
+		m_bStampPending = false;
+	}
+
+	// At field rate the second field of the last frame is shown without
+	// dequeuing a new one, and always needs a draw
+	bool bSecondField = m_bSecondField;
+	if (bSecondField)
+	{
+		m_bSecondField = false;
+		m_bStatic = false;
+	}
+	else
+	{
+		int iCount = gCount;
+
+		if (!DequeueVideo())
+			return false;
+		m_bSecondField = m_bDeintFieldRate && gCount != iCount && HasTwoFields(m_uiVideoField);
+	}
+
+	if (m_iFilterMode >= 0)
+		UpdateFilter();
+	if (m_iDeintMode >= 0)
+		UpdateDeinterlace(bSecondField);
+
+	// Nothing changed and the last frame is still on the surface
+	if (m_bStatic && m_bPreserved)
+	{
+		m_uiSkippedDraws++;
+		return true;
+	}
+
+	float fAspect = m_fCropW / m_fCropH;
+	// Single field buffers make frames of twice their height
+	if (m_iDeintMode >= 0 && (m_uiVideoField == V4L2_FIELD_TOP || m_uiVideoField == V4L2_FIELD_BOTTOM))
+		fAspect /= 2.0f;
+	if (m_uiOrientation & ORIENT_ROTATE_90)
+		fAspect = 1.0f / fAspect;
+
+	unsigned int uiWidth = PVRShellGet(prefWidth);
+	unsigned int uiHeight = PVRShellGet(prefHeight);
+	GLint aiViewport[4];
+
+	if (m_uiFbo)
+	{
+		// Convert once at the target resolution...
+		static const GLfloat afBlitPositions[8] = { -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, -1.0f, 1.0f, 1.0f };
+		static const GLfloat afBlitCoords[8] = { 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 1.0f };
+
+		// An unchanged frame is still in the render target
+		if (m_bStatic)
+		{
+			m_uiSkippedPasses++;
+		}
+		else
+		{
+			// The last output becomes the history of this one
+			if (m_uiPrevFbo)
+			{
+				GLuint uiFbo = m_uiFbo, uiTexture = m_uiFboTexture;
+
+				m_uiFbo = m_uiPrevFbo;
+				m_uiFboTexture = m_uiPrevTexture;
+				m_uiPrevFbo = uiFbo;
+				m_uiPrevTexture = uiTexture;
+
+				UpdateDenoise();
+				glActiveTexture(GL_TEXTURE1);
+				glBindTexture(GL_TEXTURE_2D, m_uiPrevTexture);
+				m_uiDenoisedFrames++;
+			}
+
+			glBindFramebuffer(GL_FRAMEBUFFER, m_uiFbo);
+			GetViewport(m_uiFboWidth, m_uiFboHeight, fAspect, aiViewport);
+			glViewport(aiViewport[0], aiViewport[1], aiViewport[2], aiViewport[3]);
+			glClear(GL_COLOR_BUFFER_BIT);
+			DrawFrame();
+
+			if (m_pu8Readback)
+				ReadbackFbo();
+		}
+
+		// ...then show the result
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		GetViewport(uiWidth, uiHeight, (float)m_uiFboWidth / m_uiFboHeight, aiViewport);
+		glViewport(aiViewport[0], aiViewport[1], aiViewport[2], aiViewport[3]);
+		glClear(GL_COLOR_BUFFER_BIT);
+		DrawQuad(m_uiBlitProgram, m_uiFboTexture, afBlitPositions, afBlitCoords);
+	}
+	else
+	{
+		// Set the viewport
+		GetViewport(uiWidth, uiHeight, fAspect, aiViewport);
+		glViewport(aiViewport[0], aiViewport[1], aiViewport[2], aiViewport[3]);
+
+		// Clear the color buffer
+		glClear ( GL_COLOR_BUFFER_BIT );
+
+		DrawFrame();
+	}
 
 	//usleep(1000*100);
 	//printf("WP: userData->baseMapTexId=0x%x\n", userData->baseMapTexId);
 
-	glDeleteTextures ( 1, &baseMapTexId );
-	
 	return true;
 }
+
+/*!****************************************************************************
+ @Function		DrawFrame
+ @Description	Draws the crop rectangle of the frame over the viewport, one
+				quad per tile. Each tile covers its own part of the crop
+				rectangle, taken to the unit square and through the
+				orientation map to find where it lands on screen.
+******************************************************************************/
+void yuv2rgb::DrawFrame( void )
+{
+	const struct orient_map* m = &m_sOrientMap;
+	unsigned int uiTiles = m_cFrame.GetTileCount();
+	CTiledTexture::STile sBuffer;
+
+	// An imported buffer is one tile covering the frame
+	if (m_bDmabuf)
+	{
+		if (m_iDmabufIndex < 0)
+			return;
+
+		sBuffer.uiTexture = dmatex_texture(&m_sDmatex, m_iDmabufIndex);
+		sBuffer.uiX = sBuffer.uiY = 0;
+		sBuffer.uiWidth = Device.width;
+		sBuffer.uiHeight = Device.height;
+		uiTiles = 1;
+	}
+
+	for (unsigned int i = 0; i < uiTiles; ++i)
+	{
+		const CTiledTexture::STile& sTile = m_bDmabuf ? sBuffer : m_cFrame.GetTile(i);
+		float fX0 = m_fCropX > sTile.uiX ? m_fCropX : (float)sTile.uiX;
+		float fY0 = m_fCropY > sTile.uiY ? m_fCropY : (float)sTile.uiY;
+		float fX1 = m_fCropX + m_fCropW < sTile.uiX + sTile.uiWidth ? m_fCropX + m_fCropW : (float)(sTile.uiX + sTile.uiWidth);
+		float fY1 = m_fCropY + m_fCropH < sTile.uiY + sTile.uiHeight ? m_fCropY + m_fCropH : (float)(sTile.uiY + sTile.uiHeight);
+
+		if (fX0 >= fX1 || fY0 >= fY1)
+			continue;
+
+		// Frame corners in quad order: top-left, bottom-left, bottom-right, top-right
+		const float afX[4] = { fX0, fX0, fX1, fX1 };
+		const float afY[4] = { fY0, fY1, fY1, fY0 };
+		GLfloat afPositions[8], afTexCoords[8];
+
+		for (int c = 0; c < 4; ++c)
+		{
+			float u = (afX[c] - m_fCropX) / m_fCropW;
+			float v = (afY[c] - m_fCropY) / m_fCropH;
+			float du = m->xx * u + m->xy * v + m->x0;
+			float dv = m->yx * u + m->yy * v + m->y0;
+
+			afPositions[c * 2] = -1.0f + 2.0f * du;
+			afPositions[c * 2 + 1] = 1.0f - 2.0f * dv;
+			afTexCoords[c * 2] = (afX[c] - sTile.uiX) / sTile.uiWidth;
+			afTexCoords[c * 2 + 1] = (afY[c] - sTile.uiY) / sTile.uiHeight;
+		}
+
+		glUseProgram(m_uiProgramObject);
+		glUniform1f(m_iTextureWidthLoc, (float)sTile.uiWidth);
+		glUniform1f(m_iTexelWidthLoc, 1.0f / sTile.uiWidth);
+		glUniform1f(m_iTexelHeightLoc, 1.0f / sTile.uiHeight);
+		DrawQuad(m_uiProgramObject, sTile.uiTexture, afPositions, afTexCoords);
+	}
+
+	if (m_bDmabuf)
+		dmatex_fence(&m_sDmatex, m_iDmabufIndex);
+}
 //Lynx
 void yuv2rgb::InitV4L( void )
 {
@@ -21,11 +21,192 @@
 //   the texture coordinates in the shader go from 0 to 1.0.
 //   so each texel is (1.0 / texture_width) wide.
 
+// DENOISE - defined by the CPU program for the temporal denoise. The
+//   converted pixel is blended with the previous output, read from
+//   s_prevMap at the same window position (prev_texel is one over its
+//   size). The weight of the new pixel grows from weight_min where
+//   nothing changed to 1.0 at a difference of threshold.
+
+// FILTER - defined by the CPU program, together with one of
+//   FILTER_SHARPEN, FILTER_UNSHARP or FILTER_SOBEL and FILTER_SIZE (3 or
+//   5), to filter the luma before it is converted. The centre texel and
+//   the neighbour fetched for its chroma are taps already, the others
+//   are texel_height apart vertically. filter_amount is 1.0 for the
+//   nominal strength. The Sobel magnitude is shown as grey. The taps
+//   clamp at the edge of the texture, so the frame has to be in one.
+
+// DEINTERLACE - defined by the CPU program, together with one of
+//   DEINT_WEAVE, DEINT_BOB or DEINT_ADAPTIVE, to show the field
+//   field_parity (0.0 top, 1.0 bottom, negative for progressive frames)
+//   of an interlaced texture. Line i of a field is texture row
+//   i * field_layout.x plus field_layout.y (top) or .z (bottom), and
+//   fields have field_layout.w lines. The missing lines are woven from
+//   the other field, interpolated (bob), or woven unless the other field
+//   combs, its luma being outside the lines around it by comb_threshold
+//   (squared), which is as adaptive as a single frame allows. Every
+//   texel read, the filter taps included, goes through frame_texel().
+
+// OUTPUT_BGRX, OUTPUT_XRGB - defined by the CPU program when the render
+//   target is read back with glReadPixels(GL_RGBA), so that the bytes
+//   come out in the order of V4L2_PIX_FMT_BGR32 or V4L2_PIX_FMT_RGB32.
+
+// TEXEL_RG - defined by the CPU program when s_baseMap is the capture
+//   buffer itself, imported as a two channel image with the chroma in
+//   green rather than alpha. Every texture read goes through base_texel().
+
+// HIGHP - defined by the CPU program for textures wider than 1024
+//   texels, whose columns mediump cannot tell apart either.
+
+#if (defined(DEINTERLACE) || defined(HIGHP)) && defined(GL_FRAGMENT_PRECISION_HIGH)
+// mediump does not tell the rows of a 1080 line texture apart
+precision highp float;
+#else
 precision mediump float;
+#endif
 uniform sampler2D s_baseMap;
 uniform float texture_width;
 uniform float texel_width;
 varying vec2 v_texCoord;
+#ifdef TEXEL_RG
+#define base_texel(coord) texture2D(s_baseMap, coord).rrrg
+#else
+#define base_texel(coord) texture2D(s_baseMap, coord)
+#endif
+#ifdef DENOISE
+uniform sampler2D s_prevMap;
+uniform vec2 prev_texel;
+uniform float weight_min;
+uniform float threshold;
+#endif
+#if defined(FILTER) || defined(DEINTERLACE)
+uniform float texel_height;
+#endif
+#ifdef DEINTERLACE
+uniform float field_parity;
+uniform vec4 field_layout;
+uniform float comb_threshold;
+
+vec4 field_texel(float s, float parity, float line)
+{
+	float row = line * field_layout.x + (parity == 0.0 ? field_layout.y : field_layout.z);
+
+	return base_texel(vec2(s, (row + 0.5) * texel_height));
+}
+
+// the texel of the progressive frame at coord
+vec4 frame_texel(vec2 coord)
+{
+	if (field_parity < 0.0)
+		return base_texel(coord);
+
+	float row = floor(coord.t * 2.0 * field_layout.w);
+	float parity = mod(row, 2.0);
+	float line = floor(row / 2.0);
+
+#ifdef DEINT_WEAVE
+	return field_texel(coord.s, parity, line);
+#else
+	if (parity == field_parity)
+		return field_texel(coord.s, parity, line);
+
+	float last = field_layout.w - 1.0;
+	vec4 above = field_texel(coord.s, field_parity, clamp(floor((row - 1.0) / 2.0), 0.0, last));
+	vec4 below = field_texel(coord.s, field_parity, clamp(floor((row + 1.0) / 2.0), 0.0, last));
+	vec4 bob = (above + below) * 0.5;
+#ifdef DEINT_BOB
+	return bob;
+#else
+	vec4 weave = field_texel(coord.s, parity, line);
+
+	return (weave.r - above.r) * (weave.r - below.r) > comb_threshold ? bob : weave;
+#endif
+#endif
+}
+
+// one frame row in texture coordinates
+#define frame_row (0.5 / field_layout.w)
+#else
+#define frame_texel(coord) base_texel(coord)
+#define frame_row texel_height
+#endif
+#ifdef FILTER
+uniform float filter_amount;
+
+float filter_tap(vec2 coord, float dx, float dy)
+{
+	return frame_texel(coord + vec2(dx * texel_width, dy * frame_row)).r;
+}
+
+#if FILTER_SIZE == 5
+float filter_binomial(int i)
+{
+	return i == 0 ? 6.0 : (i == 1 || i == -1) ? 4.0 : 1.0;
+}
+
+float filter_derivative(int i)
+{
+	return i == 0 ? 0.0 : (i == 1 || i == -1) ? 2.0 * float(i) : float(i) / 2.0;
+}
+#endif
+
+// filtered luma at coord, c is its own and n the one of the neighbour dx
+// (+1.0 or -1.0) texels away horizontally
+float filter_luma(vec2 coord, float c, float n, float dx)
+{
+#if FILTER_SIZE == 5
+	float sum = 0.0, gx = 0.0, gy = 0.0;
+
+	for (int j = -2; j <= 2; j++)
+	{
+		for (int i = -2; i <= 2; i++)
+		{
+			float v;
+
+			if (j == 0 && i == 0)
+				v = c;
+			else if (j == 0 && float(i) == dx)
+				v = n;
+			else
+				v = filter_tap(coord, float(i), float(j));
+#if defined(FILTER_SHARPEN)
+			sum += v;
+#elif defined(FILTER_UNSHARP)
+			sum += filter_binomial(i) * filter_binomial(j) * v;
+#else
+			gx += filter_binomial(j) * filter_derivative(i) * v;
+			gy += filter_derivative(j) * filter_binomial(i) * v;
+#endif
+		}
+	}
+#if defined(FILTER_SHARPEN)
+	return c + filter_amount * (25.0 * c - sum) / 16.0;
+#elif defined(FILTER_UNSHARP)
+	return c + filter_amount * (c - sum / 256.0);
+#else
+	return filter_amount * (abs(gx) + abs(gy)) / 32.0;
+#endif
+#else
+	float l = dx < 0.0 ? n : filter_tap(coord, -1.0, 0.0);
+	float r = dx > 0.0 ? n : filter_tap(coord, 1.0, 0.0);
+	float tl = filter_tap(coord, -1.0, -1.0);
+	float t = filter_tap(coord, 0.0, -1.0);
+	float tr = filter_tap(coord, 1.0, -1.0);
+	float bl = filter_tap(coord, -1.0, 1.0);
+	float b = filter_tap(coord, 0.0, 1.0);
+	float br = filter_tap(coord, 1.0, 1.0);
+#if defined(FILTER_SHARPEN)
+	return c + filter_amount * (8.0 * c - (tl + t + tr + l + r + bl + b + br)) / 8.0;
+#elif defined(FILTER_UNSHARP)
+	float blur = (tl + 2.0 * t + tr + 2.0 * l + 4.0 * c + 2.0 * r + bl + 2.0 * b + br) / 16.0;
+	return c + filter_amount * (c - blur);
+#else
+	float gx = (tr + 2.0 * r + br) - (tl + 2.0 * l + bl);
+	float gy = (bl + 2.0 * b + br) - (tl + 2.0 * t + tr);
+	return filter_amount * (abs(gx) + abs(gy)) / 4.0;
+#endif
+#endif
+}
+#endif
 
 void main()
 {
@@ -34,6 +215,8 @@ void main()
 	float luma, chroma_u,  chroma_v;
 	float pixelx, pixely;
 	float xcoord, ycoord;
+	vec4 neighbour;
+	float neighbour_dx;
 	vec3 yuv;
 
 	// note: pixelx, pixely are 0.0 to 1.0 so "next pixel horizontally"
@@ -51,31 +234,62 @@ void main()
 
 	xcoord = floor (pixelx * texture_width);
 
-	luma_chroma = texture2D(s_baseMap, vec2(pixelx, pixely));
+	luma_chroma = frame_texel(vec2(pixelx, pixely));
 
 	// just look up the brightness
 	luma = (luma_chroma.r - 0.0625) * 1.1643;
 
 	if (0.0 == mod(xcoord , 2.0)) // even
 	{
+		neighbour = frame_texel(
+		vec2(pixelx + texel_width, pixely));
+		neighbour_dx = 1.0;
 		chroma_u = luma_chroma.a;
-		chroma_v = texture2D(s_baseMap, 
-		vec2(pixelx + texel_width, pixely)).a;
+		chroma_v = neighbour.a;
 	}
 	else // odd
 	{
+		neighbour = frame_texel(
+		vec2(pixelx - texel_width, pixely));
+		neighbour_dx = -1.0;
 		chroma_v = luma_chroma.a;
-		chroma_u = texture2D(s_baseMap, 
-		vec2(pixelx - texel_width, pixely)).a;     
+		chroma_u = neighbour.a;
 	}
 	chroma_u = chroma_u - 0.5;
 	chroma_v = chroma_v - 0.5;
 
+#ifdef FILTER
+	luma = clamp(filter_luma(vec2(pixelx, pixely), luma_chroma.r, neighbour.r, neighbour_dx), 0.0, 1.0);
+	luma = (luma - 0.0625) * 1.1643;
+#ifdef FILTER_SOBEL
+	chroma_u = 0.0;
+	chroma_v = 0.0;
+#endif
+#endif
+
 	red = luma + 1.5958 * chroma_v;
 	green = luma - 0.39173 * chroma_u - 0.81290 * chroma_v;
 	blue = luma + 2.017 * chroma_u;
 
+#ifdef DENOISE
+	vec3 rgb = clamp(vec3(red, green, blue), 0.0, 1.0);
+	vec3 prev = texture2D(s_prevMap, gl_FragCoord.xy * prev_texel).rgb;
+	vec3 diff = abs(rgb - prev);
+	float motion = min(max(max(diff.r, diff.g), diff.b) / threshold, 1.0);
+
+	rgb = mix(prev, rgb, mix(weight_min, 1.0, motion));
+	red = rgb.r;
+	green = rgb.g;
+	blue = rgb.b;
+#endif
+
 	// set the color based on the texture color
+#if defined(OUTPUT_BGRX)
+    gl_FragColor = vec4(blue, green, red, 1.0);
+#elif defined(OUTPUT_XRGB)
+    gl_FragColor = vec4(1.0, red, green, blue);
+#else
     gl_FragColor = vec4(red, green, blue, 1.0);
+#endif
     //gl_FragColor = vec4(luma, luma, luma, 1.0);
 }
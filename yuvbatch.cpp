@@ -0,0 +1,679 @@
+/*
+ * yuvbatch.cpp -- offline converter for recorded raw frames
+ *
+ * Converts files of raw frames, as saved by video_save_image() one frame
+ * per file or appended into one file, to PPM, PNG or raw RGB with the
+ * converters of the live pipeline, so the output is byte for byte what
+ * the convert node produces. Inputs are memory mapped and every frame is
+ * a task for the work-stealing pool; a frame is converted straight into
+ * its output file image and written by the same worker. Output buffers
+ * come from a fixed set sized by --memory, which bounds the memory in
+ * flight: reading stops while all of them wait to be written.
+ *
+ * PNG files use stored deflate blocks, each holding whole lines that are
+ * converted in place. They are as large as raw files, but cost no CPU to
+ * compress; recompress them later if space matters.
+ */
+
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "yavtalib.h"
+#include "convert.h"
+#include "workpool.h"
+
+enum batch_type
+{
+	BATCH_PPM,
+	BATCH_PNG,
+	BATCH_RAW
+};
+
+struct batch_file
+{
+	const char *path;
+	uint8_t *map;
+	size_t size;
+	unsigned int frames;
+	/* Frames not written yet, the last one unmaps the file. */
+	volatile unsigned int remaining;
+};
+
+struct batch;
+
+struct batch_job
+{
+	struct batch *batch;
+	struct batch_file *file;
+	unsigned int frame;
+	uint8_t *buffer;
+};
+
+struct batch
+{
+	enum batch_type type;
+	unsigned int fourcc;
+	unsigned int dst_fourcc;
+	unsigned int width;
+	unsigned int height;
+	unsigned int frame_size;
+	unsigned int out_stride;
+	unsigned int out_size;
+	const char *dir;
+	convert_fn convert;
+
+	struct workpool pool;
+
+	/* Free output buffers, the bound on memory in flight. */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct batch_job *jobs;
+	struct batch_job **free;
+	unsigned int nfree;
+	unsigned int njobs;
+
+	/* Statistics. */
+	volatile unsigned int done;
+	volatile unsigned int errors;
+	volatile uint64_t bytes_in;
+	volatile uint64_t bytes_out;
+};
+
+static uint64_t batch_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* -----------------------------------------------------------------------------
+ * PNG
+ */
+
+#define PNG_BLOCK_MAX	65535
+/* Widest frame whose lines each fit in a stored block. */
+#define PNG_MAX_WIDTH	((PNG_BLOCK_MAX - 1) / 3)
+
+static uint32_t png_crc_table[256];
+
+static void __attribute__((constructor)) png_crc_init(void)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < 256; ++i) {
+		uint32_t c = i;
+
+		for (j = 0; j < 8; ++j)
+			c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		png_crc_table[i] = c;
+	}
+}
+
+static uint32_t png_crc(uint32_t crc, const uint8_t *p, size_t n)
+{
+	while (n--)
+		crc = png_crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+static uint32_t png_adler(uint32_t adler, const uint8_t *p, size_t n)
+{
+	uint32_t a = adler & 0xffff;
+	uint32_t b = adler >> 16;
+
+	/* 5552 bytes is the most that cannot overflow b between modulos. */
+	while (n) {
+		size_t chunk = n < 5552 ? n : 5552;
+
+		n -= chunk;
+		while (chunk--) {
+			a += *p++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+
+	return (b << 16) | a;
+}
+
+static uint8_t *png_put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+	return p + 4;
+}
+
+/* Lines per stored deflate block, a filter byte and an RGB24 line each. */
+static unsigned int png_block_lines(unsigned int width)
+{
+	return PNG_BLOCK_MAX / (width * 3 + 1);
+}
+
+static unsigned int png_size(unsigned int width, unsigned int height)
+{
+	unsigned int lines = png_block_lines(width);
+	unsigned int blocks = (height + lines - 1) / lines;
+
+	/* Signature, IHDR, IDAT with zlib header and checksum, IEND. */
+	return 8 + 25 + 12 + 2 + blocks * 5 + (width * 3 + 1) * height + 4 + 12;
+}
+
+static uint8_t *png_chunk_end(uint8_t *start, uint8_t *end)
+{
+	uint32_t crc;
+
+	png_put32(start, end - start - 8);
+	crc = png_crc(0xffffffff, start + 4, end - start - 4);
+	return png_put32(end, crc ^ 0xffffffff);
+}
+
+/* Convert src into a PNG file image, returns its size. */
+static unsigned int png_render(struct batch *batch, const struct image *src,
+	uint8_t *out)
+{
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	unsigned int lines = png_block_lines(src->width);
+	unsigned int stride = src->width * 3 + 1;
+	uint32_t adler = 1;
+	uint8_t *chunk;
+	uint8_t *p = out;
+	unsigned int y, i;
+
+	memcpy(p, signature, 8);
+	p += 8;
+
+	chunk = p;
+	memcpy(p + 4, "IHDR", 4);
+	p = png_put32(p + 8, src->width);
+	p = png_put32(p, src->height);
+	*p++ = 8;		/* bit depth */
+	*p++ = 2;		/* truecolour */
+	*p++ = 0;
+	*p++ = 0;
+	*p++ = 0;
+	p = png_chunk_end(chunk, p);
+
+	chunk = p;
+	memcpy(p + 4, "IDAT", 4);
+	p += 8;
+	*p++ = 0x78;
+	*p++ = 0x01;
+
+	for (y = 0; y < src->height; y += lines) {
+		unsigned int n = src->height - y < lines ? src->height - y : lines;
+		unsigned int len = n * stride;
+		struct image s = *src;
+		struct image d;
+
+		*p++ = y + n == src->height;
+		*p++ = len;
+		*p++ = len >> 8;
+		*p++ = ~len;
+		*p++ = ~len >> 8;
+
+		/* The lines of the block, each after its filter byte. */
+		s.data = src->data + y * src->stride;
+		s.height = n;
+		image_init(&d, V4L2_PIX_FMT_RGB24, src->width, n, stride, p + 1);
+		batch->convert(&s, &d, 0, n);
+		for (i = 0; i < n; ++i)
+			p[i * stride] = 0;
+
+		adler = png_adler(adler, p, len);
+		p += len;
+	}
+
+	p = png_put32(p, adler);
+	p = png_chunk_end(chunk, p);
+
+	chunk = p;
+	memcpy(p + 4, "IEND", 4);
+	p = png_chunk_end(chunk, p + 8);
+
+	return p - out;
+}
+
+/* -----------------------------------------------------------------------------
+ * Jobs
+ */
+
+static unsigned int batch_render(struct batch *batch, const struct image *src,
+	uint8_t *out)
+{
+	struct image dst;
+	int header = 0;
+
+	switch (batch->type) {
+	case BATCH_PNG:
+		return png_render(batch, src, out);
+	case BATCH_PPM:
+		header = sprintf((char *)out, "P6\n%u %u\n255\n", src->width, src->height);
+		break;
+	default:
+		break;
+	}
+
+	image_init(&dst, batch->dst_fourcc, src->width, src->height,
+		   batch->out_stride, out + header);
+	batch->convert(src, &dst, 0, src->height);
+	return header + batch->out_stride * src->height;
+}
+
+static const char *batch_extension(enum batch_type type)
+{
+	switch (type) {
+	case BATCH_PPM:
+		return "ppm";
+	case BATCH_PNG:
+		return "png";
+	default:
+		return "raw";
+	}
+}
+
+/* Output name: the input name in the output directory, per frame if several. */
+static void batch_filename(struct batch *batch, const struct batch_file *file,
+	unsigned int frame, char *name, size_t size)
+{
+	const char *base = strrchr(file->path, '/');
+	const char *dot;
+	int len;
+
+	base = base ? base + 1 : file->path;
+	dot = strrchr(base, '.');
+	len = dot && dot != base ? (int)(dot - base) : (int)strlen(base);
+
+	if (file->frames > 1)
+		snprintf(name, size, "%s/%.*s-%06u.%s", batch->dir, len, base, frame,
+			 batch_extension(batch->type));
+	else
+		snprintf(name, size, "%s/%.*s.%s", batch->dir, len, base,
+			 batch_extension(batch->type));
+}
+
+static int batch_write(const char *name, const uint8_t *data, unsigned int size)
+{
+	ssize_t ret;
+	int fd;
+
+	fd = open(name, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+	if (fd < 0) {
+		printf("\nUnable to create %s: %s (%d).\n", name, strerror(errno), errno);
+		return -errno;
+	}
+
+	while (size) {
+		ret = write(fd, data, size);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0) {
+			printf("\nUnable to write %s: %s (%d).\n", name, strerror(errno), errno);
+			close(fd);
+			return -errno;
+		}
+		data += ret;
+		size -= ret;
+	}
+
+	close(fd);
+	return 0;
+}
+
+static void batch_put_job(struct batch *batch, struct batch_job *job)
+{
+	pthread_mutex_lock(&batch->lock);
+	batch->free[batch->nfree++] = job;
+	pthread_cond_signal(&batch->cond);
+	pthread_mutex_unlock(&batch->lock);
+}
+
+/* Wait up to timeout ms for a free output buffer. */
+static struct batch_job *batch_get_job(struct batch *batch, unsigned int timeout)
+{
+	struct batch_job *job = NULL;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec += timeout * 1000000;
+	ts.tv_sec += ts.tv_nsec / 1000000000;
+	ts.tv_nsec %= 1000000000;
+
+	pthread_mutex_lock(&batch->lock);
+	while (batch->nfree == 0) {
+		if (pthread_cond_timedwait(&batch->cond, &batch->lock, &ts) == ETIMEDOUT)
+			break;
+	}
+	if (batch->nfree)
+		job = batch->free[--batch->nfree];
+	pthread_mutex_unlock(&batch->lock);
+
+	return job;
+}
+
+static void batch_run_job(void *arg)
+{
+	struct batch_job *job = (struct batch_job *)arg;
+	struct batch *batch = job->batch;
+	struct batch_file *file = job->file;
+	struct image src;
+	unsigned int size;
+	char name[1024];
+
+	image_init(&src, batch->fourcc, batch->width, batch->height, 0,
+		   file->map + (size_t)job->frame * batch->frame_size);
+	size = batch_render(batch, &src, job->buffer);
+
+	batch_filename(batch, file, job->frame, name, sizeof name);
+	if (batch_write(name, job->buffer, size) < 0) {
+		__sync_fetch_and_add(&batch->errors, 1);
+	} else {
+		__sync_fetch_and_add(&batch->bytes_in, batch->frame_size);
+		__sync_fetch_and_add(&batch->bytes_out, size);
+	}
+
+	if (__sync_sub_and_fetch(&file->remaining, 1) == 0) {
+		munmap(file->map, file->size);
+		file->map = NULL;
+	}
+
+	__sync_fetch_and_add(&batch->done, 1);
+	batch_put_job(batch, job);
+}
+
+/* -----------------------------------------------------------------------------
+ * Main
+ */
+
+static void batch_progress(struct batch *batch, unsigned int total,
+	uint64_t elapsed, bool last)
+{
+	double seconds = elapsed / 1e9;
+
+	printf("\r%u/%u frames, %.1f fps, %.1f MB/s read, %.1f MB/s written%s",
+		batch->done, total, batch->done / seconds,
+		batch->bytes_in / seconds / 1e6, batch->bytes_out / seconds / 1e6,
+		last ? "\n" : "");
+	fflush(stdout);
+}
+
+static int batch_map(struct batch_file *file)
+{
+	int fd;
+
+	fd = open(file->path, O_RDONLY);
+	if (fd < 0) {
+		printf("\nUnable to open %s: %s (%d).\n", file->path, strerror(errno), errno);
+		return -errno;
+	}
+
+	file->map = (uint8_t *)mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (file->map == MAP_FAILED) {
+		file->map = NULL;
+		printf("\nUnable to map %s: %s (%d).\n", file->path, strerror(errno), errno);
+		return -errno;
+	}
+
+	/* Frames are read in order, once. */
+	madvise(file->map, file->size, MADV_SEQUENTIAL | MADV_WILLNEED);
+	file->remaining = file->frames;
+	return 0;
+}
+
+static void usage(const char *argv0)
+{
+	printf("Usage: %s [options] file...\n", argv0);
+	printf("Convert files of raw frames to PPM, PNG or raw RGB.\n\n");
+	printf("Supported options:\n");
+	printf("-d, --dir dir			Output directory (default .)\n");
+	printf("-f, --format format		Input format (default YUYV)\n");
+	printf("-F, --out-format format		Output format of raw files (default RGB24)\n");
+	printf("-h, --help			Show this help screen\n");
+	printf("-j, --threads n			Number of threads (default one per CPU)\n");
+	printf("-m, --memory MB			Output memory in flight (default 64)\n");
+	printf("-q, --quiet			Do not show progress\n");
+	printf("-s, --size WxH			Frame size\n");
+	printf("-t, --type ppm|png|raw		Output file type (default ppm)\n");
+}
+
+static struct option opts[] = {
+	{"dir", 1, 0, 'd'},
+	{"format", 1, 0, 'f'},
+	{"out-format", 1, 0, 'F'},
+	{"help", 0, 0, 'h'},
+	{"threads", 1, 0, 'j'},
+	{"memory", 1, 0, 'm'},
+	{"quiet", 0, 0, 'q'},
+	{"size", 1, 0, 's'},
+	{"type", 1, 0, 't'},
+	{0, 0, 0, 0}
+};
+
+int main(int argc, char *argv[])
+{
+	struct batch batch;
+	struct batch_file *files;
+	const struct pixfmt_info *info;
+	unsigned int nfiles, total = 0;
+	unsigned int unreadable = 0;
+	unsigned int threads = 0;
+	unsigned int memory = 64;
+	bool quiet = false;
+	uint64_t start, last;
+	unsigned int i, j;
+	int ret = 1;
+	int c;
+
+	memset(&batch, 0, sizeof batch);
+	batch.type = BATCH_PPM;
+	batch.fourcc = V4L2_PIX_FMT_YUYV;
+	batch.dst_fourcc = V4L2_PIX_FMT_RGB24;
+	batch.dir = ".";
+
+	while ((c = getopt_long(argc, argv, "d:f:F:hj:m:qs:t:", opts, NULL)) != -1) {
+		switch (c) {
+		case 'd':
+			batch.dir = optarg;
+			break;
+		case 'f':
+		case 'F':
+			if (v4l2_format_code(optarg) == 0) {
+				printf("Unsupported video format '%s'\n", optarg);
+				return 1;
+			}
+			if (c == 'f')
+				batch.fourcc = v4l2_format_code(optarg);
+			else
+				batch.dst_fourcc = v4l2_format_code(optarg);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		case 'm':
+			memory = atoi(optarg);
+			break;
+		case 'q':
+			quiet = true;
+			break;
+		case 's':
+			if (sscanf(optarg, "%ux%u", &batch.width, &batch.height) != 2) {
+				printf("Invalid size '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 't':
+			if (strcmp(optarg, "ppm") == 0)
+				batch.type = BATCH_PPM;
+			else if (strcmp(optarg, "png") == 0)
+				batch.type = BATCH_PNG;
+			else if (strcmp(optarg, "raw") == 0)
+				batch.type = BATCH_RAW;
+			else {
+				printf("Invalid output type '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		default:
+			printf("Invalid option -%c\n", c);
+			printf("Run %s -h for help.\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind >= argc || batch.width == 0 || batch.height == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* PPM and PNG hold RGB24. */
+	if (batch.type != BATCH_RAW)
+		batch.dst_fourcc = V4L2_PIX_FMT_RGB24;
+
+	if (batch.type == BATCH_PNG && batch.width > PNG_MAX_WIDTH) {
+		printf("PNG output is limited to %u pixels wide.\n", PNG_MAX_WIDTH);
+		return 1;
+	}
+
+	info = pixfmt_lookup(batch.fourcc);
+	batch.convert = convert_lookup(batch.fourcc, batch.dst_fourcc);
+	if (info == NULL || info->bpp == 0 || batch.convert == NULL) {
+		printf("No conversion from %s to %s.\n", v4l2_format_name(batch.fourcc),
+			v4l2_format_name(batch.dst_fourcc));
+		return 1;
+	}
+
+	batch.frame_size = pixfmt_image_size(info, pixfmt_bytesperline(info, batch.width),
+					     batch.height);
+	batch.out_stride = pixfmt_bytesperline(pixfmt_lookup(batch.dst_fourcc), batch.width);
+	if (batch.type == BATCH_PNG)
+		batch.out_size = png_size(batch.width, batch.height);
+	else
+		batch.out_size = 32 + batch.out_stride * batch.height;
+
+	/* Sizes first, for the progress. */
+	nfiles = argc - optind;
+	files = (struct batch_file *)calloc(nfiles, sizeof *files);
+	if (files == NULL)
+		return 1;
+
+	for (i = 0; i < nfiles; ++i) {
+		struct batch_file *file = &files[i];
+		struct stat st;
+
+		file->path = argv[optind + i];
+		if (stat(file->path, &st) < 0) {
+			printf("Unable to stat %s: %s (%d).\n", file->path,
+				strerror(errno), errno);
+			unreadable++;
+			continue;
+		}
+
+		file->size = st.st_size;
+		file->frames = file->size / batch.frame_size;
+		if (file->size % batch.frame_size)
+			printf("%s: %zu trailing bytes ignored.\n", file->path,
+				file->size % batch.frame_size);
+		total += file->frames;
+	}
+
+	if (workpool_init(&batch.pool, threads) < 0)
+		goto done;
+
+	/* At least a frame per thread, or they idle. */
+	batch.njobs = (uint64_t)memory * 1024 * 1024 / batch.out_size;
+	if (batch.njobs < batch.pool.nthreads)
+		batch.njobs = batch.pool.nthreads;
+	if (batch.njobs > total)
+		batch.njobs = total ? total : 1;
+
+	pthread_mutex_init(&batch.lock, NULL);
+	pthread_cond_init(&batch.cond, NULL);
+	batch.jobs = (struct batch_job *)calloc(batch.njobs, sizeof *batch.jobs);
+	batch.free = (struct batch_job **)calloc(batch.njobs, sizeof *batch.free);
+	if (batch.jobs == NULL || batch.free == NULL)
+		goto done;
+
+	for (i = 0; i < batch.njobs; ++i) {
+		batch.jobs[i].batch = &batch;
+		batch.jobs[i].buffer = (uint8_t *)malloc(batch.out_size);
+		if (batch.jobs[i].buffer == NULL)
+			goto done;
+		batch.free[batch.nfree++] = &batch.jobs[i];
+	}
+
+	if (!quiet)
+		printf("%u frames in %u files, %u threads, %u buffers of %u kB\n",
+			total, nfiles, batch.pool.nthreads, batch.njobs,
+			batch.out_size / 1024);
+
+	start = last = batch_now();
+
+	for (i = 0; i < nfiles; ++i) {
+		struct batch_file *file = &files[i];
+
+		if (file->frames == 0)
+			continue;
+		if (batch_map(file) < 0) {
+			unreadable++;
+			continue;
+		}
+
+		for (j = 0; j < file->frames; ++j) {
+			struct batch_job *job;
+
+			while ((job = batch_get_job(&batch, 500)) == NULL) {
+				if (!quiet)
+					batch_progress(&batch, total, batch_now() - start, false);
+			}
+
+			if (!quiet && batch_now() - last >= 500000000ULL) {
+				last = batch_now();
+				batch_progress(&batch, total, last - start, false);
+			}
+
+			job->file = file;
+			job->frame = j;
+			workpool_submit(&batch.pool, batch_run_job, job);
+		}
+	}
+
+	/* Every buffer back means every frame written. */
+	pthread_mutex_lock(&batch.lock);
+	while (batch.nfree < batch.njobs)
+		pthread_cond_wait(&batch.cond, &batch.lock);
+	pthread_mutex_unlock(&batch.lock);
+
+	threads = batch.pool.nthreads;
+	workpool_cleanup(&batch.pool);
+
+	if (!quiet) {
+		batch_progress(&batch, total, batch_now() - start, true);
+		for (i = 0; i < threads; ++i)
+			printf("thread %2u: %u frames, %u stolen\n", i,
+				batch.pool.workers[i].executed, batch.pool.workers[i].stolen);
+	}
+
+	if (batch.errors || unreadable)
+		printf("%u frames failed, %u files unreadable.\n", batch.errors,
+			unreadable);
+	ret = batch.errors || unreadable ? 1 : 0;
+
+done:
+	if (batch.pool.nthreads)
+		workpool_cleanup(&batch.pool);
+	if (batch.jobs) {
+		for (i = 0; i < batch.njobs; ++i)
+			free(batch.jobs[i].buffer);
+	}
+	free(batch.jobs);
+	free(batch.free);
+	free(files);
+	return ret;
+}
@@ -0,0 +1,981 @@
+/*
+ * yuvbench.cpp -- conversion and filter microbenchmarks
+ *
+ * Times every converter (scalar, SIMD, streaming stores and SIMD on
+ * bandconv threads) for every supported format pair, the rotating and
+ * flipping converters, the fused conversion pyramid, and the filter,
+ * denoise, deinterlace, motion and statistics kernels, over a range of
+ * frame sizes. Each case runs with warm caches, the same frames over and
+ * over, and with cold caches, a buffer larger than the last level cache
+ * written before every iteration. Results are in ns per pixel, GB/s of
+ * source and destination frames, and CPU cycles per pixel when the
+ * kernel allows perf events; multi-threaded cases count wall time only.
+ *
+ * The end to end case runs a pipeline, by default a pattern source fed
+ * through a convert node to a null sink as fast as it goes, or the one
+ * of a configuration file, to time a real capture device.
+ *
+ * Results are written as JSON, along with the CPU, the SIMD flavour and
+ * the compiler, to compare boards and builds.
+ */
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+
+#include "yavtalib.h"
+#include "bandconv.h"
+#include "filter.h"
+#include "denoise.h"
+#include "deint.h"
+#include "motion.h"
+#include "yuvstats.h"
+#include "pyramid.h"
+#include "pipeline.h"
+
+#define BENCH_MAX_SIZES		8
+#define BENCH_COLD_ITERATIONS	5
+#define BENCH_MAX_ITERATIONS	1000
+
+struct bench;
+struct bench_case;
+
+typedef void (*bench_fn)(struct bench_case *bc, unsigned int iteration);
+
+struct bench_case
+{
+	const char *kernel;
+	char variant[32];
+	unsigned int src_fourcc;
+	unsigned int dst_fourcc;
+	unsigned int width;
+	unsigned int height;
+	unsigned int threads;
+	/* Bytes of source and destination frames per iteration. */
+	uint64_t bytes;
+	bench_fn fn;
+
+	/* Two source frames for the temporal kernels, one destination. */
+	struct frame *src[2];
+	struct frame *dst;
+
+	convert_fn convert;
+	convert_orient_fn orient;
+	const struct orient_map *map;
+	struct bandconv *bands;
+	struct pyramid *pyr;
+	struct filter *flt;
+	struct denoise *dn;
+	struct deint *di;
+	struct motion *md;
+	struct yuvstats *st;
+};
+
+struct bench_result
+{
+	unsigned int iterations;
+	uint64_t total_ns;
+	uint64_t min_ns;
+	/* 0 when not counted. */
+	uint64_t cycles;
+};
+
+struct bench
+{
+	unsigned int sizes[BENCH_MAX_SIZES][2];
+	unsigned int nsizes;
+	const char *kernels;
+	unsigned int threads;
+	uint64_t min_ns;
+	unsigned int nframes;
+	const char *config;
+
+	uint8_t *evict;
+	size_t evict_size;
+	int perf_fd;
+	struct bandconv bands;
+
+	FILE *json;
+	unsigned int results;
+};
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* -----------------------------------------------------------------------------
+ * Kernels
+ */
+
+static void bench_convert(struct bench_case *bc, unsigned int)
+{
+	bc->convert(&bc->src[0]->image, &bc->dst->image, 0, bc->height);
+}
+
+static void bench_convert_mt(struct bench_case *bc, unsigned int)
+{
+	bandconv_run(bc->bands, bc->convert, &bc->src[0]->image, &bc->dst->image);
+}
+
+static void bench_orient(struct bench_case *bc, unsigned int)
+{
+	bc->orient(&bc->src[0]->image, &bc->dst->image, bc->map, 0, bc->height);
+}
+
+static void bench_orient_mt(struct bench_case *bc, unsigned int)
+{
+	bandconv_run_oriented(bc->bands, bc->orient, bc->map, &bc->src[0]->image,
+			      &bc->dst->image);
+}
+
+static void bench_pyramid(struct bench_case *bc, unsigned int)
+{
+	pyramid_process(bc->pyr, &bc->src[0]->image, 0, bc->height);
+}
+
+static void bench_filter(struct bench_case *bc, unsigned int)
+{
+	filter_run(bc->flt, &bc->src[0]->image, &bc->dst->image);
+}
+
+static void bench_denoise(struct bench_case *bc, unsigned int iteration)
+{
+	denoise_convert(bc->dn, &bc->src[iteration & 1]->image, &bc->dst->image);
+}
+
+static void bench_deint(struct bench_case *bc, unsigned int iteration)
+{
+	int outputs = deint_push(bc->di, bc->src[iteration & 1]);
+	int i;
+
+	for (i = 0; i < outputs; ++i)
+		deint_render(bc->di, i, bc->dst);
+}
+
+static void bench_motion(struct bench_case *bc, unsigned int iteration)
+{
+	struct motion_result result;
+
+	motion_detect(bc->md, &bc->src[iteration & 1]->image, &result);
+}
+
+static void bench_stats(struct bench_case *bc, unsigned int iteration)
+{
+	yuvstats_run(bc->st, &bc->src[0]->image, iteration, 0);
+}
+
+/* -----------------------------------------------------------------------------
+ * Measurement
+ */
+
+static int bench_perf_open(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof attr);
+	attr.size = sizeof attr;
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void bench_iteration(struct bench *bench, struct bench_case *bc,
+	unsigned int iteration, struct bench_result *result, bool cycles)
+{
+	uint64_t start, elapsed;
+	uint64_t count = 0;
+
+	if (cycles) {
+		ioctl(bench->perf_fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(bench->perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+
+	start = bench_now();
+	bc->fn(bc, iteration);
+	elapsed = bench_now() - start;
+
+	if (cycles) {
+		ioctl(bench->perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(bench->perf_fd, &count, sizeof count) != sizeof count)
+			count = 0;
+	}
+
+	result->iterations++;
+	result->total_ns += elapsed;
+	result->cycles += count;
+	if (result->min_ns == 0 || elapsed < result->min_ns)
+		result->min_ns = elapsed;
+}
+
+/*
+ * Warm: one untimed run, then runs until min_ns have passed. Cold: a few
+ * runs, each after the eviction buffer was written.
+ */
+static void bench_measure(struct bench *bench, struct bench_case *bc, bool cold,
+	struct bench_result *result)
+{
+	bool cycles = bench->perf_fd >= 0 && bc->threads == 1;
+	unsigned int i;
+
+	memset(result, 0, sizeof *result);
+
+	if (cold) {
+		for (i = 0; i < BENCH_COLD_ITERATIONS; ++i) {
+			memset(bench->evict, i, bench->evict_size);
+			bench_iteration(bench, bc, i, result, cycles);
+		}
+		return;
+	}
+
+	bc->fn(bc, 0);
+	for (i = 1; i <= BENCH_MAX_ITERATIONS; ++i) {
+		bench_iteration(bench, bc, i, result, cycles);
+		if (result->total_ns >= bench->min_ns && i >= BENCH_COLD_ITERATIONS)
+			break;
+	}
+}
+
+/* -----------------------------------------------------------------------------
+ * Reporting
+ */
+
+static void bench_json_string(FILE *file, const char *s)
+{
+	fputc('"', file);
+	for (; *s; ++s) {
+		if (*s == '"' || *s == '\\')
+			fputc('\\', file);
+		if ((unsigned char)*s >= ' ')
+			fputc(*s, file);
+	}
+	fputc('"', file);
+}
+
+static void bench_report(struct bench *bench, const struct bench_case *bc,
+	bool cold, const struct bench_result *result)
+{
+	double pixels = (double)bc->width * bc->height;
+	double ns = (double)result->total_ns / result->iterations;
+	double cycles = (double)result->cycles / result->iterations / pixels;
+
+	printf("%-8s %-16s %-5s -> %-5s %4ux%-4u t%-2u %s: %7.3f ns/pixel, %6.2f GB/s",
+		bc->kernel, bc->variant, v4l2_format_name(bc->src_fourcc),
+		bc->dst_fourcc ? v4l2_format_name(bc->dst_fourcc) : "-",
+		bc->width, bc->height, bc->threads, cold ? "cold" : "warm",
+		ns / pixels, bc->bytes / ns);
+	if (result->cycles)
+		printf(", %.2f cycles/pixel", cycles);
+	printf("\n");
+
+	fprintf(bench->json, "%s\n    { \"kernel\": \"%s\", \"variant\": \"%s\", "
+		"\"src\": \"%s\", \"dst\": \"%s\", \"width\": %u, \"height\": %u, "
+		"\"threads\": %u, \"cache\": \"%s\", \"iterations\": %u, "
+		"\"us_per_frame\": %.3f, \"min_us_per_frame\": %.3f, "
+		"\"ns_per_pixel\": %.4f, \"gb_per_s\": %.3f, ",
+		bench->results++ ? "," : "", bc->kernel, bc->variant,
+		v4l2_format_name(bc->src_fourcc),
+		bc->dst_fourcc ? v4l2_format_name(bc->dst_fourcc) : "",
+		bc->width, bc->height, bc->threads, cold ? "cold" : "warm",
+		result->iterations, ns / 1e3, result->min_ns / 1e3, ns / pixels,
+		bc->bytes / ns);
+	if (result->cycles)
+		fprintf(bench->json, "\"cycles_per_pixel\": %.3f }", cycles);
+	else
+		fprintf(bench->json, "\"cycles_per_pixel\": null }");
+	fflush(bench->json);
+}
+
+static void bench_run(struct bench *bench, struct bench_case *bc)
+{
+	struct bench_result result;
+
+	if (bench->kernels && !strstr(bench->kernels, bc->kernel))
+		return;
+
+	bench_measure(bench, bc, false, &result);
+	bench_report(bench, bc, false, &result);
+	bench_measure(bench, bc, true, &result);
+	bench_report(bench, bc, true, &result);
+}
+
+static void bench_system(struct bench *bench)
+{
+	char cpu[256] = "unknown";
+	char line[256];
+	struct utsname uts;
+	FILE *file;
+
+	/* x86 has a model name, ARM kernels a Hardware line or a CPU part. */
+	file = fopen("/proc/cpuinfo", "r");
+	while (file && fgets(line, sizeof line, file)) {
+		char *value = strchr(line, ':');
+
+		if (value == NULL)
+			continue;
+		if (strncmp(line, "model name", 10) && strncmp(line, "Hardware", 8) &&
+		    (strncmp(line, "CPU part", 8) || strcmp(cpu, "unknown")))
+			continue;
+
+		value += strspn(value + 1, " \t") + 1;
+		value[strcspn(value, "\n")] = '\0';
+		snprintf(cpu, sizeof cpu, "%s", value);
+		if (strncmp(line, "CPU part", 8))
+			break;
+	}
+	if (file)
+		fclose(file);
+
+	uname(&uts);
+
+	fprintf(bench->json, "{\n  \"system\": { \"cpu\": ");
+	bench_json_string(bench->json, cpu);
+	fprintf(bench->json, ", \"machine\": ");
+	bench_json_string(bench->json, uts.machine);
+	fprintf(bench->json, ", \"kernel\": ");
+	bench_json_string(bench->json, uts.release);
+	fprintf(bench->json, ", \"cpus\": %ld, \"simd\": \"%s\", \"compiler\": ",
+		sysconf(_SC_NPROCESSORS_ONLN),
+#if defined(SIMD_NEON)
+		"neon"
+#elif defined(SIMD_SSE2)
+		"sse2"
+#else
+		"none"
+#endif
+		);
+	bench_json_string(bench->json, __VERSION__);
+	fprintf(bench->json, ", \"cycles\": %s },\n",
+		bench->perf_fd >= 0 ? "true" : "false");
+	fprintf(bench->json, "  \"config\": { \"min_ms\": %.0f, \"cold_mb\": %zu, "
+		"\"threads\": %u },\n  \"results\": [", bench->min_ns / 1e6,
+		bench->evict_size >> 20, bench->threads);
+
+	printf("%s, %s, %ld CPUs, cycles %s\n", cpu, uts.machine,
+		sysconf(_SC_NPROCESSORS_ONLN),
+		bench->perf_fd >= 0 ? "counted" : "not available");
+}
+
+/* -----------------------------------------------------------------------------
+ * Cases
+ */
+
+static const unsigned int bench_sources[] = {
+	V4L2_PIX_FMT_YUYV,
+	V4L2_PIX_FMT_UYVY,
+	V4L2_PIX_FMT_GREY,
+};
+
+static const unsigned int bench_destinations[] = {
+	V4L2_PIX_FMT_RGB24,
+	V4L2_PIX_FMT_BGR24,
+	V4L2_PIX_FMT_BGR32,
+	V4L2_PIX_FMT_RGB32,
+	V4L2_PIX_FMT_RGB565,
+};
+
+/* Noise, so that data dependent kernels do not take shortcuts. */
+static struct frame *bench_frame(unsigned int fourcc, unsigned int width,
+	unsigned int height, uint32_t seed)
+{
+	struct frame *frame;
+	unsigned int x, y;
+
+	frame = frame_alloc(fourcc, width, height);
+	if (frame == NULL)
+		return NULL;
+
+	for (y = 0; y < height; ++y) {
+		uint8_t *line = frame->image.data + y * frame->image.stride;
+
+		for (x = 0; x < frame->image.stride; ++x) {
+			seed = seed * 1103515245 + 12345;
+			line[x] = seed >> 24;
+		}
+	}
+
+	frame->sequence = seed & 1;
+	frame->flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+	frame->field = V4L2_FIELD_NONE;
+	return frame;
+}
+
+static uint64_t bench_image_bytes(const struct frame *frame)
+{
+	return frame ? (uint64_t)frame->image.stride * frame->image.height : 0;
+}
+
+static void bench_case_init(struct bench_case *bc, const char *kernel,
+	const char *variant, unsigned int src_fourcc, unsigned int dst_fourcc,
+	unsigned int width, unsigned int height, bench_fn fn)
+{
+	memset(bc, 0, sizeof *bc);
+	bc->kernel = kernel;
+	snprintf(bc->variant, sizeof bc->variant, "%s", variant);
+	bc->src_fourcc = src_fourcc;
+	bc->dst_fourcc = dst_fourcc;
+	bc->width = width;
+	bc->height = height;
+	bc->threads = 1;
+	bc->fn = fn;
+}
+
+static void bench_converters(struct bench *bench, unsigned int width,
+	unsigned int height)
+{
+	static const char *const names[] = { "scalar", "simd", "stream" };
+	struct bench_case bc;
+	unsigned int i, j, k;
+
+	for (i = 0; i < ARRAY_SIZE(bench_sources); ++i) {
+		struct frame *src = bench_frame(bench_sources[i], width, height, 1);
+
+		for (j = 0; j < ARRAY_SIZE(bench_destinations); ++j) {
+			struct frame *dst;
+
+			if (convert_lookup(bench_sources[i], bench_destinations[j]) == NULL)
+				continue;
+
+			dst = frame_alloc(bench_destinations[j], width, height);
+
+			for (k = 0; k <= ARRAY_SIZE(names); ++k) {
+				bool mt = k == ARRAY_SIZE(names);
+
+				if (mt && bench->threads < 2)
+					continue;
+
+				bench_case_init(&bc, "convert", mt ? "simd-threads" : names[k],
+						bench_sources[i], bench_destinations[j],
+						width, height, mt ? bench_convert_mt : bench_convert);
+				bc.convert = convert_lookup_variant(bench_sources[i],
+					bench_destinations[j], mt ? CONVERT_SIMD : (enum convert_variant)k);
+				bc.bands = &bench->bands;
+				bc.threads = mt ? bench->threads : 1;
+				bc.src[0] = src;
+				bc.dst = dst;
+				bc.bytes = bench_image_bytes(src) + bench_image_bytes(dst);
+				bench_run(bench, &bc);
+			}
+
+			frame_put(dst);
+		}
+
+		frame_put(src);
+	}
+}
+
+/* Rotations and a flip, the ones a display mounted sideways needs. */
+static void bench_oriented(struct bench *bench, unsigned int width,
+	unsigned int height)
+{
+	static const struct {
+		const char *name;
+		unsigned int orientation;
+	} orientations[] = {
+		{ "rot90", ORIENT_ROTATE_90 },
+		{ "rot180", ORIENT_ROTATE_180 },
+		{ "rot270", ORIENT_ROTATE_270 },
+		{ "hflip", ORIENT_HFLIP },
+	};
+	struct orient_map map;
+	struct bench_case bc;
+	char variant[32];
+	unsigned int i, j, k;
+	int mt;
+
+	for (i = 0; i < ARRAY_SIZE(bench_sources); ++i) {
+		struct frame *src = bench_frame(bench_sources[i], width, height, 1);
+
+		for (j = 0; j < ARRAY_SIZE(bench_destinations); ++j) {
+			convert_orient_fn fn;
+
+			fn = convert_orient_lookup(bench_sources[i], bench_destinations[j]);
+			if (fn == NULL)
+				continue;
+
+			for (k = 0; k < ARRAY_SIZE(orientations); ++k) {
+				struct frame *dst;
+
+				orient_map_init(&map, orientations[k].orientation, width, height);
+				dst = frame_alloc(bench_destinations[j], map.width, map.height);
+
+				for (mt = 0; mt < 2; ++mt) {
+					if (mt && bench->threads < 2)
+						continue;
+
+					snprintf(variant, sizeof variant, "%s%s",
+						 orientations[k].name, mt ? "-threads" : "");
+					bench_case_init(&bc, "orient", variant, bench_sources[i],
+							bench_destinations[j], width, height,
+							mt ? bench_orient_mt : bench_orient);
+					bc.orient = fn;
+					bc.map = &map;
+					bc.bands = &bench->bands;
+					bc.threads = mt ? bench->threads : 1;
+					bc.src[0] = src;
+					bc.dst = dst;
+					bc.bytes = bench_image_bytes(src) + bench_image_bytes(dst);
+					bench_run(bench, &bc);
+				}
+
+				frame_put(dst);
+			}
+		}
+
+		frame_put(src);
+	}
+}
+
+/* All three levels, alone and with a tensor of the smallest one. */
+static void bench_pyramids(struct bench *bench, unsigned int width,
+	unsigned int height)
+{
+	static const char *const names[] = { "levels-3", "levels-3-f16", "levels-3-i8" };
+	static const enum tensor_type tensors[] = { TENSOR_NONE, TENSOR_FLOAT16, TENSOR_INT8 };
+	struct frame *src = bench_frame(V4L2_PIX_FMT_YUYV, width, height, 1);
+	struct frame *out[PYRAMID_MAX_LEVELS + 1];
+	struct pyramid_config config;
+	struct pyramid pyr;
+	struct bench_case bc;
+	unsigned int nout;
+	unsigned int i, j;
+
+	memset(&config, 0, sizeof config);
+	config.fourcc = V4L2_PIX_FMT_RGB24;
+	config.levels = PYRAMID_MAX_LEVELS;
+	config.tensor_level = PYRAMID_MAX_LEVELS - 1;
+	for (i = 0; i < 3; ++i) {
+		config.mean[i] = 128.0f;
+		config.scale[i] = 1.0f / 64;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(tensors); ++i) {
+		config.tensor = tensors[i];
+		if (pyramid_init(&pyr, &config, V4L2_PIX_FMT_YUYV, width, height) < 0)
+			continue;
+
+		bench_case_init(&bc, "pyramid", names[i], V4L2_PIX_FMT_YUYV,
+				V4L2_PIX_FMT_RGB24, width, height, bench_pyramid);
+		bc.pyr = &pyr;
+		bc.src[0] = src;
+		bc.bytes = bench_image_bytes(src) + pyr.tensor_size;
+
+		nout = 0;
+		for (j = 0; j < config.levels; ++j) {
+			out[nout] = frame_alloc(config.fourcc, pyr.level[j].width,
+						pyr.level[j].height);
+			if (out[nout] == NULL)
+				goto next;
+			pyr.level[j].data = out[nout]->image.data;
+			bc.bytes += bench_image_bytes(out[nout++]);
+		}
+
+		if (config.tensor != TENSOR_NONE) {
+			out[nout] = frame_alloc(V4L2_PIX_FMT_GREY, pyr.tensor_size, 1);
+			if (out[nout] == NULL)
+				goto next;
+			pyr.tensor = out[nout++]->image.data;
+		}
+
+		bench_run(bench, &bc);
+
+next:
+		for (j = 0; j < nout; ++j)
+			frame_put(out[j]);
+	}
+
+	frame_put(src);
+}
+
+static void bench_filters(struct bench *bench, unsigned int width,
+	unsigned int height)
+{
+	static const char *const modes[] = { "sharpen", "unsharp", "sobel" };
+	struct frame *src = bench_frame(V4L2_PIX_FMT_YUYV, width, height, 1);
+	struct bench_case bc;
+	struct filter flt;
+	unsigned int i, size, fused;
+	char variant[32];
+
+	for (i = 0; i < ARRAY_SIZE(modes); ++i) {
+		for (size = 3; size <= 5; size += 2) {
+			for (fused = 0; fused < 2; ++fused) {
+				unsigned int dst_fourcc = fused ? V4L2_PIX_FMT_RGB24 : V4L2_PIX_FMT_YUYV;
+				enum filter_mode mode;
+				struct frame *dst;
+
+				filter_parse_mode(modes[i], &mode);
+				if (filter_init(&flt, mode, size, V4L2_PIX_FMT_YUYV, dst_fourcc,
+						width, height) < 0)
+					continue;
+
+				dst = frame_alloc(dst_fourcc, width, height);
+				snprintf(variant, sizeof variant, "%s-%ux%u", modes[i], size, size);
+				bench_case_init(&bc, "filter", variant, V4L2_PIX_FMT_YUYV,
+						dst_fourcc, width, height, bench_filter);
+				bc.flt = &flt;
+				bc.src[0] = src;
+				bc.dst = dst;
+				bc.bytes = bench_image_bytes(src) + bench_image_bytes(dst);
+				bench_run(bench, &bc);
+
+				frame_put(dst);
+				filter_cleanup(&flt);
+			}
+		}
+	}
+
+	frame_put(src);
+}
+
+static void bench_temporal(struct bench *bench, unsigned int width,
+	unsigned int height)
+{
+	static const char *const modes[] = { "weave", "bob", "adaptive" };
+	struct frame *src[2];
+	struct frame *dst;
+	struct bench_case bc;
+	struct denoise dn;
+	struct deint di;
+	struct motion md;
+	struct yuvstats st;
+	unsigned int i;
+
+	src[0] = bench_frame(V4L2_PIX_FMT_YUYV, width, height, 1);
+	src[1] = bench_frame(V4L2_PIX_FMT_YUYV, width, height, 2);
+
+	if (denoise_init(&dn, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_RGB24, width, height) == 0) {
+		dst = frame_alloc(V4L2_PIX_FMT_RGB24, width, height);
+		bench_case_init(&bc, "denoise", "strength-128", V4L2_PIX_FMT_YUYV,
+				V4L2_PIX_FMT_RGB24, width, height, bench_denoise);
+		bc.dn = &dn;
+		bc.src[0] = src[0];
+		bc.src[1] = src[1];
+		bc.dst = dst;
+		bc.bytes = bench_image_bytes(src[0]) + bench_image_bytes(dst);
+		bench_run(bench, &bc);
+		frame_put(dst);
+		denoise_cleanup(&dn);
+	}
+
+	/* Interlaced frames, one progressive frame out of each. */
+	src[0]->field = V4L2_FIELD_INTERLACED_TB;
+	src[1]->field = V4L2_FIELD_INTERLACED_TB;
+	dst = frame_alloc(V4L2_PIX_FMT_YUYV, width, height);
+	for (i = 0; i < ARRAY_SIZE(modes); ++i) {
+		enum deint_mode mode;
+
+		deint_parse_mode(modes[i], &mode);
+		deint_init(&di, mode, false, V4L2_FIELD_INTERLACED_TB);
+		bench_case_init(&bc, "deint", modes[i], V4L2_PIX_FMT_YUYV,
+				V4L2_PIX_FMT_YUYV, width, height, bench_deint);
+		bc.di = &di;
+		bc.src[0] = src[0];
+		bc.src[1] = src[1];
+		bc.dst = dst;
+		bc.bytes = bench_image_bytes(src[0]) + bench_image_bytes(dst);
+		bench_run(bench, &bc);
+		deint_reset(&di);
+	}
+	frame_put(dst);
+	src[0]->field = V4L2_FIELD_NONE;
+	src[1]->field = V4L2_FIELD_NONE;
+
+	if (motion_init(&md, V4L2_PIX_FMT_YUYV, width, height, 4) == 0) {
+		bench_case_init(&bc, "motion", "factor-4", V4L2_PIX_FMT_YUYV, 0,
+				width, height, bench_motion);
+		bc.md = &md;
+		bc.src[0] = src[0];
+		bc.src[1] = src[1];
+		bc.bytes = bench_image_bytes(src[0]);
+		bench_run(bench, &bc);
+		motion_cleanup(&md);
+	}
+
+	if (yuvstats_init(&st, V4L2_PIX_FMT_YUYV, width, height, 8, 8, 1) == 0) {
+		bench_case_init(&bc, "stats", "zones-8x8", V4L2_PIX_FMT_YUYV, 0,
+				width, height, bench_stats);
+		bc.st = &st;
+		bc.src[0] = src[0];
+		bc.bytes = bench_image_bytes(src[0]);
+		bench_run(bench, &bc);
+		yuvstats_cleanup(&st);
+	}
+
+	frame_put(src[0]);
+	frame_put(src[1]);
+}
+
+/* -----------------------------------------------------------------------------
+ * Pipeline
+ */
+
+static struct pipeline bench_pipe;
+
+/*
+ * Run a pipeline for nframes and report the rate and the time per node.
+ * A size of 0 is taken from the width and height of the source node, and
+ * left out of the results when that does not have them either.
+ */
+static void bench_pipeline(struct bench *bench, const char *config,
+	unsigned int width, unsigned int height)
+{
+	struct pipeline *pipe = &bench_pipe;
+	uint64_t start, elapsed;
+	unsigned int frames = 0;
+	double ns_per_pixel = 0.0;
+	unsigned int i;
+
+	if (bench->kernels && !strstr(bench->kernels, "pipeline"))
+		return;
+
+	memset(pipe, 0, sizeof *pipe);
+	if (pipeline_load(pipe, config) < 0)
+		return;
+
+	for (i = 0; i < pipe->nnodes && width == 0; ++i) {
+		if (pipe->nodes[i].ops->source) {
+			width = pipeline_node_arg_uint(&pipe->nodes[i], "width", 0);
+			height = pipeline_node_arg_uint(&pipe->nodes[i], "height", 0);
+		}
+	}
+	if (height == 0)
+		width = 0;
+
+	pipe->max_frames = bench->nframes;
+	start = bench_now();
+	if (pipeline_start(pipe, 0) < 0) {
+		pipeline_cleanup(pipe);
+		return;
+	}
+	pipeline_wait(pipe);
+	elapsed = bench_now() - start;
+
+	/* The node that saw the fewest frames is the end of the path. */
+	for (i = 0; i < pipe->nnodes; ++i) {
+		if (!pipe->nodes[i].ops->source &&
+		    (frames == 0 || pipe->nodes[i].frames < frames))
+			frames = pipe->nodes[i].frames;
+	}
+
+	if (frames && elapsed) {
+		if (width)
+			ns_per_pixel = (double)elapsed / frames / ((double)width * height);
+
+		if (width)
+			printf("pipeline %ux%u: %u frames, %.1f fps, %.3f ns/pixel\n",
+				width, height, frames, frames * 1e9 / elapsed, ns_per_pixel);
+		else
+			printf("pipeline: %u frames, %.1f fps\n", frames,
+				frames * 1e9 / elapsed);
+
+		fprintf(bench->json, "%s\n    { \"kernel\": \"pipeline\", ",
+			bench->results++ ? "," : "");
+		if (width)
+			fprintf(bench->json, "\"width\": %u, \"height\": %u, ",
+				width, height);
+		else
+			fprintf(bench->json, "\"width\": null, \"height\": null, ");
+		fprintf(bench->json, "\"frames\": %u, \"fps\": %.2f, ", frames,
+			frames * 1e9 / elapsed);
+		if (width)
+			fprintf(bench->json, "\"ns_per_pixel\": %.4f, \"nodes\": [",
+				ns_per_pixel);
+		else
+			fprintf(bench->json, "\"ns_per_pixel\": null, \"nodes\": [");
+		for (i = 0; i < pipe->nnodes; ++i) {
+			struct pipeline_node *node = &pipe->nodes[i];
+
+			fprintf(bench->json, "%s{ \"name\": ", i ? ", " : " ");
+			bench_json_string(bench->json, node->name);
+			fprintf(bench->json, ", \"type\": \"%s\", \"frames\": %u, "
+				"\"us_per_frame\": %.3f }", node->ops->type, node->frames,
+				node->frames ? node->busy / 1e3 / node->frames : 0.0);
+		}
+		fprintf(bench->json, " ] }");
+		fflush(bench->json);
+	}
+
+	pipeline_cleanup(pipe);
+}
+
+/* Pattern source, converted on the bandconv threads, to a null sink. */
+static void bench_default_pipeline(struct bench *bench, unsigned int width,
+	unsigned int height)
+{
+	char path[] = "/tmp/yuvbenchXXXXXX";
+	FILE *file;
+	int fd;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		return;
+
+	file = fdopen(fd, "w");
+	fprintf(file, "node src pattern width=%u height=%u fps=0\n"
+		"node rgb convert format=RGB24 threads=%u\n"
+		"node sink null\n"
+		"link src rgb depth=2 policy=block\n"
+		"link rgb sink depth=2 policy=block\n", width, height, bench->threads);
+	fclose(file);
+
+	bench_pipeline(bench, path, width, height);
+	unlink(path);
+}
+
+/* -----------------------------------------------------------------------------
+ * Main
+ */
+
+static int bench_parse_sizes(struct bench *bench, const char *list)
+{
+	const char *p = list;
+
+	bench->nsizes = 0;
+	while (*p && bench->nsizes < BENCH_MAX_SIZES) {
+		unsigned int *size = bench->sizes[bench->nsizes];
+
+		if (sscanf(p, "%ux%u", &size[0], &size[1]) != 2 || size[0] == 0 ||
+		    size[1] == 0 || size[0] % 2) {
+			printf("Invalid size list '%s'\n", list);
+			return -EINVAL;
+		}
+		bench->nsizes++;
+
+		p = strchr(p, ',');
+		if (p == NULL)
+			break;
+		p++;
+	}
+
+	return 0;
+}
+
+static void usage(const char *argv0)
+{
+	printf("Usage: %s [options]\n", argv0);
+	printf("Benchmark the converters, filters and the pipeline.\n\n");
+	printf("Supported options:\n");
+	printf("-c, --cold MB			Buffer written to flush the caches (default 64)\n");
+	printf("-h, --help			Show this help screen\n");
+	printf("-k, --kernels list		Only these of convert,orient,pyramid,filter,denoise,deint,motion,stats,pipeline\n");
+	printf("-n, --nframes n			Frames of the pipeline runs (default 300)\n");
+	printf("-o, --output file		JSON results (default yuvbench.json)\n");
+	printf("-p, --pipeline config		Time this pipeline instead of pattern, convert, null\n");
+	printf("-s, --sizes list		Frame sizes (default 640x480,1280x720,1920x1080,3840x2160)\n");
+	printf("-t, --threads n			Threads of the parallel cases (default one per CPU)\n");
+	printf("-T, --time ms			Minimum time of a warm case (default 200)\n");
+}
+
+static struct option opts[] = {
+	{"cold", 1, 0, 'c'},
+	{"help", 0, 0, 'h'},
+	{"kernels", 1, 0, 'k'},
+	{"nframes", 1, 0, 'n'},
+	{"output", 1, 0, 'o'},
+	{"pipeline", 1, 0, 'p'},
+	{"sizes", 1, 0, 's'},
+	{"threads", 1, 0, 't'},
+	{"time", 1, 0, 'T'},
+	{0, 0, 0, 0}
+};
+
+int main(int argc, char *argv[])
+{
+	static struct bench bench;
+	const char *output = "yuvbench.json";
+	unsigned int i;
+	int c;
+
+	bench.evict_size = 64 << 20;
+	bench.threads = sysconf(_SC_NPROCESSORS_ONLN);
+	bench.min_ns = 200000000ULL;
+	bench.nframes = 300;
+	bench_parse_sizes(&bench, "640x480,1280x720,1920x1080,3840x2160");
+
+	while ((c = getopt_long(argc, argv, "c:hk:n:o:p:s:t:T:", opts, NULL)) != -1) {
+		switch (c) {
+		case 'c':
+			bench.evict_size = (size_t)atoi(optarg) << 20;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		case 'k':
+			bench.kernels = optarg;
+			break;
+		case 'n':
+			bench.nframes = atoi(optarg);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'p':
+			bench.config = optarg;
+			break;
+		case 's':
+			if (bench_parse_sizes(&bench, optarg) < 0)
+				return 1;
+			break;
+		case 't':
+			bench.threads = atoi(optarg);
+			break;
+		case 'T':
+			bench.min_ns = atoi(optarg) * 1000000ULL;
+			break;
+		default:
+			printf("Invalid option -%c\n", c);
+			printf("Run %s -h for help.\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (bench.threads == 0)
+		bench.threads = 1;
+
+	bench.json = fopen(output, "w");
+	if (bench.json == NULL) {
+		printf("Unable to open %s: %s (%d).\n", output, strerror(errno), errno);
+		return 1;
+	}
+
+	bench.evict = (uint8_t *)malloc(bench.evict_size ? bench.evict_size : 1);
+	if (bench.evict == NULL || bandconv_init(&bench.bands, bench.threads, NULL) < 0)
+		return 1;
+
+	bench.perf_fd = bench_perf_open();
+	bench_system(&bench);
+
+	for (i = 0; i < bench.nsizes; ++i) {
+		unsigned int width = bench.sizes[i][0];
+		unsigned int height = bench.sizes[i][1];
+
+		bench_converters(&bench, width, height);
+		bench_oriented(&bench, width, height);
+		bench_pyramids(&bench, width, height);
+		bench_filters(&bench, width, height);
+		bench_temporal(&bench, width, height);
+		if (bench.config == NULL)
+			bench_default_pipeline(&bench, width, height);
+	}
+
+	if (bench.config)
+		bench_pipeline(&bench, bench.config, 0, 0);
+
+	fprintf(bench.json, "\n  ]\n}\n");
+	fclose(bench.json);
+	printf("Results written to %s.\n", output);
+
+	if (bench.perf_fd >= 0)
+		close(bench.perf_fd);
+	bandconv_cleanup(&bench.bands);
+	free(bench.evict);
+	return 0;
+}
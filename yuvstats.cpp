@@ -0,0 +1,489 @@
+/*
+ * yuvstats.cpp -- exposure and white balance statistics of packed 4:2:2
+ */
+
+#include "yuvstats.h"
+
+/* Lines converted at a time by yuvstats_convert(), a few kB of source. */
+#define YUVSTATS_CHUNK_LINES	8
+
+static uint64_t yuvstats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* -----------------------------------------------------------------------------
+ * Kernels
+ */
+
+#if defined(SIMD_NEON)
+static inline uint8_t yuvstats_min_u8(uint8x16_t v)
+{
+	uint8x8_t m = vpmin_u8(vget_low_u8(v), vget_high_u8(v));
+
+	m = vpmin_u8(m, m);
+	m = vpmin_u8(m, m);
+	m = vpmin_u8(m, m);
+	return vget_lane_u8(m, 0);
+}
+
+static inline uint8_t yuvstats_max_u8(uint8x16_t v)
+{
+	uint8x8_t m = vpmax_u8(vget_low_u8(v), vget_high_u8(v));
+
+	m = vpmax_u8(m, m);
+	m = vpmax_u8(m, m);
+	m = vpmax_u8(m, m);
+	return vget_lane_u8(m, 0);
+}
+
+static inline uint32_t yuvstats_sum_u32(uint32x4_t v)
+{
+	uint64x2_t s = vpaddlq_u32(v);
+
+	return vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1);
+}
+#elif defined(SIMD_SSE2)
+static inline uint8_t yuvstats_min_u8(__m128i v)
+{
+	v = _mm_min_epu8(v, _mm_srli_si128(v, 8));
+	v = _mm_min_epu8(v, _mm_srli_si128(v, 4));
+	v = _mm_min_epu8(v, _mm_srli_si128(v, 2));
+	v = _mm_min_epu8(v, _mm_srli_si128(v, 1));
+	return _mm_cvtsi128_si32(v) & 0xff;
+}
+
+static inline uint8_t yuvstats_max_u8(__m128i v)
+{
+	v = _mm_max_epu8(v, _mm_srli_si128(v, 8));
+	v = _mm_max_epu8(v, _mm_srli_si128(v, 4));
+	v = _mm_max_epu8(v, _mm_srli_si128(v, 2));
+	v = _mm_max_epu8(v, _mm_srli_si128(v, 1));
+	return _mm_cvtsi128_si32(v) & 0xff;
+}
+
+static inline uint32_t yuvstats_sum_u64(__m128i v)
+{
+	return _mm_cvtsi128_si32(v) + _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+}
+#endif
+
+static inline void yuvstats_pair(const uint8_t *p, unsigned int yoff,
+	unsigned int uoff, unsigned int voff, uint32_t *ysum, uint32_t *usum,
+	uint32_t *vsum, unsigned int *min, unsigned int *max)
+{
+	unsigned int y0 = p[yoff];
+	unsigned int y1 = p[yoff + 2];
+
+	*ysum += y0 + y1;
+	*usum += p[uoff];
+	*vsum += p[voff];
+	if (y0 > y1) {
+		unsigned int t = y0;
+
+		y0 = y1;
+		y1 = t;
+	}
+	if (y0 < *min)
+		*min = y0;
+	if (y1 > *max)
+		*max = y1;
+}
+
+/*
+ * Accumulate one line into a part: the histogram, the luma range and the
+ * Y, U and V sums of every zone of the zone row the line belongs to.
+ */
+static void yuvstats_line(const struct yuvstats *st, struct yuvstats_part *part,
+	const uint8_t *s, uint32_t (*sums)[3])
+{
+	uint32_t *h0 = part->histogram[0];
+	uint32_t *h1 = part->histogram[1];
+	uint32_t *h2 = part->histogram[2];
+	uint32_t *h3 = part->histogram[3];
+	const unsigned int yoff = st->yoff;
+	const unsigned int uoff = st->uoff;
+	const unsigned int voff = st->voff;
+	unsigned int min = part->min;
+	unsigned int max = part->max;
+	unsigned int zone;
+
+#if defined(SIMD_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ymask = _mm_set1_epi32((0xff << (yoff * 8)) | (0xff << (yoff * 8 + 16)));
+	const __m128i umask = _mm_set1_epi32(0xff << (uoff * 8));
+	const __m128i vmask = _mm_set1_epi32(0xffU << (voff * 8));
+	const __m128i chroma = _mm_andnot_si128(ymask, _mm_set1_epi8(-1));
+	__m128i vmin = _mm_set1_epi8(-1);
+	__m128i vmax = zero;
+#elif defined(SIMD_NEON)
+	const uint8x16_t ymask = vreinterpretq_u8_u32(vdupq_n_u32((0xff << (yoff * 8)) | (0xff << (yoff * 8 + 16))));
+	const uint8x16_t umask = vreinterpretq_u8_u32(vdupq_n_u32(0xff << (uoff * 8)));
+	const uint8x16_t vmask = vreinterpretq_u8_u32(vdupq_n_u32(0xffU << (voff * 8)));
+	const uint8x16_t chroma = vmvnq_u8(ymask);
+	uint8x16_t vmin = vdupq_n_u8(0xff);
+	uint8x16_t vmax = vdupq_n_u8(0);
+#endif
+
+	for (zone = 0; zone < st->zones_x; ++zone) {
+		const uint8_t *p = s + st->zone_pairs[zone] * 4;
+		const uint8_t *end = s + st->zone_pairs[zone + 1] * 4;
+		uint32_t ysum = 0, usum = 0, vsum = 0;
+
+#if defined(SIMD_SSE2)
+		__m128i yacc = zero, uacc = zero, vacc = zero;
+
+		for (; p + 16 <= end; p += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *)p);
+			__m128i y = _mm_and_si128(v, ymask);
+
+			yacc = _mm_add_epi64(yacc, _mm_sad_epu8(y, zero));
+			uacc = _mm_add_epi64(uacc, _mm_sad_epu8(_mm_and_si128(v, umask), zero));
+			vacc = _mm_add_epi64(vacc, _mm_sad_epu8(_mm_and_si128(v, vmask), zero));
+			vmin = _mm_min_epu8(vmin, _mm_or_si128(v, chroma));
+			vmax = _mm_max_epu8(vmax, y);
+
+			h0[p[yoff]]++;
+			h1[p[yoff + 2]]++;
+			h2[p[yoff + 4]]++;
+			h3[p[yoff + 6]]++;
+			h0[p[yoff + 8]]++;
+			h1[p[yoff + 10]]++;
+			h2[p[yoff + 12]]++;
+			h3[p[yoff + 14]]++;
+		}
+		ysum = yuvstats_sum_u64(yacc);
+		usum = yuvstats_sum_u64(uacc);
+		vsum = yuvstats_sum_u64(vacc);
+#elif defined(SIMD_NEON)
+		uint32x4_t yacc = vdupq_n_u32(0);
+		uint32x4_t uacc = vdupq_n_u32(0);
+		uint32x4_t vacc = vdupq_n_u32(0);
+
+		for (; p + 16 <= end; p += 16) {
+			uint8x16_t v = vld1q_u8(p);
+			uint8x16_t y = vandq_u8(v, ymask);
+
+			yacc = vpadalq_u16(yacc, vpaddlq_u8(y));
+			uacc = vpadalq_u16(uacc, vpaddlq_u8(vandq_u8(v, umask)));
+			vacc = vpadalq_u16(vacc, vpaddlq_u8(vandq_u8(v, vmask)));
+			vmin = vminq_u8(vmin, vorrq_u8(v, chroma));
+			vmax = vmaxq_u8(vmax, y);
+
+			h0[p[yoff]]++;
+			h1[p[yoff + 2]]++;
+			h2[p[yoff + 4]]++;
+			h3[p[yoff + 6]]++;
+			h0[p[yoff + 8]]++;
+			h1[p[yoff + 10]]++;
+			h2[p[yoff + 12]]++;
+			h3[p[yoff + 14]]++;
+		}
+		ysum = yuvstats_sum_u32(yacc);
+		usum = yuvstats_sum_u32(uacc);
+		vsum = yuvstats_sum_u32(vacc);
+#endif
+
+		/* Two pairs at a time so the four tables are used without SIMD too. */
+		for (; p + 8 <= end; p += 8) {
+			h2[p[yoff + 4]]++;
+			h3[p[yoff + 6]]++;
+			yuvstats_pair(p + 4, yoff, uoff, voff, &ysum, &usum, &vsum, &min, &max);
+			h0[p[yoff]]++;
+			h1[p[yoff + 2]]++;
+			yuvstats_pair(p, yoff, uoff, voff, &ysum, &usum, &vsum, &min, &max);
+		}
+		if (p < end) {
+			h0[p[yoff]]++;
+			h1[p[yoff + 2]]++;
+			yuvstats_pair(p, yoff, uoff, voff, &ysum, &usum, &vsum, &min, &max);
+		}
+
+		sums[zone][0] += ysum;
+		sums[zone][1] += usum;
+		sums[zone][2] += vsum;
+	}
+
+#ifdef HAVE_SIMD
+	if (yuvstats_min_u8(vmin) < min)
+		min = yuvstats_min_u8(vmin);
+	if (yuvstats_max_u8(vmax) > max)
+		max = yuvstats_max_u8(vmax);
+#endif
+
+	part->min = min;
+	part->max = max;
+}
+
+/* -----------------------------------------------------------------------------
+ * Frames
+ */
+
+/*
+ * Collect statistics of frames of a packed 4:2:2 format and size over a
+ * zones_x x zones_y grid, from up to nparts threads at once.
+ */
+int yuvstats_init(struct yuvstats *st, unsigned int fourcc, unsigned int width,
+	unsigned int height, unsigned int zones_x, unsigned int zones_y,
+	unsigned int nparts)
+{
+	unsigned int pairs = width / 2;
+	unsigned int i;
+
+	memset(st, 0, sizeof *st);
+
+	switch (fourcc) {
+	case V4L2_PIX_FMT_YUYV:
+		st->yoff = 0;
+		st->uoff = 1;
+		st->voff = 3;
+		break;
+	case V4L2_PIX_FMT_UYVY:
+		st->yoff = 1;
+		st->uoff = 0;
+		st->voff = 2;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (width == 0 || height == 0 || width % 2 || zones_x == 0 ||
+	    zones_y == 0 || zones_x * zones_y > YUVSTATS_MAX_ZONES ||
+	    zones_x > pairs || zones_y > height || nparts == 0 ||
+	    nparts > YUVSTATS_MAX_PARTS)
+		return -EINVAL;
+
+	st->fourcc = fourcc;
+	st->width = width;
+	st->height = height;
+	st->zones_x = zones_x;
+	st->zones_y = zones_y;
+	st->nparts = nparts;
+
+	for (i = 0; i <= zones_x; ++i)
+		st->zone_pairs[i] = i * pairs / zones_x;
+
+	st->zone_rows = (uint16_t *)malloc(height * sizeof *st->zone_rows);
+	st->parts = (struct yuvstats_part *)calloc(nparts, sizeof *st->parts);
+	if (st->zone_rows == NULL || st->parts == NULL) {
+		yuvstats_cleanup(st);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < height; ++i) {
+		st->zone_rows[i] = i * zones_y / height;
+		st->zone_lines[st->zone_rows[i]]++;
+	}
+
+	return 0;
+}
+
+/* Start a frame, the threads accumulate into parts from here. */
+void yuvstats_begin(struct yuvstats *st)
+{
+	unsigned int i;
+
+	for (i = 0; i < st->nparts; ++i)
+		st->parts[i].used = false;
+}
+
+/* Accumulate lines [first, last) of src into part, from its own thread. */
+void yuvstats_lines(struct yuvstats *st, unsigned int part,
+	const struct image *src, unsigned int first, unsigned int last)
+{
+	struct yuvstats_part *p = &st->parts[part];
+	unsigned int y;
+
+	/* A part is cleared by its first lines of the frame. */
+	if (!p->used) {
+		memset(p->histogram, 0, sizeof p->histogram);
+		memset(p->sums, 0, st->zones_x * st->zones_y * sizeof p->sums[0]);
+		p->min = 255;
+		p->max = 0;
+		p->used = true;
+	}
+
+	for (y = first; y < last; ++y)
+		yuvstats_line(st, p, src->data + y * src->stride,
+			      &p->sums[st->zone_rows[y] * st->zones_x]);
+}
+
+/* bandconv hook, bands of every worker go to its own part. */
+void yuvstats_band(void *priv, unsigned int part, const struct image *src,
+	unsigned int first, unsigned int last)
+{
+	yuvstats_lines((struct yuvstats *)priv, part, src, first, last);
+}
+
+/* Merge the parts and publish the result of the frame. */
+void yuvstats_end(struct yuvstats *st, unsigned int sequence,
+	uint64_t timestamp)
+{
+	uint32_t number = st->published;
+	unsigned int slot = number % YUVSTATS_RESULTS;
+	struct yuvstats_result *result = &st->results[slot];
+	unsigned int zones = st->zones_x * st->zones_y;
+	uint64_t total = 0;
+	unsigned int i, j;
+
+	st->seq[slot] = 2 * number + 1;
+	__sync_synchronize();
+
+	result->sequence = sequence;
+	result->timestamp = timestamp;
+	result->min = 255;
+	result->max = 0;
+	result->zones_x = st->zones_x;
+	result->zones_y = st->zones_y;
+	memset(result->histogram, 0, sizeof result->histogram);
+
+	for (i = 0; i < zones; ++i) {
+		uint64_t sums[3] = { 0, 0, 0 };
+		unsigned int lines = st->zone_lines[i / st->zones_x];
+		unsigned int pairs = st->zone_pairs[i % st->zones_x + 1] -
+				     st->zone_pairs[i % st->zones_x];
+		uint64_t count = (uint64_t)pairs * lines;
+
+		for (j = 0; j < st->nparts; ++j) {
+			if (!st->parts[j].used)
+				continue;
+			sums[0] += st->parts[j].sums[i][0];
+			sums[1] += st->parts[j].sums[i][1];
+			sums[2] += st->parts[j].sums[i][2];
+		}
+
+		total += sums[0];
+		result->zones[i].y = (sums[0] * 256 + count) / (count * 2);
+		result->zones[i].u = (sums[1] * 256 + count / 2) / count;
+		result->zones[i].v = (sums[2] * 256 + count / 2) / count;
+	}
+
+	for (j = 0; j < st->nparts; ++j) {
+		const struct yuvstats_part *part = &st->parts[j];
+
+		if (!part->used)
+			continue;
+
+		for (i = 0; i < 256; ++i)
+			result->histogram[i] += part->histogram[0][i] + part->histogram[1][i] +
+						part->histogram[2][i] + part->histogram[3][i];
+		if (part->min < result->min)
+			result->min = part->min;
+		if (part->max > result->max)
+			result->max = part->max;
+	}
+
+	result->mean = (total * 256 + st->width * st->height / 2) /
+		       ((uint64_t)st->width * st->height);
+
+	__sync_synchronize();
+	st->seq[slot] = 2 * number + 2;
+	st->published = number + 1;
+	st->frames++;
+}
+
+/* Statistics of a whole frame on the calling thread. */
+void yuvstats_run(struct yuvstats *st, const struct image *src,
+	unsigned int sequence, uint64_t timestamp)
+{
+	uint64_t start = yuvstats_now();
+	uint64_t elapsed;
+
+	yuvstats_begin(st);
+	yuvstats_lines(st, 0, src, 0, st->height);
+	yuvstats_end(st, sequence, timestamp);
+
+	elapsed = yuvstats_now() - start;
+	st->stats_ns += elapsed;
+	if (elapsed > st->max_ns)
+		st->max_ns = elapsed;
+}
+
+/*
+ * Convert src into dst with fn, a few lines at a time right after their
+ * statistics are taken, so the frame is read from memory once.
+ */
+void yuvstats_convert(struct yuvstats *st, convert_fn fn,
+	const struct image *src, struct image *dst, unsigned int sequence,
+	uint64_t timestamp)
+{
+	unsigned int y;
+
+	yuvstats_begin(st);
+
+	for (y = 0; y < st->height; y += YUVSTATS_CHUNK_LINES) {
+		unsigned int last = y + YUVSTATS_CHUNK_LINES;
+
+		if (last > st->height)
+			last = st->height;
+
+		yuvstats_lines(st, 0, src, y, last);
+		fn(src, dst, y, last);
+	}
+
+	yuvstats_end(st, sequence, timestamp);
+}
+
+/*
+ * The latest result, NULL before the first one. It is read in place and
+ * valid as long as yuvstats_done() says so afterwards.
+ */
+const struct yuvstats_result *yuvstats_latest(const struct yuvstats *st,
+	uint32_t *number)
+{
+	uint32_t published = st->published;
+
+	if (published == 0)
+		return NULL;
+
+	*number = published - 1;
+	__sync_synchronize();
+	return &st->results[*number % YUVSTATS_RESULTS];
+}
+
+/* Whether result number was left alone while it was read. */
+bool yuvstats_done(const struct yuvstats *st, uint32_t number)
+{
+	__sync_synchronize();
+	return st->seq[number % YUVSTATS_RESULTS] == 2 * number + 2;
+}
+
+/* Parse a zone grid, "<columns>x<rows>". */
+int yuvstats_parse_zones(const char *spec, unsigned int *zones_x,
+	unsigned int *zones_y)
+{
+	if (sscanf(spec, "%ux%u", zones_x, zones_y) != 2 || *zones_x == 0 ||
+	    *zones_y == 0 || *zones_x * *zones_y > YUVSTATS_MAX_ZONES)
+		return -EINVAL;
+
+	return 0;
+}
+
+void yuvstats_print(const struct yuvstats *st, const char *name)
+{
+	const struct yuvstats_result *result;
+	uint32_t number;
+
+	result = yuvstats_latest(st, &number);
+	if (result == NULL)
+		return;
+
+	printf("%s: %u frames, %ux%u zones, last luma %u-%u mean %.1f\n", name,
+		st->frames, st->zones_x, st->zones_y, result->min, result->max,
+		result->mean / 256.0);
+	if (st->stats_ns)
+		printf("%s: %.1f us/frame (max %.1f), %.2f ns/pixel\n", name,
+			st->stats_ns / 1e3 / st->frames, st->max_ns / 1e3,
+			(double)st->stats_ns / st->frames / (st->width * st->height));
+}
+
+void yuvstats_cleanup(struct yuvstats *st)
+{
+	free(st->zone_rows);
+	free(st->parts);
+	st->zone_rows = NULL;
+	st->parts = NULL;
+}
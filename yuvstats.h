@@ -0,0 +1,120 @@
+/*
+ * yuvstats.h -- exposure and white balance statistics of packed 4:2:2
+ *
+ * One read of a YUYV or UYVY frame gives the 256 bin luma histogram, the
+ * luma minimum, maximum and mean, and the mean Y, U and V of every zone
+ * of a grid of up to YUVSTATS_MAX_ZONES. Sums, minimum and maximum are
+ * taken 16 bytes at a time with NEON or SSE2; the histogram is spread
+ * over four tables so that runs of equal values do not serialise on one
+ * counter.
+ *
+ * Lines may be accumulated in any order, by up to YUVSTATS_MAX_PARTS
+ * threads at once, each into its own part, so the statistics can ride
+ * along with a band conversion while the lines are still in the cache:
+ * see yuvstats_convert() and yuvstats_band(), a bandconv hook.
+ *
+ * Results are published into a ring guarded like the frame bus slots: a
+ * reader takes the latest with yuvstats_latest(), reads it in place and
+ * checks with yuvstats_done() that it was not rewritten meanwhile. The
+ * writer never waits for readers.
+ */
+
+#ifndef __YUVSTATS_H__
+#define __YUVSTATS_H__
+
+#include "convert.h"
+
+#define YUVSTATS_MAX_ZONES	256
+#define YUVSTATS_MAX_PARTS	32
+#define YUVSTATS_RESULTS	4
+
+/* Means are in 1/256 levels. */
+struct yuvstats_zone
+{
+	uint16_t y;
+	uint16_t u;
+	uint16_t v;
+};
+
+struct yuvstats_result
+{
+	unsigned int sequence;
+	uint64_t timestamp;
+
+	uint32_t histogram[256];
+	uint8_t min;
+	uint8_t max;
+	uint16_t mean;
+
+	/* Zones in rows, left to right and top to bottom. */
+	unsigned int zones_x;
+	unsigned int zones_y;
+	struct yuvstats_zone zones[YUVSTATS_MAX_ZONES];
+};
+
+/* Accumulators of one thread. */
+struct yuvstats_part
+{
+	uint32_t histogram[4][256];
+	uint8_t min;
+	uint8_t max;
+	uint32_t sums[YUVSTATS_MAX_ZONES][3];
+	bool used;
+};
+
+struct yuvstats
+{
+	unsigned int fourcc;
+	unsigned int width;
+	unsigned int height;
+	unsigned int zones_x;
+	unsigned int zones_y;
+	/* Byte offsets of the first Y, of U and of V in a pixel pair. */
+	unsigned int yoff, uoff, voff;
+
+	/* First pixel pair of every zone column, zone row of every line. */
+	unsigned int zone_pairs[YUVSTATS_MAX_ZONES + 1];
+	uint16_t *zone_rows;
+	/* Lines in every zone row. */
+	unsigned int zone_lines[YUVSTATS_MAX_ZONES];
+
+	struct yuvstats_part *parts;
+	unsigned int nparts;
+
+	/* 2 * n + 1 while result n is written, 2 * n + 2 once it is done. */
+	struct yuvstats_result results[YUVSTATS_RESULTS];
+	volatile uint32_t seq[YUVSTATS_RESULTS];
+	volatile uint32_t published;
+
+	/* Statistics. */
+	unsigned int frames;
+	uint64_t stats_ns;
+	uint64_t max_ns;
+};
+
+int yuvstats_init(struct yuvstats *st, unsigned int fourcc, unsigned int width,
+	unsigned int height, unsigned int zones_x, unsigned int zones_y,
+	unsigned int nparts);
+void yuvstats_begin(struct yuvstats *st);
+void yuvstats_lines(struct yuvstats *st, unsigned int part,
+	const struct image *src, unsigned int first, unsigned int last);
+void yuvstats_band(void *priv, unsigned int part, const struct image *src,
+	unsigned int first, unsigned int last);
+void yuvstats_end(struct yuvstats *st, unsigned int sequence,
+	uint64_t timestamp);
+void yuvstats_run(struct yuvstats *st, const struct image *src,
+	unsigned int sequence, uint64_t timestamp);
+void yuvstats_convert(struct yuvstats *st, convert_fn fn,
+	const struct image *src, struct image *dst, unsigned int sequence,
+	uint64_t timestamp);
+
+const struct yuvstats_result *yuvstats_latest(const struct yuvstats *st,
+	uint32_t *number);
+bool yuvstats_done(const struct yuvstats *st, uint32_t number);
+
+int yuvstats_parse_zones(const char *spec, unsigned int *zones_x,
+	unsigned int *zones_y);
+void yuvstats_print(const struct yuvstats *st, const char *name);
+void yuvstats_cleanup(struct yuvstats *st);
+
+#endif /* __YUVSTATS_H__ */